@@ -20,6 +20,37 @@ namespace
     const XMVECTOR MIN = XMVectorSplatOne() * std::numeric_limits<float>::lowest();
 }
 
+void BVH::Initialise(const float* heights, size_t stride, int resolution, float spacing, XMFLOAT2 origin)
+{
+    m_heights = heights;
+    m_stride = stride;
+    m_resolution = resolution;
+    m_spacing = spacing;
+    m_origin = origin;
+
+    // Initialise primitive (triangle) array
+    const int numTriangles = (resolution - 1) * (resolution - 1) * 2;
+
+    m_primitives.clear();
+    m_primitives.reserve(numTriangles);
+    for (int z = 0; z < resolution - 1; ++z)
+    {
+        for (int x = 0; x < resolution - 1; ++x)
+        {
+            const uint32_t bottomLeft = (z * resolution) + x;
+            const uint32_t bottomRight = bottomLeft + 1;
+            const uint32_t topRight = bottomLeft + resolution + 1;
+            const uint32_t topLeft = bottomLeft + resolution;
+
+            m_primitives.emplace_back(bottomLeft, bottomRight, topRight);
+            m_primitives.emplace_back(bottomLeft, topRight, topLeft);
+        }
+    }
+
+    m_poolPtr = 1;
+    InitialiseNodes(m_primitives.size());
+}
+
 bool BVH::Intersects(FXMVECTOR origin, FXMVECTOR direction, XMVECTOR& hit) const
 {
     float dist;
@@ -40,6 +71,16 @@ void BVH::Refit()
     Refit(*m_root);
 }
 
+void BVH::Refit(int minX, int minZ, int maxX, int maxZ)
+{
+    // Region on the xz-plane, with a little slack so triangles that only touch it are included
+    const float slack = m_spacing * 0.5f;
+    const XMFLOAT2 regionMin(m_origin.x + minX * m_spacing - slack, m_origin.y + minZ * m_spacing - slack);
+    const XMFLOAT2 regionMax(m_origin.x + maxX * m_spacing + slack, m_origin.y + maxZ * m_spacing + slack);
+
+    Refit(*m_root, regionMin, regionMax);
+}
+
 void BVH::InitialiseDebugVisualiastion(ID3D11DeviceContext* context)
 {
     static const XMFLOAT3 size(2.f, 2.f, 2.f);
@@ -67,6 +108,14 @@ void BVH::InitialiseNodes(size_t size)
     Subdivide(*m_root);
 }
 
+XMVECTOR XM_CALLCONV BVH::GetVertex(uint32_t index) const
+{
+    const int x = int(index % m_resolution);
+    const int z = int(index / m_resolution);
+
+    return XMVectorSet(m_origin.x + x * m_spacing, m_heights[index * m_stride], m_origin.y + z * m_spacing, 0.f);
+}
+
 BoundingBox BVH::CalculateBounds(int first, int count) const
 {
     XMVECTOR min = MAX;
@@ -79,7 +128,7 @@ BoundingBox BVH::CalculateBounds(int first, int count) const
 
         for (int j = 0; j < 3; ++j)
         {
-            XMVECTOR vertex = XMLoadFloat3(triangle.v[j]);
+            XMVECTOR vertex = GetVertex(triangle.v[j]);
 
             min = XMVectorMin(min, vertex);
             max = XMVectorMax(max, vertex);
@@ -129,7 +178,7 @@ void BVH::Partition(BVHNode& node)
         // Calculate triangle center
         XMVECTOR center = XMVectorZero();
         for (int j = 0; j < 3; ++j)
-            center += XMLoadFloat3(triangle.v[j]);
+            center += GetVertex(triangle.v[j]);
         center /= 3;
         
         // Determine which child (left/right) this primitive(triangle) belongs to
@@ -167,9 +216,9 @@ bool BVH::Intersects(const BVHNode& node, FXMVECTOR origin, FXMVECTOR direction,
         {
             const Triangle& triangle = m_primitives[node.leftFirst + i];
 
-            XMVECTOR t0 = XMLoadFloat3(triangle.v[0]);
-            XMVECTOR t1 = XMLoadFloat3(triangle.v[1]);
-            XMVECTOR t2 = XMLoadFloat3(triangle.v[2]);
+            XMVECTOR t0 = GetVertex(triangle.v[0]);
+            XMVECTOR t1 = GetVertex(triangle.v[1]);
+            XMVECTOR t2 = GetVertex(triangle.v[2]);
 
             if (TriangleTests::Intersects(origin, direction, t0, t1, t2, tempDist))
             {
@@ -216,6 +265,29 @@ void BVH::Refit(BVHNode& node)
     }
 }
 
+void BVH::Refit(BVHNode& node, const XMFLOAT2& regionMin, const XMFLOAT2& regionMax)
+{
+    // Heights don't move anything on the xz-plane, so nodes away from the region are still correct
+    const XMFLOAT3& center = node.bounds.Center;
+    const XMFLOAT3& extents = node.bounds.Extents;
+    if (center.x + extents.x < regionMin.x || center.x - extents.x > regionMax.x ||
+        center.z + extents.z < regionMin.y || center.z - extents.z > regionMax.y)
+        return;
+
+    if (node.count > 0)
+        node.bounds = CalculateBounds(node.leftFirst, node.count);
+    else
+    {
+        BVHNode& childL = m_pool[node.leftFirst + 0];
+        BVHNode& childR = m_pool[node.leftFirst + 1];
+
+        Refit(childL, regionMin, regionMax);
+        Refit(childR, regionMin, regionMax);
+
+        BoundingBox::CreateMerged(node.bounds, childL.bounds, childR.bounds);
+    }
+}
+
 void XM_CALLCONV BVH::DebugRender(BVHNode& node, ID3D11DeviceContext* context, FXMMATRIX view, CXMMATRIX projection, int currentDepth, int depth)
 {
     // Only render nodes at the requested depth
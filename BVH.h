@@ -2,7 +2,6 @@
 #include <d3d11_1.h>
 #include <DirectXMath.h>
 #include <DirectXCollision.h>
-#include <VertexTypes.h>
 // For visualising BVH
 #include <GeometricPrimitive.h>
 
@@ -14,18 +13,17 @@ class BVH
     {
         Triangle() = default;
 
-        // - Stores three pointers to vertices/vertex positions
-        //   - Means I don't have to do any extra stuff (like updating BVHs vertex positions)
-        //     when refitting the structure--just recalculate the internal node's AABBs
-        // NOTE: Poor design, really.
-        Triangle(const DirectX::XMFLOAT3& v0, const DirectX::XMFLOAT3& v1, const DirectX::XMFLOAT3& v2)
+        // - Stores the grid indices of the three vertices
+        //   - Positions are worked out from the heights when needed, so refitting the structure
+        //     is just a matter of recalculating the internal node's AABBs
+        Triangle(uint32_t v0, uint32_t v1, uint32_t v2)
         {
-            v[0] = &v0;
-            v[1] = &v1;
-            v[2] = &v2;
+            v[0] = v0;
+            v[1] = v1;
+            v[2] = v2;
         }
 
-        const DirectX::XMFLOAT3* v[3];
+        uint32_t v[3];
     };
 
     struct BVHNode
@@ -42,46 +40,25 @@ class BVH
 public:
     BVH() = default;
 
-    template <size_t numVertices>
-    BVH(const DirectX::VertexPositionNormalTexture(&vertices)[numVertices])
+    // heights: one height per grid vertex, every 'stride' floats (row major, z rows)
+    // spacing: distance between grid vertices, origin: world space (x, z) of vertex (0, 0)
+    BVH(const float* heights, size_t stride, int resolution, float spacing, DirectX::XMFLOAT2 origin)
     {
-        Initialise(vertices);
+        Initialise(heights, stride, resolution, spacing, origin);
     }
 
-    template <size_t numVertices>
-    void Initialise(const DirectX::VertexPositionNormalTexture (&vertices)[numVertices])
-    {
-        // Assuming square terrain
-        const int dimensions = (int) std::sqrt(float(numVertices));
-        const int numQuads = numVertices - (dimensions * 2 - 1);
-        const int numTriangles = numQuads * 2;
-
-        // Initialise primitive (triangle) array
-        m_primitives.reserve(numTriangles);
-        for (int z = 0; z < dimensions - 1; ++z)
-        {
-            for (int x = 0; x < dimensions - 1; ++x)
-            {
-                const int index = (z * dimensions) + x;
-
-                // I don't expect terrainGeometry to move around in memory
-                // NOTE: Poor design
-                const DirectX::XMFLOAT3& bottomLeft = vertices[index].position;
-                const DirectX::XMFLOAT3& bottomRight = vertices[index + 1].position;
-                const DirectX::XMFLOAT3& topRight = vertices[index + dimensions + 1].position;
-                const DirectX::XMFLOAT3& topLeft = vertices[index + dimensions].position;
-
-                m_primitives.emplace_back(bottomLeft, bottomRight, topRight);
-                m_primitives.emplace_back(bottomLeft, topRight, topLeft);
-            }
-        }
-
-        InitialiseNodes(m_primitives.size());
-    }
+    void Initialise(const float* heights, size_t stride, int resolution, float spacing, DirectX::XMFLOAT2 origin);
 
     bool XM_CALLCONV Intersects(DirectX::FXMVECTOR origin, DirectX::FXMVECTOR direction, DirectX::XMVECTOR& hit) const;
 
     void Refit();
+    // Only refits the nodes over a (grid coordinate, inclusive) region whose heights have changed
+    void Refit(int minX, int minZ, int maxX, int maxZ);
+
+    // Bounds of the whole terrain
+    const DirectX::BoundingBox& GetBounds() const { return m_root->bounds; }
+
+    size_t GetMemoryUsage() const { return m_pool.size() * sizeof(BVHNode) + m_primitives.size() * sizeof(Triangle); }
 
     void InitialiseDebugVisualiastion(ID3D11DeviceContext* context);
     void XM_CALLCONV DebugRender(ID3D11DeviceContext* context, DirectX::FXMMATRIX view, DirectX::CXMMATRIX projection, int depth);
@@ -91,12 +68,15 @@ private:
 
     DirectX::BoundingBox CalculateBounds(int first, int count) const;
 
+    DirectX::XMVECTOR XM_CALLCONV GetVertex(uint32_t index) const;
+
     void Subdivide(BVHNode& node, int depth = 0);
     void Partition(BVHNode& node);
 
     bool XM_CALLCONV Intersects(const BVHNode& node, DirectX::FXMVECTOR origin, DirectX::FXMVECTOR direction, float& dist) const;
 
     void Refit(BVHNode& node);
+    void Refit(BVHNode& node, const DirectX::XMFLOAT2& regionMin, const DirectX::XMFLOAT2& regionMax);
 
     void XM_CALLCONV DebugRender(BVHNode& node, ID3D11DeviceContext* context, DirectX::FXMMATRIX view, DirectX::CXMMATRIX projection, int currentDepth, int depth);
 
@@ -109,6 +89,14 @@ private:
     
     std::vector<Triangle> m_primitives;
 
+    // I don't expect the heights to move around in memory
+    // NOTE: Poor design
+    const float* m_heights = nullptr;
+    size_t m_stride = 1;
+    int m_resolution = 0;
+    float m_spacing = 1.f;
+    DirectX::XMFLOAT2 m_origin;
+
     // Debug visualisation stuff
     std::unique_ptr<DirectX::GeometricPrimitive> m_box;
 };
@@ -0,0 +1,102 @@
+#include "ChunkBVH.h"
+
+#include <algorithm>
+#include <numeric>
+
+using namespace DirectX;
+
+constexpr uint32_t ChunkBVH::INVALID;
+
+void ChunkBVH::Build(const BoundingBox* bounds, const uint32_t* items, size_t count)
+{
+    Clear();
+    if (count == 0)
+        return;
+
+    m_buildBounds.assign(bounds, bounds + count);
+    m_buildItems.assign(items, items + count);
+
+    const uint32_t maxItem = *std::max_element(items, items + count);
+    m_leaves.assign(maxItem + 1, INVALID);
+
+    // A leaf per item, and an internal node above every pair
+    m_nodes.resize(count * 2 - 1);
+    m_nextNode = 1;
+
+    std::vector<uint32_t> entries(count);
+    std::iota(entries.begin(), entries.end(), 0u);
+
+    Subdivide(0, INVALID, entries.data(), 0, count);
+}
+
+void ChunkBVH::Clear()
+{
+    m_nodes.clear();
+    m_leaves.clear();
+}
+
+void ChunkBVH::Refit(uint32_t item, const BoundingBox& bounds)
+{
+    if (item >= m_leaves.size() || m_leaves[item] == INVALID)
+        return;
+
+    uint32_t node = m_leaves[item];
+    m_nodes[node].bounds = bounds;
+
+    for (node = m_nodes[node].parent; node != INVALID; node = m_nodes[node].parent)
+    {
+        Node& parent = m_nodes[node];
+        BoundingBox::CreateMerged(parent.bounds, m_nodes[parent.leftItem + 0].bounds, m_nodes[parent.leftItem + 1].bounds);
+    }
+}
+
+void ChunkBVH::Subdivide(uint32_t nodeIndex, uint32_t parent, uint32_t* entries, size_t first, size_t count)
+{
+    m_nodes[nodeIndex].parent = parent;
+
+    if (count == 1)
+    {
+        Node& node = m_nodes[nodeIndex];
+        node.bounds = m_buildBounds[entries[first]];
+        node.leftItem = m_buildItems[entries[first]];
+        node.leaf = true;
+
+        m_leaves[node.leftItem] = nodeIndex;
+        return;
+    }
+
+    // Split at the median along the longest axis of the centers
+    XMVECTOR minCenter = XMLoadFloat3(&m_buildBounds[entries[first]].Center);
+    XMVECTOR maxCenter = minCenter;
+    for (size_t i = first + 1; i < first + count; ++i)
+    {
+        const XMVECTOR center = XMLoadFloat3(&m_buildBounds[entries[i]].Center);
+        minCenter = XMVectorMin(minCenter, center);
+        maxCenter = XMVectorMax(maxCenter, center);
+    }
+
+    XMFLOAT3 extent;
+    XMStoreFloat3(&extent, maxCenter - minCenter);
+
+    int axis = 0;
+    if (extent.y > (&extent.x)[axis]) axis = 1;
+    if (extent.z > (&extent.x)[axis]) axis = 2;
+
+    const size_t half = count / 2;
+    std::nth_element(entries + first, entries + first + half, entries + first + count, [&](uint32_t a, uint32_t b)
+    {
+        return (&m_buildBounds[a].Center.x)[axis] < (&m_buildBounds[b].Center.x)[axis];
+    });
+
+    // Children are allocated in pairs, straight after the nodes used so far
+    const uint32_t childL = m_nextNode;
+    m_nextNode += 2;
+
+    Subdivide(childL + 0, nodeIndex, entries, first, half);
+    Subdivide(childL + 1, nodeIndex, entries, first + half, count - half);
+
+    Node& node = m_nodes[nodeIndex];
+    node.leftItem = childL;
+    node.leaf = false;
+    BoundingBox::CreateMerged(node.bounds, m_nodes[childL + 0].bounds, m_nodes[childL + 1].bounds);
+}
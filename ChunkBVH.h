@@ -0,0 +1,113 @@
+#pragma once
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+// Top level of the terrain's acceleration structure: a small BVH over the bounds of the loaded chunks,
+// each of which has its own (triangle) BVH below it. Rays walk this one front to back and only descend
+// into the chunks they actually pass through, stopping once the next chunk is further away than a hit.
+// Rebuilt when chunks come and go (there are only ever a handful), refitted when a chunk is edited.
+class ChunkBVH
+{
+    struct Node
+    {
+        DirectX::BoundingBox bounds;
+        // If leaf: the item, otherwise: the index of the left child (the right child follows it)
+        uint32_t leftItem;
+        uint32_t parent;
+        bool leaf;
+    };
+
+public:
+    static constexpr uint32_t INVALID = UINT32_MAX;
+
+    // items: caller's identifiers (e.g. indices into its own array), one per set of bounds
+    void Build(const DirectX::BoundingBox* bounds, const uint32_t* items, size_t count);
+    void Clear();
+
+    // Updates an item's bounds, and every node above it
+    void Refit(uint32_t item, const DirectX::BoundingBox& bounds);
+
+    bool IsEmpty() const { return m_nodes.empty(); }
+
+    // test(item, dist) tests an item's own geometry, returning true (and the distance along the ray) on a hit.
+    // Returns the nearest hit over all items
+    template <typename TestItem>
+    bool XM_CALLCONV Intersects(DirectX::FXMVECTOR origin, DirectX::FXMVECTOR direction, float& dist, TestItem test) const
+    {
+        dist = FLT_MAX;
+
+        float entry;
+        if (m_nodes.empty() || !m_nodes[0].bounds.Intersects(origin, direction, entry))
+            return false;
+
+        struct Entry
+        {
+            uint32_t node;
+            float distance;
+        };
+
+        // Built balanced, so this is plenty deep
+        Entry stack[64];
+        int stackSize = 0;
+        stack[stackSize++] = { 0, entry };
+
+        bool found = false;
+        while (stackSize > 0)
+        {
+            const Entry current = stack[--stackSize];
+
+            // Everything in here is further away than what's been hit already
+            if (current.distance >= dist)
+                continue;
+
+            const Node& node = m_nodes[current.node];
+            if (node.leaf)
+            {
+                float itemDist;
+                if (test(node.leftItem, itemDist) && itemDist < dist)
+                {
+                    dist = itemDist;
+                    found = true;
+                }
+                continue;
+            }
+
+            float distL, distR;
+            const bool hitL = m_nodes[node.leftItem + 0].bounds.Intersects(origin, direction, distL);
+            const bool hitR = m_nodes[node.leftItem + 1].bounds.Intersects(origin, direction, distR);
+
+            // Push the far child first, so the near one is visited first
+            if (hitL && hitR && distL < distR)
+            {
+                stack[stackSize++] = { node.leftItem + 1, distR };
+                stack[stackSize++] = { node.leftItem + 0, distL };
+            }
+            else
+            {
+                if (hitL)
+                    stack[stackSize++] = { node.leftItem + 0, distL };
+                if (hitR)
+                    stack[stackSize++] = { node.leftItem + 1, distR };
+            }
+        }
+
+        return found;
+    }
+
+private:
+    // Builds the node covering entries [first, first + count), whose index has already been reserved
+    void Subdivide(uint32_t node, uint32_t parent, uint32_t* entries, size_t first, size_t count);
+
+    std::vector<Node> m_nodes;
+    // Leaf node of each item (INVALID if the item isn't in the tree)
+    std::vector<uint32_t> m_leaves;
+    uint32_t m_nextNode = 0;
+
+    // Scratch space for building
+    std::vector<DirectX::BoundingBox> m_buildBounds;
+    std::vector<uint32_t> m_buildItems;
+};
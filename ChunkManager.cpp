@@ -0,0 +1,1094 @@
+#include "pch.h"
+#include "ChunkManager.h"
+#include "ParallelFor.h"
+#include "sqlite3.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+    // Same column layout as the Objects table
+    SceneObject ReadSceneObject(sqlite3_stmt* pResults)
+    {
+        SceneObject newSceneObject;
+        newSceneObject.ID = sqlite3_column_int(pResults, 0);
+        newSceneObject.chunk_ID = sqlite3_column_int(pResults, 1);
+        newSceneObject.model_path = reinterpret_cast<const char*>(sqlite3_column_text(pResults, 2));
+        newSceneObject.tex_diffuse_path = reinterpret_cast<const char*>(sqlite3_column_text(pResults, 3));
+        newSceneObject.posX = static_cast<float>(sqlite3_column_double(pResults, 4));
+        newSceneObject.posY = static_cast<float>(sqlite3_column_double(pResults, 5));
+        newSceneObject.posZ = static_cast<float>(sqlite3_column_double(pResults, 6));
+        newSceneObject.rotX = static_cast<float>(sqlite3_column_double(pResults, 7));
+        newSceneObject.rotY = static_cast<float>(sqlite3_column_double(pResults, 8));
+        newSceneObject.rotZ = static_cast<float>(sqlite3_column_double(pResults, 9));
+        newSceneObject.scaX = static_cast<float>(sqlite3_column_double(pResults, 10));
+        newSceneObject.scaY = static_cast<float>(sqlite3_column_double(pResults, 11));
+        newSceneObject.scaZ = static_cast<float>(sqlite3_column_double(pResults, 12));
+        newSceneObject.render = (sqlite3_column_int(pResults, 13) != 0);
+        newSceneObject.collision = (sqlite3_column_int(pResults, 14) != 0);
+        newSceneObject.collision_mesh = reinterpret_cast<const char*>(sqlite3_column_text(pResults, 15));
+        newSceneObject.collectable = (sqlite3_column_int(pResults, 16) != 0);
+        newSceneObject.destructable = (sqlite3_column_int(pResults, 17) != 0);
+        newSceneObject.health_amount = sqlite3_column_int(pResults, 18);
+        newSceneObject.editor_render = (sqlite3_column_int(pResults, 19) != 0);
+        newSceneObject.editor_texture_vis = (sqlite3_column_int(pResults, 20) != 0);
+        newSceneObject.editor_normals_vis = (sqlite3_column_int(pResults, 21) != 0);
+        newSceneObject.editor_collision_vis = (sqlite3_column_int(pResults, 22) != 0);
+        newSceneObject.editor_pivot_vis = (sqlite3_column_int(pResults, 23) != 0);
+        newSceneObject.pivotX = static_cast<float>(sqlite3_column_double(pResults, 24));
+        newSceneObject.pivotY = static_cast<float>(sqlite3_column_double(pResults, 25));
+        newSceneObject.pivotZ = static_cast<float>(sqlite3_column_double(pResults, 26));
+        newSceneObject.snapToGround = (sqlite3_column_int(pResults, 27) != 0);
+        newSceneObject.AINode = (sqlite3_column_int(pResults, 28) != 0);
+        newSceneObject.audio_path = reinterpret_cast<const char*>(sqlite3_column_text(pResults, 29));
+        newSceneObject.volume = static_cast<float>(sqlite3_column_double(pResults, 30));
+        newSceneObject.pitch = static_cast<float>(sqlite3_column_double(pResults, 31));
+        newSceneObject.pan = static_cast<float>(sqlite3_column_int(pResults, 32));
+        newSceneObject.one_shot = (sqlite3_column_int(pResults, 33) != 0);
+        newSceneObject.play_on_init = (sqlite3_column_int(pResults, 34) != 0);
+        newSceneObject.play_in_editor = (sqlite3_column_int(pResults, 35) != 0);
+        newSceneObject.min_dist = static_cast<int>(sqlite3_column_double(pResults, 36));
+        newSceneObject.max_dist = static_cast<int>(sqlite3_column_double(pResults, 37));
+        newSceneObject.camera = (sqlite3_column_int(pResults, 38) != 0);
+        newSceneObject.path_node = (sqlite3_column_int(pResults, 39) != 0);
+        newSceneObject.path_node_start = (sqlite3_column_int(pResults, 40) != 0);
+        newSceneObject.path_node_end = (sqlite3_column_int(pResults, 41) != 0);
+        newSceneObject.parent_id = sqlite3_column_int(pResults, 42);
+        newSceneObject.editor_wireframe = (sqlite3_column_int(pResults, 43) != 0);
+        newSceneObject.name = reinterpret_cast<const char*>(sqlite3_column_text(pResults, 44));
+
+        return newSceneObject;
+    }
+}
+
+ChunkManager::~ChunkManager()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+
+    m_wakeWorker.notify_one();
+
+    if (m_worker.joinable())
+        m_worker.join();
+}
+
+void ChunkManager::Initialise(DX::DeviceResources* deviceResources, const Settings& settings)
+{
+    assert(settings.unloadRadius >= settings.loadRadius);
+
+    m_deviceResources = deviceResources;
+    m_settings = settings;
+
+    if (!m_worker.joinable())
+        m_worker = std::thread(&ChunkManager::WorkerMain, this);
+}
+
+void ChunkManager::SetChunks(const std::vector<ChunkObject>& chunks, const std::string& databasePath)
+{
+    // The owner of the scene graph starts over as well, so there's no need to tell it about any of this
+    while (!m_loadedChunks.empty())
+        Unload(m_loadedChunks.back());
+
+    m_streamedIn.clear();
+    m_streamedOut.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_requests.clear();
+        m_results.clear();
+        m_requestData = chunks;
+        m_databasePath = databasePath;
+        ++m_generation;
+    }
+
+    m_chunks.clear();
+    m_chunkLookup.clear();
+    m_chunkBVH.Clear();
+    m_chunkBVHDirty = false;
+    m_paths.Clear();
+    m_memoryUsage = 0;
+    m_undoTiles.clear();
+    m_undoTileKeys.clear();
+
+    m_terrainLayers = {
+        { "Base", TerrainLayerStack::LAYER_BASE, TerrainLayerStack::BLEND_REPLACE, true },
+        { "Sculpt 1", TerrainLayerStack::LAYER_SCULPT, TerrainLayerStack::BLEND_ADD, true },
+        { "Paths", TerrainLayerStack::LAYER_PROCEDURAL, TerrainLayerStack::BLEND_REPLACE, true } };
+    m_selectedTerrainLayer = 1;
+    m_numSculptLayers = 1;
+    m_numStampLayers = 0;
+    m_numRequested = 0;
+    m_numFailed = 0;
+    m_lastFailedChunk.clear();
+
+    m_chunks.resize(chunks.size());
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        m_chunks[i].data = chunks[i];
+        m_chunkLookup[GridKey(chunks[i].grid_x, chunks[i].grid_z)] = i;
+    }
+}
+
+void XM_CALLCONV ChunkManager::Update(FXMVECTOR cameraPosition)
+{
+    ReceiveResults();
+
+    const float cameraX = XMVectorGetX(cameraPosition);
+    const float cameraZ = XMVectorGetZ(cameraPosition);
+
+    for (Chunk& chunk : m_chunks)
+        chunk.distance = DistanceToChunk(cameraX, cameraZ, chunk.data);
+
+    // Only let go of chunks once they're past the unload radius
+    for (size_t i = m_loadedChunks.size(); i-- > 0;)
+    {
+        const Chunk& chunk = m_chunks[m_loadedChunks[i]];
+        if (chunk.distance > m_settings.unloadRadius && !chunk.display->HasUnsavedChanges())
+            Unload(m_loadedChunks[i]);
+    }
+
+    // Requests the camera has moved away from before they were served.
+    // If the worker is already on it, the result is thrown away when it arrives
+    for (size_t i = 0; i < m_chunks.size(); ++i)
+    {
+        Chunk& chunk = m_chunks[i];
+        if (chunk.state == CHUNK_REQUESTED && chunk.distance > m_settings.unloadRadius)
+        {
+            RemoveRequest(i);
+            chunk.state = CHUNK_UNLOADED;
+            --m_numRequested;
+        }
+    }
+
+    RequestChunks();
+
+    // Lighting casts sun rays through the whole terrain
+    if (m_chunkBVHDirty)
+        RebuildChunkBVH();
+
+    // Catch up on lighting invalidated by edits (or chunks coming and going around it), a few tiles at a time
+    const TerrainLightmap::RayTest occluded = [this](const XMVECTOR& origin, const XMVECTOR& direction)
+    {
+        XMVECTOR hit;
+        return Intersects(origin, direction, hit);
+    };
+
+    for (size_t chunk : m_loadedChunks)
+    {
+        const DisplayChunk* surrounding[3][3];
+        GetSurroundings(chunk, surrounding);
+
+        m_chunks[chunk].display->BakeLighting(DisplayChunk::LIGHTMAP_BAKE_BUDGET, surrounding, occluded);
+    }
+
+    // Keep the overlay in step with edits (chunks that haven't changed are skipped)
+    if (m_hydrologyOverlay != TerrainHydrology::OVERLAY_NONE)
+    {
+        ParallelFor(m_loadedChunks.size(), [this](size_t i)
+        {
+            m_chunks[m_loadedChunks[i]].display->UpdateHydrology();
+        });
+    }
+}
+
+void XM_CALLCONV ChunkManager::Render(ID3D11DeviceContext* context, FXMMATRIX view, CXMMATRIX projection)
+{
+    for (size_t chunk : m_loadedChunks)
+        m_chunks[chunk].display->RenderBatch(context, view, projection);
+}
+
+void ChunkManager::TakeStreamedChunks(std::vector<StreamedChunk>& loaded, std::vector<int>& unloaded)
+{
+    loaded.clear();
+    unloaded.clear();
+
+    loaded.swap(m_streamedIn);
+    unloaded.swap(m_streamedOut);
+}
+
+DisplayChunk* ChunkManager::FindChunk(float x, float z)
+{
+    return const_cast<DisplayChunk*>(static_cast<const ChunkManager*>(this)->FindChunk(x, z));
+}
+
+const DisplayChunk* ChunkManager::FindChunk(float x, float z) const
+{
+    // Chunks are centered on their grid position
+    const int gridX = int(std::floor(x / DisplayChunk::TERRAINSIZE + 0.5f));
+    const int gridZ = int(std::floor(z / DisplayChunk::TERRAINSIZE + 0.5f));
+
+    auto it = m_chunkLookup.find(GridKey(gridX, gridZ));
+    if (it == m_chunkLookup.end())
+        return nullptr;
+
+    const Chunk& chunk = m_chunks[it->second];
+    return (chunk.state == CHUNK_LOADED ? chunk.display.get() : nullptr);
+}
+
+const DisplayChunk* ChunkManager::FindNearestChunk(float x, float z) const
+{
+    if (const DisplayChunk* chunk = FindChunk(x, z))
+        return chunk;
+
+    const DisplayChunk* nearest = nullptr;
+    float nearestDistance = FLT_MAX;
+    for (size_t chunk : m_loadedChunks)
+    {
+        const float distance = DistanceToChunk(x, z, m_chunks[chunk].data);
+        if (distance < nearestDistance)
+        {
+            nearest = m_chunks[chunk].display.get();
+            nearestDistance = distance;
+        }
+    }
+
+    return nearest;
+}
+
+bool XM_CALLCONV ChunkManager::Intersects(FXMVECTOR origin, FXMVECTOR direction, XMVECTOR& wsCoord) const
+{
+    // Nearest hit out of the chunks along the ray
+    float dist;
+    const bool found = m_chunkBVH.Intersects(origin, direction, dist, [&](uint32_t chunk, float& chunkDist)
+    {
+        XMVECTOR hit;
+        if (!m_chunks[chunk].display->Intersects(origin, direction, hit))
+            return false;
+
+        chunkDist = XMVectorGetX(XMVector3Dot(hit - origin, direction));
+        return true;
+    });
+
+    wsCoord = (found ? origin + direction * dist : XMVectorZero());
+    return found;
+}
+
+void ChunkManager::Intersects(const XMFLOAT3* origins, const XMFLOAT3* directions, XMFLOAT3* hits, bool* found, size_t count) const
+{
+    // Batches big enough to be worth handing to a thread
+    const size_t batchSize = 64;
+    ParallelFor((count + batchSize - 1) / batchSize, [&](size_t batch)
+    {
+        for (size_t i = batch * batchSize; i < std::min(count, (batch + 1) * batchSize); ++i)
+        {
+            XMVECTOR hit;
+            found[i] = Intersects(XMLoadFloat3(&origins[i]), XMLoadFloat3(&directions[i]), hit);
+            if (found[i])
+                XMStoreFloat3(&hits[i], hit);
+        }
+    });
+}
+
+float ChunkManager::SampleHeight(float x, float z) const
+{
+    const DisplayChunk* chunk = FindNearestChunk(x, z);
+    return (chunk ? chunk->SampleHeight(x, z) : 0.f);
+}
+
+XMVECTOR ChunkManager::SampleNormal(float x, float z) const
+{
+    const DisplayChunk* chunk = FindNearestChunk(x, z);
+    return (chunk ? chunk->SampleNormal(x, z) : g_XMIdentityR1.v);
+}
+
+void ChunkManager::SampleHeights(const float* xs, const float* zs, float* heights, size_t count) const
+{
+    // Group the positions by chunk, so each chunk can still do them four at a time
+    std::unordered_map<const DisplayChunk*, std::vector<size_t>> groups;
+    for (size_t i = 0; i < count; ++i)
+        groups[FindNearestChunk(xs[i], zs[i])].push_back(i);
+
+    std::vector<float> groupXs, groupZs, groupHeights;
+    for (const auto& group : groups)
+    {
+        const std::vector<size_t>& indices = group.second;
+
+        // Nothing is loaded
+        if (!group.first)
+        {
+            for (size_t i : indices)
+                heights[i] = 0.f;
+
+            continue;
+        }
+
+        groupXs.resize(indices.size());
+        groupZs.resize(indices.size());
+        groupHeights.resize(indices.size());
+        for (size_t i = 0; i < indices.size(); ++i)
+        {
+            groupXs[i] = xs[indices[i]];
+            groupZs[i] = zs[indices[i]];
+        }
+
+        group.first->SampleHeights(groupXs.data(), groupZs.data(), groupHeights.data(), indices.size());
+
+        for (size_t i = 0; i < indices.size(); ++i)
+            heights[indices[i]] = groupHeights[i];
+    }
+}
+
+size_t ChunkManager::AddSculptLayer()
+{
+    // Just below the paths
+    const size_t index = m_terrainLayers.size() - 1;
+    InsertTerrainLayer(index, "Sculpt " + std::to_string(++m_numSculptLayers), TerrainLayerStack::LAYER_SCULPT, TerrainLayerStack::BLEND_ADD);
+
+    return index;
+}
+
+void ChunkManager::SetTerrainLayerVisible(size_t layer, bool visible, bool saveUndo)
+{
+    if (layer >= m_terrainLayers.size() || m_terrainLayers[layer].visible == visible)
+        return;
+
+    m_terrainLayers[layer].visible = visible;
+
+    // Only the chunks that have anything in the layer change
+    std::vector<DisplayChunk::GridRegion> regions(m_loadedChunks.size());
+    ParallelFor(m_loadedChunks.size(), [&](size_t i)
+    {
+        regions[i] = m_chunks[m_loadedChunks[i]].display->SetLayerVisible(layer, visible);
+    });
+
+    std::vector<size_t> edited;
+    std::vector<DisplayChunk::GridRegion> editedRegions;
+    for (size_t i = 0; i < m_loadedChunks.size(); ++i)
+    {
+        if (!regions[i].IsEmpty())
+        {
+            edited.push_back(m_loadedChunks[i]);
+            editedRegions.push_back(regions[i]);
+        }
+    }
+
+    FinishHeightEdit(edited, editedRegions, saveUndo);
+}
+
+void XM_CALLCONV ChunkManager::ManipulateTerrain(FXMVECTOR clickPos, bool elevate, int brushSize, float brushForce)
+{
+    // Into the selected layer if it can be sculpted, otherwise the topmost one that can
+    size_t layer = m_selectedTerrainLayer;
+    if (layer >= m_terrainLayers.size() || m_terrainLayers[layer].type != TerrainLayerStack::LAYER_SCULPT)
+    {
+        layer = m_terrainLayers.size();
+        for (size_t i = m_terrainLayers.size(); i-- > 0;)
+        {
+            if (m_terrainLayers[i].type == TerrainLayerStack::LAYER_SCULPT)
+            {
+                layer = i;
+                break;
+            }
+        }
+
+        if (layer == m_terrainLayers.size())
+            return;
+    }
+
+    std::vector<size_t> edited;
+    FindChunksUnderBrush(clickPos, brushSize, edited);
+    if (edited.empty())
+        return;
+
+    SaveTerrainUndo(edited, int(layer), clickPos, brushSize);
+
+    // Each chunk only touches its own heights
+    std::vector<DisplayChunk::GridRegion> regions(edited.size());
+    ParallelFor(edited.size(), [&](size_t i)
+    {
+        regions[i] = m_chunks[edited[i]].display->ManipulateTerrain(layer, clickPos, elevate, brushSize, brushForce);
+    });
+
+    FinishHeightEdit(edited, regions, true);
+}
+
+void ChunkManager::CopyHeights(float x, float z, float size, TerrainStamp& stamp) const
+{
+    // Sampled at the terrain's own spacing, so a straight paste is a copy of the original
+    const float spacing = float(DisplayChunk::TERRAINSIZE) / (DisplayChunk::TERRAINRESOLUTION - 1);
+    const int resolution = std::max(2, int(std::lround(size / spacing)) + 1);
+    const float halfSize = 0.5f * (resolution - 1) * spacing;
+
+    std::vector<float> xs(resolution * resolution), zs(resolution * resolution), heights(resolution * resolution);
+    for (int row = 0; row < resolution; ++row)
+    {
+        for (int column = 0; column < resolution; ++column)
+        {
+            xs[row * resolution + column] = x - halfSize + column * spacing;
+            zs[row * resolution + column] = z - halfSize + row * spacing;
+        }
+    }
+
+    SampleHeights(xs.data(), zs.data(), heights.data(), heights.size());
+
+    stamp.Set(std::move(heights), resolution, spacing);
+}
+
+bool ChunkManager::PasteHeights(const TerrainStamp& stamp, const TerrainStamp::Placement& placement, size_t& layer)
+{
+    if (stamp.IsEmpty())
+        return false;
+
+    XMFLOAT2 min, max;
+    stamp.GetFootprint(placement, min, max);
+
+    std::vector<size_t> edited;
+    FindChunksOverlapping(min, max, edited);
+    if (edited.empty())
+        return false;
+
+    // A layer of its own (just below the paths), blended in the way the paste asks for
+    static const TerrainLayerStack::BlendMode LAYER_BLENDS[TerrainStamp::BLEND_COUNT] = {
+        TerrainLayerStack::BLEND_REPLACE, TerrainLayerStack::BLEND_ADD, TerrainLayerStack::BLEND_MAX, TerrainLayerStack::BLEND_MIN };
+
+    layer = m_terrainLayers.size() - 1;
+    InsertTerrainLayer(layer, "Stamp " + std::to_string(++m_numStampLayers), TerrainLayerStack::LAYER_STAMP, LAYER_BLENDS[placement.blend]);
+
+    std::vector<DisplayChunk::GridRegion> regions(edited.size());
+    ParallelFor(edited.size(), [&](size_t i)
+    {
+        regions[i] = m_chunks[edited[i]].display->ApplyStamp(layer, stamp, placement);
+    });
+
+    FinishHeightEdit(edited, regions, true);
+    return true;
+}
+
+bool ChunkManager::SetPaths(const std::vector<SceneObject>& nodes)
+{
+    std::vector<TerrainPaths::Area> changed;
+    m_paths.Update(nodes, changed);
+
+    return CarvePaths(changed, m_loadedChunks);
+}
+
+void ChunkManager::InsertTerrainLayer(size_t index, const std::string& name, TerrainLayerStack::Type type, TerrainLayerStack::BlendMode blend)
+{
+    m_terrainLayers.insert(m_terrainLayers.begin() + index, { name, type, blend, true });
+
+    // The selection stays on the same layer
+    if (m_selectedTerrainLayer >= index)
+        ++m_selectedTerrainLayer;
+
+    // An empty layer changes nothing, so there's nothing to refresh
+    for (size_t chunk : m_loadedChunks)
+        m_chunks[chunk].display->InsertLayer(index, type, blend);
+}
+
+bool ChunkManager::CarvePaths(const std::vector<TerrainPaths::Area>& areas, const std::vector<size_t>& chunks)
+{
+    if (areas.empty())
+        return false;
+
+    const float spacing = float(DisplayChunk::TERRAINSIZE) / (DisplayChunk::TERRAINRESOLUTION - 1);
+    const int tilesPerSide = (DisplayChunk::TERRAINRESOLUTION + DisplayChunk::PATH_TILE_SIZE - 1) / DisplayChunk::PATH_TILE_SIZE;
+
+    std::vector<size_t> edited;
+    std::vector<DisplayChunk::GridRegion> regions;
+    std::vector<int> tileIndices;
+    std::vector<DisplayChunk::GridRegion> tiles;
+
+    for (size_t chunk : chunks)
+    {
+        DisplayChunk& display = *m_chunks[chunk].display;
+        const XMFLOAT2& origin = display.GetOrigin();
+
+        // Tiles of this chunk under any of the areas
+        tileIndices.clear();
+        for (const TerrainPaths::Area& area : areas)
+        {
+            const DisplayChunk::GridRegion region = DisplayChunk::GridRegion{
+                int(std::floor((area.min.x - origin.x) / spacing)), int(std::floor((area.min.y - origin.y) / spacing)),
+                int(std::ceil((area.max.x - origin.x) / spacing)), int(std::ceil((area.max.y - origin.y) / spacing)) }.Clipped();
+            if (region.IsEmpty())
+                continue;
+
+            for (int tileZ = region.minZ / DisplayChunk::PATH_TILE_SIZE; tileZ <= region.maxZ / DisplayChunk::PATH_TILE_SIZE; ++tileZ)
+                for (int tileX = region.minX / DisplayChunk::PATH_TILE_SIZE; tileX <= region.maxX / DisplayChunk::PATH_TILE_SIZE; ++tileX)
+                    tileIndices.push_back(tileZ * tilesPerSide + tileX);
+        }
+
+        if (tileIndices.empty())
+            continue;
+
+        std::sort(tileIndices.begin(), tileIndices.end());
+        tileIndices.erase(std::unique(tileIndices.begin(), tileIndices.end()), tileIndices.end());
+
+        tiles.clear();
+        for (int tile : tileIndices)
+        {
+            const int minX = (tile % tilesPerSide) * DisplayChunk::PATH_TILE_SIZE;
+            const int minZ = (tile / tilesPerSide) * DisplayChunk::PATH_TILE_SIZE;
+            tiles.push_back({ minX, minZ, minX + DisplayChunk::PATH_TILE_SIZE - 1, minZ + DisplayChunk::PATH_TILE_SIZE - 1 });
+        }
+
+        const DisplayChunk::GridRegion changed = display.CarvePaths(m_paths, tiles);
+        if (!changed.IsEmpty())
+        {
+            edited.push_back(chunk);
+            regions.push_back(changed);
+        }
+    }
+
+    FinishHeightEdit(edited, regions, false);
+    return !edited.empty();
+}
+
+void ChunkManager::FinishHeightEdit(const std::vector<size_t>& edited, const std::vector<DisplayChunk::GridRegion>& regions, bool saveUndo)
+{
+    // Chunks needing a refresh. Neighbours of an edited chunk are included, since their normals along the
+    // shared edge depend on heights on this side of it
+    std::vector<size_t> refreshed = edited;
+    std::vector<DisplayChunk::GridRegion> refreshRegions = regions;
+
+    const int last = DisplayChunk::TERRAINRESOLUTION - 1;
+    std::vector<int> tiles;
+    for (size_t i = 0; i < edited.size(); ++i)
+    {
+        const DisplayChunk::GridRegion region = regions[i];
+        if (region.IsEmpty())
+            continue;
+
+        const ChunkObject& data = m_chunks[edited[i]].data;
+        for (int dz = -1; dz <= 1; ++dz)
+        {
+            for (int dx = -1; dx <= 1; ++dx)
+            {
+                size_t neighbour;
+                if ((dx == 0 && dz == 0) || !FindLoadedChunk(data.grid_x + dx, data.grid_z + dz, neighbour))
+                    continue;
+
+                // Lighting reaches further across the border than the heights that are shared
+                m_chunks[neighbour].display->MarkLightingDirty(region.Offset(-dx * last, -dz * last));
+
+                // The (widened) region in the neighbour's grid coordinates
+                const DisplayChunk::GridRegion mapped = region.Expanded(1).Offset(-dx * last, -dz * last).Clipped();
+                if (mapped.IsEmpty())
+                    continue;
+
+                // Sharing the border moves both chunks' base layers, which has to be undone along with the edit
+                if (saveUndo)
+                {
+                    const DisplayChunk::GridRegion shared = DisplayChunk::GetSharedBorder(dx, dz, region);
+
+                    DisplayChunk::GetRegionTiles(shared, tiles);
+                    SaveTerrainTiles(edited[i], 0, tiles);
+                    DisplayChunk::GetRegionTiles(shared.Offset(-dx * last, -dz * last), tiles);
+                    SaveTerrainTiles(neighbour, 0, tiles);
+                }
+
+                m_chunks[edited[i]].display->ShareBorder(*m_chunks[neighbour].display, dx, dz, region);
+
+                auto it = std::find(refreshed.begin(), refreshed.end(), neighbour);
+                if (it == refreshed.end())
+                {
+                    refreshed.push_back(neighbour);
+                    refreshRegions.push_back(mapped);
+                }
+                else
+                {
+                    DisplayChunk::GridRegion& existing = refreshRegions[it - refreshed.begin()];
+                    existing = DisplayChunk::GridRegion::Union(existing, mapped);
+                }
+            }
+        }
+    }
+
+    // Every chunk's heights are final, so normals can be read across the borders while refreshing
+    ParallelFor(refreshed.size(), [&](size_t i)
+    {
+        const DisplayChunk* neighbours[DisplayChunk::NEIGHBOUR_COUNT];
+        GetNeighbours(refreshed[i], neighbours);
+
+        m_chunks[refreshed[i]].display->RefreshRegion(refreshRegions[i], neighbours);
+    });
+
+    for (size_t chunk : refreshed)
+        m_chunkBVH.Refit(uint32_t(chunk), m_chunks[chunk].display->GetBounds());
+}
+
+void XM_CALLCONV ChunkManager::PaintSplat(FXMVECTOR clickPos, int layer, int brushSize, float strength)
+{
+    // Painting doesn't move any geometry, so there's nothing to refresh
+    std::vector<size_t> painted;
+    FindChunksUnderBrush(clickPos, brushSize, painted);
+
+    SaveTerrainUndo(painted, TerrainTile::SPLAT_MAP, clickPos, brushSize);
+
+    for (size_t chunk : painted)
+        m_chunks[chunk].display->PaintSplat(clickPos, layer, brushSize, strength);
+}
+
+void ChunkManager::TakeTerrainUndo(std::vector<TerrainTile>& tiles, bool strokeEnded)
+{
+    tiles = std::move(m_undoTiles);
+    m_undoTiles.clear();
+
+    if (strokeEnded)
+        m_undoTileKeys.clear();
+}
+
+void ChunkManager::SwapTerrainTiles(const std::vector<TerrainTile*>& tiles)
+{
+    std::vector<size_t> edited;
+    std::vector<DisplayChunk::GridRegion> regions;
+
+    for (TerrainTile* tile : tiles)
+    {
+        Chunk& chunk = m_chunks[tile->chunk];
+        if (chunk.state != CHUNK_LOADED || chunk.loadID != tile->loadID)
+            continue;
+
+        if (tile->layer == TerrainTile::SPLAT_MAP)
+        {
+            // Painting doesn't move any geometry
+            chunk.display->SwapSplatTile(tile->tile, tile->weights);
+            continue;
+        }
+
+        const DisplayChunk::GridRegion region = chunk.display->SwapLayerTile(tile->layer, tile->tile, tile->heights);
+
+        auto it = std::find(edited.begin(), edited.end(), tile->chunk);
+        if (it == edited.end())
+        {
+            edited.push_back(tile->chunk);
+            regions.push_back(region);
+        }
+        else
+        {
+            DisplayChunk::GridRegion& existing = regions[it - edited.begin()];
+            existing = DisplayChunk::GridRegion::Union(existing, region);
+        }
+    }
+
+    FinishHeightEdit(edited, regions, false);
+}
+
+void XM_CALLCONV ChunkManager::SaveTerrainUndo(const std::vector<size_t>& chunks, int layer, FXMVECTOR clickPos, int brushSize)
+{
+    std::vector<int> tiles;
+    for (size_t chunk : chunks)
+    {
+        m_chunks[chunk].display->GetBrushTiles(clickPos, brushSize, tiles);
+        SaveTerrainTiles(chunk, layer, tiles);
+    }
+}
+
+void ChunkManager::SaveTerrainTiles(size_t chunk, int layer, const std::vector<int>& tiles)
+{
+    const DisplayChunk& display = *m_chunks[chunk].display;
+    for (int tile : tiles)
+    {
+        // Only the first time the tile is changed counts
+        const uint64_t key = (uint64_t(chunk) << 40) | (uint64_t(uint32_t(layer + 1)) << 16) | uint64_t(tile);
+        if (!m_undoTileKeys.insert(key).second)
+            continue;
+
+        TerrainTile saved = { chunk, m_chunks[chunk].loadID, layer, tile };
+        if (layer == TerrainTile::SPLAT_MAP)
+            display.CopySplatTile(tile, saved.weights);
+        else
+            display.CopyLayerTile(size_t(layer), tile, saved.heights);
+
+        m_undoTiles.push_back(std::move(saved));
+    }
+}
+
+void ChunkManager::SetHydrologyOverlay(TerrainHydrology::Overlay overlay)
+{
+    m_hydrologyOverlay = overlay;
+
+    for (size_t chunk : m_loadedChunks)
+        m_chunks[chunk].display->SetHydrologyOverlay(overlay);
+}
+
+bool ChunkManager::QueryHydrology(float x, float z, TerrainHydrology::Sample& sample)
+{
+    DisplayChunk* chunk = FindChunk(x, z);
+    if (!chunk)
+        return false;
+
+    sample = chunk->QueryHydrology(x, z);
+    return true;
+}
+
+void ChunkManager::WorkerMain()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        m_wakeWorker.wait(lock, [this] { return m_quit || !m_requests.empty(); });
+
+        if (m_quit)
+            return;
+
+        // Nearest chunk first
+        auto next = std::min_element(m_requests.begin(), m_requests.end(),
+                                     [](const Request& a, const Request& b) { return a.priority < b.priority; });
+
+        const size_t chunk = next->chunk;
+        m_requests.erase(next);
+
+        const ChunkObject data = m_requestData[chunk];
+        const std::string databasePath = m_databasePath;
+        const unsigned generation = m_generation;
+
+        // The main thread is free to queue/cancel requests while this one is loading
+        lock.unlock();
+        Result result = Load(chunk, data, databasePath, generation);
+        lock.lock();
+
+        m_results.push_back(std::move(result));
+    }
+}
+
+ChunkManager::Result ChunkManager::Load(size_t chunk, const ChunkObject& data, const std::string& databasePath, unsigned generation) const
+{
+    Result result;
+    result.chunk = chunk;
+    result.generation = generation;
+    result.display = std::make_unique<DisplayChunk>();
+
+    // Everything that doesn't need the device context (GPU buffers are made on the main thread once this is done)
+    result.display->PopulateChunkData(&data);
+    if (!result.display->LoadHeightMap(m_deviceResources->GetD3DDevice()))
+    {
+        result.display.reset();
+        return result;
+    }
+
+    result.display->InitialiseBatch();
+
+    // The objects that live in this chunk. The worker uses a connection of its own, so it never shares one with the main thread
+    sqlite3 *database = NULL;
+    if (sqlite3_open_v2(databasePath.c_str(), &database, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK)
+    {
+        sqlite3_stmt *pResults = NULL;
+        if (sqlite3_prepare_v2(database, "SELECT * from Objects WHERE chunk_ID = ?", -1, &pResults, 0) == SQLITE_OK)
+        {
+            sqlite3_bind_int(pResults, 1, data.ID);
+
+            while (sqlite3_step(pResults) == SQLITE_ROW)
+                result.objects.push_back(ReadSceneObject(pResults));
+
+            sqlite3_finalize(pResults);
+        }
+    }
+
+    sqlite3_close(database);
+
+    return result;
+}
+
+void ChunkManager::ReceiveResults()
+{
+    std::vector<Result> results;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        results.swap(m_results);
+    }
+
+    std::vector<size_t> loaded;
+    for (Result& result : results)
+    {
+        // From a previous world
+        if (result.generation != m_generation)
+            continue;
+
+        Chunk& chunk = m_chunks[result.chunk];
+
+        // Cancelled while it was being loaded (or it was requested twice, and this is the second copy)
+        if (chunk.state != CHUNK_REQUESTED)
+            continue;
+
+        RemoveRequest(result.chunk);
+        --m_numRequested;
+
+        if (!result.display)
+        {
+            // Reported in the status bar (see ToolMain::getTerrainLoadStatus), rather than holding up the frame
+            chunk.state = CHUNK_FAILED;
+            ++m_numFailed;
+            m_lastFailedChunk = chunk.data.name;
+            continue;
+        }
+
+        // The world's layers (empty, so the heights are as loaded until the paths are carved in below)
+        for (size_t layer = 1; layer < m_terrainLayers.size(); ++layer)
+        {
+            result.display->InsertLayer(layer, m_terrainLayers[layer].type, m_terrainLayers[layer].blend);
+            if (!m_terrainLayers[layer].visible)
+                result.display->SetLayerVisible(layer, false);
+        }
+
+        result.display->SetHydrologyOverlay(m_hydrologyOverlay);
+        result.display->InitialiseRendering(m_deviceResources);
+
+        chunk.display = std::move(result.display);
+        chunk.state = CHUNK_LOADED;
+        chunk.loadID = ++m_numLoads;
+        chunk.memoryUsage = chunk.display->GetMemoryUsage();
+
+        m_memoryUsage += chunk.memoryUsage;
+        m_loadedChunks.push_back(result.chunk);
+        m_chunkBVHDirty = true;
+
+        // Normals along the new chunk's edges, and its neighbours' edges facing it, can now be taken across the border
+        UpdateEdgeNormals(result.chunk);
+        MarkBorderLightingDirty(result.chunk);
+        loaded.push_back(result.chunk);
+
+        m_streamedIn.push_back({ chunk.data.ID, std::move(result.objects) });
+    }
+
+    // Paths that reach into the new chunks
+    if (!loaded.empty() && !m_paths.IsEmpty())
+    {
+        std::vector<TerrainPaths::Area> areas;
+        m_paths.GetAreas(areas);
+        CarvePaths(areas, loaded);
+    }
+}
+
+void ChunkManager::Unload(size_t chunk)
+{
+    Chunk& unloaded = m_chunks[chunk];
+    assert(unloaded.state == CHUNK_LOADED);
+
+    m_memoryUsage -= unloaded.memoryUsage;
+    unloaded.memoryUsage = 0;
+    unloaded.display.reset();
+    unloaded.state = CHUNK_UNLOADED;
+
+    m_loadedChunks.erase(std::find(m_loadedChunks.begin(), m_loadedChunks.end(), chunk));
+    m_chunkBVHDirty = true;
+    m_streamedOut.push_back(unloaded.data.ID);
+
+    // The neighbours' edges no longer have anything on the other side
+    UpdateEdgeNormals(chunk);
+    MarkBorderLightingDirty(chunk);
+}
+
+bool ChunkManager::RemoveRequest(size_t chunk)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = std::find_if(m_requests.begin(), m_requests.end(), [&](const Request& request) { return request.chunk == chunk; });
+    if (it == m_requests.end())
+        return false;
+
+    m_requests.erase(it);
+    return true;
+}
+
+void ChunkManager::RequestChunks()
+{
+    // Chunks in range that aren't loaded yet, nearest first
+    std::vector<size_t> candidates;
+    for (size_t i = 0; i < m_chunks.size(); ++i)
+    {
+        if (m_chunks[i].state == CHUNK_UNLOADED && m_chunks[i].distance <= m_settings.loadRadius)
+            candidates.push_back(i);
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [&](size_t a, size_t b) { return m_chunks[a].distance < m_chunks[b].distance; });
+
+    // Chunks that are still on their way are assumed to be as big as the biggest loaded one
+    size_t estimate = sizeof(DisplayChunk);
+    for (size_t chunk : m_loadedChunks)
+        estimate = std::max(estimate, m_chunks[chunk].memoryUsage);
+
+    size_t committed = m_memoryUsage + m_numRequested * estimate;
+
+    std::vector<Request> newRequests;
+    for (size_t candidate : candidates)
+    {
+        const float distance = m_chunks[candidate].distance;
+
+        // Make room by dropping chunks that are further away than this one
+        while (committed + estimate > m_settings.memoryBudget)
+        {
+            auto furthest = m_loadedChunks.end();
+            for (auto it = m_loadedChunks.begin(); it != m_loadedChunks.end(); ++it)
+            {
+                const Chunk& chunk = m_chunks[*it];
+                if (chunk.distance > distance && !chunk.display->HasUnsavedChanges() &&
+                    (furthest == m_loadedChunks.end() || chunk.distance > m_chunks[*furthest].distance))
+                    furthest = it;
+            }
+
+            if (furthest == m_loadedChunks.end())
+                break;
+
+            committed -= m_chunks[*furthest].memoryUsage;
+            Unload(*furthest);
+        }
+
+        // Everything that's loaded is nearer (or has unsaved edits), so this is as much as fits
+        if (committed + estimate > m_settings.memoryBudget)
+            break;
+
+        m_chunks[candidate].state = CHUNK_REQUESTED;
+        ++m_numRequested;
+        committed += estimate;
+
+        newRequests.push_back({ candidate, distance });
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_requests.insert(m_requests.end(), newRequests.begin(), newRequests.end());
+
+    // The camera has moved, so re-prioritise what's still in the queue
+    for (Request& request : m_requests)
+        request.priority = m_chunks[request.chunk].distance;
+
+    if (!m_requests.empty())
+        m_wakeWorker.notify_one();
+}
+
+void XM_CALLCONV ChunkManager::FindChunksUnderBrush(FXMVECTOR clickPos, int brushSize, std::vector<size_t>& chunks) const
+{
+    const float halfSize = brushSize * 0.5f;
+    const float x = XMVectorGetX(clickPos);
+    const float z = XMVectorGetZ(clickPos);
+
+    FindChunksOverlapping(XMFLOAT2(x - halfSize, z - halfSize), XMFLOAT2(x + halfSize, z + halfSize), chunks);
+}
+
+void ChunkManager::FindChunksOverlapping(const XMFLOAT2& min, const XMFLOAT2& max, std::vector<size_t>& chunks) const
+{
+    chunks.clear();
+
+    // A grid step extra, so chunks sharing a border sample with the area's edge are included
+    const float reach = float(DisplayChunk::TERRAINSIZE) / (DisplayChunk::TERRAINRESOLUTION - 1);
+    const float halfSize = DisplayChunk::TERRAINSIZE * 0.5f;
+
+    for (size_t chunk : m_loadedChunks)
+    {
+        const ChunkObject& data = m_chunks[chunk].data;
+        const float centerX = float(data.grid_x * DisplayChunk::TERRAINSIZE);
+        const float centerZ = float(data.grid_z * DisplayChunk::TERRAINSIZE);
+
+        if (min.x - reach <= centerX + halfSize && max.x + reach >= centerX - halfSize &&
+            min.y - reach <= centerZ + halfSize && max.y + reach >= centerZ - halfSize)
+            chunks.push_back(chunk);
+    }
+}
+
+bool ChunkManager::FindLoadedChunk(int gridX, int gridZ, size_t& chunk) const
+{
+    auto it = m_chunkLookup.find(GridKey(gridX, gridZ));
+    if (it == m_chunkLookup.end() || m_chunks[it->second].state != CHUNK_LOADED)
+        return false;
+
+    chunk = it->second;
+    return true;
+}
+
+void ChunkManager::GetNeighbours(size_t chunk, const DisplayChunk* neighbours[DisplayChunk::NEIGHBOUR_COUNT]) const
+{
+    static const int offsets[DisplayChunk::NEIGHBOUR_COUNT][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+    const ChunkObject& data = m_chunks[chunk].data;
+    for (int i = 0; i < DisplayChunk::NEIGHBOUR_COUNT; ++i)
+    {
+        size_t neighbour;
+        neighbours[i] = (FindLoadedChunk(data.grid_x + offsets[i][0], data.grid_z + offsets[i][1], neighbour) ? m_chunks[neighbour].display.get() : nullptr);
+    }
+}
+
+void ChunkManager::GetSurroundings(size_t chunk, const DisplayChunk* surrounding[3][3]) const
+{
+    const ChunkObject& data = m_chunks[chunk].data;
+    for (int dz = -1; dz <= 1; ++dz)
+    {
+        for (int dx = -1; dx <= 1; ++dx)
+        {
+            size_t neighbour;
+            surrounding[dz + 1][dx + 1] = ((dx != 0 || dz != 0) && FindLoadedChunk(data.grid_x + dx, data.grid_z + dz, neighbour) ? m_chunks[neighbour].display.get() : nullptr);
+        }
+    }
+}
+
+void ChunkManager::MarkBorderLightingDirty(size_t chunk)
+{
+    const int last = DisplayChunk::TERRAINRESOLUTION - 1;
+    const DisplayChunk::GridRegion whole = { 0, 0, last, last };
+
+    const Chunk& changed = m_chunks[chunk];
+    for (int dz = -1; dz <= 1; ++dz)
+    {
+        for (int dx = -1; dx <= 1; ++dx)
+        {
+            size_t neighbour;
+            if ((dx == 0 && dz == 0) || !FindLoadedChunk(changed.data.grid_x + dx, changed.data.grid_z + dz, neighbour))
+                continue;
+
+            // Each side's lighting near the border, as far as the other can reach into it
+            m_chunks[neighbour].display->MarkLightingDirty(whole.Offset(-dx * last, -dz * last));
+            if (changed.state == CHUNK_LOADED)
+                changed.display->MarkLightingDirty(whole.Offset(dx * last, dz * last));
+        }
+    }
+}
+
+void ChunkManager::UpdateEdgeNormals(size_t chunk)
+{
+    const ChunkObject& data = m_chunks[chunk].data;
+    const int offsets[][2] = { { 0, 0 }, { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+    for (const auto& offset : offsets)
+    {
+        size_t updated;
+        if (!FindLoadedChunk(data.grid_x + offset[0], data.grid_z + offset[1], updated))
+            continue;
+
+        const DisplayChunk* neighbours[DisplayChunk::NEIGHBOUR_COUNT];
+        GetNeighbours(updated, neighbours);
+
+        m_chunks[updated].display->UpdateEdgeNormals(neighbours);
+    }
+}
+
+void ChunkManager::RefitBVH()
+{
+    for (size_t chunk : m_loadedChunks)
+        m_chunks[chunk].display->RefitBVH();
+
+    RebuildChunkBVH();
+}
+
+void ChunkManager::RebuildChunkBVH()
+{
+    std::vector<BoundingBox> bounds;
+    std::vector<uint32_t> items;
+    bounds.reserve(m_loadedChunks.size());
+    items.reserve(m_loadedChunks.size());
+
+    for (size_t chunk : m_loadedChunks)
+    {
+        bounds.push_back(m_chunks[chunk].display->GetBounds());
+        items.push_back(uint32_t(chunk));
+    }
+
+    m_chunkBVH.Build(bounds.data(), items.data(), items.size());
+    m_chunkBVHDirty = false;
+}
+
+float ChunkManager::DistanceToChunk(float x, float z, const ChunkObject& data)
+{
+    const float halfSize = 0.5f * DisplayChunk::TERRAINSIZE;
+
+    const float dx = std::max(std::abs(x - data.grid_x * float(DisplayChunk::TERRAINSIZE)) - halfSize, 0.f);
+    const float dz = std::max(std::abs(z - data.grid_z * float(DisplayChunk::TERRAINSIZE)) - halfSize, 0.f);
+
+    return std::sqrt(dx * dx + dz * dz);
+}
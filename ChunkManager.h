@@ -0,0 +1,287 @@
+#pragma once
+#include "DeviceResources.h"
+#include "ChunkBVH.h"
+#include "ChunkObject.h"
+#include "DisplayChunk.h"
+#include "SceneObject.h"
+#include "TerrainLayerStack.h"
+#include "TerrainPaths.h"
+#include "TerrainStamp.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Streams the chunks of a world (a grid of DisplayChunks) in and out around the camera.
+// Heightmaps, textures and objects are read on a background thread, nearest chunks first. Chunks are
+// loaded once they come within the load radius, and only dropped once they're past the (larger) unload
+// radius, so hovering around a border doesn't keep reloading the same chunk. If the memory budget runs
+// out, the furthest chunks make way for nearer ones. Chunks with unsaved edits are never dropped.
+class ChunkManager
+{
+public:
+    struct Settings
+    {
+        // Distances (on the xz-plane) from the camera to the edge of a chunk
+        float loadRadius = 768.f;
+        float unloadRadius = 1024.f;
+        // Bytes the loaded chunks may hold on to (estimated by DisplayChunk::GetMemoryUsage)
+        size_t memoryBudget = 256 * 1024 * 1024;
+    };
+
+    // A chunk that has finished loading, along with the objects stored for it in the database
+    struct StreamedChunk
+    {
+        int chunkID;
+        std::vector<SceneObject> objects;
+    };
+
+    ChunkManager() = default;
+    ChunkManager(const ChunkManager&) = delete;
+    ChunkManager& operator=(const ChunkManager&) = delete;
+    // Waits for the chunk being loaded (if any)
+    ~ChunkManager();
+
+    void Initialise(DX::DeviceResources* deviceResources, const Settings& settings = Settings());
+
+    // Replaces the world. Every chunk is unloaded, and chunks are loaded from scratch as the camera needs them
+    void SetChunks(const std::vector<ChunkObject>& chunks, const std::string& databasePath);
+
+    // Picks up finished loads, and works out what to load/unload next
+    void XM_CALLCONV Update(DirectX::FXMVECTOR cameraPosition);
+    void XM_CALLCONV Render(ID3D11DeviceContext* context, DirectX::FXMMATRIX view, DirectX::CXMMATRIX projection);
+
+    // Chunks that have been loaded/unloaded since the last call (the owner of the scene graph adds/removes their objects)
+    void TakeStreamedChunks(std::vector<StreamedChunk>& loaded, std::vector<int>& unloaded);
+
+    // Loaded chunk covering a world space position (nullptr if that part of the world isn't loaded)
+    DisplayChunk* FindChunk(float x, float z);
+    const DisplayChunk* FindChunk(float x, float z) const;
+    // As above, but falls back to the nearest loaded chunk
+    const DisplayChunk* FindNearestChunk(float x, float z) const;
+
+    // Queries over every loaded chunk. Rays only test the chunks they pass through (see ChunkBVH)
+    bool XM_CALLCONV Intersects(DirectX::FXMVECTOR origin, DirectX::FXMVECTOR direction, DirectX::XMVECTOR& wsCoord) const;
+    // Many rays at once (directions normalised), spread across threads. hits[i] is only written if found[i]
+    void Intersects(const DirectX::XMFLOAT3* origins, const DirectX::XMFLOAT3* directions, DirectX::XMFLOAT3* hits, bool* found, size_t count) const;
+    float SampleHeight(float x, float z) const;
+    DirectX::XMVECTOR SampleNormal(float x, float z) const;
+    void SampleHeights(const float* xs, const float* zs, float* heights, size_t count) const;
+
+    // Refits every loaded chunk's BVH (and the chunk BVH above them)
+    void RefitBVH();
+
+    // The world's terrain layers (see TerrainLayerStack), bottom to top. Every loaded chunk has the same layers.
+    // A world starts out with its heightmaps (the base), one sculpt layer, and the paths (always on top)
+    struct TerrainLayer
+    {
+        std::string name;
+        TerrainLayerStack::Type type;
+        TerrainLayerStack::BlendMode blend;
+        bool visible;
+    };
+
+    const std::vector<TerrainLayer>& GetTerrainLayers() const { return m_terrainLayers; }
+    size_t GetSelectedTerrainLayer() const { return m_selectedTerrainLayer; }
+    void SelectTerrainLayer(size_t layer) { m_selectedTerrainLayer = std::min(layer, m_terrainLayers.size() - 1); }
+    // Adds a sculpt layer on top of the others (below the paths). Returns its index
+    size_t AddSculptLayer();
+    // 'saveUndo' keeps the tiles it changes for TakeTerrainUndo (as a brush does), unless it's undoing something itself
+    void SetTerrainLayerVisible(size_t layer, bool visible, bool saveUndo);
+
+    // Brushes across every loaded chunk under the brush, into the selected layer (or the topmost sculpt layer, if the
+    // selected one isn't a sculpt layer). Chunks are edited in parallel, then the samples on
+    // their shared borders are made to agree, and each chunk refreshes only the region that changed
+    void XM_CALLCONV ManipulateTerrain(DirectX::FXMVECTOR clickPos, bool elevate, int brushSize, float brushForce);
+    void XM_CALLCONV PaintSplat(DirectX::FXMVECTOR clickPos, int layer, int brushSize, float strength);
+
+    // Undo for brush strokes: a tile of a chunk's layer (or of its splat map) as it was before the brush changed it.
+    // A chunk that has been streamed out since has lost its layers and paint (they're saved as the composite), so
+    // tiles from an earlier load of it are left alone
+    struct TerrainTile
+    {
+        static constexpr int SPLAT_MAP = -1;
+
+        size_t chunk;
+        unsigned loadID;
+        // Layer index, or SPLAT_MAP
+        int layer;
+        int tile;
+        std::vector<float> heights;
+        std::vector<DirectX::PackedVector::XMUBYTEN4> weights;
+    };
+
+    // Hands over the tiles brushed since the last call, as they were before the first brush touched them. Until the
+    // stroke has ended, the tiles handed over aren't kept again
+    void TakeTerrainUndo(std::vector<TerrainTile>& tiles, bool strokeEnded);
+    // Swaps each tile's contents with what's in the terrain (so swapping the same tiles again puts it back)
+    void SwapTerrainTiles(const std::vector<TerrainTile*>& tiles);
+
+    // Terrain clipboard. Copies a square (size metres across, centered on (x, z)) of the loaded terrain's heights,
+    // and pastes them back into every loaded chunk under the stamp (with the same border/refresh handling as brushes).
+    // Every paste goes into a stamp layer of its own. Pasting returns false (and adds no layer) if there was nothing to
+    // paste or nowhere to paste it, and otherwise which layer it went into
+    void CopyHeights(float x, float z, float size, TerrainStamp& stamp) const;
+    bool PasteHeights(const TerrainStamp& stamp, const TerrainStamp::Placement& placement, size_t& layer);
+
+    // Roads and rivers along the scene's path nodes (see TerrainPaths). Only the tiles around spans next to nodes that
+    // have changed are recarved, and chunks are carved as they stream in. Returns true if any heights changed
+    bool SetPaths(const std::vector<SceneObject>& nodes);
+
+    // Drainage analysis (see TerrainHydrology), per chunk with the chunk's edges as outlets. While an overlay is
+    // shown, chunks whose heights have changed are reanalysed (in parallel) every Update
+    void SetHydrologyOverlay(TerrainHydrology::Overlay overlay);
+    TerrainHydrology::Overlay GetHydrologyOverlay() const { return m_hydrologyOverlay; }
+    // Analysis results at a world space position. Returns false if that part of the world isn't loaded
+    bool QueryHydrology(float x, float z, TerrainHydrology::Sample& sample);
+
+    template <typename Func>
+    void ForEachLoadedChunk(Func func)
+    {
+        for (size_t chunk : m_loadedChunks)
+            func(*m_chunks[chunk].display);
+    }
+
+    template <typename Func>
+    void ForEachLoadedChunk(Func func) const
+    {
+        for (size_t chunk : m_loadedChunks)
+            func(static_cast<const DisplayChunk&>(*m_chunks[chunk].display));
+    }
+
+    size_t GetChunkCount() const { return m_chunks.size(); }
+    size_t GetLoadedChunkCount() const { return m_loadedChunks.size(); }
+    size_t GetPendingChunkCount() const { return m_numRequested; }
+    size_t GetMemoryUsage() const { return m_memoryUsage; }
+    // Chunks that couldn't be loaded (e.g. their heightmap is missing), and the name of the last one. They aren't
+    // tried again until the world is reloaded
+    size_t GetFailedChunkCount() const { return m_numFailed; }
+    const std::string& GetLastFailedChunkName() const { return m_lastFailedChunk; }
+
+private:
+    enum ChunkState
+    {
+        CHUNK_UNLOADED,
+        CHUNK_REQUESTED,
+        CHUNK_LOADED,
+        CHUNK_FAILED        // Not retried until the world is reloaded
+    };
+
+    struct Chunk
+    {
+        ChunkObject data;
+        ChunkState state = CHUNK_UNLOADED;
+        std::unique_ptr<DisplayChunk> display;
+        // Distance from the camera as of the last Update
+        float distance = 0.f;
+        size_t memoryUsage = 0;
+        // Different every time the chunk is loaded (see TerrainTile)
+        unsigned loadID = 0;
+    };
+
+    // IO queue entry. Priority is the chunk's distance, so it's refreshed every Update
+    struct Request
+    {
+        size_t chunk;
+        float priority;
+    };
+
+    struct Result
+    {
+        size_t chunk;
+        unsigned generation;
+        std::unique_ptr<DisplayChunk> display;
+        std::vector<SceneObject> objects;
+    };
+
+    void WorkerMain();
+    // Runs on the worker thread. Returns a null display chunk if the heightmap couldn't be read
+    Result Load(size_t chunk, const ChunkObject& data, const std::string& databasePath, unsigned generation) const;
+
+    void ReceiveResults();
+    void Unload(size_t chunk);
+    // Takes a chunk out of the IO queue. Returns false if the worker has already picked it up
+    bool RemoveRequest(size_t chunk);
+    void RequestChunks();
+
+    // Makes shared border samples agree after the heights of some chunks have changed, then refreshes
+    // (in parallel) only the regions that changed, in those chunks and their neighbours. With 'saveUndo', the base
+    // layer tiles that get moved to agree are kept for undo first
+    void FinishHeightEdit(const std::vector<size_t>& edited, const std::vector<DisplayChunk::GridRegion>& regions, bool saveUndo);
+    // Keeps a copy of the tiles a brush is about to change (that haven't been since the stroke started)
+    void XM_CALLCONV SaveTerrainUndo(const std::vector<size_t>& chunks, int layer, DirectX::FXMVECTOR clickPos, int brushSize);
+    void SaveTerrainTiles(size_t chunk, int layer, const std::vector<int>& tiles);
+    // Inserts a layer into the world, and every loaded chunk
+    void InsertTerrainLayer(size_t index, const std::string& name, TerrainLayerStack::Type type, TerrainLayerStack::BlendMode blend);
+    // Recarves the paths into the tiles of some chunks that overlap some world space areas. Returns true if any heights changed
+    bool CarvePaths(const std::vector<TerrainPaths::Area>& areas, const std::vector<size_t>& chunks);
+
+    // Loaded chunks under a square brush, or overlapping a world space (x, z) rectangle
+    void XM_CALLCONV FindChunksUnderBrush(DirectX::FXMVECTOR clickPos, int brushSize, std::vector<size_t>& chunks) const;
+    void FindChunksOverlapping(const DirectX::XMFLOAT2& min, const DirectX::XMFLOAT2& max, std::vector<size_t>& chunks) const;
+    bool FindLoadedChunk(int gridX, int gridZ, size_t& chunk) const;
+    // Loaded neighbours of a chunk (null where there isn't one), indexed by DisplayChunk::Neighbour
+    void GetNeighbours(size_t chunk, const DisplayChunk* neighbours[DisplayChunk::NEIGHBOUR_COUNT]) const;
+    // Loaded chunks around a chunk, diagonals included, by [dz + 1][dx + 1] (null where there isn't one, and in the middle)
+    void GetSurroundings(size_t chunk, const DisplayChunk* surrounding[3][3]) const;
+    // Recalculates the edge normals of a chunk and its loaded neighbours (after it has been loaded/unloaded)
+    void UpdateEdgeNormals(size_t chunk);
+    // Rebakes the lighting either side of a chunk's borders (after it has been loaded/unloaded)
+    void MarkBorderLightingDirty(size_t chunk);
+    void RebuildChunkBVH();
+
+    // Distance on the xz-plane from a position to the edge of a chunk (zero if it's inside)
+    static float DistanceToChunk(float x, float z, const ChunkObject& data);
+    static uint64_t GridKey(int x, int z) { return (uint64_t(uint32_t(x)) << 32) | uint32_t(z); }
+
+    DX::DeviceResources* m_deviceResources = nullptr;
+    Settings m_settings;
+
+    std::vector<Chunk> m_chunks;
+    std::unordered_map<uint64_t, size_t> m_chunkLookup;
+    std::vector<size_t> m_loadedChunks;
+
+    // Over the loaded chunks (items are indices into m_chunks). Rebuilt at the end of an Update that loaded/unloaded any
+    ChunkBVH m_chunkBVH;
+    bool m_chunkBVHDirty = false;
+
+    TerrainPaths m_paths;
+
+    std::vector<TerrainLayer> m_terrainLayers;
+    size_t m_selectedTerrainLayer = 0;
+    int m_numSculptLayers = 0;
+    int m_numStampLayers = 0;
+
+    TerrainHydrology::Overlay m_hydrologyOverlay = TerrainHydrology::OVERLAY_NONE;
+
+    size_t m_memoryUsage = 0;
+    size_t m_numRequested = 0;
+    unsigned m_numLoads = 0;
+    size_t m_numFailed = 0;
+    std::string m_lastFailedChunk;
+
+    // Brushed tiles waiting for TakeTerrainUndo, and which ones have been kept this stroke (chunk, layer and tile)
+    std::vector<TerrainTile> m_undoTiles;
+    std::unordered_set<uint64_t> m_undoTileKeys;
+
+    std::vector<StreamedChunk> m_streamedIn;
+    std::vector<int> m_streamedOut;
+
+    // Shared with the worker (guarded by m_mutex)
+    std::mutex m_mutex;
+    std::condition_variable m_wakeWorker;
+    std::vector<Request> m_requests;
+    std::vector<Result> m_results;
+    std::vector<ChunkObject> m_requestData;
+    std::string m_databasePath;
+    // Bumped by SetChunks, so results for the previous world are thrown away
+    unsigned m_generation = 0;
+    bool m_quit = false;
+
+    std::thread m_worker;
+};
@@ -4,6 +4,8 @@
 
 ChunkObject::ChunkObject()
 {
+	grid_x = 0;
+	grid_z = 0;
 }
 
 
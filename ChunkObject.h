@@ -27,6 +27,9 @@ public:
 	int tex_splat_2_tiling;
 	int tex_splat_3_tiling;
 	int tex_splat_4_tiling;
+	// Position of the chunk in the world's grid of chunks (optional grid_x/grid_z columns)
+	int grid_x;
+	int grid_z;
 
 };
 
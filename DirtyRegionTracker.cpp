@@ -0,0 +1,67 @@
+#include "DirtyRegionTracker.h"
+#include <algorithm>
+
+void DirtyRegionTracker::Initialise(int width, int height)
+{
+    m_width = width;
+    m_height = height;
+
+    m_rows.assign(height, RowSpan{ width, -1 });
+    m_numDirtyRows = 0;
+}
+
+void DirtyRegionTracker::MarkDirty(int minX, int minZ, int maxX, int maxZ)
+{
+    minX = std::max(minX, 0);
+    minZ = std::max(minZ, 0);
+    maxX = std::min(maxX, m_width - 1);
+    maxZ = std::min(maxZ, m_height - 1);
+
+    for (int z = minZ; z <= maxZ && minX <= maxX; ++z)
+    {
+        RowSpan& row = m_rows[z];
+        if (row.minX > row.maxX)
+            ++m_numDirtyRows;
+
+        row.minX = std::min(row.minX, minX);
+        row.maxX = std::max(row.maxX, maxX);
+    }
+}
+
+void DirtyRegionTracker::Schedule(size_t maxElements, std::vector<Range>& ranges)
+{
+    ranges.clear();
+
+    size_t budget = maxElements;
+    for (int z = 0; z < m_height && m_numDirtyRows > 0 && budget > 0; ++z)
+    {
+        RowSpan& row = m_rows[z];
+        if (row.minX > row.maxX)
+            continue;
+
+        const size_t first = size_t(z) * m_width + row.minX;
+        size_t count = size_t(row.maxX - row.minX + 1);
+
+        // Stretch the previous range over the gap if that's cheaper than another upload
+        const size_t gap = ranges.empty() ? 0 : first - (ranges.back().first + ranges.back().count);
+        const bool merge = !ranges.empty() && gap <= size_t(m_width) && gap < budget;
+        if (merge)
+            budget -= gap;
+
+        count = std::min(count, budget);
+        budget -= count;
+
+        if (merge)
+            ranges.back().count += gap + count;
+        else
+            ranges.push_back({ first, count });
+
+        // Out of budget part way through the row--leave the rest for next time
+        row.minX += int(count);
+        if (row.minX > row.maxX)
+        {
+            row = RowSpan{ m_width, -1 };
+            --m_numDirtyRows;
+        }
+    }
+}
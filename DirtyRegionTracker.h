@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// Keeps track of which parts of a row-major grid (e.g. the terrain's vertices) have changed since they were
+// last uploaded, and hands them back as contiguous element ranges a budgeted amount at a time.
+// Anything over budget stays dirty for the next call, so a big edit is spread over several frames.
+class DirtyRegionTracker
+{
+public:
+    struct Range
+    {
+        size_t first;
+        size_t count;
+    };
+
+    DirtyRegionTracker() = default;
+
+    // Everything starts out clean
+    void Initialise(int width, int height);
+
+    // Inclusive grid coordinates (clamped to the grid)
+    void MarkDirty(int minX, int minZ, int maxX, int maxZ);
+    void MarkAllDirty() { MarkDirty(0, 0, m_width - 1, m_height - 1); }
+
+    bool IsDirty() const { return m_numDirtyRows > 0; }
+
+    // Takes up to maxElements worth of dirty elements (in row order), marking them clean.
+    // Neighbouring rows are merged into a single range when the clean gap between them fits in the budget
+    void Schedule(size_t maxElements, std::vector<Range>& ranges);
+
+private:
+    // Dirty span of a row (clean if minX > maxX)
+    struct RowSpan
+    {
+        int minX;
+        int maxX;
+    };
+
+    std::vector<RowSpan> m_rows;
+    int m_width = 0;
+    int m_height = 0;
+    int m_numDirtyRows = 0;
+};
@@ -1,6 +1,8 @@
 #include <string>
 #include "DisplayChunk.h"
 #include "Game.h"
+#include "ParallelFor.h"
+#include "TerrainSimplifier.h"
 #include <locale>
 #include <codecvt>
 
@@ -8,8 +10,28 @@
 using namespace DirectX;
 using namespace DirectX::SimpleMath;
 
+const D3D11_INPUT_ELEMENT_DESC TerrainVertex::InputElements[] =
+{
+    { "HEIGHT",      0, DXGI_FORMAT_R32_FLOAT,          0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+    { "MORPHHEIGHT", 0, DXGI_FORMAT_R32_FLOAT,          0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+    { "NORMAL",      0, DXGI_FORMAT_R8G8_UNORM,         0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+    { "MORPHLEVEL",  0, DXGI_FORMAT_R8_UINT,            0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+};
+
+namespace
+{
+    // Heights are read straight out of the vertices
+    constexpr size_t HEIGHT_STRIDE = sizeof(TerrainVertex) / sizeof(float);
+}
+
 
-void DisplayChunk::PopulateChunkData(ChunkObject * SceneChunk)
+DisplayChunk::~DisplayChunk()
+{
+    if (m_texture_diffuse)
+        m_texture_diffuse->Release();
+}
+
+void DisplayChunk::PopulateChunkData(const ChunkObject * SceneChunk)
 {
     m_name = SceneChunk->name;
     m_chunk_x_size_metres = SceneChunk->chunk_x_size_metres;
@@ -29,71 +51,98 @@ void DisplayChunk::PopulateChunkData(ChunkObject * SceneChunk)
     m_tex_splat_2_tiling = SceneChunk->tex_splat_2_tiling;
     m_tex_splat_3_tiling = SceneChunk->tex_splat_3_tiling;
     m_tex_splat_4_tiling = SceneChunk->tex_splat_4_tiling;
+
+    // Chunks are centered on their grid position
+    m_origin = XMFLOAT2((SceneChunk->grid_x - 0.5f) * m_terrainSize, (SceneChunk->grid_z - 0.5f) * m_terrainSize);
 }
 
 void XM_CALLCONV DisplayChunk::RenderBatch(ID3D11DeviceContext* context, FXMMATRIX view, CXMMATRIX projection)
 {
-    m_terrainEffect->Apply(context);
-    context->IASetInputLayout(m_terrainInputLayout.Get());
+    // Push any painted splat weights to the GPU
+    m_splatMap.UploadDirtyTiles(context);
+    m_lightmap.UploadDirtyTiles(context);
 
-    m_batch->Begin();
-    m_batch->DrawIndexed(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, m_indices.data(), m_indices.size(), m_terrainGeometry, NUM_VERTICES);
-    m_batch->End();
+    if (m_overlayDirty && m_overlayTexture)
+    {
+        // Cleared if there's no analysis to show yet
+        m_hydrology.BuildOverlay(m_hydrologyOverlay, m_overlayTexels);
+        if (m_overlayTexels.size() != NUM_VERTICES)
+            m_overlayTexels.assign(NUM_VERTICES, 0);
 
-    //m_bvh.DebugRender(context, view, projection, 3);
-}
+        context->UpdateSubresource(m_overlayTexture.Get(), 0, nullptr, m_overlayTexels.data(), TERRAINRESOLUTION * sizeof(uint32_t), 0);
 
-void DisplayChunk::InitialiseBatch()
-{
-    //build geometry for our terrain array
-    //iterate through all the vertices of our required resolution terrain.
-    const float terrainSizeH = m_terrainSize * 0.5f;
+        m_overlayDirty = false;
+    }
 
-    for (size_t z = 0; z < TERRAINRESOLUTION; z++)
+    // Pick this frame's patches
+    m_quadtree.Select(view, projection, m_selectedPatches);
+    if (m_selectedPatches.empty())
     {
-        for (size_t x = 0; x < TERRAINRESOLUTION; x++)
-        {
-            int index = (TERRAINRESOLUTION * z) + x;
-
-            //This will create a terrain going from -64->64.  rather than 0->128.  So the center of the terrain is on the origin
-            m_terrainGeometry[index].position = {
-                (x * m_terrainPositionScalingFactor) - terrainSizeH,
-                float(m_heightMap[index]) * m_terrainHeightScale,
-                (z * m_terrainPositionScalingFactor) - terrainSizeH
-            };
-
-            m_terrainGeometry[index].normal = Vector3::UnitY;
-            //Spread tex coords so that its distributed evenly across the terrain from 0-1
-            m_terrainGeometry[index].textureCoordinate = { x * TEXCOORD_STEP * m_tex_diffuse_tiling, z * TEXCOORD_STEP * m_tex_diffuse_tiling };
-        }
+        m_selectedTriangles = 0;
+        return;
     }
 
-    // Initialise indices
-    for (size_t z = 0; z < TERRAINRESOLUTION - 1; z++)
+    // Only send the vertices that have been edited (up to this frame's budget)
+    if (m_dirtyVertices.IsDirty())
     {
-        for (size_t x = 0; x < TERRAINRESOLUTION - 1; x++)
+        m_dirtyVertices.Schedule(VERTEX_UPLOAD_BUDGET, m_uploadRanges);
+
+        for (const DirtyRegionTracker::Range& range : m_uploadRanges)
         {
-            int bottomL = (TERRAINRESOLUTION * z) + x;
-            int bottomR = (TERRAINRESOLUTION * z) + x + 1;
-            int topR = (TERRAINRESOLUTION * (z + 1)) + x + 1;
-            int topL = (TERRAINRESOLUTION * (z + 1)) + x;
-
-            // First triangle
-            m_indices.push_back(bottomL);
-            m_indices.push_back(bottomR);
-            m_indices.push_back(topR);
-
-            // Second triangle
-            m_indices.push_back(bottomL);
-            m_indices.push_back(topR);
-            m_indices.push_back(topL);
+            const D3D11_BOX box = CD3D11_BOX(UINT(range.first * sizeof(TerrainVertex)), 0, 0, UINT((range.first + range.count) * sizeof(TerrainVertex)), 1, 1);
+            context->UpdateSubresource(m_vertexBuffer.Get(), 0, &box, &m_terrainGeometry[range.first], 0, 0);
         }
     }
 
-    CalculateTerrainNormals();
+    m_terrainEffect->SetView(view);
+    m_terrainEffect->SetProjection(projection);
+    m_terrainEffect->SetWorld(XMMatrixIdentity());
+    m_terrainEffect->SetCameraPosition(XMMatrixInverse(nullptr, view).r[3]);
+    m_terrainEffect->Apply(context);
+    context->IASetInputLayout(m_terrainInputLayout.Get());
+
+    const UINT stride = sizeof(TerrainVertex);
+    const UINT offset = 0;
+    context->IASetVertexBuffers(0, 1, m_vertexBuffer.GetAddressOf(), &stride, &offset);
+    context->IASetIndexBuffer(m_indexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
+    context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+    // Every patch's indices are already in the index buffer
+    m_selectedTriangles = 0;
+    for (const TerrainQuadtree::Patch& patch : m_selectedPatches)
+    {
+        const TerrainQuadtree::IndexRange& range = m_quadtree.GetIndexRange(patch);
+        context->DrawIndexed(range.count, range.first, 0);
+
+        m_selectedTriangles += range.count / 3;
+    }
+
+    //m_bvh.DebugRender(context, view, projection, 3);
+}
+
+void DisplayChunk::InitialiseBatch()
+{
+    //the heights were filled in by LoadHeightMap. x/z and uv are worked out from a vertex' place in the grid
+    //(starting at m_origin, so the center of the chunk is on its grid position)
+
+    // Indices are picked per frame by the quadtree (one leaf patch spans 16 quads)
+    m_quadtree.Initialise(TERRAINRESOLUTION, m_terrainPositionScalingFactor, m_origin, 16, 2.f * 16.f * m_terrainPositionScalingFactor);
+    m_dirtyVertices.Initialise(TERRAINRESOLUTION, TERRAINRESOLUTION);
+
+    // The loaded heights are the base layer (the rest are added once the chunk is in the world)
+    m_layers.Initialise(TERRAINRESOLUTION, &m_terrainGeometry[0].height, HEIGHT_STRIDE);
+
+    // Neighbours (if any) are taken into account once the chunk is in the world (see UpdateEdgeNormals)
+    const DisplayChunk* neighbours[NEIGHBOUR_COUNT] = {};
+    CalculateTerrainNormals({ 0, 0, TERRAINRESOLUTION - 1, TERRAINRESOLUTION - 1 }, neighbours);
+    UpdateLodData(0, 0, TERRAINRESOLUTION - 1, TERRAINRESOLUTION - 1);
 
     // initialise bvh
-    m_bvh.Initialise(m_terrainGeometry);
+    m_bvh.Initialise(&m_terrainGeometry[0].height, HEIGHT_STRIDE, TERRAINRESOLUTION, m_terrainPositionScalingFactor, m_origin);
+
+    // Bake the lighting up front, so the chunk shows up lit (this runs off the main thread when streaming)
+    m_lightmap.Initialise(TERRAINRESOLUTION, m_terrainPositionScalingFactor);
+    BakeLighting();
 }
 
 void DisplayChunk::InitialiseRendering(DX::DeviceResources* deviceResources)
@@ -102,12 +151,50 @@ void DisplayChunk::InitialiseRendering(DX::DeviceResources* deviceResources)
     ID3D11DeviceContext* context = deviceResources->GetD3DDeviceContext();
 
     //setup terrain effect
-    m_terrainEffect = std::make_unique<BasicEffect>(device);
-    m_terrainEffect->EnableDefaultLighting();
-    m_terrainEffect->SetLightingEnabled(true);
-    m_terrainEffect->SetTextureEnabled(true);
+    m_terrainEffect = std::make_unique<TerrainEffect>(device);
     m_terrainEffect->SetTexture(m_texture_diffuse);
 
+    m_lightmap.CreateTexture(device);
+    m_terrainEffect->SetLightmap(m_lightmap.GetShaderResourceView());
+
+    // Splat textures that couldn't be loaded are drawn with the diffuse texture instead, so a chunk without any looks
+    // as it did before painting
+    {
+        ID3D11ShaderResourceView* splatTextures[SplatMap::NUM_LAYERS];
+        const int tiling[SplatMap::NUM_LAYERS] = { m_tex_splat_1_tiling, m_tex_splat_2_tiling, m_tex_splat_3_tiling, m_tex_splat_4_tiling };
+        int splatTiling[SplatMap::NUM_LAYERS];
+
+        for (int layer = 0; layer < SplatMap::NUM_LAYERS; ++layer)
+        {
+            const bool loaded = (m_texture_splat[layer] != nullptr);
+            splatTextures[layer] = loaded ? m_texture_splat[layer].Get() : m_texture_diffuse;
+            splatTiling[layer] = loaded ? tiling[layer] : m_tex_diffuse_tiling;
+        }
+
+        m_terrainEffect->SetSplat(m_splatMap.GetShaderResourceView(), splatTextures, splatTiling);
+    }
+
+    // Hydrology overlay (empty until one is picked)
+    {
+        CD3D11_TEXTURE2D_DESC desc(DXGI_FORMAT_R8G8B8A8_UNORM, TERRAINRESOLUTION, TERRAINRESOLUTION, 1, 1, D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_DEFAULT);
+
+        m_overlayTexels.assign(NUM_VERTICES, 0);
+        D3D11_SUBRESOURCE_DATA initialData = { m_overlayTexels.data(), TERRAINRESOLUTION * sizeof(uint32_t), 0 };
+
+        if (SUCCEEDED(device->CreateTexture2D(&desc, &initialData, m_overlayTexture.ReleaseAndGetAddressOf())))
+            device->CreateShaderResourceView(m_overlayTexture.Get(), nullptr, m_overlaySRV.ReleaseAndGetAddressOf());
+
+        m_terrainEffect->SetOverlay(m_overlaySRV.Get());
+        m_overlayDirty = (m_hydrologyOverlay != TerrainHydrology::OVERLAY_NONE);
+    }
+    m_terrainEffect->SetGrid(TERRAINRESOLUTION, m_terrainPositionScalingFactor, m_origin, TEXCOORD_STEP * m_tex_diffuse_tiling);
+
+    for (int lod = 0; lod < m_quadtree.GetLodCount(); ++lod)
+    {
+        const XMFLOAT2& range = m_quadtree.GetMorphRange(lod);
+        m_terrainEffect->SetMorphRange(lod, range.x, range.y);
+    }
+
     void const* shaderByteCode;
     size_t byteCodeLength;
 
@@ -115,75 +202,188 @@ void DisplayChunk::InitialiseRendering(DX::DeviceResources* deviceResources)
 
     //setup batch
     DX::ThrowIfFailed(
-        device->CreateInputLayout(VertexPositionNormalTexture::InputElements,
-                                  VertexPositionNormalTexture::InputElementCount,
+        device->CreateInputLayout(TerrainVertex::InputElements,
+                                  TerrainVertex::InputElementCount,
                                   shaderByteCode,
                                   byteCodeLength,
                                   m_terrainInputLayout.ReleaseAndGetAddressOf())
     );
 
-    m_batch = std::make_unique<PrimitiveBatch<VertexPositionNormalTexture>>(context, m_indices.size() + 1, NUM_VERTICES + 1);
+    //setup buffers. The vertices are updated in place as the terrain is edited
+    CD3D11_BUFFER_DESC vertexBufferDesc(sizeof(m_terrainGeometry), D3D11_BIND_VERTEX_BUFFER, D3D11_USAGE_DEFAULT);
+    D3D11_SUBRESOURCE_DATA vertexData = { m_terrainGeometry, 0, 0 };
+    DX::ThrowIfFailed(device->CreateBuffer(&vertexBufferDesc, &vertexData, m_vertexBuffer.ReleaseAndGetAddressOf()));
+
+    std::vector<uint32_t> indices;
+    m_quadtree.BuildPatchIndices(indices);
+
+    CD3D11_BUFFER_DESC indexBufferDesc(UINT(indices.size() * sizeof(uint32_t)), D3D11_BIND_INDEX_BUFFER, D3D11_USAGE_IMMUTABLE);
+    D3D11_SUBRESOURCE_DATA indexData = { indices.data(), 0, 0 };
+    DX::ThrowIfFailed(device->CreateBuffer(&indexBufferDesc, &indexData, m_indexBuffer.ReleaseAndGetAddressOf()));
+
+    // The buffer was created from the current vertices
+    m_dirtyVertices.Initialise(TERRAINRESOLUTION, TERRAINRESOLUTION);
 
     m_bvh.InitialiseDebugVisualiastion(context);
 }
 
-void DisplayChunk::LoadHeightMap(ID3D11Device* device)
+bool DisplayChunk::LoadHeightMap(ID3D11Device* device)
 {
     //load in heightmap .raw
     FILE *pFile = NULL;
 
     // Open The File In Read / Binary Mode.
     errno_t ret = fopen_s(&pFile, m_heightmap_path.c_str(), "rb");
-    // Check To See If We Found The File And Could Open It
+    // Check To See If We Found The File And Could Open It (it's up to the caller to tell the user)
     if (ret != 0 || pFile == NULL)
-    {
-        // Display Error Message And Stop The Function
-        MessageBox(NULL, L"Can't Find The Height Map!", L"Error", MB_OK);
-        return;
-    }
+        return false;
 
     // Here We Load The .RAW File Into Our pHeightMap Data Array
     // We Are Only Reading In '1', And The Size Is (Width * Height)
-    fread(m_heightMap, 1, NUM_VERTICES, pFile);
+    std::vector<BYTE> heightMap(NUM_VERTICES);
+    fread(heightMap.data(), 1, NUM_VERTICES, pFile);
 
     fclose(pFile);
 
+    // The vertices are the only copy of the heights we keep
+    for (int i = 0; i < NUM_VERTICES; ++i)
+        m_terrainGeometry[i].height = float(heightMap[i]) * m_terrainHeightScale;
+
     //load the diffuse texture
     std::wstring_convert<std::codecvt_utf8<wchar_t>> convertToWide;
     std::wstring texturewstr = convertToWide.from_bytes(m_tex_diffuse_path);
     HRESULT rs = CreateDDSTextureFromFile(device, texturewstr.c_str(), NULL, &m_texture_diffuse);	//load tex into Shader resource	view and resource
+
+    //load the splat weights (the chunk may not have an alpha map yet, so give it one next to the heightmap)
+    if (m_tex_splat_alpha_path.empty())
+        m_tex_splat_alpha_path = m_heightmap_path.substr(0, m_heightmap_path.find_last_of('.')) + "_splat.raw";
+
+    m_splatMap.Initialise(TERRAINRESOLUTION, TERRAINRESOLUTION);
+    m_splatMap.Load(m_tex_splat_alpha_path);
+    m_splatMap.CreateTexture(device);
+
+    //load the textures it blends between
+    const std::string* splatPaths[SplatMap::NUM_LAYERS] = { &m_tex_splat_1_path, &m_tex_splat_2_path, &m_tex_splat_3_path, &m_tex_splat_4_path };
+    for (int layer = 0; layer < SplatMap::NUM_LAYERS; ++layer)
+    {
+        m_texture_splat[layer].Reset();
+        if (!splatPaths[layer]->empty())
+            CreateDDSTextureFromFile(device, convertToWide.from_bytes(*splatPaths[layer]).c_str(), nullptr, m_texture_splat[layer].ReleaseAndGetAddressOf());
+    }
+
+    return true;
 }
 
-void DisplayChunk::SaveHeightMap()
+bool DisplayChunk::SaveHeightMap()
 {
+    if (m_heightMapWriter.IsBusy())
+        return false;
+
+    // Nothing to write (unless the last save didn't make it to disk)
+    if (!m_heightsModified && m_heightMapWriter.GetState() != HeightMapWriter::STATE_FAILED)
+        return true;
+
+    // Snapshot only the heights--this is all the writer needs, and the terrain is free to change after this point.
+    // The heights are interleaved with the rest of each vertex, so there's nothing to share; copying them out is one
+    // pass over a chunk's 64KB of floats, once per save of an edited chunk
+    auto heights = std::make_shared<std::vector<float>>(NUM_VERTICES);
     for (int i = 0; i < NUM_VERTICES; ++i)
-        m_heightMap[i] = m_terrainGeometry[i].position.y / m_terrainHeightScale;
+        (*heights)[i] = m_terrainGeometry[i].height;
 
-    FILE *pFile = NULL;
+    // Encoding and writing happens on a background thread
+    if (!m_heightMapWriter.Begin(std::move(heights), m_terrainHeightScale, m_heightmap_path))
+        return false;
 
-    // Open The File In Read / Binary Mode.
-    errno_t ret = fopen_s(&pFile, m_heightmap_path.c_str(), "wb+");
-    // Check To See If We Found The File And Could Open It
-    if (ret != 0 || pFile == NULL)
+    m_heightsModified = false;
+    return true;
+}
+
+bool DisplayChunk::SaveSplatMap()
+{
+    return m_splatMap.Save(m_tex_splat_alpha_path);
+}
+
+bool DisplayChunk::ExportSimplifiedMesh(float maxError, std::string& path) const
+{
+    std::vector<float> heights(NUM_VERTICES);
+    for (int i = 0; i < NUM_VERTICES; ++i)
+        heights[i] = m_terrainGeometry[i].height;
+
+    TerrainSimplifier simplifier(std::move(heights), TERRAINRESOLUTION, m_terrainPositionScalingFactor, m_origin);
+
+    path = m_heightmap_path.substr(0, m_heightmap_path.find_last_of('.')) + "_simplified.obj";
+    return TerrainSimplifier::WriteOBJ(path, simplifier.Simplify(maxError));
+}
+
+size_t DisplayChunk::BakeLighting(size_t maxTiles)
+{
+    return m_lightmap.Bake(&m_terrainGeometry[0].height, HEIGHT_STRIDE, m_bvh, m_origin, maxTiles);
+}
+
+size_t DisplayChunk::BakeLighting(size_t maxTiles, const DisplayChunk* const surrounding[3][3], const TerrainLightmap::RayTest& occluded)
+{
+    if (!m_lightmap.IsDirty())
+        return 0;
+
+    TerrainLightmap::Surroundings surroundings;
+    for (int z = 0; z < 3; ++z)
     {
-        // Display Error Message And Stop The Function
-        MessageBox(NULL, L"Can't Find The Height Map!", L"Error", MB_OK);
-        return;
+        for (int x = 0; x < 3; ++x)
+        {
+            const DisplayChunk* chunk = surrounding[z][x];
+            if (!chunk || chunk == this)
+                continue;
+
+            surroundings.heights[z][x] = &chunk->m_terrainGeometry[0].height;
+            surroundings.maxHeight = std::max(surroundings.maxHeight, chunk->GetBounds().Center.y + chunk->GetBounds().Extents.y);
+        }
     }
+    surroundings.occluded = occluded;
 
-    size_t written = fwrite(m_heightMap, sizeof(BYTE), NUM_VERTICES, pFile);
-    fclose(pFile);
+    return m_lightmap.Bake(&m_terrainGeometry[0].height, HEIGHT_STRIDE, m_bvh, m_origin, maxTiles, surroundings);
+}
 
-    MessageBox(NULL, L"Terrain has been saved successfully", L"OK", MB_OK);
+bool DisplayChunk::ExportLightmap(std::string& path) const
+{
+    path = m_heightmap_path.substr(0, m_heightmap_path.find_last_of('.')) + "_lightmap.dds";
+    return m_lightmap.Save(path);
 }
 
-void DisplayChunk::UpdateTerrain()
+void DisplayChunk::UpdateHydrology()
 {
-    //all this is doing is transferring the height from the heigtmap into the terrain geometry.
-    for (size_t i = 0; i < NUM_VERTICES; ++i)
-        m_terrainGeometry[i].position.y = float(m_heightMap[i]) * m_terrainHeightScale;
+    if (!m_hydrologyDirty)
+        return;
 
-    CalculateTerrainNormals();
+    m_hydrology.Analyse(&m_terrainGeometry[0].height, HEIGHT_STRIDE, TERRAINRESOLUTION, m_terrainPositionScalingFactor);
+    m_hydrologyDirty = false;
+    m_overlayDirty = (m_hydrologyOverlay != TerrainHydrology::OVERLAY_NONE);
+}
+
+TerrainHydrology::Sample DisplayChunk::QueryHydrology(float x, float z)
+{
+    UpdateHydrology();
+    return m_hydrology.Query((x - m_origin.x) / m_terrainPositionScalingFactor, (z - m_origin.y) / m_terrainPositionScalingFactor);
+}
+
+void DisplayChunk::SetHydrologyOverlay(TerrainHydrology::Overlay overlay)
+{
+    if (overlay == m_hydrologyOverlay)
+        return;
+
+    m_hydrologyOverlay = overlay;
+    m_overlayDirty = true;
+}
+
+void DisplayChunk::UpdateTerrain()
+{
+    //the heights live in the vertices, so all that's left to do is bring everything derived from them up to date
+    const DisplayChunk* neighbours[NEIGHBOUR_COUNT] = {};
+    CalculateTerrainNormals({ 0, 0, TERRAINRESOLUTION - 1, TERRAINRESOLUTION - 1 }, neighbours);
+    UpdateLodData(0, 0, TERRAINRESOLUTION - 1, TERRAINRESOLUTION - 1);
+    m_lightmap.MarkDirty(0, 0, TERRAINRESOLUTION - 1, TERRAINRESOLUTION - 1);
+    m_hydrologyDirty = true;
+
+    m_heightsModified = true;
 }
 
 void DisplayChunk::GenerateHeightmap()
@@ -191,51 +391,311 @@ void DisplayChunk::GenerateHeightmap()
     //insert how YOU want to update the heigtmap here! :D
 }
 
-void XM_CALLCONV DisplayChunk::ManipulateTerrain(FXMVECTOR clickPos, bool elevate, int brushSize, float brushForce)
+void DisplayChunk::InsertLayer(size_t index, TerrainLayerStack::Type type, TerrainLayerStack::BlendMode blend)
+{
+    m_layers.InsertLayer(index, type, blend);
+
+    if (type == TerrainLayerStack::LAYER_PROCEDURAL)
+    {
+        m_layers.SetGenerator(std::min(index, m_layers.GetLayerCount() - 1), [this](int minX, int minZ, int maxX, int maxZ, float* heights)
+        {
+            CarvePathTile(minX, minZ, maxX, maxZ, heights);
+        });
+    }
+}
+
+DisplayChunk::GridRegion DisplayChunk::SetLayerVisible(size_t layer, bool visible)
+{
+    m_layers.SetVisible(layer, visible);
+    return CompositeLayers();
+}
+
+DisplayChunk::GridRegion XM_CALLCONV DisplayChunk::ManipulateTerrain(size_t layer, FXMVECTOR clickPos, bool elevate, int brushSize, float brushForce)
 {    
-    // Transform to grid (nearest) coordinates
-    int hitX = (XMVectorGetX(clickPos) + (0.5f * m_terrainSize)) / m_terrainPositionScalingFactor;
-    int hitZ = (XMVectorGetZ(clickPos) + (0.5f * m_terrainSize)) / m_terrainPositionScalingFactor;
+    // Transform to grid coordinates (the click may be in a neighbouring chunk, hence the floor)
+    int hitX = int(std::floor((XMVectorGetX(clickPos) - m_origin.x) / m_terrainPositionScalingFactor));
+    int hitZ = int(std::floor((XMVectorGetZ(clickPos) - m_origin.y) / m_terrainPositionScalingFactor));
 
     const int brushRadius = brushSize / 2;
     const int brushRadiusGrid = brushRadius / m_terrainPositionScalingFactor;
 
+    const GridRegion region = GridRegion{ hitX - brushRadiusGrid, hitZ - brushRadiusGrid, hitX + brushRadiusGrid - 1, hitZ + brushRadiusGrid - 1 }.Clipped();
+    if (region.IsEmpty())
+        return region;
+
     // Hit position on the xz-plane
-    XMVECTOR hitPosition = XMVectorSetY(clickPos, 0.f);
-    for (int z = std::max(0, hitZ - brushRadiusGrid); z < std::min(TERRAINRESOLUTION, hitZ + brushRadiusGrid); ++z)
+    const XMVECTOR hitPosition = XMVectorSetY(clickPos, 0.f);
+    m_layers.Edit(layer, region.minX, region.minZ, region.maxX, region.maxZ, false, [&](int minX, int minZ, int maxX, int maxZ, float* offsets, float*)
     {
-        for (int x = std::max(0, hitX - brushRadiusGrid); x < std::min(TERRAINRESOLUTION, hitX + brushRadiusGrid); ++x)
+        for (int z = minZ; z <= maxZ; ++z)
         {
-            // Only manipulate vertices that are within the brush radius
-            int gridDistance = (int)std::sqrt(std::pow(x - hitX, 2) + std::pow(z - hitZ, 2));
-            if (gridDistance >= brushRadiusGrid)
-                continue;
+            for (int x = minX; x <= maxX; ++x)
+            {
+                // Only manipulate vertices that are within the brush radius
+                int gridDistance = (int)std::sqrt(std::pow(x - hitX, 2) + std::pow(z - hitZ, 2));
+                if (gridDistance >= brushRadiusGrid)
+                    continue;
+
+                const int idx = x + (z * TERRAINRESOLUTION);
+
+                XMVECTOR position = GetPosition(idx);
+                // Make sure length is only calculated on the xz-plane
+                position = XMVectorSetY(position, 0.f);
+
+                // Calculate weight based on vertex' distance from click position
+                float distance = XMVectorGetX(XMVector3LengthEst(position - hitPosition));
+                float weight = 1.f - (distance / brushRadius);
+
+                float displacement = weight * brushForce;
+
+                // Clamp against the terrain as it looks, so pushing past the limits doesn't build up offsets that have no effect
+                float newHeight = 0.f;
+                float currentHeight = m_terrainGeometry[idx].height;
+                if (elevate)
+                    newHeight = std::min(currentHeight + displacement, 255.f * m_terrainHeightScale);
+                else
+                    newHeight = std::max(currentHeight - displacement, 0.f);
+
+                offsets[TerrainLayerStack::GetTileIndex(x, z)] += newHeight - currentHeight;
+            }
+        }
+    });
+
+    return CompositeLayers();
+}
+
+DisplayChunk::GridRegion DisplayChunk::ApplyStamp(size_t layer, const TerrainStamp& stamp, const TerrainStamp::Placement& placement)
+{
+    XMFLOAT2 min, max;
+    stamp.GetFootprint(placement, min, max);
+
+    // Only the vertices under the stamp
+    const float invScale = 1.f / m_terrainPositionScalingFactor;
+    const GridRegion region = GridRegion{
+        int(std::ceil((min.x - m_origin.x) * invScale)), int(std::ceil((min.y - m_origin.y) * invScale)),
+        int(std::floor((max.x - m_origin.x) * invScale)), int(std::floor((max.y - m_origin.y) * invScale)) }.Clipped();
+    if (region.IsEmpty())
+        return region;
 
-            const int idx = x + (z * TERRAINRESOLUTION);
-            
-            XMVECTOR position = XMLoadFloat3(&m_terrainGeometry[idx].position);
-            // Make sure length is only calculated on the xz-plane
-            position = XMVectorSetY(position, 0.f);
-            
-            // Calculate weight based on vertex' distance from click position
-            float distance = XMVectorGetX(XMVector3LengthEst(position - hitPosition));
-            float weight = 1.f - (distance / brushRadius);
-            
-            float displacement = weight * brushForce;
-            
-            // Change and clamp vertex y-coordinate
-            float newHeight = 0.f;
-            float currentHeight = m_terrainGeometry[idx].position.y;
-            if (elevate)
-                newHeight = std::min(currentHeight + displacement, 255.f * m_terrainHeightScale);
-            else
-                newHeight = std::max(currentHeight - displacement, 0.f);
-            
-            m_terrainGeometry[idx].position.y = newHeight;
+    const XMVECTOR laneOffsets = XMVectorSet(0.f, 1.f, 2.f, 3.f);
+
+    // The blending happens as the layer is composited, with the stamp's fade as its mask
+    m_layers.Edit(layer, region.minX, region.minZ, region.maxX, region.maxZ, true, [&](int minX, int minZ, int maxX, int maxZ, float* values, float* mask)
+    {
+        for (int z = minZ; z <= maxZ; ++z)
+        {
+            const XMVECTOR zs = XMVectorReplicate(m_origin.y + z * m_terrainPositionScalingFactor);
+
+            // Four vertices at a time (the last few lanes of a row may hang over the end, and are left alone)
+            for (int x = minX; x <= maxX; x += 4)
+            {
+                const int count = std::min(4, maxX - x + 1);
+
+                const XMVECTOR xs = XMVectorReplicate(m_origin.x) + (XMVectorReplicate(float(x)) + laneOffsets) * XMVectorReplicate(m_terrainPositionScalingFactor);
+
+                XMVECTOR weight;
+                XMFLOAT4A sampled, weights;
+                XMStoreFloat4A(&sampled, stamp.Sample(placement, xs, zs, weight));
+                XMStoreFloat4A(&weights, weight);
+
+                // Every paste has a layer of its own, so the stamp goes in as it is, faded in by the mask alone
+                for (int lane = 0; lane < count; ++lane)
+                {
+                    const size_t index = TerrainLayerStack::GetTileIndex(x + lane, z);
+                    const float w = (&weights.x)[lane];
+                    if (w <= 0.f)
+                        continue;
+
+                    values[index] = (&sampled.x)[lane];
+                    mask[index] = w;
+                }
+            }
+        }
+    });
+
+    return CompositeLayers();
+}
+
+DisplayChunk::GridRegion DisplayChunk::CarvePaths(const TerrainPaths& paths, const std::vector<GridRegion>& tiles)
+{
+    m_paths = &paths;
+
+    for (const GridRegion& tile : tiles)
+        m_layers.Invalidate(tile.minX, tile.minZ, tile.maxX, tile.maxZ);
+
+    // A chunk saved with its paths already carved in comes out the same, and isn't flagged as edited
+    return CompositeLayers();
+}
+
+DisplayChunk::GridRegion DisplayChunk::CompositeLayers()
+{
+    GridRegion region;
+    if (!m_layers.Composite(&m_terrainGeometry[0].height, HEIGHT_STRIDE, 0.f, 255.f * m_terrainHeightScale, region.minX, region.minZ, region.maxX, region.maxZ))
+        return GridRegion::Empty();
+
+    m_heightsModified = true;
+    return region;
+}
+
+void DisplayChunk::CarvePathTile(int minX, int minZ, int maxX, int maxZ, float* heights) const
+{
+    if (!m_paths)
+        return;
+
+    // Only the parts of the paths near the tile
+    const TerrainPaths::Area area = {
+        XMFLOAT2(m_origin.x + minX * m_terrainPositionScalingFactor, m_origin.y + minZ * m_terrainPositionScalingFactor),
+        XMFLOAT2(m_origin.x + maxX * m_terrainPositionScalingFactor, m_origin.y + maxZ * m_terrainPositionScalingFactor) };
+
+    std::vector<uint32_t> segments;
+    m_paths->FindSegments(area, segments);
+    if (segments.empty())
+        return;
+
+    for (int z = minZ; z <= maxZ; ++z)
+    {
+        for (int x = minX; x <= maxX; ++x)
+        {
+            float& height = heights[z * TERRAINRESOLUTION + x];
+            height = m_paths->Apply(m_origin.x + x * m_terrainPositionScalingFactor, m_origin.y + z * m_terrainPositionScalingFactor, height, segments);
         }
     }
+}
+
+DisplayChunk::GridRegion DisplayChunk::GetSharedBorder(int dx, int dz, const GridRegion& region)
+{
+    const int last = TERRAINRESOLUTION - 1;
+
+    GridRegion shared = region.Clipped();
+
+    // Nothing unless the region reaches the side(s) facing the neighbour
+    if ((dx > 0 && shared.maxX < last) || (dx < 0 && shared.minX > 0) || (dz > 0 && shared.maxZ < last) || (dz < 0 && shared.minZ > 0))
+        return GridRegion::Empty();
+
+    // The samples along the shared edge (or the single shared corner) that fall within the region
+    if (dx != 0)
+        shared.minX = shared.maxX = (dx > 0 ? last : 0);
+    if (dz != 0)
+        shared.minZ = shared.maxZ = (dz > 0 ? last : 0);
+
+    return shared;
+}
+
+void DisplayChunk::ShareBorder(DisplayChunk& neighbour, int dx, int dz, const GridRegion& region)
+{
+    const int last = TERRAINRESOLUTION - 1;
+
+    const GridRegion shared = GetSharedBorder(dx, dz, region);
+    if (shared.IsEmpty())
+        return;
+
+    bool changed = false;
+    for (int z = shared.minZ; z <= shared.maxZ; ++z)
+    {
+        for (int x = shared.minX; x <= shared.maxX; ++x)
+        {
+            float& height = m_terrainGeometry[z * TERRAINRESOLUTION + x].height;
+            float& neighbourHeight = neighbour.m_terrainGeometry[(z - dz * last) * TERRAINRESOLUTION + (x - dx * last)].height;
+
+            // Both sides may have been edited (with slightly different rounding), so meet in the middle.
+            // The base layers take up the difference, so it isn't lost when they're next recomposited
+            if (height != neighbourHeight)
+            {
+                height = neighbourHeight = 0.5f * (height + neighbourHeight);
+                m_layers.Rebase(x, z, height);
+                neighbour.m_layers.Rebase(x - dx * last, z - dz * last, height);
+                changed = true;
+            }
+        }
+    }
+
+    if (changed)
+        m_heightsModified = neighbour.m_heightsModified = true;
+}
 
-    CalculateTerrainNormals();
+void DisplayChunk::RefreshRegion(const GridRegion& region, const DisplayChunk* const neighbours[NEIGHBOUR_COUNT])
+{
+    const GridRegion clipped = region.Clipped();
+    if (clipped.IsEmpty())
+        return;
+
+    // Normals depend on the heights either side
+    CalculateTerrainNormals(clipped.Expanded(1).Clipped(), neighbours);
+    UpdateLodData(clipped.minX - 1, clipped.minZ - 1, clipped.maxX + 1, clipped.maxZ + 1);
+
+    m_bvh.Refit(clipped.minX, clipped.minZ, clipped.maxX, clipped.maxZ);
+
+    // Rebaked over the next few frames (see BakeLighting)
+    m_lightmap.MarkDirty(clipped.minX, clipped.minZ, clipped.maxX, clipped.maxZ);
+
+    // Drainage can change anywhere downstream, so the whole chunk is reanalysed (when next needed)
+    m_hydrologyDirty = true;
+}
+
+void DisplayChunk::UpdateEdgeNormals(const DisplayChunk* const neighbours[NEIGHBOUR_COUNT])
+{
+    const int last = TERRAINRESOLUTION - 1;
+
+    const GridRegion edges[] =
+    {
+        { 0, 0, 0, last },
+        { last, 0, last, last },
+        { 0, 0, last, 0 },
+        { 0, last, last, last }
+    };
+
+    for (const GridRegion& edge : edges)
+    {
+        CalculateTerrainNormals(edge, neighbours);
+        m_dirtyVertices.MarkDirty(edge.minX, edge.minZ, edge.maxX, edge.maxZ);
+    }
+}
+
+void XM_CALLCONV DisplayChunk::PaintSplat(FXMVECTOR clickPos, int layer, int brushSize, float strength)
+{
+    // The splat map shares the terrain's grid, so paint in grid coordinates
+    float hitX = (XMVectorGetX(clickPos) - m_origin.x) / m_terrainPositionScalingFactor;
+    float hitZ = (XMVectorGetZ(clickPos) - m_origin.y) / m_terrainPositionScalingFactor;
+
+    const float brushRadiusGrid = (brushSize / 2) / m_terrainPositionScalingFactor;
+
+    m_splatMap.Paint(hitX, hitZ, brushRadiusGrid, layer, strength);
+}
+
+void XM_CALLCONV DisplayChunk::GetBrushTiles(FXMVECTOR clickPos, int brushSize, std::vector<int>& tiles) const
+{
+    // Generous, so whatever rounding the brushes do it's covered
+    const float hitX = (XMVectorGetX(clickPos) - m_origin.x) / m_terrainPositionScalingFactor;
+    const float hitZ = (XMVectorGetZ(clickPos) - m_origin.y) / m_terrainPositionScalingFactor;
+    const float brushRadiusGrid = (brushSize / 2) / m_terrainPositionScalingFactor;
+
+    GetRegionTiles(GridRegion{
+        int(std::floor(hitX - brushRadiusGrid)) - 1, int(std::floor(hitZ - brushRadiusGrid)) - 1,
+        int(std::ceil(hitX + brushRadiusGrid)) + 1, int(std::ceil(hitZ + brushRadiusGrid)) + 1 }, tiles);
+}
+
+void DisplayChunk::GetRegionTiles(const GridRegion& unclipped, std::vector<int>& tiles)
+{
+    tiles.clear();
+
+    const GridRegion region = unclipped.Clipped();
+    if (region.IsEmpty())
+        return;
+
+    static_assert(SplatMap::TILE_SIZE == TerrainLayerStack::TILE_SIZE, "The splat map's tiles have to line up with the layers'");
+
+    const int TILE_SIZE = TerrainLayerStack::TILE_SIZE;
+    const int tilesPerSide = (TERRAINRESOLUTION + TILE_SIZE - 1) / TILE_SIZE;
+
+    for (int tileZ = region.minZ / TILE_SIZE; tileZ <= region.maxZ / TILE_SIZE; ++tileZ)
+        for (int tileX = region.minX / TILE_SIZE; tileX <= region.maxX / TILE_SIZE; ++tileX)
+            tiles.push_back(tileZ * tilesPerSide + tileX);
+}
+
+DisplayChunk::GridRegion DisplayChunk::SwapLayerTile(size_t layer, int tile, std::vector<float>& values)
+{
+    m_layers.SwapTile(layer, tile, values);
+    return CompositeLayers();
 }
 
 void DisplayChunk::RefitBVH()
@@ -243,14 +703,35 @@ void DisplayChunk::RefitBVH()
     m_bvh.Refit();
 }
 
-bool XM_CALLCONV DisplayChunk::CursorIntersectsTerrain(FXMVECTOR origin, long mouseX, long mouseY, D3D11_VIEWPORT viewport, FXMMATRIX projection, CXMMATRIX view, CXMMATRIX world, XMVECTOR& wsCoord) const
+bool DisplayChunk::HasUnsavedChanges() const
 {
-    // Create ray
-    XMVECTOR farPoint = XMVectorSet(mouseX, mouseY, 0.f, 1.f);
-    farPoint = XMVector3Unproject(farPoint, viewport.TopLeftX, viewport.TopLeftY, viewport.Width, viewport.Height, viewport.MinDepth, viewport.MaxDepth, projection, view, world);
+    const HeightMapWriter::State saveState = m_heightMapWriter.GetState();
+    return m_heightsModified || m_splatMap.HasUnsavedTiles() ||
+           saveState == HeightMapWriter::STATE_WRITING || saveState == HeightMapWriter::STATE_FAILED;
+}
 
-    XMVECTOR direction = XMVector3Normalize(farPoint - origin);
+size_t DisplayChunk::GetMemoryUsage() const
+{
+    // Vertices are kept on both sides. The diffuse texture is left out (chunks tend to share them)
+    size_t bytes = sizeof(*this) + sizeof(m_terrainGeometry);
+    bytes += m_bvh.GetMemoryUsage();
+    bytes += m_splatMap.GetMemoryUsage();
+    bytes += m_lightmap.GetMemoryUsage();
+    bytes += m_layers.GetMemoryUsage();
+    bytes += m_hydrology.GetMemoryUsage() + m_overlayTexels.size() * sizeof(uint32_t) * 2;
+
+    if (m_indexBuffer)
+    {
+        D3D11_BUFFER_DESC desc;
+        m_indexBuffer->GetDesc(&desc);
+        bytes += desc.ByteWidth;
+    }
 
+    return bytes;
+}
+
+bool XM_CALLCONV DisplayChunk::Intersects(FXMVECTOR origin, FXMVECTOR direction, XMVECTOR& wsCoord) const
+{
     // Query BVH
     XMVECTOR hit;
     if (m_bvh.Intersects(origin, direction, hit))
@@ -263,39 +744,200 @@ bool XM_CALLCONV DisplayChunk::CursorIntersectsTerrain(FXMVECTOR origin, long mo
     return false;
 }
 
-void DisplayChunk::CalculateTerrainNormals()
+float DisplayChunk::SampleHeight(float x, float z) const
+{
+    int cellX, cellZ;
+    float fracX, fracZ;
+    WorldToCell(x, z, cellX, cellZ, fracX, fracZ);
+
+    const float bottomL = GetHeight(cellX, cellZ);
+    const float bottomR = GetHeight(cellX + 1, cellZ);
+    const float topR = GetHeight(cellX + 1, cellZ + 1);
+    const float topL = GetHeight(cellX, cellZ + 1);
+
+    // Interpolate across whichever of the quad's two triangles (split along bottomL-topR, like the index buffer) the point is in
+    if (fracX >= fracZ)
+        return bottomL + (fracX * (bottomR - bottomL)) + (fracZ * (topR - bottomR));
+    else
+        return bottomL + (fracZ * (topL - bottomL)) + (fracX * (topR - topL));
+}
+
+XMVECTOR DisplayChunk::SampleNormal(float x, float z) const
 {
-    // Lambda for testing if two indices are on the same terrain row
-    static const auto OnSameRow = [](int i0, int i1)
+    int cellX, cellZ;
+    float fracX, fracZ;
+    WorldToCell(x, z, cellX, cellZ, fracX, fracZ);
+
+    const float bottomL = GetHeight(cellX, cellZ);
+    const float bottomR = GetHeight(cellX + 1, cellZ);
+    const float topR = GetHeight(cellX + 1, cellZ + 1);
+    const float topL = GetHeight(cellX, cellZ + 1);
+
+    // Height gradient of the triangle the point is in
+    float dx, dz;
+    if (fracX >= fracZ)
     {
-        return (i0 / TERRAINRESOLUTION) == (i1 / TERRAINRESOLUTION);
-    };
+        dx = bottomR - bottomL;
+        dz = topR - bottomR;
+    }
+    else
+    {
+        dx = topR - topL;
+        dz = topL - bottomL;
+    }
+
+    return XMVector3Normalize(XMVectorSet(-dx, m_terrainPositionScalingFactor, -dz, 0.f));
+}
+
+void DisplayChunk::SampleHeights(const float* xs, const float* zs, float* heights, size_t count) const
+{
+    const XMVECTOR originX = XMVectorReplicate(m_origin.x);
+    const XMVECTOR originZ = XMVectorReplicate(m_origin.y);
+    const XMVECTOR invScale = XMVectorReplicate(1.f / m_terrainPositionScalingFactor);
+    const XMVECTOR maxCell = XMVectorReplicate(float(TERRAINRESOLUTION - 2));
 
-    for (int i = 0; i < NUM_QUADS; i++)
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
     {
-        // Neighbour index calculation and range checks
-        int upIdx = (i + TERRAINRESOLUTION >= (TERRAINRESOLUTION * TERRAINRESOLUTION) ? i : i + TERRAINRESOLUTION);
-        int downIdx = (i - TERRAINRESOLUTION < 0 ? i : i - TERRAINRESOLUTION);
-
-        int leftIdx = (OnSameRow(i, i - 1) ? i - 1 : i);
-        int rightIdx = (OnSameRow(i, i + 1) ? i + 1 : i);
-
-        // Normal calculation
-        Vector3 upDownVector(
-            (m_terrainGeometry[upIdx].position.x - m_terrainGeometry[downIdx].position.x),
-            (m_terrainGeometry[upIdx].position.y - m_terrainGeometry[downIdx].position.y),
-            (m_terrainGeometry[upIdx].position.z - m_terrainGeometry[downIdx].position.z)
-        );
-
-        Vector3 leftRightVector(
-            (m_terrainGeometry[leftIdx].position.x - m_terrainGeometry[rightIdx].position.x),
-            (m_terrainGeometry[leftIdx].position.y - m_terrainGeometry[rightIdx].position.y),
-            (m_terrainGeometry[leftIdx].position.z - m_terrainGeometry[rightIdx].position.z)
-        );
-
-        Vector3 normalVector = leftRightVector.Cross(upDownVector);
-        normalVector.Normalize();
-
-        m_terrainGeometry[i].normal = normalVector;
+        // Grid coordinates for four positions at a time
+        XMVECTOR gridX = XMVectorClamp((XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(xs + i)) - originX) * invScale, g_XMZero, maxCell + g_XMOne);
+        XMVECTOR gridZ = XMVectorClamp((XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(zs + i)) - originZ) * invScale, g_XMZero, maxCell + g_XMOne);
+
+        XMVECTOR cellX = XMVectorMin(XMVectorFloor(gridX), maxCell);
+        XMVECTOR cellZ = XMVectorMin(XMVectorFloor(gridZ), maxCell);
+
+        XMVECTOR fracX = gridX - cellX;
+        XMVECTOR fracZ = gridZ - cellZ;
+
+        XMFLOAT4A cx, cz;
+        XMStoreFloat4A(&cx, cellX);
+        XMStoreFloat4A(&cz, cellZ);
+
+        // No gather instruction to lean on, so fetch the corner heights one lane at a time
+        XMFLOAT4A bottomL, bottomR, topR, topL;
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            const int x = int((&cx.x)[lane]);
+            const int z = int((&cz.x)[lane]);
+
+            (&bottomL.x)[lane] = GetHeight(x, z);
+            (&bottomR.x)[lane] = GetHeight(x + 1, z);
+            (&topR.x)[lane] = GetHeight(x + 1, z + 1);
+            (&topL.x)[lane] = GetHeight(x, z + 1);
+        }
+
+        const XMVECTOR hBL = XMLoadFloat4A(&bottomL);
+        const XMVECTOR hBR = XMLoadFloat4A(&bottomR);
+        const XMVECTOR hTR = XMLoadFloat4A(&topR);
+        const XMVECTOR hTL = XMLoadFloat4A(&topL);
+
+        // Evaluate both triangles and pick per lane
+        XMVECTOR lower = hBL + (fracX * (hBR - hBL)) + (fracZ * (hTR - hBR));
+        XMVECTOR upper = hBL + (fracZ * (hTL - hBL)) + (fracX * (hTR - hTL));
+
+        XMVECTOR result = XMVectorSelect(upper, lower, XMVectorGreaterOrEqual(fracX, fracZ));
+        XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(heights + i), result);
     }
+
+    // Leftovers
+    for (; i < count; ++i)
+        heights[i] = SampleHeight(xs[i], zs[i]);
+}
+
+void DisplayChunk::WorldToCell(float x, float z, int& cellX, int& cellZ, float& fracX, float& fracZ) const
+{
+    const float maxGrid = float(TERRAINRESOLUTION - 1);
+
+    float gridX = std::min(std::max((x - m_origin.x) / m_terrainPositionScalingFactor, 0.f), maxGrid);
+    float gridZ = std::min(std::max((z - m_origin.y) / m_terrainPositionScalingFactor, 0.f), maxGrid);
+
+    // The far edge belongs to the last cell
+    cellX = std::min(int(gridX), TERRAINRESOLUTION - 2);
+    cellZ = std::min(int(gridZ), TERRAINRESOLUTION - 2);
+
+    fracX = gridX - cellX;
+    fracZ = gridZ - cellZ;
+}
+
+void DisplayChunk::CalculateTerrainNormals(const GridRegion& region, const DisplayChunk* const neighbours[NEIGHBOUR_COUNT])
+{
+    const int last = TERRAINRESOLUTION - 1;
+
+    for (int z = region.minZ; z <= region.maxZ; ++z)
+    {
+        for (int x = region.minX; x <= region.maxX; ++x)
+        {
+            // Neighbouring heights, reaching into the next chunk across the edges. Without a neighbour the
+            // vertex itself stands in (so the difference is only taken over one step)
+            int leftX = x - 1, rightX = x + 1, downZ = z - 1, upZ = z + 1;
+            float left, right, down, up;
+
+            if (x > 0)                              left = GetHeight(x - 1, z);
+            else if (neighbours[NEIGHBOUR_LEFT])    left = neighbours[NEIGHBOUR_LEFT]->GetHeight(last - 1, z);
+            else                                    left = GetHeight(leftX = x, z);
+
+            if (x < last)                           right = GetHeight(x + 1, z);
+            else if (neighbours[NEIGHBOUR_RIGHT])   right = neighbours[NEIGHBOUR_RIGHT]->GetHeight(1, z);
+            else                                    right = GetHeight(rightX = x, z);
+
+            if (z > 0)                              down = GetHeight(x, z - 1);
+            else if (neighbours[NEIGHBOUR_DOWN])    down = neighbours[NEIGHBOUR_DOWN]->GetHeight(x, last - 1);
+            else                                    down = GetHeight(x, downZ = z);
+
+            if (z < last)                           up = GetHeight(x, z + 1);
+            else if (neighbours[NEIGHBOUR_UP])      up = neighbours[NEIGHBOUR_UP]->GetHeight(x, 1);
+            else                                    up = GetHeight(x, upZ = z);
+
+            // Normal calculation
+            Vector3 upDownVector(0.f, up - down, (upZ - downZ) * m_terrainPositionScalingFactor);
+            Vector3 leftRightVector((leftX - rightX) * m_terrainPositionScalingFactor, left - right, 0.f);
+
+            Vector3 normalVector = leftRightVector.Cross(upDownVector);
+            normalVector.Normalize();
+
+            EncodeOctNormal(normalVector, m_terrainGeometry[z * TERRAINRESOLUTION + x].normal);
+        }
+    }
+}
+
+void DisplayChunk::UpdateLodData(int minX, int minZ, int maxX, int maxZ)
+{
+    minX = std::max(minX, 0);
+    minZ = std::max(minZ, 0);
+    maxX = std::min(maxX, TERRAINRESOLUTION - 1);
+    maxZ = std::min(maxZ, TERRAINRESOLUTION - 1);
+
+    if (minX > maxX || minZ > maxZ)
+        return;
+
+    const float* heights = &m_terrainGeometry[0].height;
+
+    m_quadtree.UpdateHeights(heights, HEIGHT_STRIDE, minX, minZ, maxX, maxZ);
+
+    // Morph targets depend on heights up to one (coarsest) step away
+    const int reach = 1 << std::max(m_quadtree.GetLodCount() - 2, 0);
+
+    // Normals and morph targets around the edges change too
+    m_dirtyVertices.MarkDirty(minX - reach, minZ - reach, maxX + reach, maxZ + reach);
+
+    for (int z = std::max(0, minZ - reach); z <= std::min(maxZ + reach, TERRAINRESOLUTION - 1); ++z)
+    {
+        for (int x = std::max(0, minX - reach); x <= std::min(maxX + reach, TERRAINRESOLUTION - 1); ++x)
+        {
+            int morphLevel;
+            const float target = m_quadtree.GetMorphTarget(heights, HEIGHT_STRIDE, x, z, morphLevel);
+
+            TerrainVertex& vertex = m_terrainGeometry[z * TERRAINRESOLUTION + x];
+            vertex.morphHeight = target;
+            vertex.morphLevel = uint8_t(morphLevel);
+        }
+    }
+}
+
+XMVECTOR DisplayChunk::GetPosition(int index) const
+{
+    const int x = index % TERRAINRESOLUTION;
+    const int z = index / TERRAINRESOLUTION;
+
+    return XMVectorSet(m_origin.x + (x * m_terrainPositionScalingFactor), m_terrainGeometry[index].height, m_origin.y + (z * m_terrainPositionScalingFactor), 0.f);
 }
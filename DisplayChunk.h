@@ -4,49 +4,224 @@
 #include "ChunkObject.h"
 
 #include "BVH.h"
+#include "DirtyRegionTracker.h"
+#include "HeightMapWriter.h"
+#include "SplatMap.h"
+#include "TerrainEffect.h"
+#include "TerrainHydrology.h"
+#include "TerrainLayerStack.h"
+#include "TerrainLightmap.h"
+#include "TerrainPaths.h"
+#include "TerrainQuadtree.h"
+#include "TerrainStamp.h"
+#include "TerrainVertex.h"
 
 class DisplayChunk
 {
 public:
     static constexpr int TERRAINRESOLUTION = 128;
+    static constexpr int TERRAINSIZE = 512;		//size of a chunk in metres (chunks are laid out on a grid this far apart)
     static constexpr int NUM_VERTICES = TERRAINRESOLUTION * TERRAINRESOLUTION;
-    static constexpr int NUM_QUADS = (TERRAINRESOLUTION * TERRAINRESOLUTION) - (TERRAINRESOLUTION * 2 - 1);
     static constexpr float TEXCOORD_STEP = 1.f / (TERRAINRESOLUTION - 1);
+    // Most vertices sent to the GPU in a single frame (edits beyond this are spread over the following frames)
+    static constexpr size_t VERTEX_UPLOAD_BUDGET = 32 * 1024;
+    // Most lightmap tiles rebaked per chunk per frame (see BakeLighting)
+    static constexpr size_t LIGHTMAP_BAKE_BUDGET = 8;
+    // Width (in vertices) of the tiles paths are carved in (see CarvePaths). These are the layer stack's tiles
+    static constexpr int PATH_TILE_SIZE = TerrainLayerStack::TILE_SIZE;
 
-	void PopulateChunkData(ChunkObject * SceneChunk);
+    // Neighbouring chunks, by the side of this chunk they're on
+    enum Neighbour
+    {
+        NEIGHBOUR_LEFT,     // -x
+        NEIGHBOUR_RIGHT,    // +x
+        NEIGHBOUR_DOWN,     // -z
+        NEIGHBOUR_UP,       // +z
+        NEIGHBOUR_COUNT
+    };
+
+    // Inclusive rectangle of grid vertices
+    struct GridRegion
+    {
+        int minX, minZ, maxX, maxZ;
+
+        bool IsEmpty() const { return minX > maxX || minZ > maxZ; }
+        GridRegion Expanded(int amount) const { return{ minX - amount, minZ - amount, maxX + amount, maxZ + amount }; }
+        GridRegion Offset(int x, int z) const { return{ minX + x, minZ + z, maxX + x, maxZ + z }; }
+        GridRegion Clipped() const { return{ std::max(minX, 0), std::max(minZ, 0), std::min(maxX, TERRAINRESOLUTION - 1), std::min(maxZ, TERRAINRESOLUTION - 1) }; }
+
+        static GridRegion Empty() { return{ 0, 0, -1, -1 }; }
+        static GridRegion Union(const GridRegion& a, const GridRegion& b)
+        {
+            if (a.IsEmpty()) return b;
+            if (b.IsEmpty()) return a;
+            return{ std::min(a.minX, b.minX), std::min(a.minZ, b.minZ), std::max(a.maxX, b.maxX), std::max(a.maxZ, b.maxZ) };
+        }
+    };
+
+    DisplayChunk() = default;
+    DisplayChunk(const DisplayChunk&) = delete;
+    DisplayChunk& operator=(const DisplayChunk&) = delete;
+    ~DisplayChunk();
+
+	void PopulateChunkData(const ChunkObject * SceneChunk);
     void XM_CALLCONV RenderBatch(ID3D11DeviceContext* context, DirectX::FXMMATRIX view, DirectX::CXMMATRIX projection);
     void InitialiseRendering(DX::DeviceResources* deviceResources);
     void InitialiseBatch();	//initial setup, base coordinates etc based on scale
-    void LoadHeightMap(ID3D11Device* device);
-    void SaveHeightMap();			//saves the heigtmap back to file.
-	void UpdateTerrain();			//updates the geometry based on the heigtmap
+    // NOTE: Only touches the device (not the context), so this is safe to call off the main thread
+    bool LoadHeightMap(ID3D11Device* device);	//returns false if the heightmap could not be read
+    bool SaveHeightMap();			//saves the heigtmap back to file (asynchronously), if it has been edited. returns false if a save is already in progress
+	void UpdateTerrain();			//updates normals etc. after the heights have been changed
 	void GenerateHeightmap();		//creates or alters the heightmap
 
-    void XM_CALLCONV ManipulateTerrain(DirectX::FXMVECTOR clickPos, bool elevate, int brushSize, float brushForce);
+    // Terrain layers (see TerrainLayerStack). Layer 0 is the heightmap as it was loaded, and every chunk in a world
+    // has the same layers, in the same order. A procedural layer carves the paths (see CarvePaths)
+    void InsertLayer(size_t index, TerrainLayerStack::Type type, TerrainLayerStack::BlendMode blend);
+    size_t GetLayerCount() const { return m_layers.GetLayerCount(); }
+    // Returns the region whose heights changed, which then needs a RefreshRegion()
+    GridRegion SetLayerVisible(size_t layer, bool visible);
+
+    // The edits below only change a layer's contents, and recomposite the heights that depend on them.
+    // Each returns the region whose heights changed, which then needs a RefreshRegion()
+
+    // Brushes the offsets of a sculpt layer
+    GridRegion XM_CALLCONV ManipulateTerrain(size_t layer, DirectX::FXMVECTOR clickPos, bool elevate, int brushSize, float brushForce);
+    // Pastes a stamp (see TerrainStamp) into a stamp layer, over the part of its footprint inside this chunk
+    GridRegion ApplyStamp(size_t layer, const TerrainStamp& stamp, const TerrainStamp::Placement& placement);
+    // Recarves the paths over some (grid coordinate) tiles, a tile per thread. The paths are kept to carve with
+    // until the next call, so they must outlive the chunk (or the next call)
+    GridRegion CarvePaths(const TerrainPaths& paths, const std::vector<GridRegion>& tiles);
+    // Makes the samples shared with a neighbouring chunk (dx/dz chunks away, diagonals included) agree within a region of this chunk
+    void ShareBorder(DisplayChunk& neighbour, int dx, int dz, const GridRegion& region);
+    // The samples ShareBorder can change on this side (empty if the region doesn't reach the border)
+    static GridRegion GetSharedBorder(int dx, int dz, const GridRegion& region);
+    // Brings normals, LOD data and the BVH up to date after heights in a region have changed.
+    // Normals on the edges are taken across into the neighbours (any of which may be null)
+    void RefreshRegion(const GridRegion& region, const DisplayChunk* const neighbours[NEIGHBOUR_COUNT]);
+    // Recalculates the normals along the chunk's edges (after a neighbour has been loaded)
+    void UpdateEdgeNormals(const DisplayChunk* const neighbours[NEIGHBOUR_COUNT]);
+    void XM_CALLCONV PaintSplat(DirectX::FXMVECTOR clickPos, int layer, int brushSize, float strength);
+
+    // Undo for brush strokes (see ChunkManager::TerrainTile). The layer stack's tiles and the splat map's are laid out
+    // the same. Which tiles a brush at clickPos can touch (sculpting or painting), and copies/swaps of their contents
+    void XM_CALLCONV GetBrushTiles(DirectX::FXMVECTOR clickPos, int brushSize, std::vector<int>& tiles) const;
+    static void GetRegionTiles(const GridRegion& region, std::vector<int>& tiles);
+    void CopyLayerTile(size_t layer, int tile, std::vector<float>& values) const { m_layers.CopyTile(layer, tile, values); }
+    // Returns the region whose heights changed, which then needs a RefreshRegion()
+    GridRegion SwapLayerTile(size_t layer, int tile, std::vector<float>& values);
+    void CopySplatTile(int tile, std::vector<DirectX::PackedVector::XMUBYTEN4>& weights) const { m_splatMap.CopyTile(tile, weights); }
+    void SwapSplatTile(int tile, std::vector<DirectX::PackedVector::XMUBYTEN4>& weights) { m_splatMap.SwapTile(tile, weights); }
+    bool SaveSplatMap();			//writes painted splat tiles back to the alpha map
+    bool ExportSimplifiedMesh(float maxError, std::string& path) const;	//writes an RTIN simplified copy of the terrain to <heightmap>_simplified.obj
+    // Rebakes up to maxTiles lightmap tiles that edits have invalidated (all of them if 0). Returns the number still waiting
+    size_t BakeLighting(size_t maxTiles = 0);
+    // The same, lit together with the chunks around it (by [dz + 1][dx + 1], null where there isn't one), with sun rays
+    // cast through the whole terrain
+    size_t BakeLighting(size_t maxTiles, const DisplayChunk* const surrounding[3][3], const TerrainLightmap::RayTest& occluded);
+    // Heights in a region have changed, here or in a chunk around it (in this chunk's grid coordinates)
+    void MarkLightingDirty(const GridRegion& region) { m_lightmap.MarkDirty(region.minX, region.minZ, region.maxX, region.maxZ); }
+    bool ExportLightmap(std::string& path) const;	//writes the baked lighting to <heightmap>_lightmap.dds
+
+    // Drainage analysis (see TerrainHydrology). It's only rerun when asked for after the heights have changed
+    void UpdateHydrology();
+    // Water depth, flow and watershed at a world space position (clamped to the terrain's edges)
+    TerrainHydrology::Sample QueryHydrology(float x, float z);
+    // Which analysis result (if any) is drawn over the terrain. The overlay follows the analysis as it's updated
+    void SetHydrologyOverlay(TerrainHydrology::Overlay overlay);
 
     void RefitBVH();
 
-	std::unique_ptr<DirectX::PrimitiveBatch<DirectX::VertexPositionNormalTexture>>  m_batch;
-	std::unique_ptr<DirectX::BasicEffect>       m_terrainEffect;
+    // Edits that haven't made it to disk yet (including a save that is still being written, or failed)
+    bool HasUnsavedChanges() const;
+    // Rough number of bytes (CPU and GPU) the chunk is holding on to
+    size_t GetMemoryUsage() const;
+    // World space (x, z) of the chunk's first vertex
+    const DirectX::XMFLOAT2& GetOrigin() const { return m_origin; }
 
-	ID3D11ShaderResourceView *					m_texture_diffuse;				//diffuse texture
+    const HeightMapWriter& GetHeightMapWriter() const { return m_heightMapWriter; }
+    // Patches/triangles drawn by the last RenderBatch
+    size_t GetSelectedPatchCount() const { return m_selectedPatches.size(); }
+    size_t GetSelectedTriangleCount() const { return m_selectedTriangles; }
+    ID3D11ShaderResourceView* GetSplatMapSRV() const { return m_splatMap.GetShaderResourceView(); }
+
+	std::unique_ptr<TerrainEffect>              m_terrainEffect;
+
+	ID3D11ShaderResourceView *					m_texture_diffuse = nullptr;	//diffuse texture
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_texture_splat[SplatMap::NUM_LAYERS];	//splat textures (null if missing)
 	Microsoft::WRL::ComPtr<ID3D11InputLayout>   m_terrainInputLayout;
 
-    bool XM_CALLCONV CursorIntersectsTerrain(DirectX::FXMVECTOR origin, long mouseX, long mouseY, D3D11_VIEWPORT viewport, DirectX::FXMMATRIX projection, DirectX::CXMMATRIX view, DirectX::CXMMATRIX world, DirectX::XMVECTOR& wsCoord) const;
+    // Height/normal of the terrain surface at a world space position (exact for the rendered triangles, clamped to the terrain's edges)
+    float SampleHeight(float x, float z) const;
+    DirectX::XMVECTOR SampleNormal(float x, float z) const;
+    // Batch version of SampleHeight (processes four positions at a time)
+    void SampleHeights(const float* xs, const float* zs, float* heights, size_t count) const;
+
+    // World space ray against the terrain (direction must be normalised)
+    bool XM_CALLCONV Intersects(DirectX::FXMVECTOR origin, DirectX::FXMVECTOR direction, DirectX::XMVECTOR& wsCoord) const;
+    // World space bounds of the terrain (kept up to date by RefreshRegion)
+    const DirectX::BoundingBox& GetBounds() const { return m_bvh.GetBounds(); }
 
 private:
-    void CalculateTerrainNormals();
+    void CalculateTerrainNormals(const GridRegion& region, const DisplayChunk* const neighbours[NEIGHBOUR_COUNT]);
+    // Recomposites the layers wherever they've changed. Returns the region whose heights changed
+    GridRegion CompositeLayers();
+    // Carves the paths into a tile of the composite (the procedural layers' generator)
+    void CarvePathTile(int minX, int minZ, int maxX, int maxZ, float* heights) const;
+    // Refreshes LOD node bounds and vertex morph targets after heights in a (grid coordinate) region have changed
+    void UpdateLodData(int minX, int minZ, int maxX, int maxZ);
+
+    float GetHeight(int x, int z) const { return m_terrainGeometry[(z * TERRAINRESOLUTION) + x].height; }
+    // Full world space position of a vertex (only the height is stored)
+    DirectX::XMVECTOR GetPosition(int index) const;
+    // Converts a world space position to the grid cell it lies in and its position within that cell ([0, 1])
+    void WorldToCell(float x, float z, int& cellX, int& cellZ, float& fracX, float& fracZ) const;
 	
-    std::vector<uint16_t> m_indices;
-    DirectX::VertexPositionNormalTexture m_terrainGeometry[NUM_VERTICES];
-    BYTE m_heightMap[NUM_VERTICES];
+    TerrainVertex m_terrainGeometry[NUM_VERTICES];
 
     BVH m_bvh;
 
+    // LOD selection, and the patches picked for the current frame
+    TerrainQuadtree m_quadtree;
+    std::vector<TerrainQuadtree::Patch> m_selectedPatches;
+    size_t m_selectedTriangles = 0;
+
+    // GPU copy of m_terrainGeometry, and the indices of every patch the quadtree can pick (these never change)
+    Microsoft::WRL::ComPtr<ID3D11Buffer> m_vertexBuffer;
+    Microsoft::WRL::ComPtr<ID3D11Buffer> m_indexBuffer;
+
+    // Vertices that have changed since they were last uploaded
+    DirtyRegionTracker m_dirtyVertices;
+    std::vector<DirtyRegionTracker::Range> m_uploadRanges;
+
+    HeightMapWriter m_heightMapWriter;
+
+    SplatMap m_splatMap;
+
+    TerrainLightmap m_lightmap;
+
+    TerrainLayerStack m_layers;
+    // What procedural layers carve (see CarvePaths)
+    const TerrainPaths* m_paths = nullptr;
+
+    TerrainHydrology m_hydrology;
+    TerrainHydrology::Overlay m_hydrologyOverlay = TerrainHydrology::OVERLAY_NONE;
+    // Heights have changed since the last analysis, and the overlay texture is behind the analysis
+    bool m_hydrologyDirty = true;
+    bool m_overlayDirty = false;
+    std::vector<uint32_t> m_overlayTexels;
+    Microsoft::WRL::ComPtr<ID3D11Texture2D>             m_overlayTexture;
+    Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>    m_overlaySRV;
+
+    // Heights have been edited since the last save
+    bool m_heightsModified = false;
+
     float	m_terrainHeightScale = 0.25f;	//convert our 0-256 terrain to 64
-    int		m_terrainSize = 512;				//size of terrain in metres
+    int		m_terrainSize = TERRAINSIZE;		//size of terrain in metres
     float   m_terrainPositionScalingFactor = m_terrainSize / (float) (TERRAINRESOLUTION - 1);	//factor we multiply the position by to convert it from its native resolution( 0- Terrain Resolution) to full scale size in metres dictated by m_Terrainsize
 
+    // World space (x, z) of vertex (0, 0). The chunk at grid (0, 0) is centered on the origin
+    DirectX::XMFLOAT2 m_origin = DirectX::XMFLOAT2(-0.5f * TERRAINSIZE, -0.5f * TERRAINSIZE);
+
 	std::string m_name;
 	int m_chunk_x_size_metres;
 	int m_chunk_y_size_metres;
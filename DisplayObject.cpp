@@ -4,15 +4,8 @@ DisplayObject::DisplayObject()
 {
 	m_model = NULL;
 	m_texture_diffuse = NULL;
-	m_orientation.x = 0.0f;
-	m_orientation.y = 0.0f;
-	m_orientation.z = 0.0f;
-	m_position.x = 0.0f;
-	m_position.y = 0.0f;
-	m_position.z = 0.0f;
-	m_scale.x = 0.0f;
-	m_scale.y = 0.0f;
-	m_scale.z = 0.0f;
+	m_parentID = 0;
+	m_transform = 0;
 	m_render = true;
 	m_wireframe = false;
 }
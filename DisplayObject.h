@@ -13,9 +13,8 @@ public:
 
 
 	int m_ID;
-	DirectX::SimpleMath::Vector3			m_position;
-	DirectX::SimpleMath::Vector3			m_orientation;
-	DirectX::SimpleMath::Vector3			m_scale;
+	int m_parentID;													//0 if the object isn't parented to another
+	uint32_t								m_transform;						//index of the position/orientation/scale and cached world matrix/bounds (see TransformArray)
 	bool									m_render;
 	bool									m_wireframe;
 };
@@ -0,0 +1,216 @@
+#include "EditHistory.h"
+
+using namespace DirectX;
+
+constexpr size_t EditHistory::DEFAULT_MEMORY_BUDGET;
+
+EditHistory::Transform EditHistory::Transform::Of(const SceneObject& object)
+{
+    return
+    {
+        XMFLOAT3(object.posX, object.posY, object.posZ),
+        XMFLOAT3(object.rotX, object.rotY, object.rotZ),
+        XMFLOAT3(object.scaX, object.scaY, object.scaZ)
+    };
+}
+
+void EditHistory::Transform::ApplyTo(SceneObject& object) const
+{
+    object.posX = position.x; object.posY = position.y; object.posZ = position.z;
+    object.rotX = rotation.x; object.rotY = rotation.y; object.rotZ = rotation.z;
+    object.scaX = scale.x; object.scaY = scale.y; object.scaZ = scale.z;
+}
+
+void EditHistory::Open(uint64_t mergeKey)
+{
+    if (IsOpen(mergeKey))
+        return;
+
+    Close();
+
+    m_open = true;
+    m_openEntryAdded = false;
+    m_openMergeKey = mergeKey;
+}
+
+void EditHistory::Close()
+{
+    if (!m_open)
+        return;
+
+    m_open = false;
+    m_openObjects.clear();
+
+    // Nothing was recorded into it otherwise
+    if (m_openEntryAdded)
+    {
+        m_openEntryAdded = false;
+        UpdateMemoryUsage(m_entries.back());
+        Trim();
+    }
+}
+
+void EditHistory::RecordObject(int id, const SceneObject* object)
+{
+    auto recorded = m_openObjects.find(id);
+    if (!m_open || recorded == m_openObjects.end())
+    {
+        Change& change = AddChange(Change::OBJECT, id);
+        if (object)
+            change.object.reset(new SceneObject(*object));
+
+        AddToOpenEntry(GetMemoryUsage(change));
+        return;
+    }
+
+    // Only the transform was recorded, as it was before the entry. The rest hasn't changed since, so the whole object
+    // as it was is the object as it is now, with that transform
+    Change& change = m_entries.back().changes[recorded->second];
+    if (change.type == Change::OBJECT_TRANSFORM && object)
+    {
+        const size_t memoryUsage = GetMemoryUsage(change);
+
+        change.type = Change::OBJECT;
+        change.object.reset(new SceneObject(*object));
+        change.transform.ApplyTo(*change.object);
+
+        AddToOpenEntry(GetMemoryUsage(change) - memoryUsage);
+    }
+}
+
+void EditHistory::RecordTransform(int id, const Transform& transform)
+{
+    if (m_open && m_openObjects.count(id) != 0)
+        return;
+
+    Change& change = AddChange(Change::OBJECT_TRANSFORM, id);
+    change.transform = transform;
+    AddToOpenEntry(GetMemoryUsage(change));
+}
+
+void EditHistory::RecordTerrainTile(ChunkManager::TerrainTile&& tile)
+{
+    Change change;
+    change.type = Change::TERRAIN_TILE;
+    change.id = tile.layer;
+    change.tile.reset(new ChunkManager::TerrainTile(std::move(tile)));
+
+    const size_t memoryUsage = GetMemoryUsage(change);
+    GetOpenEntry().changes.push_back(std::move(change));
+    AddToOpenEntry(memoryUsage);
+}
+
+void EditHistory::RecordTerrainLayer(size_t layer, bool visible)
+{
+    Change change;
+    change.type = Change::TERRAIN_LAYER;
+    change.id = int(layer);
+    change.visible = visible;
+
+    const size_t memoryUsage = GetMemoryUsage(change);
+    GetOpenEntry().changes.push_back(std::move(change));
+    AddToOpenEntry(memoryUsage);
+}
+
+void EditHistory::Clear()
+{
+    m_entries.clear();
+    m_numDone = 0;
+    m_open = false;
+    m_openEntryAdded = false;
+    m_openObjects.clear();
+    m_memoryUsage = 0;
+}
+
+EditHistory::Entry& EditHistory::GetOpenEntry()
+{
+    if (!m_open)
+        Open();
+
+    if (!m_openEntryAdded)
+    {
+        // Forget what could have been redone
+        for (size_t i = m_numDone; i < m_entries.size(); ++i)
+            m_memoryUsage -= m_entries[i].memoryUsage;
+        m_entries.erase(m_entries.begin() + m_numDone, m_entries.end());
+
+        m_entries.push_back({ {}, sizeof(Entry) });
+        m_memoryUsage += sizeof(Entry);
+        m_numDone = m_entries.size();
+        m_openEntryAdded = true;
+    }
+
+    return m_entries.back();
+}
+
+EditHistory::Change& EditHistory::AddChange(Change::Type type, int id)
+{
+    std::vector<Change>& changes = GetOpenEntry().changes;
+    m_openObjects[id] = changes.size();
+
+    changes.emplace_back();
+    changes.back().type = type;
+    changes.back().id = id;
+    return changes.back();
+}
+
+void EditHistory::AddToOpenEntry(size_t memoryUsage)
+{
+    m_entries.back().memoryUsage += memoryUsage;
+    m_memoryUsage += memoryUsage;
+
+    // The open entry is the last one done, so it stays
+    Trim();
+}
+
+void EditHistory::UpdateMemoryUsage(Entry& entry)
+{
+    size_t memoryUsage = sizeof(Entry);
+    for (const Change& change : entry.changes)
+        memoryUsage += GetMemoryUsage(change);
+
+    m_memoryUsage = m_memoryUsage - entry.memoryUsage + memoryUsage;
+    entry.memoryUsage = memoryUsage;
+}
+
+void EditHistory::Trim()
+{
+    while (m_memoryUsage > m_memoryBudget)
+    {
+        // The last entry done is kept, however big. Undone entries go from the other end, as each builds on the ones
+        // before it
+        if (m_numDone > 1)
+        {
+            m_memoryUsage -= m_entries.front().memoryUsage;
+            m_entries.pop_front();
+            --m_numDone;
+        }
+        else if (m_numDone < m_entries.size())
+        {
+            m_memoryUsage -= m_entries.back().memoryUsage;
+            m_entries.pop_back();
+        }
+        else
+            break;
+    }
+}
+
+size_t EditHistory::GetMemoryUsage(const Change& change)
+{
+    size_t memoryUsage = sizeof(Change);
+
+    if (change.object)
+    {
+        const SceneObject& object = *change.object;
+        memoryUsage += sizeof(SceneObject) + object.model_path.capacity() + object.tex_diffuse_path.capacity() +
+            object.collision_mesh.capacity() + object.audio_path.capacity() + object.name.capacity();
+    }
+
+    if (change.tile)
+    {
+        memoryUsage += sizeof(ChunkManager::TerrainTile) + change.tile->heights.capacity() * sizeof(float) +
+            change.tile->weights.capacity() * sizeof(PackedVector::XMUBYTEN4);
+    }
+
+    return memoryUsage;
+}
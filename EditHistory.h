@@ -0,0 +1,154 @@
+#pragma once
+#include "ChunkManager.h"
+#include "SceneObject.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Undo/redo journal. Each entry is one step of undo, made up of the changes an edit made: to objects (moves only keep
+// the transform, anything else the whole object), to tiles of the terrain (see ChunkManager::TerrainTile) and to
+// whether terrain layers are shown. A change holds the state on the other side of it, so undoing or redoing an entry
+// swaps that with what's in the scene (touching nothing the entry didn't change), leaving it ready to go back again.
+// Changes are recorded into the open entry before they're made. Opening an entry with the same (non-zero) merge key as
+// the open one carries on with it, so a whole drag, brush stroke or run of edits in a dialog is undone in one go.
+// Once the entries take up more than the memory budget, the oldest are forgotten (the last one done never is).
+class EditHistory
+{
+public:
+    struct Transform
+    {
+        DirectX::XMFLOAT3 position, rotation, scale;
+
+        static Transform Of(const SceneObject& object);
+        void ApplyTo(SceneObject& object) const;
+    };
+
+    struct Change
+    {
+        enum Type
+        {
+            OBJECT = 0,
+            OBJECT_TRANSFORM,
+            TERRAIN_TILE,
+            TERRAIN_LAYER
+        } type;
+
+        // Object ID, or terrain layer
+        int id;
+
+        // The state on the other side of the change
+        Transform transform;
+        // Null if the object doesn't exist there
+        std::unique_ptr<SceneObject> object;
+        std::unique_ptr<ChunkManager::TerrainTile> tile;
+        bool visible = false;
+    };
+
+    static constexpr size_t DEFAULT_MEMORY_BUDGET = 64 * 1024 * 1024;
+
+    explicit EditHistory(size_t memoryBudget = DEFAULT_MEMORY_BUDGET) : m_memoryBudget(memoryBudget) {}
+
+    // The entry only goes in once something is recorded into it, which is also when whatever could have been redone
+    // is forgotten
+    void Open(uint64_t mergeKey = 0);
+    void Close();
+    bool IsOpen() const { return m_open; }
+    bool IsOpen(uint64_t mergeKey) const { return m_open && mergeKey != 0 && m_openMergeKey == mergeKey; }
+
+    // Each records the state before a change (opening an entry if there isn't one). Only the first record of an object
+    // in an entry counts, except that recording the whole object takes over from a transform
+    void RecordObject(int id, const SceneObject* object);
+    void RecordTransform(int id, const Transform& transform);
+    void RecordTerrainTile(ChunkManager::TerrainTile&& tile);
+    void RecordTerrainLayer(size_t layer, bool visible);
+
+    // swap(change) swaps the change's state with the scene's. Closes the open entry first. canSwap(change) is asked
+    // about every change of the entry first, and if any can't be swapped, nothing is (and the journal is left as it
+    // is). Returns false if there was nothing to undo/redo, or it couldn't be
+    template <typename CanSwap, typename Swap>
+    bool Undo(CanSwap canSwap, Swap swap)
+    {
+        Close();
+        if (m_numDone == 0 || !CanSwapAll(m_entries[m_numDone - 1], canSwap))
+            return false;
+
+        // Last change first
+        Entry& entry = m_entries[--m_numDone];
+        for (auto change = entry.changes.rbegin(); change != entry.changes.rend(); ++change)
+            swap(*change);
+
+        UpdateMemoryUsage(entry);
+        Trim();
+        return true;
+    }
+
+    template <typename CanSwap, typename Swap>
+    bool Redo(CanSwap canSwap, Swap swap)
+    {
+        Close();
+        if (m_numDone == m_entries.size() || !CanSwapAll(m_entries[m_numDone], canSwap))
+            return false;
+
+        Entry& entry = m_entries[m_numDone++];
+        for (Change& change : entry.changes)
+            swap(change);
+
+        UpdateMemoryUsage(entry);
+        Trim();
+        return true;
+    }
+
+    void Clear();
+
+    bool CanUndo() const { return m_numDone > 0; }
+    bool CanRedo() const { return m_numDone < m_entries.size(); }
+    size_t GetMemoryUsage() const { return m_memoryUsage; }
+
+private:
+    struct Entry
+    {
+        std::vector<Change> changes;
+        size_t memoryUsage;
+    };
+
+    template <typename CanSwap>
+    static bool CanSwapAll(const Entry& entry, CanSwap canSwap)
+    {
+        for (const Change& change : entry.changes)
+            if (!canSwap(change))
+                return false;
+
+        return true;
+    }
+
+    // The open entry, putting it in if it isn't yet (opening one if there isn't one)
+    Entry& GetOpenEntry();
+    Change& AddChange(Change::Type type, int id);
+
+    // Counts a change recorded into the open entry (as it's recorded, so the budget holds while the entry is open)
+    void AddToOpenEntry(size_t memoryUsage);
+    // Worked out again as entries are closed, undone and redone
+    void UpdateMemoryUsage(Entry& entry);
+    // Forgets the oldest entries (or, once none are left, the newest undone ones) until it's back within budget
+    void Trim();
+
+    static size_t GetMemoryUsage(const Change& change);
+
+    std::deque<Entry> m_entries;
+    // Entries before this are done (and can be undone), the rest have been undone (and can be redone). The open entry,
+    // once it's in, is always the last, and done
+    size_t m_numDone = 0;
+    bool m_open = false;
+    bool m_openEntryAdded = false;
+    uint64_t m_openMergeKey = 0;
+
+    // Each object's change in the open entry
+    std::unordered_map<int, size_t> m_openObjects;
+
+    size_t m_memoryBudget;
+    size_t m_memoryUsage = 0;
+};
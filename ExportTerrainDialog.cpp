@@ -0,0 +1,18 @@
+#include "ExportTerrainDialog.h"
+#include "stdafx.h"
+
+IMPLEMENT_DYNAMIC(ExportTerrainDialog, CDialogEx)
+
+ExportTerrainDialog::ExportTerrainDialog(float maxError, CWnd* parent)
+    :   CDialogEx(IDD_DIALOG_EXPORTTERRAIN, parent),
+        m_maxError(maxError)
+{
+}
+
+void ExportTerrainDialog::DoDataExchange(CDataExchange* pDX)
+{
+    CDialogEx::DoDataExchange(pDX);
+
+    DDX_Text(pDX, IDC_EDIT_MAXERROR, m_maxError);
+    DDV_MinMaxFloat(pDX, m_maxError, 0.f, 1000.f);
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "afxdialogex.h"
+#include "afxwin.h"
+#include "resource.h"
+
+// Modal dialog asking for the settings of a simplified terrain export
+class ExportTerrainDialog : public CDialogEx
+{
+    DECLARE_DYNAMIC(ExportTerrainDialog)
+
+public:
+    explicit ExportTerrainDialog(float maxError, CWnd* parent = nullptr);
+
+#ifdef AFX_DESIGN_TIME
+    enum { IDD = IDD_DIALOG_EXPORTTERRAIN };
+#endif
+
+    float GetMaxError() const { return m_maxError; }
+
+protected:
+    virtual void DoDataExchange(CDataExchange* pDX) override;
+
+private:
+    float m_maxError;
+};
@@ -54,6 +54,8 @@ void Game::Initialize(HWND window, int width, int height)
 	m_deviceResources->CreateDeviceResources();
 	CreateDeviceDependentResources();
 
+	m_chunkManager.Initialise(m_deviceResources.get());
+
 	m_deviceResources->CreateWindowSizeDependentResources();
 	CreateWindowSizeDependentResources();
 
@@ -175,9 +177,9 @@ void Game::Update(DX::StepTimer const& timer)
 
 	m_batchEffect->SetView(m_view);
 	m_batchEffect->SetWorld(SimpleMath::Matrix::Identity);
-	m_displayChunk.m_terrainEffect->SetView(m_view);
-    m_displayChunk.m_terrainEffect->SetProjection(m_projection);
-	m_displayChunk.m_terrainEffect->SetWorld(SimpleMath::Matrix::Identity);
+
+	//stream terrain chunks in/out around the camera
+	m_chunkManager.Update(m_camera.GetPosition());
 
 
 	#ifdef DXTK_AUDIO
@@ -210,7 +212,8 @@ void Game::Update(DX::StepTimer const& timer)
 
 void Game::RenderSceneGraph(ID3D11DeviceContext * context, FXMMATRIX view, CXMMATRIX projection)
 {
-	const XMVECTOR zero = XMVectorZero();
+    // Only the objects that have moved since the last frame
+    m_transforms.UpdateDirty();
 
     for (auto itModel = m_displayList.cbegin(); itModel != m_displayList.cend(); ++itModel)
     {
@@ -218,21 +221,13 @@ void Game::RenderSceneGraph(ID3D11DeviceContext * context, FXMMATRIX view, CXMMA
         assert(model != nullptr);
 
         m_deviceResources->PIXBeginEvent(L"Draw model");
-        const XMVECTORF32 scale = { itModel->m_scale.x, itModel->m_scale.y, itModel->m_scale.z };
-        const XMVECTORF32 translate = { itModel->m_position.x, itModel->m_position.y, itModel->m_position.z };
-
-        //convert degrees into radians for rotation matrix
-        XMVECTOR rotate = SimpleMath::Quaternion::CreateFromYawPitchRoll(XMConvertToRadians(itModel->m_orientation.y),
-                                                                         XMConvertToRadians(itModel->m_orientation.x),
-                                                                         XMConvertToRadians(itModel->m_orientation.z));
-
-        XMMATRIX local = m_world * XMMatrixTransformation(zero, SimpleMath::Quaternion::Identity, scale, zero, rotate, translate);
+        XMMATRIX local = m_world * m_transforms.GetWorld(itModel->m_transform);
 
         // First, render object normally
         model->Draw(context, *m_states, local, view, projection, false);	// second to last variable in draw,  make TRUE for wireframe
 
         // Render selected objects to the stencil buffer and to a separate render target in a flat colour
-        if (std::find(m_selectionIDs.cbegin(), m_selectionIDs.cend(), itModel->m_ID) != m_selectionIDs.cend())
+        if (m_selection != nullptr && m_selection->Contains(itModel->m_ID))
             RenderSelectedObject(context, *model, local, view, projection);
 
         m_deviceResources->PIXEndEvent();
@@ -315,7 +310,7 @@ void Game::PostProcess(ID3D11DeviceContext* context)
     }
 
     // Selection highlighting
-    if (!m_selectionIDs.empty())
+    if (m_selection != nullptr && !m_selection->empty())
     {
         RECT quarterRect{ 0, 0, viewport.Width / 4, viewport.Height / 4 };
         D3D11_VIEWPORT quarterViewport{ 0, 0, quarterRect.right, quarterRect.bottom, viewport.MinDepth, viewport.MaxDepth };
@@ -394,8 +389,8 @@ void Game::Render()
     ID3D11SamplerState* samplers[] = { m_states->AnisotropicWrap() };
     context->PSSetSamplers(0, 1, samplers);
 
-    //Render the batch,  This is handled in the Display chunk becuase it has the potential to get complex
-    m_displayChunk.RenderBatch(context, m_view, m_projection);
+    //Render the batches,  This is handled in the Display chunks becuase it has the potential to get complex
+    m_chunkManager.Render(context, m_view, m_projection);
 
     context->OMSetDepthStencilState(m_states->DepthDefault(), 0);
 
@@ -423,9 +418,40 @@ void Game::Render()
 	}
     
     // HUD
+    size_t terrainPatches = 0, terrainTriangles = 0;
+    m_chunkManager.ForEachLoadedChunk([&](const DisplayChunk& chunk)
+    {
+        terrainPatches += chunk.GetSelectedPatchCount();
+        terrainTriangles += chunk.GetSelectedTriangleCount();
+    });
+
     m_sprites->Begin();
     std::wstring var =  L"FPS: " + std::to_wstring(m_timer.GetFramesPerSecond()) +
-                        L"\nFrame time: " + std::to_wstring(m_timer.GetElapsedSeconds() * 1000) + L"ms";
+                        L"\nFrame time: " + std::to_wstring(m_timer.GetElapsedSeconds() * 1000) + L"ms" +
+                        L"\nTerrain: " + std::to_wstring(terrainPatches) + L" patches, " +
+                        std::to_wstring(terrainTriangles) + L" triangles" +
+                        L"\nChunks: " + std::to_wstring(m_chunkManager.GetLoadedChunkCount()) + L"/" + std::to_wstring(m_chunkManager.GetChunkCount()) +
+                        L" loaded (" + std::to_wstring(m_chunkManager.GetPendingChunkCount()) + L" pending, " +
+                        std::to_wstring(m_chunkManager.GetMemoryUsage() / (1024 * 1024)) + L"MB)";
+
+    const std::vector<ChunkManager::TerrainLayer>& layers = m_chunkManager.GetTerrainLayers();
+    if (m_showTerrainBrush && m_chunkManager.GetSelectedTerrainLayer() < layers.size())
+    {
+        const ChunkManager::TerrainLayer& layer = layers[m_chunkManager.GetSelectedTerrainLayer()];
+        var += L"\nLayer: " + std::wstring(layer.name.begin(), layer.name.end()) + (layer.visible ? L"" : L" (hidden)");
+    }
+
+    if (m_hoveredID != -1)
+        var += L"\nObject: " + std::to_wstring(m_hoveredID);
+
+    TerrainHydrology::Sample hydrology;
+    if (m_chunkManager.GetHydrologyOverlay() != TerrainHydrology::OVERLAY_NONE && m_showTerrainBrush &&
+        m_chunkManager.QueryHydrology(m_brushPosition.x, m_brushPosition.z, hydrology))
+    {
+        var += L"\nWater depth: " + std::to_wstring(hydrology.waterDepth) + L"m, drainage area: " +
+               std::to_wstring(int(hydrology.drainageArea)) + L"m^2, watershed: " + std::to_wstring(hydrology.watershed);
+    }
+
     m_font->DrawString(m_sprites.get(), var.c_str(), XMFLOAT2(10, 10), Colors::Yellow);
     m_sprites->End();
 
@@ -505,95 +531,6 @@ void XM_CALLCONV Game::DrawGrid(FXMVECTOR xAxis, FXMVECTOR yAxis, FXMVECTOR orig
 	m_deviceResources->PIXEndEvent();
 }
 
-bool XM_CALLCONV Game::CreateScreenSpaceBoundingBox(const DirectX::BoundingBox & modelSpaceBB, FXMMATRIX local, DirectX::BoundingBox& screenSpaceBB) const
-{
-	const auto viewport = m_deviceResources->GetScreenViewport();
-
-	const XMVECTOR center = XMLoadFloat3(&modelSpaceBB.Center);
-	const XMVECTOR extents = XMLoadFloat3(&modelSpaceBB.Extents);
-
-	// project all corners to screen space
-	static const XMVECTOR offsets[8] =
-	{
-		XMVectorSet(-1.f, -1.f, -1.f, 1.f),		// top left front
-		XMVectorSet(-1.f, -1.f,  1.f, 1.f),		// top left back
-		XMVectorSet(-1.f,  1.f, -1.f, 1.f),		// bottom left front
-		XMVectorSet(-1.f,  1.f,  1.f, 1.f),		// bottom left back
-		XMVectorSet( 1.f,  1.f,  1.f, 1.f),		// top right front
-		XMVectorSet( 1.f,  1.f, -1.f, 1.f),		// top right back
-		XMVectorSet( 1.f, -1.f,  1.f, 1.f),		// bottom right front
-		XMVectorSet( 1.f, -1.f, -1.f, 1.f)		// bottom right back
-	};
-
-	m_deviceResources->PIXBeginEvent(L"Selection box picking: XMVector3ProjectStream");
-
-	// calculate corners
-	XMFLOAT3 cornerStream[8];
-	for (int i = 0; i < 8; ++i)
-	{
-		const XMVECTOR corner = center + (extents * offsets[i]);
-		XMStoreFloat3(&cornerStream[i], corner);
-	}
-
-	// do the actual projection
-	XMFLOAT3 projectedCornerStream[8];
-	XMVector3ProjectStream(projectedCornerStream, sizeof(XMFLOAT3), cornerStream, sizeof(XMFLOAT3), 8,
-						   0.f, 0.f, viewport.Width, viewport.Height, 0.f, 1.f, m_projection, m_view, local);
-
-	std::vector<XMVECTOR> corners(8);
-    std::transform(projectedCornerStream, projectedCornerStream + 8, corners.begin(),
-    [](const XMFLOAT3& corner)
-    {
-        return XMLoadFloat3(&corner);
-    });
-
-	m_deviceResources->PIXEndEvent();
-
-	// Check if projected corners are within viewport range ([0, viewport.Width - 1], [0, viewport.Height - 1], [0, 1])
-	// NOTE: Could be solved earlier/more cleanly with frustum culling
-	const XMVECTOR lowBounds = XMVectorZero();
-	const XMVECTOR highBounds = XMVectorSet(viewport.Width, viewport.Height, 1.f, 0.f);
-	
-	corners.erase(std::remove_if(corners.begin(), corners.end(),
-		[lowBounds, highBounds] (FXMVECTOR corner)
-	{
-		bool inLowBounds = XMVector3GreaterOrEqual(corner, lowBounds);
-		bool inHighBounds = XMVector3Less(corner, highBounds);
-
-		return !(inLowBounds && inHighBounds);
-	}), corners.end());
-
-	// Guess we're not making a BB then
-	if (corners.empty())
-		return false;
-
-	// Calculate min coordinates
-	XMVECTOR min = XMVectorSplatInfinity();
-	for (int i = 0; i < corners.size(); ++i)
-		min = XMVectorMin(min, corners[i]);
-
-	// Calculate max coordinates
-	XMVECTOR max = XMVectorZero();
-	for (int i = 0; i < corners.size(); ++i)
-		max = XMVectorMax(max, corners[i]);
-
-	// Create screen-space bounding box
-	screenSpaceBB.CreateFromPoints(screenSpaceBB, min, max);
-
-	return true;
-}
-
-auto Game::GetDisplayListIteratorFromID(int id)
-{
-    return std::find_if(m_displayList.begin(), m_displayList.end(),
-                        [&](const auto& object) {return object.m_ID == id; });
-}
-
-auto Game::GetDisplayListIteratorFromID(int id) const
-{
-    return std::find_if(m_displayList.cbegin(), m_displayList.cend(),
-                        [&](const auto& object) {return object.m_ID == id; });
-}
 #pragma endregion
 
 #pragma region Message Handlers
@@ -636,29 +573,99 @@ void Game::BuildDisplayList(std::vector<SceneObject> * SceneGraph)
 
     // clear out any old data if this is a rebuild
     if (!m_displayList.empty())
-    {
-        m_displayList.clear();
-        m_highlightEffectLayouts.clear();
-    }
+        ClearDisplayList();
 
 	// Create a visual representation of every scene object
     std::for_each(SceneGraph->cbegin(), SceneGraph->cend(), std::bind(&Game::AddDisplayListItem, this, _1));
 }
 
-void Game::BuildDisplayChunk(ChunkObject * SceneChunk)
+void Game::ClearDisplayList()
 {
-	//populate our local DISPLAYCHUNK with all the chunk info we need from the object stored in toolmain
-	//which, to be honest, is almost all of it. Its mostly rendering related info so...
-	m_displayChunk.PopulateChunkData(SceneChunk);		//migrate chunk data
-	m_displayChunk.LoadHeightMap(m_deviceResources->GetD3DDevice());
-	m_displayChunk.InitialiseBatch();
-    m_displayChunk.InitialiseRendering(m_deviceResources.get());
-	m_displayChunk.m_terrainEffect->SetProjection(m_projection);
+    m_displayList.clear();
+    m_transforms.Clear();
+    m_transformObjectIDs.clear();
+    m_childIDs.clear();
+    m_hoveredID = -1;
+    m_previewStale = true;
+    m_highlightEffectLayouts.clear();
+    // The layouts go with the models
+    m_modelCache.clear();
+}
+
+void Game::BuildDisplayChunks(const std::vector<ChunkObject>& chunks, const std::string& databasePath)
+{
+	//the chunk manager builds a DISPLAYCHUNK from each chunk object (and loads its objects) once the camera gets near it
+	m_chunkManager.SetChunks(chunks, databasePath);
+}
+
+bool Game::SaveDisplayChunks()
+{
+	bool succeeded = true;
+	m_chunkManager.ForEachLoadedChunk([&](DisplayChunk& chunk)
+	{
+		chunk.SaveSplatMap();						//painted splat tiles are small, so these are written straight away
+		succeeded = chunk.SaveHeightMap() && succeeded;	//save heightmap to file.
+	});
+
+	return succeeded;
+}
+
+HeightMapWriter::State Game::GetTerrainSaveState(float& progress) const
+{
+	// Still writing if any chunk is, otherwise failed if any chunk failed
+	HeightMapWriter::State state = HeightMapWriter::STATE_IDLE;
+	float totalProgress = 0.f;
+	int numChunks = 0;
+
+	m_chunkManager.ForEachLoadedChunk([&](const DisplayChunk& chunk)
+	{
+		const HeightMapWriter& writer = chunk.GetHeightMapWriter();
+		if (writer.GetState() == HeightMapWriter::STATE_IDLE)
+			return;
+
+		switch (writer.GetState())
+		{
+			case HeightMapWriter::STATE_WRITING:
+				state = HeightMapWriter::STATE_WRITING;
+				break;
+			case HeightMapWriter::STATE_FAILED:
+				if (state != HeightMapWriter::STATE_WRITING)
+					state = HeightMapWriter::STATE_FAILED;
+				break;
+			default:
+				if (state == HeightMapWriter::STATE_IDLE)
+					state = HeightMapWriter::STATE_SUCCEEDED;
+				break;
+		}
+
+		totalProgress += writer.GetProgress();
+		++numChunks;
+	});
+
+	progress = (numChunks > 0 ? totalProgress / numChunks : 0.f);
+	return state;
 }
 
-void Game::SaveDisplayChunk(ChunkObject * SceneChunk)
+bool Game::ExportSimplifiedTerrain(float maxError, std::string& paths)
 {
-	m_displayChunk.SaveHeightMap();			//save heightmap to file.
+	bool succeeded = true;
+	paths.clear();
+
+	m_chunkManager.ForEachLoadedChunk([&](DisplayChunk& chunk)
+	{
+		std::string path;
+		succeeded = chunk.ExportSimplifiedMesh(maxError, path) && succeeded;
+
+		paths += (paths.empty() ? "" : "\n") + path;
+
+		// The baked lighting goes along with the mesh (finishing off any tiles still waiting on a rebake)
+		chunk.BakeLighting();
+		succeeded = chunk.ExportLightmap(path) && succeeded;
+
+		paths += "\n" + path;
+	});
+
+	return succeeded;
 }
 
 bool Game::AddDisplayListItem(const SceneObject & sceneObject)
@@ -666,38 +673,121 @@ bool Game::AddDisplayListItem(const SceneObject & sceneObject)
     auto device = m_deviceResources->GetD3DDevice();
     auto context = m_deviceResources->GetD3DDeviceContext();
 
+    // Replacing an object that's already there
+    RemoveDisplayListItem(sceneObject.ID);
+
+    m_previewStale = true;
+
     //create a temp display object that we will populate then append to the display list.
     DisplayObject newDisplayObject;
 
     newDisplayObject.m_ID = sceneObject.ID;
 
-    //load model
-    std::wstring modelwstr = StringToWCHART(sceneObject.model_path);							//convect string to Wchar
-    newDisplayObject.m_model = Model::CreateFromCMO(device, modelwstr.c_str(), *m_fxFactory, true);	//get DXSDK to load model "False" for LH coordinate system (maya)
+    //Load Texture (each file only once)
+    Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>& texture = m_textureCache[sceneObject.tex_diffuse_path];
+    if (!texture)
+    {
+        std::wstring texturewstr = StringToWCHART(sceneObject.tex_diffuse_path);								//convect string to Wchar
+        HRESULT rs;
+        rs = CreateDDSTextureFromFile(device, texturewstr.c_str(), nullptr, texture.ReleaseAndGetAddressOf());	//load tex into Shader resource
 
-                                                                                                    //Load Texture
-    std::wstring texturewstr = StringToWCHART(sceneObject.tex_diffuse_path);								//convect string to Wchar
-    HRESULT rs;
-    rs = CreateDDSTextureFromFile(device, texturewstr.c_str(), nullptr, &newDisplayObject.m_texture_diffuse);	//load tex into Shader resource
+                                                                                                                    //if texture fails.  load error default
+        if (rs)
+        {
+            CreateDDSTextureFromFile(device, L"database/data/Error.dds", nullptr, texture.ReleaseAndGetAddressOf());	//load tex into Shader resource
+        }
+    }
+    newDisplayObject.m_texture_diffuse = texture.Get();
 
-                                                                                                                //if texture fails.  load error default
-    if (rs)
+    //load model, unless another object already has it with the same texture
+    std::shared_ptr<Model>& model = m_modelCache[std::make_pair(sceneObject.model_path, sceneObject.tex_diffuse_path)];
+    newDisplayObject.m_model = model;
+    if (!model)
     {
-        CreateDDSTextureFromFile(device, L"database/data/Error.dds", nullptr, &newDisplayObject.m_texture_diffuse);	//load tex into Shader resource
+        std::wstring modelwstr = StringToWCHART(sceneObject.model_path);							//convect string to Wchar
+        model = Model::CreateFromCMO(device, modelwstr.c_str(), *m_fxFactory, true);	//get DXSDK to load model "False" for LH coordinate system (maya)
+        newDisplayObject.m_model = model;
+
+        //apply new texture to models effect
+        newDisplayObject.m_model->UpdateEffects([&](IEffect* effect) //This uses a Lambda function,  if you dont understand it: Look it up.
+        {
+            auto lights = dynamic_cast<BasicEffect*>(effect);
+            if (lights)
+            {
+                lights->SetTexture(newDisplayObject.m_texture_diffuse);
+            }
+        });
+
+        CreateHighlightInputLayouts(*model);
     }
 
-    //apply new texture to models effect
-    newDisplayObject.m_model->UpdateEffects([&](IEffect* effect) //This uses a Lambda function,  if you dont understand it: Look it up.
+    // Model-space bounds of the whole model, for the world-space bounds worked out along with the world matrix
+    BoundingBox modelBB(XMFLOAT3(0.f, 0.f, 0.f), XMFLOAT3(0.f, 0.f, 0.f));
+    for (auto mit = newDisplayObject.m_model->meshes.cbegin(); mit != newDisplayObject.m_model->meshes.cend(); ++mit)
     {
-        auto lights = dynamic_cast<BasicEffect*>(effect);
-        if (lights)
+        if (mit == newDisplayObject.m_model->meshes.cbegin())
+            modelBB = (*mit)->boundingBox;
+        else
+            BoundingBox::CreateMerged(modelBB, modelBB, (*mit)->boundingBox);
+    }
+
+    //set position, orientation and scale
+    newDisplayObject.m_transform = m_transforms.Add(XMFLOAT3(sceneObject.posX, sceneObject.posY, sceneObject.posZ),
+                                                    XMFLOAT3(sceneObject.rotX, sceneObject.rotY, sceneObject.rotZ),
+                                                    XMFLOAT3(sceneObject.scaX, sceneObject.scaY, sceneObject.scaZ),
+                                                    modelBB);
+
+    if (m_transformObjectIDs.size() <= newDisplayObject.m_transform)
+        m_transformObjectIDs.resize(newDisplayObject.m_transform + 1, -1);
+    m_transformObjectIDs[newDisplayObject.m_transform] = sceneObject.ID;
+
+    //set wireframe / render flags
+    newDisplayObject.m_render = sceneObject.editor_render;
+    newDisplayObject.m_wireframe = sceneObject.editor_wireframe;
+
+    m_displayList.Insert(newDisplayObject);
+
+    // Slot it into the hierarchy: under its parent, and above any of its children that were added before it
+    DisplayObject* displayObject = m_displayList.Find(sceneObject.ID);
+    SetDisplayListItemParent(*displayObject, sceneObject.parent_id);
+
+    auto children = m_childIDs.find(sceneObject.ID);
+    if (children != m_childIDs.end())
+    {
+        for (int childID : children->second)
         {
-            lights->SetTexture(newDisplayObject.m_texture_diffuse);
+            if (const DisplayObject* child = m_displayList.Find(childID))
+                m_transforms.SetParent(child->m_transform, displayObject->m_transform);
         }
-    });
+    }
 
+    return true;
+}
+
+void Game::UpdateDisplayListItem(const SceneObject & sceneObject)
+{
+    DisplayObject* displayObject = m_displayList.Find(sceneObject.ID);
+
+    if (!displayObject)
+        return;
+
+    if (displayObject->m_parentID != sceneObject.parent_id)
+        SetDisplayListItemParent(*displayObject, sceneObject.parent_id);
+
+    m_previewStale = true;
+
+    // The world matrix and bounds are only worked out again (next time they're needed) if anything's changed.
+    // Position, orientation and scale are relative to the parent, so its children move along with it
+    m_transforms.Set(displayObject->m_transform,
+                     XMFLOAT3(sceneObject.posX, sceneObject.posY, sceneObject.posZ),
+                     XMFLOAT3(sceneObject.rotX, sceneObject.rotY, sceneObject.rotZ),
+                     XMFLOAT3(sceneObject.scaX, sceneObject.scaY, sceneObject.scaZ));
+}
+
+void Game::CreateHighlightInputLayouts(const Model& model)
+{
     // Create input layout for the selection highlight effect
-    for (auto mit = newDisplayObject.m_model->meshes.cbegin(); mit != newDisplayObject.m_model->meshes.cend(); ++mit)
+    for (auto mit = model.meshes.cbegin(); mit != model.meshes.cend(); ++mit)
     {
         auto mesh = mit->get();
         assert(mesh != 0);
@@ -714,185 +804,379 @@ bool Game::AddDisplayListItem(const SceneObject & sceneObject)
             m_highlightEffectLayouts[mesh->name].emplace_back(il);
         }
     }
+}
 
-    //set position
-    newDisplayObject.m_position.x = sceneObject.posX;
-    newDisplayObject.m_position.y = sceneObject.posY;
-    newDisplayObject.m_position.z = sceneObject.posZ;
+bool Game::RemoveDisplayListItem(int id)
+{
+    // TODO: Do something about the input layouts as well--if the last of a mesh type has been deleted,
+    //       perhaps that input layout (for highlight effect) should be deleted also?
+    DisplayObject* displayObject = m_displayList.Find(id);
+    if (!displayObject)
+        return false;
 
-    //setorientation
-    newDisplayObject.m_orientation.x = sceneObject.rotX;
-    newDisplayObject.m_orientation.y = sceneObject.rotY;
-    newDisplayObject.m_orientation.z = sceneObject.rotZ;
+    // Its children are left in world space (until it comes back)
+    auto children = m_childIDs.find(id);
+    if (children != m_childIDs.end())
+    {
+        for (int childID : children->second)
+        {
+            if (const DisplayObject* child = m_displayList.Find(childID))
+                m_transforms.SetParent(child->m_transform, TransformArray::NO_PARENT);
+        }
+    }
 
-    //set scale
-    newDisplayObject.m_scale.x = sceneObject.scaX;
-    newDisplayObject.m_scale.y = sceneObject.scaY;
-    newDisplayObject.m_scale.z = sceneObject.scaZ;
+    SetDisplayListItemParent(*displayObject, 0);
 
-    //set wireframe / render flags
-    newDisplayObject.m_render = sceneObject.editor_render;
-    newDisplayObject.m_wireframe = sceneObject.editor_wireframe;
+    m_transforms.Remove(displayObject->m_transform);
+    m_transformObjectIDs[displayObject->m_transform] = -1;
 
-    m_displayList.push_back(newDisplayObject);
+    if (m_hoveredID == id)
+        m_hoveredID = -1;
 
+    m_previewStale = true;
 
+    return m_displayList.Remove(id);
+}
+
+bool Game::GetDisplayListItemTransform(int id, XMFLOAT3& position, XMFLOAT3& rotation, XMFLOAT3& scale) const
+{
+    const DisplayObject* displayObject = m_displayList.Find(id);
+    if (!displayObject)
+        return false;
+
+    m_transforms.Get(displayObject->m_transform, position, rotation, scale);
     return true;
 }
 
-void Game::UpdateDisplayListItem(const SceneObject & sceneObject)
+void XM_CALLCONV Game::TransformDisplayListItems(const std::vector<int>& ids, FXMVECTOR pivot, FXMVECTOR translation, float yaw, float scale)
 {
-    auto it = GetDisplayListIteratorFromID(sceneObject.ID);
+    m_batchTransforms.clear();
+    for (int id : ids)
+    {
+        if (const DisplayObject* displayObject = m_displayList.Find(id))
+            m_batchTransforms.push_back(displayObject->m_transform);
+    }
 
-    if (it == m_displayList.end())
+    if (m_batchTransforms.empty())
         return;
 
-    it->m_position.x = sceneObject.posX;
-    it->m_position.y = sceneObject.posY;
-    it->m_position.z = sceneObject.posZ;
-
-    it->m_orientation.x = sceneObject.rotX;
-    it->m_orientation.y = sceneObject.rotY;
-    it->m_orientation.z = sceneObject.rotZ;
+    m_previewStale = true;
 
-    it->m_scale.x = sceneObject.scaX;
-    it->m_scale.y = sceneObject.scaY;
-    it->m_scale.z = sceneObject.scaZ;
+    m_transforms.TransformGroup(m_batchTransforms.data(), m_batchTransforms.size(), pivot, translation, yaw, scale);
 }
 
-bool Game::RemoveDisplayListItem(int id)
+void Game::SetDisplayListItemParent(DisplayObject& displayObject, int parentID)
 {
-    auto it = GetDisplayListIteratorFromID(id);
+    if (displayObject.m_parentID != 0)
+    {
+        auto siblings = m_childIDs.find(displayObject.m_parentID);
+        if (siblings != m_childIDs.end())
+        {
+            siblings->second.erase(displayObject.m_ID);
+            if (siblings->second.empty())
+                m_childIDs.erase(siblings);
+        }
+    }
 
-    if (it == m_displayList.cend())
-        return false;
+    displayObject.m_parentID = parentID;
 
-    // TODO: Do something about the input layouts as well--if the last of a mesh type has been deleted,
-    //       perhaps that input layout (for highlight effect) should be deleted also?
-    m_displayList.erase(it);
-    return true;
+    uint32_t parentTransform = TransformArray::NO_PARENT;
+    if (parentID != 0)
+    {
+        m_childIDs[parentID].insert(displayObject.m_ID);
+
+        if (const DisplayObject* parent = m_displayList.Find(parentID))
+            parentTransform = parent->m_transform;
+    }
+
+    // An object can't be parented to one of its own children; if it would be, it's left in world space instead
+    m_transforms.SetParent(displayObject.m_transform, parentTransform);
 }
 
 bool Game::Pick(POINT cursorPos, RECT clientRect, int& id) const
 {
+	m_transforms.UpdateDirty();
+
 	// Points on the near and far plane in screen space
 	const XMVECTOR nearPoint = XMVectorSet(cursorPos.x, cursorPos.y, 0.f, 0.f);
 	const XMVECTOR farPoint = XMVectorSet(cursorPos.x, cursorPos.y, 1.f, 0.f);
 
-	// NOTE: Inefficient due to the scene graph not actually being a graph
-	int nearestID = -1;
-	float nearestDist = std::numeric_limits<float>::max();
-	for (auto itModel = m_displayList.cbegin(); itModel != m_displayList.cend(); ++itModel)
-	{
-		auto model = itModel->m_model;
-		assert(model != nullptr);
+	// The picking ray in world space (the same for every object)
+	const XMVECTOR nearPointWS = XMVector3Unproject(nearPoint, clientRect.left, clientRect.top, clientRect.right, clientRect.bottom, 0.f, 1.f, m_projection, m_view, XMMatrixIdentity());
+	const XMVECTOR farPointWS = XMVector3Unproject(farPoint, clientRect.left, clientRect.top, clientRect.right, clientRect.bottom, 0.f, 1.f, m_projection, m_view, XMMatrixIdentity());
+	const XMVECTOR directionWS = XMVector3Normalize(farPointWS - nearPointWS);
 
-		for (auto itMesh = model->meshes.cbegin(); itMesh != model->meshes.cend(); ++itMesh)
+	// Front to back through the objects' bounds, testing the meshes of the objects the ray actually reaches
+	uint32_t nearestTransform;
+	float nearestDist;
+	const bool hit = m_transforms.GetTree().Intersects(nearPointWS, directionWS, nearestTransform, nearestDist, [&](uint32_t transform, float& objectDist)
+	{
+		// The tree holds fattened bounds, so check against the exact ones first
+		float boundsDist;
+		if (!m_transforms.GetBounds(transform).Intersects(nearPointWS, directionWS, boundsDist))
+			return false;
+
+		XMVECTOR determinant;
+		const XMMATRIX invWorld = XMMatrixInverse(&determinant, m_transforms.GetWorld(transform));
+		if (XMVector3Equal(determinant, g_XMZero))
+			return false;
+
+		// Ray in model space. The direction's length there is what a world space metre along the ray comes to
+		const XMVECTOR nearPointMS = XMVector3TransformCoord(nearPointWS, invWorld);
+		const XMVECTOR stepMS = XMVector3TransformNormal(directionWS, invWorld);
+		const float stepLength = XMVectorGetX(XMVector3Length(stepMS));
+		const XMVECTOR direction = stepMS / stepLength;
+
+		const DisplayObject* displayObject = m_displayList.Find(m_transformObjectIDs[transform]);
+		assert(displayObject != nullptr && displayObject->m_model != nullptr);
+
+		bool meshHit = false;
+		objectDist = std::numeric_limits<float>::max();
+		for (auto itMesh = displayObject->m_model->meshes.cbegin(); itMesh != displayObject->m_model->meshes.cend(); ++itMesh)
 		{
 			auto mesh = *itMesh;
 			assert(mesh != nullptr);
 
-			auto meshBB = mesh->boundingBox;
-			auto world = SimpleMath::Matrix::CreateScale(itModel->m_scale) * SimpleMath::Matrix::CreateFromYawPitchRoll(itModel->m_orientation.x, itModel->m_orientation.y, itModel->m_orientation.z) * SimpleMath::Matrix::CreateTranslation(itModel->m_position);
-
-			// Convert points to model space
-			XMVECTOR nearPointMS = XMVector3Unproject(nearPoint, clientRect.left, clientRect.top, clientRect.right, clientRect.bottom, 0.f, 1.f, m_projection, m_view, world);
-			XMVECTOR farPointMS = XMVector3Unproject(farPoint, clientRect.left, clientRect.top, clientRect.right, clientRect.bottom, 0.f, 1.f, m_projection, m_view, world);
-
-			// Calculate normalised direction
-			XMVECTOR direction = XMVector3Normalize(farPointMS - nearPointMS);
-
-			// Test for intersection between bounding box and picking ray
-			float dist = std::numeric_limits<float>::max();
-			if (meshBB.Intersects(nearPointMS, direction, dist))
+			// Test for intersection between bounding box and picking ray (compared in world space distances)
+			float dist;
+			if (mesh->boundingBox.Intersects(nearPointMS, direction, dist) && dist / stepLength < objectDist)
 			{
-				if (dist < nearestDist)
-				{
-					nearestDist = dist;
-					nearestID = itModel->m_ID;
-				}
+				objectDist = dist / stepLength;
+				meshHit = true;
 			}
 		}
-	}
+
+		return meshHit;
+	});
 
 	// Check if the click intersected any objects
-	if (nearestID != -1)
+	if (hit)
 	{
-		id = nearestID;
+		id = m_transformObjectIDs[nearestTransform];
 		return true;
 	}
 
 	return false;
 }
 
-bool Game::PickWithinScreenRectangle(RECT selectionRect, std::vector<int>& selections, PickingMode mode) const
+void Game::UpdateHoveredObject(POINT cursorPos, RECT clientRect)
+{
+	if (!Pick(cursorPos, clientRect, m_hoveredID))
+		m_hoveredID = -1;
+}
+
+bool Game::PickWithinScreenRectangle(RECT selectionRect, SelectionSet& selections, PickingMode mode) const
 {
 	// only clear selections if we are doing normal picking
 	if (mode == PICK_NORMAL)
-		selections.clear();
+		selections.Clear();
 
-	// Create a screen space bounding box for the selection box
-	XMVECTOR topLeftNear = XMVectorSet(selectionRect.left, selectionRect.top, 0.f, 1.f);
-	XMVECTOR bottomRightFar = XMVectorSet(selectionRect.right, selectionRect.bottom, 1.f, 1.f);
+	m_transforms.UpdateDirty();
 
-	BoundingBox pickingBB;
-	pickingBB.CreateFromPoints(pickingBB, topLeftNear, bottomRightFar);
+	const BoundingFrustum viewFrustum = CreateViewFrustum(m_view, m_projection);
+	const BoundingFrustum selectionFrustum = CreateSelectionFrustum(viewFrustum, selectionRect);
 
-	// Iterate over every model in the scene (inefficient)
-	for (auto itModel = m_displayList.cbegin(); itModel != m_displayList.cend(); ++itModel)
+	// Only the objects whose bounds reach into the selection frustum can be in it
+	m_transforms.GetTree().Query(selectionFrustum, [&](uint32_t transform)
 	{
-		auto model = itModel->m_model;
-		assert(model != 0);
+		if (IsInSelectionFrustum(transform, viewFrustum, selectionFrustum))
+			ApplyPick(m_transformObjectIDs[transform], selections, mode);
+	});
 
-		// calculate world (local) matrix
-		const XMVECTORF32 scale = { itModel->m_scale.x, itModel->m_scale.y, itModel->m_scale.z };
-		const XMVECTORF32 translate = { itModel->m_position.x, itModel->m_position.y, itModel->m_position.z };
+	return !selections.empty();
+}
 
-		//convert degrees into radians for rotation matrix
-		XMVECTOR rotate = SimpleMath::Quaternion::CreateFromYawPitchRoll(XMConvertToRadians(itModel->m_orientation.y),
-															 XMConvertToRadians(itModel->m_orientation.x),
-															 XMConvertToRadians(itModel->m_orientation.z));
+void Game::ApplyPick(int id, SelectionSet& selections, PickingMode mode)
+{
+	// delete the entry if it already exists (unless picking normally)--otherwise add it
+	if (mode == PICK_NORMAL || !selections.Erase(id))
+	{
+		if (mode != PICK_EXCLUSIVE)
+			selections.Insert(id);
+	}
+}
+
+bool Game::UpdateSelectionPreview(RECT selectionRect)
+{
+	const size_t previewChanges = m_previewChanges;
+
+	m_transforms.UpdateDirty();
 
-		SimpleMath::Matrix local = m_world * XMMatrixTransformation(g_XMZero, SimpleMath::Quaternion::Identity, scale, g_XMZero, rotate, translate);
+	const BoundingFrustum viewFrustum = CreateViewFrustum(m_view, m_projection);
+	const BoundingFrustum selectionFrustum = CreateSelectionFrustum(viewFrustum, selectionRect);
 
-		for (auto itMesh = model->meshes.cbegin(); itMesh != model->meshes.cend(); ++itMesh)
+	// Start over if the camera has moved, or objects have come, gone or moved (or this is a new preview)
+	const bool viewChanged = (memcmp(&m_previewView, &m_view, sizeof(m_previewView)) != 0);
+	if (!m_previewActive || m_previewStale || viewChanged)
+	{
+		++m_previewChanges;
+
+		m_previewIDs.clear();
+		m_previewTransforms.clear();
+		m_previewSlots.assign(m_transforms.size(), UINT32_MAX);
+		m_previewVisited.assign(m_transforms.size(), 0);
+		m_previewPass = 0;
+
+		m_transforms.GetTree().Query(selectionFrustum, [&](uint32_t transform)
 		{
-			auto mesh = *itMesh;
+			UpdatePreviewItem(transform, viewFrustum, selectionFrustum);
+		});
+	}
+	else if (!EqualRect(&selectionRect, &m_previewRect))
+	{
+		// Only objects in the strips the rectangle has grown or shrunk by can have gone in or out
+		RECT strips[8];
+		int numStrips = SubtractRect(selectionRect, m_previewRect, strips);
+		numStrips += SubtractRect(m_previewRect, selectionRect, strips + numStrips);
 
-			// get model-space bounding box of mesh
-			BoundingBox meshBB = mesh->boundingBox;
+		// Objects can be in more than one strip, but only need looking at once
+		if (++m_previewPass == 0)
+		{
+			std::fill(m_previewVisited.begin(), m_previewVisited.end(), 0);
+			m_previewPass = 1;
+		}
 
-			// project to screen-space
-			BoundingBox ssMeshBB;
-			if (!CreateScreenSpaceBoundingBox(meshBB, local, ssMeshBB))
-				break;
-			
-			// If projected bounding box is inside selection box, add the ID to the selection vector
-			if (pickingBB.Contains(ssMeshBB))
+		for (int i = 0; i < numStrips; ++i)
+		{
+			m_transforms.GetTree().Query(CreateSelectionFrustum(viewFrustum, strips[i]), [&](uint32_t transform)
 			{
-				if (mode == PICK_NORMAL)
-					selections.push_back(itModel->m_ID);
-				else
-				{
-					// delete the entry if it already exists--otherwise add it
-					auto alreadySelectedIt = std::find(selections.cbegin(), selections.cend(), itModel->m_ID);
-					
-					if (alreadySelectedIt != selections.cend())
-						selections.erase(alreadySelectedIt);
-					else if (mode == PICK_INVERT)
-						selections.push_back(itModel->m_ID);
-				}
-			}
+				if (m_previewVisited[transform] == m_previewPass)
+					return;
+
+				m_previewVisited[transform] = m_previewPass;
+				UpdatePreviewItem(transform, viewFrustum, selectionFrustum);
+			});
 		}
 	}
 
-	return !selections.empty();
+	m_previewActive = true;
+	m_previewStale = false;
+	m_previewRect = selectionRect;
+	m_previewView = m_view;
+
+	return m_previewChanges != previewChanges;
+}
+
+void Game::UpdatePreviewItem(uint32_t transform, const BoundingFrustum& viewFrustum, const BoundingFrustum& selectionFrustum)
+{
+	const bool inside = IsInSelectionFrustum(transform, viewFrustum, selectionFrustum);
+	const bool wasInside = (m_previewSlots[transform] != UINT32_MAX);
+	if (inside == wasInside)
+		return;
+
+	++m_previewChanges;
+
+	if (inside)
+	{
+		m_previewSlots[transform] = uint32_t(m_previewIDs.size());
+		m_previewIDs.push_back(m_transformObjectIDs[transform]);
+		m_previewTransforms.push_back(transform);
+		return;
+	}
+
+	// Fill the gap with the last one
+	const uint32_t slot = m_previewSlots[transform];
+	m_previewIDs[slot] = m_previewIDs.back();
+	m_previewTransforms[slot] = m_previewTransforms.back();
+	m_previewSlots[m_previewTransforms[slot]] = slot;
+
+	m_previewIDs.pop_back();
+	m_previewTransforms.pop_back();
+	m_previewSlots[transform] = UINT32_MAX;
+}
+
+int Game::SubtractRect(const RECT& a, const RECT& b, RECT* parts)
+{
+	// No overlap, so none of a is taken away
+	if (b.left >= a.right || b.right <= a.left || b.top >= a.bottom || b.bottom <= a.top)
+	{
+		parts[0] = a;
+		return 1;
+	}
+
+	// Full width strips above and below, then what's left either side between them
+	const long top = std::max(a.top, b.top);
+	const long bottom = std::min(a.bottom, b.bottom);
+
+	int numParts = 0;
+	if (a.top < b.top)
+		parts[numParts++] = { a.left, a.top, a.right, b.top };
+	if (b.bottom < a.bottom)
+		parts[numParts++] = { a.left, b.bottom, a.right, a.bottom };
+	if (a.left < b.left)
+		parts[numParts++] = { a.left, top, b.left, bottom };
+	if (b.right < a.right)
+		parts[numParts++] = { b.right, top, a.right, bottom };
+
+	return numParts;
+}
+
+BoundingFrustum Game::CreateSelectionFrustum(const BoundingFrustum& viewFrustum, RECT selectionRect) const
+{
+	// The slopes are linear across the screen
+	const D3D11_VIEWPORT viewport = m_deviceResources->GetScreenViewport();
+
+	BoundingFrustum selectionFrustum = viewFrustum;
+	selectionFrustum.LeftSlope = viewFrustum.LeftSlope + (viewFrustum.RightSlope - viewFrustum.LeftSlope) * (selectionRect.left / viewport.Width);
+	selectionFrustum.RightSlope = viewFrustum.LeftSlope + (viewFrustum.RightSlope - viewFrustum.LeftSlope) * (selectionRect.right / viewport.Width);
+	selectionFrustum.TopSlope = viewFrustum.TopSlope + (viewFrustum.BottomSlope - viewFrustum.TopSlope) * (selectionRect.top / viewport.Height);
+	selectionFrustum.BottomSlope = viewFrustum.TopSlope + (viewFrustum.BottomSlope - viewFrustum.TopSlope) * (selectionRect.bottom / viewport.Height);
+
+	return selectionFrustum;
+}
+
+bool Game::IsInSelectionFrustum(uint32_t transform, const BoundingFrustum& viewFrustum, const BoundingFrustum& selectionFrustum) const
+{
+	const DisplayObject* displayObject = m_displayList.Find(m_transformObjectIDs[transform]);
+	assert(displayObject != nullptr && displayObject->m_model != nullptr);
+
+	const XMMATRIX world = m_transforms.GetWorld(transform);
+
+	// An object is in the selection box if any of its meshes is: if every corner of the mesh's bounds that's
+	// on screen is inside the selection box (and there's at least one)
+	for (auto itMesh = displayObject->m_model->meshes.cbegin(); itMesh != displayObject->m_model->meshes.cend(); ++itMesh)
+	{
+		XMFLOAT3 corners[BoundingBox::CORNER_COUNT];
+		(*itMesh)->boundingBox.GetCorners(corners);
+
+		bool onScreen = false;
+		bool outside = false;
+		for (size_t i = 0; i < BoundingBox::CORNER_COUNT && !outside; ++i)
+		{
+			const XMVECTOR corner = XMVector3Transform(XMLoadFloat3(&corners[i]), world);
+			if (viewFrustum.Contains(corner) == DISJOINT)
+				continue;
+
+			onScreen = true;
+			outside = (selectionFrustum.Contains(corner) == DISJOINT);
+		}
+
+		if (onScreen && !outside)
+			return true;
+	}
+
+	return false;
+}
+
+BoundingFrustum XM_CALLCONV Game::CreateViewFrustum(FXMMATRIX view, CXMMATRIX projection)
+{
+	BoundingFrustum frustum = TerrainQuadtree::GetViewFrustum(projection);
+	frustum.Transform(frustum, XMMatrixInverse(nullptr, view));
+	return frustum;
 }
 
 bool Game::CursorIntersectsTerrain(long cursorX, long cursorY, DirectX::XMVECTOR & wsCoord)
 {
     const XMVECTOR origin = m_camera.GetPosition();
-    return m_displayChunk.CursorIntersectsTerrain(origin, cursorX, cursorY, m_deviceResources->GetScreenViewport(), m_projection, m_view, m_world, wsCoord);
+
+    // Create ray
+    const D3D11_VIEWPORT viewport = m_deviceResources->GetScreenViewport();
+    XMVECTOR farPoint = XMVectorSet(float(cursorX), float(cursorY), 0.f, 1.f);
+    farPoint = XMVector3Unproject(farPoint, viewport.TopLeftX, viewport.TopLeftY, viewport.Width, viewport.Height, viewport.MinDepth, viewport.MaxDepth, m_projection, m_view, m_world);
+
+    const XMVECTOR direction = XMVector3Normalize(farPoint - origin);
+
+    return m_chunkManager.Intersects(origin, direction, wsCoord);
 }
 
 void Game::ShowBrushDecal(bool val)
@@ -902,6 +1186,8 @@ void Game::ShowBrushDecal(bool val)
 
 void XM_CALLCONV Game::SetBrushDecalPosition(FXMVECTOR wsCoord, float brushSize)
 {
+    XMStoreFloat3(&m_brushPosition, wsCoord);
+
     // Projector position a little bit above the area the cursor is hovering over
     // NOTE: One thing to be weary of here is that the projector's near plane could potentially clip the terrain
     //        when doing terrain manipulation, since (currently) the BVH is not being regenerated as the geometry
@@ -928,14 +1214,23 @@ void XM_CALLCONV Game::SetBrushDecalPosition(FXMVECTOR wsCoord, float brushSize)
 
 void XM_CALLCONV Game::ManipulateTerrain(DirectX::FXMVECTOR wsCoord, bool elevate, float brushSize, float brushForce)
 {
-    // If the player is trying to manipulate the terrain at this location
-    m_displayChunk.ManipulateTerrain(wsCoord, elevate, int(brushSize), brushForce);
-    RefitTerrainBVH();
+    // The brush may reach across into neighbouring chunks (which refit the parts of their BVHs that changed)
+    m_chunkManager.ManipulateTerrain(wsCoord, elevate, int(brushSize), brushForce);
+}
+
+void XM_CALLCONV Game::PaintTerrain(DirectX::FXMVECTOR wsCoord, int layer, float brushSize, float strength)
+{
+    m_chunkManager.PaintSplat(wsCoord, layer, int(brushSize), strength);
+}
+
+void XM_CALLCONV Game::CopyTerrain(DirectX::FXMVECTOR wsCoord, float size, TerrainStamp& stamp) const
+{
+    m_chunkManager.CopyHeights(XMVectorGetX(wsCoord), XMVectorGetZ(wsCoord), size, stamp);
 }
 
 void Game::RefitTerrainBVH()
 {
-    m_displayChunk.RefitBVH();
+    m_chunkManager.RefitBVH();
 }
 
 #ifdef DXTK_AUDIO
@@ -1048,6 +1343,9 @@ void Game::CreateWindowSizeDependentResources()
 		fovAngleY *= 2.0f;
 	}
 
+	// The selection preview's frusta are out of date with the new projection
+	m_previewStale = true;
+
 	// This sample makes use of a right-handed coordinate system using row-major matrices.
 	m_projection = SimpleMath::Matrix::CreatePerspectiveFieldOfView(
 		fovAngleY,
@@ -1060,9 +1358,6 @@ void Game::CreateWindowSizeDependentResources()
 	m_highlightEffect->SetProjection(m_projection);
 	m_batchEffect->SetProjection(m_projection);
 
-	if (m_displayChunk.m_terrainEffect)
-	    m_displayChunk.m_terrainEffect->SetProjection(m_projection);
-
     //// Create views and render targets for post processing stuff
     ID3D11Device* device = m_deviceResources->GetD3DDevice();
     DXGI_FORMAT backBufferFormat = m_deviceResources->GetBackBufferFormat();
@@ -1104,6 +1399,8 @@ void Game::OnDeviceLost()
 	m_font.reset();
 	m_shape.reset();
 	m_model.reset();
+	m_modelCache.clear();
+	m_textureCache.clear();
 	m_texture1.Reset();
 	m_texture2.Reset();
 	m_batchInputLayout.Reset();
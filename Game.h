@@ -8,12 +8,18 @@
 #include "StepTimer.h"
 #include "SceneObject.h"
 #include "DisplayObject.h"
+#include "SceneStore.h"
+#include "SelectionSet.h"
+#include "TransformArray.h"
 #include "DisplayChunk.h"
+#include "ChunkManager.h"
 #include "ChunkObject.h"
 #include "InputCommands.h"
 #include "Camera.h"
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "HighlightEffect.h"
 #include "PostProcess.h"
@@ -53,7 +59,8 @@ public:
 	// Rendering helpers
 	void Clear();
 
-	void SetSelectionIDs(const std::vector<int>& IDs) { m_selectionIDs = IDs; }
+	// The selection is shared, not copied: it's read as it is whenever a frame is drawn
+	void SetSelection(const SelectionSet& selection) { m_selection = &selection; }
 
 	// IDeviceNotify
 	virtual void OnDeviceLost() override;
@@ -68,23 +75,69 @@ public:
 
 	//tool specific
 	void BuildDisplayList(std::vector<SceneObject> * SceneGraph); //note vector passed by reference 
-	void BuildDisplayChunk(ChunkObject *SceneChunk);
-	void SaveDisplayChunk(ChunkObject *SceneChunk);	//saves geometry et al
+	void BuildDisplayChunks(const std::vector<ChunkObject>& chunks, const std::string& databasePath);	//chunks are streamed in around the camera from here on
+	void TakeStreamedChunks(std::vector<ChunkManager::StreamedChunk>& loaded, std::vector<int>& unloaded) { m_chunkManager.TakeStreamedChunks(loaded, unloaded); }
+	bool SaveDisplayChunks();	//saves geometry et al of every loaded chunk (asynchronously)
+	HeightMapWriter::State GetTerrainSaveState(float& progress) const;
+	size_t GetFailedChunkCount(std::string& lastFailedName) const { lastFailedName = m_chunkManager.GetLastFailedChunkName(); return m_chunkManager.GetFailedChunkCount(); }	//chunks that couldn't be streamed in
+	bool ExportSimplifiedTerrain(float maxError, std::string& paths);	//one .obj and baked lightmap per loaded chunk
 	void ClearDisplayList();
     bool AddDisplayListItem(const SceneObject& sceneObject);
     void UpdateDisplayListItem(const SceneObject& sceneObject);
     bool RemoveDisplayListItem(int id);
+    // The transform an object was last added or updated with. Returns false if it isn't in the display list
+    bool GetDisplayListItemTransform(int id, DirectX::XMFLOAT3& position, DirectX::XMFLOAT3& rotation, DirectX::XMFLOAT3& scale) const;
+    // Moves a group of objects together in one batch (see TransformArray::TransformGroup), straight on the display
+    // list's transforms. The scene objects are left to be brought up to date from GetDisplayListItemTransform
+    void XM_CALLCONV TransformDisplayListItems(const std::vector<int>& ids, DirectX::FXMVECTOR pivot, DirectX::FXMVECTOR translation, float yaw, float scale);
 
 	bool Pick(POINT cursorPos, RECT clientRect, int& id) const;
-	bool PickWithinScreenRectangle(RECT selectionRect, std::vector<int>& selections, PickingMode invert = PICK_NORMAL) const;
+	// The object under the cursor (shown on the HUD)
+	void UpdateHoveredObject(POINT cursorPos, RECT clientRect);
+	void ClearHoveredObject() { m_hoveredID = -1; }
+	bool PickWithinScreenRectangle(RECT selectionRect, SelectionSet& selections, PickingMode invert = PICK_NORMAL) const;
+	// Adds or removes a picked ID from the selection, the way PickWithinScreenRectangle does
+	static void ApplyPick(int id, SelectionSet& selections, PickingMode mode);
+
+	// Finds the objects that would be picked with the selection rectangle as it is, while it's being dragged out,
+	// returning true if they've changed. Between calls, only objects near the edges the rectangle has moved are looked at again
+	bool UpdateSelectionPreview(RECT selectionRect);
+	const std::vector<int>& GetSelectionPreview() const { return m_previewIDs; }
+	void EndSelectionPreview() { m_previewActive = false; }
 
     bool CursorIntersectsTerrain(long cursorX, long cursorY, DirectX::XMVECTOR& wsCoord);
     void ShowBrushDecal(bool val = true);
     void XM_CALLCONV SetBrushDecalPosition(DirectX::FXMVECTOR wsCoord, float brushSize);
     void XM_CALLCONV ManipulateTerrain(DirectX::FXMVECTOR wsCoord, bool elevate, float brushSize, float brushForce);
+    void XM_CALLCONV PaintTerrain(DirectX::FXMVECTOR wsCoord, int layer, float brushSize, float strength);
+    // Terrain clipboard: copies the heights in a square (size metres across) around wsCoord, and pastes them back
+    void XM_CALLCONV CopyTerrain(DirectX::FXMVECTOR wsCoord, float size, TerrainStamp& stamp) const;
+    bool PasteTerrain(const TerrainStamp& stamp, const TerrainStamp::Placement& placement, size_t& layer) { return m_chunkManager.PasteHeights(stamp, placement, layer); }
+    // Undo for brush strokes (see ChunkManager::TerrainTile)
+    void TakeTerrainUndo(std::vector<ChunkManager::TerrainTile>& tiles, bool strokeEnded) { m_chunkManager.TakeTerrainUndo(tiles, strokeEnded); }
+    void SwapTerrainTiles(const std::vector<ChunkManager::TerrainTile*>& tiles) { m_chunkManager.SwapTerrainTiles(tiles); }
 
     void RefitTerrainBVH();
 
+    // Terrain layers (see ChunkManager::GetTerrainLayers). Brushes sculpt the selected layer
+    const std::vector<ChunkManager::TerrainLayer>& GetTerrainLayers() const { return m_chunkManager.GetTerrainLayers(); }
+    size_t GetSelectedTerrainLayer() const { return m_chunkManager.GetSelectedTerrainLayer(); }
+    void SelectTerrainLayer(size_t layer) { m_chunkManager.SelectTerrainLayer(layer); }
+    size_t AddTerrainLayer() { return m_chunkManager.AddSculptLayer(); }
+    void SetTerrainLayerVisible(size_t layer, bool visible, bool saveUndo) { m_chunkManager.SetTerrainLayerVisible(layer, visible, saveUndo); }
+
+    // Carves roads and rivers along the path nodes among 'nodes' (see TerrainPaths). Returns true if the terrain changed
+    bool SetTerrainPaths(const std::vector<SceneObject>& nodes) { return m_chunkManager.SetPaths(nodes); }
+
+    // Drainage analysis drawn over the terrain. While one is shown, the HUD reports the results under the brush
+    void SetHydrologyOverlay(TerrainHydrology::Overlay overlay) { m_chunkManager.SetHydrologyOverlay(overlay); }
+    TerrainHydrology::Overlay GetHydrologyOverlay() const { return m_chunkManager.GetHydrologyOverlay(); }
+
+    // Terrain height lookups (no ray casting involved)
+    float SampleTerrainHeight(float x, float z) const { return m_chunkManager.SampleHeight(x, z); }
+    DirectX::XMVECTOR SampleTerrainNormal(float x, float z) const { return m_chunkManager.SampleNormal(x, z); }
+    void SampleTerrainHeights(const float* xs, const float* zs, float* heights, size_t count) const { m_chunkManager.SampleHeights(xs, zs, heights, count); }
+
 #ifdef DXTK_AUDIO
 	void NewAudioDevice();
 #endif
@@ -102,20 +155,56 @@ private:
 
 	void XM_CALLCONV DrawGrid(DirectX::FXMVECTOR xAxis, DirectX::FXMVECTOR yAxis, DirectX::FXMVECTOR origin, size_t xdivs, size_t ydivs, DirectX::GXMVECTOR color);
 
-	// returns false if no bounding box could be created (outside of viewport)
-	bool XM_CALLCONV CreateScreenSpaceBoundingBox(const DirectX::BoundingBox& modelSpaceBB, DirectX::FXMMATRIX local, DirectX::BoundingBox& screenSpaceBB) const;
+	// Moves the object under another parent (by ID, 0 for none), whether that's been added yet or not
+	void SetDisplayListItemParent(DisplayObject& displayObject, int parentID);
+    // Input layouts of a newly loaded model's parts for the selection highlight effect
+    void CreateHighlightInputLayouts(const DirectX::Model& model);
 
-    auto GetDisplayListIteratorFromID(int id);
-    auto GetDisplayListIteratorFromID(int id) const;
+	// World-space view frustum of the camera
+	static DirectX::BoundingFrustum XM_CALLCONV CreateViewFrustum(DirectX::FXMMATRIX view, DirectX::CXMMATRIX projection);
+	// The part of the view frustum behind a screen rectangle
+	DirectX::BoundingFrustum CreateSelectionFrustum(const DirectX::BoundingFrustum& viewFrustum, RECT selectionRect) const;
+	bool IsInSelectionFrustum(uint32_t transform, const DirectX::BoundingFrustum& viewFrustum, const DirectX::BoundingFrustum& selectionFrustum) const;
+
+	// Adds the object to the selection preview or takes it out, if that's changed
+	void UpdatePreviewItem(uint32_t transform, const DirectX::BoundingFrustum& viewFrustum, const DirectX::BoundingFrustum& selectionFrustum);
+	// The parts of a not in b (up to four), returning how many
+	static int SubtractRect(const RECT& a, const RECT& b, RECT* parts);
 
 	//// tool specific
-	std::vector<DisplayObject>			m_displayList;
-	DisplayChunk						m_displayChunk;
+	// Display objects by ID (see SceneStore)
+	SceneStore<DisplayObject, &DisplayObject::m_ID>	m_displayList;
+	// Their transforms, world matrices and world bounds (brought up to date lazily, hence mutable)
+	mutable TransformArray				m_transforms;
+	// ID of the display object using each transform (-1 if none), for the picking results
+	std::vector<int>					m_transformObjectIDs;
+	// Scratch space for TransformDisplayListItems
+	std::vector<uint32_t>				m_batchTransforms;
+	int									m_hoveredID = -1;
+
+	// Selection preview: the rectangle and camera it's up to date with (it's also out of date once objects change),
+	// the IDs (and transforms) in it, each transform's slot in those (UINT32_MAX if not in it), and which transforms
+	// have been looked at already in this update
+	bool								m_previewActive = false;
+	bool								m_previewStale = true;
+	RECT								m_previewRect = {};
+	DirectX::SimpleMath::Matrix			m_previewView;
+	std::vector<int>					m_previewIDs;
+	std::vector<uint32_t>				m_previewTransforms;
+	std::vector<uint32_t>				m_previewSlots;
+	std::vector<uint32_t>				m_previewVisited;
+	uint32_t							m_previewPass = 0;
+	// Goes up whenever what's in the preview changes
+	size_t								m_previewChanges = 0;
+	// IDs of the display objects under each parent ID (whether that parent has been added or not). Objects whose parent
+	// isn't there are placed in world space until it is
+	std::unordered_map<int, std::unordered_set<int>>	m_childIDs;
 	InputCommands						inputCommands;
     
 	// terrain manipulation brush
     bool m_showTerrainBrush = false;
     float m_brushSize = 0.f;
+    XMFLOAT3 m_brushPosition = XMFLOAT3(0.f, 0.f, 0.f);
 
 	__declspec(align(16))
 		struct DecalMatrixBuffer
@@ -150,10 +239,15 @@ private:
     // Selection highlighting
 	using InputLayouts = std::vector<Microsoft::WRL::ComPtr<ID3D11InputLayout>>;
 
-	std::vector<int> m_selectionIDs;
+	const SelectionSet* m_selection = nullptr;
 	std::unique_ptr<HighlightEffect>									    m_highlightEffect;
 	std::map<std::wstring, InputLayouts>									m_highlightEffectLayouts;
 
+    // Models and textures already loaded, by path, so the objects sharing them (most of a chunk's props) don't load
+    // them again as they stream in. A model's effects hold its texture, so models are kept per model and texture
+    std::map<std::pair<std::string, std::string>, std::shared_ptr<DirectX::Model>>	m_modelCache;
+    std::map<std::string, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>>		m_textureCache;
+
 	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>						m_selectionBoxTexture;
 
     //// Render targets and post process stuff
@@ -176,6 +270,9 @@ private:
 	// Device resources.
     std::shared_ptr<DX::DeviceResources>    m_deviceResources;
 
+    // Terrain chunks (declared after the device resources, so the loader thread is gone before they are)
+    ChunkManager                            m_chunkManager;
+
     // Rendering loop timer.
     DX::StepTimer                           m_timer;
 
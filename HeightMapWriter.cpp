@@ -0,0 +1,76 @@
+#include "pch.h"
+#include "HeightMapWriter.h"
+#include <cstdio>
+
+namespace
+{
+    // Number of samples encoded and written per step (progress is reported per step)
+    constexpr size_t SAMPLES_PER_BLOCK = 64 * 1024;
+}
+
+HeightMapWriter::~HeightMapWriter()
+{
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+bool HeightMapWriter::Begin(Snapshot heights, float heightScale, const std::string& path)
+{
+    if (IsBusy())
+        return false;
+
+    // The previous save has finished, so this won't block
+    if (m_thread.joinable())
+        m_thread.join();
+
+    m_progress = 0.f;
+    m_state = STATE_WRITING;
+    m_thread = std::thread(&HeightMapWriter::Write, this, std::move(heights), heightScale, path);
+
+    return true;
+}
+
+void HeightMapWriter::Write(Snapshot heights, float heightScale, std::string path)
+{
+    // Write to a temporary file first so that a failed save never leaves a half-written heightmap behind
+    const std::string tempPath = path + ".tmp";
+
+    FILE *pFile = NULL;
+    errno_t ret = fopen_s(&pFile, tempPath.c_str(), "wb");
+    if (ret != 0 || pFile == NULL)
+    {
+        m_state = STATE_FAILED;
+        return;
+    }
+
+    const size_t numSamples = heights->size();
+    std::vector<uint8_t> block(std::min(numSamples, SAMPLES_PER_BLOCK));
+
+    bool succeeded = true;
+    for (size_t first = 0; first < numSamples && succeeded; first += SAMPLES_PER_BLOCK)
+    {
+        const size_t count = std::min(SAMPLES_PER_BLOCK, numSamples - first);
+
+        // Convert world space heights back into the 0-255 range of the .raw file
+        for (size_t i = 0; i < count; ++i)
+        {
+            float height = (*heights)[first + i] / heightScale;
+            block[i] = uint8_t(std::min(std::max(height, 0.f), 255.f));
+        }
+
+        succeeded = (fwrite(block.data(), sizeof(uint8_t), count, pFile) == count);
+
+        m_progress = float(first + count) / numSamples;
+    }
+
+    succeeded = (fclose(pFile) == 0) && succeeded;
+
+    // Swap the new heightmap in
+    if (succeeded)
+        succeeded = (MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0);
+
+    if (!succeeded)
+        remove(tempPath.c_str());
+
+    m_state = (succeeded ? STATE_SUCCEEDED : STATE_FAILED);
+}
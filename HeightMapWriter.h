@@ -0,0 +1,45 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Encodes and writes a heightmap to disk on a background thread.
+// The writer only ever sees an immutable snapshot of the heights, so the terrain
+// can carry on being edited while a save is in flight.
+class HeightMapWriter
+{
+public:
+    using Snapshot = std::shared_ptr<const std::vector<float>>;
+
+    enum State
+    {
+        STATE_IDLE,
+        STATE_WRITING,
+        STATE_SUCCEEDED,
+        STATE_FAILED
+    };
+
+    HeightMapWriter() = default;
+    HeightMapWriter(const HeightMapWriter&) = delete;
+    HeightMapWriter& operator=(const HeightMapWriter&) = delete;
+    // Blocks until an in-flight save has finished (so we never lose data on exit)
+    ~HeightMapWriter();
+
+    // Returns false if a save is already in progress
+    bool Begin(Snapshot heights, float heightScale, const std::string& path);
+
+    State GetState() const { return m_state; }
+    // [0, 1] progress of the current (or last) save
+    float GetProgress() const { return m_progress; }
+    bool IsBusy() const { return m_state == STATE_WRITING; }
+
+private:
+    void Write(Snapshot heights, float heightScale, std::string path);
+
+    std::thread m_thread;
+
+    std::atomic<State> m_state{ STATE_IDLE };
+    std::atomic<float> m_progress{ 0.f };
+};
@@ -0,0 +1,65 @@
+#pragma once
+#include <unordered_set>
+#include <vector>
+
+// Hands out unique object IDs in O(1): IDs that have been given back are reused first (most recent first),
+// otherwise it's one past the highest ID in use. IDs taken some other way (loaded, or restored by an undo)
+// are claimed, so they're never handed out twice.
+class IDAllocator
+{
+public:
+    IDAllocator() = default;
+
+    // Every ID up to (and including) maxID is taken, and none are free
+    void Reset(int maxID)
+    {
+        m_maxID = maxID;
+        m_freeIDs.clear();
+        m_freeSet.clear();
+    }
+
+    int Allocate()
+    {
+        // Claimed IDs are only taken out of the set, so skip over those
+        while (!m_freeIDs.empty())
+        {
+            const int id = m_freeIDs.back();
+            m_freeIDs.pop_back();
+
+            if (m_freeSet.erase(id) != 0)
+                return id;
+        }
+
+        return ++m_maxID;
+    }
+
+    void Release(int id)
+    {
+        if (id > m_maxID || !m_freeSet.insert(id).second)
+            return;
+
+        m_freeIDs.push_back(id);
+    }
+
+    bool IsFree(int id) const { return id > m_maxID || m_freeSet.count(id) != 0; }
+
+    // Marks an ID as taken. Returns false if it already was (by something else)
+    bool Claim(int id)
+    {
+        if (id > m_maxID)
+        {
+            // Any IDs skipped over are simply never handed out
+            m_maxID = id;
+            return true;
+        }
+
+        return m_freeSet.erase(id) != 0;
+    }
+
+private:
+    int m_maxID = -1;
+
+    // Given back IDs (as a stack, for reuse), and the ones of those that haven't been claimed since
+    std::vector<int> m_freeIDs;
+    std::unordered_set<int> m_freeSet;
+};
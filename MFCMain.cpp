@@ -5,6 +5,7 @@
 BEGIN_MESSAGE_MAP(MFCMain, CWinApp)
     ON_COMMAND(ID_FILE_QUIT, &MFCMain::MenuFileQuit)
     ON_COMMAND(ID_FILE_SAVETERRAIN, &MFCMain::MenuFileSaveTerrain)
+    ON_COMMAND(ID_FILE_EXPORTTERRAIN, &MFCMain::MenuFileExportTerrain)
     ON_COMMAND(ID_EDIT_SELECT, &MFCMain::MenuEditSelect)
     ON_COMMAND(ID_EDIT_TRANSFORM, &MFCMain::MenuEditTransform)
 	ON_COMMAND(ID_BUTTON_SAVE, &MFCMain::ToolBarButton1)
@@ -76,28 +77,35 @@ int MFCMain::Run()
 		}
 		else
 		{
-			auto selectionIDs = m_ToolSystem.getCurrentSelectionIDs();
+			const SelectionSet& selectionIDs = m_ToolSystem.getCurrentSelectionIDs();
 
-			// TODO: Deal with cases where _A LOT_ of object are selected (so many that we don't want to show all the IDs in the status bar)
-			std::wstring statusString = L"Selected objects: ";
-			if (selectionIDs.empty())
-				statusString += L"none";
-			else
+			// The status text is only put together again when the selection has changed
+			std::wstring& statusString = m_selectionStatus;
+			if (statusString.empty() || selectionIDs.GetVersion() != m_selectionStatusVersion)
 			{
-                // Fix language
-                if (selectionIDs.size() == 1)
-                {
-                    int idx = statusString.find_last_of(L's');
-                    statusString.erase(statusString.begin() + idx);
-                }
-
-				for (int i : selectionIDs)
+				// TODO: Deal with cases where _A LOT_ of object are selected (so many that we don't want to show all the IDs in the status bar)
+				statusString = L"Selected objects: ";
+				if (selectionIDs.empty())
+					statusString += L"none";
+				else
 				{
-					statusString += std::to_wstring(i);
-					statusString += L", ";
+                    // Fix language
+                    if (selectionIDs.size() == 1)
+                    {
+                        int idx = statusString.find_last_of(L's');
+                        statusString.erase(statusString.begin() + idx);
+                    }
+
+					for (int i : selectionIDs)
+					{
+						statusString += std::to_wstring(i);
+						statusString += L", ";
+					}
+					// chop off the last ", "
+					statusString.resize(statusString.size() - 2);
 				}
-				// chop off the last ", "
-				statusString.resize(statusString.size() - 2);
+
+				m_selectionStatusVersion = selectionIDs.GetVersion();
 			}
 
 			m_ToolSystem.Tick(&msg);
@@ -106,12 +114,15 @@ int MFCMain::Run()
             // NOTE: This works because CWnd allows for implicit conversion to HANDLE, which is just a typedef of void*
             if (m_transformDialogue)
             {
+                // The object may have moved in memory (or been deleted) since the last frame
+                m_transformDialogue.RebindSceneObject(m_ToolSystem.GetObjectFromHandle(m_transformObject));
+
                 // If an object has been moved by the user, update the controls
                 if (m_ToolSystem.ObjectMovedThisFrame())
                     m_transformDialogue.UpdateData(FALSE);
 
                 // If the controls have changed, update the scene graph and display list
-                if (m_transformDialogue.ControlsChanged())
+                if (m_transformDialogue.ControlsChanged() && m_transformDialogue.GetSceneObject())
                 {
                     m_ToolSystem.UpdateDisplayObject(m_transformDialogue.GetSceneObject());
                     m_transformDialogue.NotifyDisplayObjectUpdated();
@@ -120,6 +131,15 @@ int MFCMain::Run()
 
 			//send current object ID to status bar in The main frame
 			m_frame->m_wndStatusBar.SetPaneText(1, statusString.c_str(), 1);
+
+			// Terrain saves happen in the background, so report how they're getting on (non-modal), along with any chunks
+			// that couldn't be streamed in
+			std::wstring terrainStatus = m_ToolSystem.getTerrainSaveStatus();
+			const std::wstring loadStatus = m_ToolSystem.getTerrainLoadStatus();
+			if (!loadStatus.empty())
+				terrainStatus += (terrainStatus.empty() ? L"" : L" | ") + loadStatus;
+
+			m_frame->m_wndStatusBar.SetPaneText(0, terrainStatus.c_str(), 1);
 		}
 	}
 
@@ -137,6 +157,17 @@ void MFCMain::MenuFileSaveTerrain()
 	m_ToolSystem.onActionSaveTerrain();
 }
 
+void MFCMain::MenuFileExportTerrain()
+{
+	// Remember the last tolerance between exports
+	ExportTerrainDialog dialog(m_exportMaxError, m_frame);
+	if (dialog.DoModal() != IDOK)
+		return;
+
+	m_exportMaxError = dialog.GetMaxError();
+	m_ToolSystem.onActionExportTerrain(m_exportMaxError);
+}
+
 void MFCMain::MenuEditSelect()
 {
 	//SelectDialogue m_ToolSelectDialogue(NULL, &m_ToolSystem.m_sceneGraph);		//create our dialoguebox //modal constructor
@@ -160,8 +191,8 @@ void MFCMain::MenuEditTransform()
         m_transformDialogue.ShowWindow(SW_SHOW);
 
         // Transform the first selected object (there should only ever be one selected)
-        SceneObject* object = m_ToolSystem.GetObjectFromID(m_ToolSystem.getCurrentSelectionIDs().front());
-        m_transformDialogue.SetSceneObject(object);
+        m_transformObject = m_ToolSystem.GetObjectHandle(m_ToolSystem.getCurrentSelectionIDs().front());
+        m_transformDialogue.SetSceneObject(m_ToolSystem.GetObjectFromHandle(m_transformObject));
     }
 }
 
@@ -10,6 +10,7 @@
 #include "MFCFrame.h"
 #include "SelectDialogue.h"
 #include "TransformDialog.h"
+#include "ExportTerrainDialog.h"
 
 
 class MFCMain : public CWinApp 
@@ -25,8 +26,14 @@ private:
 	ToolMain m_ToolSystem;	//Instance of Tool System that we interface to. 
 	CRect WindowRECT;	//Window area rectangle. 
 	SelectDialogue m_ToolSelectDialogue;			//for modeless dialogue, declare it here
+	std::wstring m_selectionStatus;					//selected objects as shown on the status bar
+	uint64_t m_selectionStatusVersion = 0;			//version of the selection it was put together from
 
     TransformDialog m_transformDialogue;
+    // Object shown in the transform dialog (its pointer is looked up again every frame, as the scene graph changes)
+    SceneGraph::Handle m_transformObject;
+
+    float m_exportMaxError = 0.5f;	//max vertical error (metres) of the last simplified terrain export
 
 	int m_width;		
 	int m_height;
@@ -34,6 +41,7 @@ private:
 	//Interface funtions for menu and toolbar etc requires
 	afx_msg void MenuFileQuit();
 	afx_msg void MenuFileSaveTerrain();
+	afx_msg void MenuFileExportTerrain();
     afx_msg void MenuEditSelect();
     afx_msg void MenuEditTransform();
     afx_msg	void ToolBarButton1();
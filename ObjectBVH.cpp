@@ -0,0 +1,253 @@
+#include "ObjectBVH.h"
+
+#include <algorithm>
+
+using namespace DirectX;
+
+constexpr uint32_t ObjectBVH::INVALID;
+constexpr float ObjectBVH::MARGIN;
+
+namespace
+{
+    // Half the surface area (the cost of a node is proportional to how likely a ray is to pass through it)
+    float Area(const BoundingBox& bounds)
+    {
+        const XMFLOAT3& e = bounds.Extents;
+        return 4.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    BoundingBox Merged(const BoundingBox& a, const BoundingBox& b)
+    {
+        BoundingBox merged;
+        BoundingBox::CreateMerged(merged, a, b);
+        return merged;
+    }
+}
+
+uint32_t ObjectBVH::Insert(uint32_t item, const BoundingBox& bounds)
+{
+    const uint32_t leaf = AllocateNode();
+
+    Node& node = m_nodes[leaf];
+    node.bounds = BoundingBox(bounds.Center, XMFLOAT3(bounds.Extents.x + MARGIN, bounds.Extents.y + MARGIN, bounds.Extents.z + MARGIN));
+    node.item = item;
+    node.height = 0;
+
+    InsertLeaf(leaf);
+    return leaf;
+}
+
+void ObjectBVH::Remove(uint32_t proxy)
+{
+    RemoveLeaf(proxy);
+    FreeNode(proxy);
+}
+
+bool ObjectBVH::Move(uint32_t proxy, const BoundingBox& bounds)
+{
+    // Still within the fattened bounds
+    if (m_nodes[proxy].bounds.Contains(bounds) == CONTAINS)
+        return false;
+
+    // The leaf keeps its index, so the proxy stays the same
+    RemoveLeaf(proxy);
+    m_nodes[proxy].bounds = BoundingBox(bounds.Center, XMFLOAT3(bounds.Extents.x + MARGIN, bounds.Extents.y + MARGIN, bounds.Extents.z + MARGIN));
+    InsertLeaf(proxy);
+
+    return true;
+}
+
+void ObjectBVH::Clear()
+{
+    m_nodes.clear();
+    m_root = INVALID;
+    m_freeList = INVALID;
+}
+
+uint32_t ObjectBVH::AllocateNode()
+{
+    uint32_t index;
+    if (m_freeList != INVALID)
+    {
+        index = m_freeList;
+        m_freeList = m_nodes[index].parent;
+    }
+    else
+    {
+        index = uint32_t(m_nodes.size());
+        m_nodes.emplace_back();
+    }
+
+    Node& node = m_nodes[index];
+    node.parent = INVALID;
+    node.children[0] = node.children[1] = INVALID;
+    node.item = INVALID;
+    node.height = 0;
+
+    return index;
+}
+
+void ObjectBVH::FreeNode(uint32_t node)
+{
+    m_nodes[node].parent = m_freeList;
+    m_nodes[node].height = -1;
+    m_freeList = node;
+}
+
+void ObjectBVH::InsertLeaf(uint32_t leaf)
+{
+    if (m_root == INVALID)
+    {
+        m_root = leaf;
+        m_nodes[leaf].parent = INVALID;
+        return;
+    }
+
+    // Walk down to the cheapest sibling for the leaf (by surface area)
+    const BoundingBox leafBounds = m_nodes[leaf].bounds;
+    uint32_t sibling = m_root;
+    while (!m_nodes[sibling].IsLeaf())
+    {
+        const Node& node = m_nodes[sibling];
+
+        const float area = Area(node.bounds);
+        const float combinedArea = Area(Merged(node.bounds, leafBounds));
+
+        // Cost of pairing the leaf with this node, and the cost pushed down onto the children if it goes further
+        const float cost = 2.f * combinedArea;
+        const float inheritedCost = 2.f * (combinedArea - area);
+
+        float childCost[2];
+        for (int i = 0; i < 2; ++i)
+        {
+            const Node& child = m_nodes[node.children[i]];
+            const float mergedArea = Area(Merged(child.bounds, leafBounds));
+            childCost[i] = (child.IsLeaf() ? mergedArea : mergedArea - Area(child.bounds)) + inheritedCost;
+        }
+
+        if (cost < childCost[0] && cost < childCost[1])
+            break;
+
+        sibling = node.children[(childCost[0] < childCost[1] ? 0 : 1)];
+    }
+
+    // A new parent for the two of them, in the sibling's place
+    const uint32_t oldParent = m_nodes[sibling].parent;
+    const uint32_t newParent = AllocateNode();
+
+    Node& parent = m_nodes[newParent];
+    parent.parent = oldParent;
+    parent.bounds = Merged(leafBounds, m_nodes[sibling].bounds);
+    parent.height = m_nodes[sibling].height + 1;
+    parent.children[0] = sibling;
+    parent.children[1] = leaf;
+
+    if (oldParent != INVALID)
+    {
+        Node& grandParent = m_nodes[oldParent];
+        grandParent.children[(grandParent.children[0] == sibling ? 0 : 1)] = newParent;
+    }
+    else
+        m_root = newParent;
+
+    m_nodes[sibling].parent = newParent;
+    m_nodes[leaf].parent = newParent;
+
+    Refit(newParent);
+}
+
+void ObjectBVH::RemoveLeaf(uint32_t leaf)
+{
+    if (leaf == m_root)
+    {
+        m_root = INVALID;
+        return;
+    }
+
+    // The sibling takes the parent's place
+    const uint32_t parent = m_nodes[leaf].parent;
+    const uint32_t grandParent = m_nodes[parent].parent;
+    const uint32_t sibling = m_nodes[parent].children[(m_nodes[parent].children[0] == leaf ? 1 : 0)];
+
+    m_nodes[sibling].parent = grandParent;
+    FreeNode(parent);
+
+    if (grandParent != INVALID)
+    {
+        Node& node = m_nodes[grandParent];
+        node.children[(node.children[0] == parent ? 0 : 1)] = sibling;
+
+        Refit(grandParent);
+    }
+    else
+        m_root = sibling;
+}
+
+void ObjectBVH::Refit(uint32_t node)
+{
+    while (node != INVALID)
+    {
+        node = Balance(node);
+
+        Node& current = m_nodes[node];
+        const Node& childL = m_nodes[current.children[0]];
+        const Node& childR = m_nodes[current.children[1]];
+
+        current.height = 1 + std::max(childL.height, childR.height);
+        BoundingBox::CreateMerged(current.bounds, childL.bounds, childR.bounds);
+
+        node = current.parent;
+    }
+}
+
+uint32_t ObjectBVH::Balance(uint32_t iA)
+{
+    Node& a = m_nodes[iA];
+    if (a.IsLeaf() || a.height < 2)
+        return iA;
+
+    const uint32_t iB = a.children[0];
+    const uint32_t iC = a.children[1];
+    Node& b = m_nodes[iB];
+    Node& c = m_nodes[iC];
+
+    const int balance = c.height - b.height;
+    if (balance >= -1 && balance <= 1)
+        return iA;
+
+    // The taller child (up) takes A's place, and A takes the taller child's shorter child
+    const int upSide = (balance > 1 ? 1 : 0);
+    const uint32_t iUp = a.children[upSide];
+    Node& up = m_nodes[iUp];
+    const Node& other = (upSide == 1 ? b : c);
+
+    const uint32_t iF = up.children[0];
+    const uint32_t iG = up.children[1];
+    const bool keepF = (m_nodes[iF].height > m_nodes[iG].height);
+    const uint32_t iKept = (keepF ? iF : iG);
+    const uint32_t iMoved = (keepF ? iG : iF);
+
+    up.parent = a.parent;
+    if (up.parent != INVALID)
+    {
+        Node& parent = m_nodes[up.parent];
+        parent.children[(parent.children[0] == iA ? 0 : 1)] = iUp;
+    }
+    else
+        m_root = iUp;
+
+    up.children[0] = iA;
+    up.children[1] = iKept;
+    a.parent = iUp;
+
+    a.children[upSide] = iMoved;
+    m_nodes[iMoved].parent = iA;
+
+    BoundingBox::CreateMerged(a.bounds, other.bounds, m_nodes[iMoved].bounds);
+    a.height = 1 + std::max(other.height, m_nodes[iMoved].height);
+
+    BoundingBox::CreateMerged(up.bounds, a.bounds, m_nodes[iKept].bounds);
+    up.height = 1 + std::max(a.height, m_nodes[iKept].height);
+
+    return iUp;
+}
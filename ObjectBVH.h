@@ -0,0 +1,157 @@
+#pragma once
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+// Dynamic BVH over the world bounds of scene objects, for picking. Unlike ChunkBVH it is never rebuilt: items are
+// inserted, removed and moved one at a time, and the tree is kept balanced with rotations as it goes (as in Box2D's
+// dynamic tree). Leaves hold slightly fattened bounds, so objects that only move a little (e.g. while being dragged)
+// don't touch the tree at all until they leave them.
+class ObjectBVH
+{
+    struct Node
+    {
+        // Fattened, if a leaf
+        DirectX::BoundingBox bounds;
+        // Next free node, if free
+        uint32_t parent;
+        // INVALID if a leaf
+        uint32_t children[2];
+        uint32_t item;
+        // Leaves are 0, free nodes -1
+        int height;
+
+        bool IsLeaf() const { return children[0] == INVALID; }
+    };
+
+public:
+    static constexpr uint32_t INVALID = UINT32_MAX;
+
+    // Added to every side of an item's bounds (in metres)
+    static constexpr float MARGIN = 0.25f;
+
+    ObjectBVH() = default;
+
+    // Returns the item's proxy, which identifies it in the tree from then on
+    uint32_t Insert(uint32_t item, const DirectX::BoundingBox& bounds);
+    void Remove(uint32_t proxy);
+    // Returns true if the item had moved far enough to be put back in somewhere else
+    bool Move(uint32_t proxy, const DirectX::BoundingBox& bounds);
+    void Clear();
+
+    uint32_t GetItem(uint32_t proxy) const { return m_nodes[proxy].item; }
+    int GetHeight() const { return (m_root == INVALID ? 0 : m_nodes[m_root].height); }
+
+    // test(item, dist) tests an item's own geometry, returning true (and the distance along the ray) on a hit.
+    // Returns the nearest hit over all items, and which item it was
+    template <typename TestItem>
+    bool XM_CALLCONV Intersects(DirectX::FXMVECTOR origin, DirectX::FXMVECTOR direction, uint32_t& item, float& dist, TestItem test) const
+    {
+        dist = FLT_MAX;
+
+        float entry;
+        if (m_root == INVALID || !m_nodes[m_root].bounds.Intersects(origin, direction, entry))
+            return false;
+
+        struct Entry
+        {
+            uint32_t node;
+            float distance;
+        };
+
+        // The tree is kept balanced, so this is plenty deep
+        Entry stack[128];
+        int stackSize = 0;
+        stack[stackSize++] = { m_root, entry };
+
+        bool found = false;
+        while (stackSize > 0)
+        {
+            const Entry current = stack[--stackSize];
+
+            // Everything in here is further away than what's been hit already
+            if (current.distance >= dist)
+                continue;
+
+            const Node& node = m_nodes[current.node];
+            if (node.IsLeaf())
+            {
+                float itemDist;
+                if (test(node.item, itemDist) && itemDist < dist)
+                {
+                    dist = itemDist;
+                    item = node.item;
+                    found = true;
+                }
+                continue;
+            }
+
+            float distL, distR;
+            const bool hitL = m_nodes[node.children[0]].bounds.Intersects(origin, direction, distL);
+            const bool hitR = m_nodes[node.children[1]].bounds.Intersects(origin, direction, distR);
+
+            // Push the far child first, so the near one is visited first
+            if (hitL && hitR && distL < distR)
+            {
+                stack[stackSize++] = { node.children[1], distR };
+                stack[stackSize++] = { node.children[0], distL };
+            }
+            else
+            {
+                if (hitL)
+                    stack[stackSize++] = { node.children[0], distL };
+                if (hitR)
+                    stack[stackSize++] = { node.children[1], distR };
+            }
+        }
+
+        return found;
+    }
+
+    // visit(item) for every item whose (fattened) bounds intersect the volume, which can be anything with an
+    // Intersects(BoundingBox) (e.g. a BoundingFrustum)
+    template <typename Volume, typename Visit>
+    void Query(const Volume& volume, Visit visit) const
+    {
+        if (m_root == INVALID)
+            return;
+
+        uint32_t stack[128];
+        int stackSize = 0;
+        stack[stackSize++] = m_root;
+
+        while (stackSize > 0)
+        {
+            const Node& node = m_nodes[stack[--stackSize]];
+            if (!volume.Intersects(node.bounds))
+                continue;
+
+            if (node.IsLeaf())
+                visit(node.item);
+            else
+            {
+                stack[stackSize++] = node.children[0];
+                stack[stackSize++] = node.children[1];
+            }
+        }
+    }
+
+private:
+    uint32_t AllocateNode();
+    void FreeNode(uint32_t node);
+
+    void InsertLeaf(uint32_t leaf);
+    void RemoveLeaf(uint32_t leaf);
+
+    // Rotates the subtree at node if it's unbalanced, returning the node now at the top of it
+    uint32_t Balance(uint32_t node);
+    // Fixes up the heights and bounds of everything from node up, balancing along the way
+    void Refit(uint32_t node);
+
+    std::vector<Node> m_nodes;
+    uint32_t m_root = INVALID;
+    uint32_t m_freeList = INVALID;
+};
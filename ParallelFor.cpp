@@ -0,0 +1,136 @@
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // Set on the workers, and on a thread while it's running a ParallelFor
+    thread_local bool t_insideParallelFor = false;
+
+    // One worker per hardware thread (but one, as the calling thread works too), kept waiting between jobs.
+    // Runs one job at a time
+    class WorkerPool
+    {
+    public:
+        WorkerPool()
+        {
+            const unsigned numWorkers = std::max(1u, std::thread::hardware_concurrency()) - 1;
+
+            m_workers.reserve(numWorkers);
+            for (unsigned i = 0; i < numWorkers; ++i)
+                m_workers.emplace_back(&WorkerPool::Work, this);
+        }
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        ~WorkerPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_quit = true;
+            }
+            m_wake.notify_all();
+
+            for (std::thread& worker : m_workers)
+                worker.join();
+        }
+
+        // Returns false (having done nothing) if another job is running
+        bool Run(size_t count, void (*call)(void*, size_t), void* context)
+        {
+            std::unique_lock<std::mutex> running(m_runMutex, std::try_to_lock);
+            if (!running.owns_lock())
+                return false;
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_call = call;
+                m_context = context;
+                m_count = count;
+                m_next = 0;
+                m_numBusy = m_workers.size();
+                ++m_job;
+            }
+            m_wake.notify_all();
+
+            Process();
+
+            // Every worker has to be done with the job (not just out of items) before it goes out of scope
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done.wait(lock, [this]() { return m_numBusy == 0; });
+            return true;
+        }
+
+    private:
+        void Process()
+        {
+            for (size_t i = m_next++; i < m_count; i = m_next++)
+                m_call(m_context, i);
+        }
+
+        void Work()
+        {
+            t_insideParallelFor = true;
+
+            uint64_t lastJob = 0;
+            for (;;)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_wake.wait(lock, [&]() { return m_quit || m_job != lastJob; });
+                    if (m_quit)
+                        return;
+
+                    lastJob = m_job;
+                }
+
+                Process();
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (--m_numBusy == 0)
+                    m_done.notify_one();
+            }
+        }
+
+        std::vector<std::thread> m_workers;
+
+        // Held while a job runs
+        std::mutex m_runMutex;
+
+        // The current job. Only changed (under m_mutex) while no worker is busy with one
+        std::mutex m_mutex;
+        std::condition_variable m_wake, m_done;
+        void (*m_call)(void*, size_t) = nullptr;
+        void* m_context = nullptr;
+        size_t m_count = 0;
+        std::atomic<size_t> m_next{ 0 };
+        size_t m_numBusy = 0;
+        uint64_t m_job = 0;
+        bool m_quit = false;
+    };
+}
+
+void RunParallelFor(size_t count, void (*call)(void* context, size_t i), void* context)
+{
+    if (count > 1 && !t_insideParallelFor)
+    {
+        static WorkerPool pool;
+
+        t_insideParallelFor = true;
+        const bool ran = pool.Run(count, call, context);
+        t_insideParallelFor = false;
+
+        if (ran)
+            return;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+        call(context, i);
+}
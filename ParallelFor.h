@@ -0,0 +1,19 @@
+#pragma once
+#include <cstddef>
+
+// Runs call(context, i) for every i in [0, count), on the shared worker threads (see ParallelFor.cpp) and the calling
+// thread. Runs it all on the calling thread instead if that's a worker already (i.e. ParallelFor is nested), or the
+// workers are busy with another thread's ParallelFor
+void RunParallelFor(size_t count, void (*call)(void* context, size_t i), void* context);
+
+// Runs func(i) for every i in [0, count) across all hardware threads (including the calling thread).
+// Work items are handed out one at a time, so uneven work per item balances itself out. The threads are started once
+// and kept for every call after
+template <typename Func>
+void ParallelFor(size_t count, Func func)
+{
+    if (count == 0)
+        return;
+
+    RunParallelFor(count, [](void* context, size_t i) { (*static_cast<Func*>(context))(i); }, &func);
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "SceneStore.h"
+
 #include <string>
 
 
@@ -47,3 +49,5 @@ public:
 
 };
 
+// Scene objects by ID (see SceneStore)
+using SceneGraph = SceneStore<SceneObject, &SceneObject::ID>;
@@ -0,0 +1,204 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Objects keyed by an int ID (the member IDMember of T), with O(1) insert, remove and lookup by ID.
+// The objects themselves are kept packed together (removing one moves the last object into its place),
+// so iterating over them is a walk along an array. Pointers and iterators are invalidated by any insert
+// or remove; to hold on to an object across those, keep its Handle, which stays valid for as long as the
+// object is in the store (and safely comes back null once it's gone, even if its place has been reused).
+template <typename T, int T::*IDMember>
+class SceneStore
+{
+public:
+    struct Handle
+    {
+        uint32_t slot = UINT32_MAX;
+        uint32_t generation = 0;
+
+        bool IsNull() const { return slot == UINT32_MAX; }
+    };
+
+    using iterator = typename std::vector<T>::iterator;
+    using const_iterator = typename std::vector<T>::const_iterator;
+
+    SceneStore() = default;
+
+    // Replaces the object with the same ID if there is one (keeping its handle valid)
+    Handle Insert(const T& object)
+    {
+        const int id = object.*IDMember;
+
+        auto existing = m_lookup.find(id);
+        if (existing != m_lookup.end())
+        {
+            m_objects[m_slots[existing->second].index] = object;
+            return{ existing->second, m_slots[existing->second].generation };
+        }
+
+        uint32_t slot;
+        if (!m_freeSlots.empty())
+        {
+            slot = m_freeSlots.back();
+            m_freeSlots.pop_back();
+        }
+        else
+        {
+            slot = uint32_t(m_slots.size());
+            m_slots.push_back(Slot());
+        }
+
+        m_slots[slot].index = uint32_t(m_objects.size());
+        m_objects.push_back(object);
+        m_objectSlots.push_back(slot);
+        m_lookup.emplace(id, slot);
+
+        return{ slot, m_slots[slot].generation };
+    }
+
+    // Returns false if there was no object with that ID
+    bool Remove(int id)
+    {
+        auto found = m_lookup.find(id);
+        if (found == m_lookup.end())
+            return false;
+
+        const uint32_t slot = found->second;
+        m_lookup.erase(found);
+
+        // Fill the gap with the last object
+        const uint32_t index = m_slots[slot].index;
+        const uint32_t last = uint32_t(m_objects.size() - 1);
+        if (index != last)
+        {
+            m_objects[index] = std::move(m_objects[last]);
+            m_objectSlots[index] = m_objectSlots[last];
+            m_slots[m_objectSlots[index]].index = index;
+        }
+
+        m_objects.pop_back();
+        m_objectSlots.pop_back();
+
+        // Outstanding handles to the slot go stale
+        ++m_slots[slot].generation;
+        m_freeSlots.push_back(slot);
+
+        return true;
+    }
+
+    // Removes every object pred(object) returns true for (pred is called once for each object, in no particular order)
+    template <typename Pred>
+    size_t RemoveIf(Pred pred)
+    {
+        size_t removed = 0;
+
+        // Backwards, so the objects moved into the gaps have already been looked at
+        for (size_t i = m_objects.size(); i-- > 0;)
+        {
+            if (pred(m_objects[i]))
+            {
+                Remove(m_objects[i].*IDMember);
+                ++removed;
+            }
+        }
+
+        return removed;
+    }
+
+    void clear()
+    {
+        // Bump every generation, so no handle given out so far comes back to life
+        m_freeSlots.clear();
+        for (uint32_t slot = 0; slot < m_slots.size(); ++slot)
+        {
+            ++m_slots[slot].generation;
+            m_freeSlots.push_back(slot);
+        }
+
+        m_objects.clear();
+        m_objectSlots.clear();
+        m_lookup.clear();
+    }
+
+    void reserve(size_t count)
+    {
+        m_objects.reserve(count);
+        m_objectSlots.reserve(count);
+        m_lookup.reserve(count);
+    }
+
+    // Null if there's no object with that ID
+    T* Find(int id)
+    {
+        auto found = m_lookup.find(id);
+        return (found == m_lookup.end() ? nullptr : &m_objects[m_slots[found->second].index]);
+    }
+
+    const T* Find(int id) const
+    {
+        auto found = m_lookup.find(id);
+        return (found == m_lookup.end() ? nullptr : &m_objects[m_slots[found->second].index]);
+    }
+
+    bool Contains(int id) const { return m_lookup.count(id) != 0; }
+
+    // A null handle if there's no object with that ID
+    Handle GetHandle(int id) const
+    {
+        auto found = m_lookup.find(id);
+        if (found == m_lookup.end())
+            return Handle();
+
+        return{ found->second, m_slots[found->second].generation };
+    }
+
+    // Null if the object has been removed since the handle was given out
+    T* Get(Handle handle)
+    {
+        if (handle.slot >= m_slots.size() || m_slots[handle.slot].generation != handle.generation)
+            return nullptr;
+
+        return &m_objects[m_slots[handle.slot].index];
+    }
+
+    const T* Get(Handle handle) const
+    {
+        return const_cast<SceneStore*>(this)->Get(handle);
+    }
+
+    size_t size() const { return m_objects.size(); }
+    bool empty() const { return m_objects.empty(); }
+
+    // In packed order (which changes as objects are removed). Changing an object's ID in place isn't allowed
+    T& operator[](size_t index) { return m_objects[index]; }
+    const T& operator[](size_t index) const { return m_objects[index]; }
+
+    iterator begin() { return m_objects.begin(); }
+    iterator end() { return m_objects.end(); }
+    const_iterator begin() const { return m_objects.begin(); }
+    const_iterator end() const { return m_objects.end(); }
+    const_iterator cbegin() const { return m_objects.cbegin(); }
+    const_iterator cend() const { return m_objects.cend(); }
+
+private:
+    struct Slot
+    {
+        // Where the object is in m_objects
+        uint32_t index = 0;
+        // Bumped every time the slot is freed
+        uint32_t generation = 0;
+    };
+
+    // Packed objects, and the slot each of them is in
+    std::vector<T> m_objects;
+    std::vector<uint32_t> m_objectSlots;
+
+    std::vector<Slot> m_slots;
+    std::vector<uint32_t> m_freeSlots;
+
+    // ID -> slot
+    std::unordered_map<int, uint32_t> m_lookup;
+};
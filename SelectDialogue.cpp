@@ -16,10 +16,10 @@ BEGIN_MESSAGE_MAP(SelectDialogue, CDialogEx)
 END_MESSAGE_MAP()
 
 
-SelectDialogue::SelectDialogue(CWnd* pParent, std::vector<SceneObject>* SceneGraph)		//constructor used in modal
+SelectDialogue::SelectDialogue(CWnd* pParent, SceneGraph* sceneGraph)		//constructor used in modal
 	: CDialogEx(IDD_DIALOG1, pParent)
 {
-	m_sceneGraph = SceneGraph;
+	m_sceneGraph = sceneGraph;
 }
 
 SelectDialogue::SelectDialogue(CWnd * pParent)			//constructor used in modeless
@@ -32,9 +32,9 @@ SelectDialogue::~SelectDialogue()
 }
 
 ///pass through pointers to the data in the tool we want to manipulate
-void SelectDialogue::SetObjectData(std::vector<SceneObject>* SceneGraph, std::vector<int>* selections)
+void SelectDialogue::SetObjectData(SceneGraph* sceneGraph, SelectionSet* selections)
 {
-	m_sceneGraph = SceneGraph;
+	m_sceneGraph = sceneGraph;
 	m_currentSelections = selections;
 
 	//roll through all the objects in the scene graph and put an entry for each in the listbox
@@ -42,7 +42,7 @@ void SelectDialogue::SetObjectData(std::vector<SceneObject>* SceneGraph, std::ve
 	for (int i = 0; i < numSceneObjects; i++)
 	{
 		//easily possible to make the data string presented more complex. showing other columns.
-		std::wstring listBoxEntry = std::to_wstring(m_sceneGraph->at(i).ID);
+		std::wstring listBoxEntry = std::to_wstring((*m_sceneGraph)[i].ID);
 		m_listBox.AddString(listBoxEntry.c_str());
 	}
 }
@@ -72,13 +72,13 @@ void SelectDialogue::Select()
 	selections.resize(actualSelections);
 
     // Get the ID of the item in the list from the list box and add it to our selected objects vector
-	m_currentSelections->clear();
+	m_currentSelections->Clear();
 	for (int selection : selections)
 	{
 		CString value;
 		m_listBox.GetText(selection, value);
 
-		m_currentSelections->push_back(_ttoi(value));
+		m_currentSelections->Insert(_ttoi(value));
 	}
 }
 
@@ -92,7 +92,7 @@ BOOL SelectDialogue::OnInitDialog()
 	for (size_t i = 0; i < numSceneObjects; i++)
 	{
 		//easily possible to make the data string presented more complex. showing other columns.
-		std::wstring listBoxEntry = std::to_wstring(m_sceneGraph->at(i).ID);
+		std::wstring listBoxEntry = std::to_wstring((*m_sceneGraph)[i].ID);
 		m_listBox.AddString(listBoxEntry.c_str());
 	}*/
 	
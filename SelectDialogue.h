@@ -3,6 +3,7 @@
 #include "resource.h"
 #include "afxwin.h"
 #include "SceneObject.h"
+#include "SelectionSet.h"
 #include <vector>
 
 // SelectDialogue dialog
@@ -12,10 +13,10 @@ class SelectDialogue : public CDialogEx
 	DECLARE_DYNAMIC(SelectDialogue)
 
 public:
-	SelectDialogue(CWnd* pParent, std::vector<SceneObject>* SceneGraph);   // modal // takes in out scenegraph in the constructor
+	SelectDialogue(CWnd* pParent, SceneGraph* sceneGraph);   // modal // takes in out scenegraph in the constructor
 	SelectDialogue(CWnd* pParent = NULL);
 	virtual ~SelectDialogue();
-	void SetObjectData(std::vector<SceneObject>* SceneGraph, std::vector<int>* selections);	//passing in pointers to the data the class will operate on.
+	void SetObjectData(SceneGraph* sceneGraph, SelectionSet* selections);	//passing in pointers to the data the class will operate on.
 	
 // Dialog Triangle
 #ifdef AFX_DESIGN_TIME
@@ -27,8 +28,8 @@ protected:
 	afx_msg void End();		//kill the dialogue
 	afx_msg void Select();	//Item has been selected
 
-	std::vector<SceneObject> * m_sceneGraph;
-	std::vector<int>* m_currentSelections;
+	SceneGraph * m_sceneGraph;
+	SelectionSet* m_currentSelections;
 	
 
 	DECLARE_MESSAGE_MAP()
@@ -0,0 +1,259 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// The IDs of the selected objects, as a hashed bitset: IDs are split into 32-bit words (ID / 32), and only the words
+// with a bit set are kept, packed together, with a hash table (open addressing) to find each one. So whether an object
+// is selected is a single lookup, while clearing, copying and iterating cost what's selected, however big the IDs are.
+// Iteration is in no particular order.
+// The version goes up whenever what's in it changes, so anything worked out from the selection (or a copy of it)
+// only needs redoing when the version isn't the one it was worked out from.
+class SelectionSet
+{
+    struct Word
+    {
+        uint32_t index;
+        // Never all zero (the word is removed instead)
+        uint32_t bits;
+    };
+
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+public:
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = int;
+        using difference_type = ptrdiff_t;
+        using pointer = const int*;
+        using reference = int;
+
+        const_iterator(const Word* word, const Word* end)
+            : m_word(word), m_end(end), m_bits(word != end ? word->bits : 0)
+        {
+        }
+
+        int operator*() const { return int(m_word->index * 32 + LowestBit(m_bits)); }
+
+        const_iterator& operator++()
+        {
+            // Clear the lowest bit, moving on to the next word once they're all gone
+            m_bits &= m_bits - 1;
+            if (m_bits == 0 && ++m_word != m_end)
+                m_bits = m_word->bits;
+
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            const_iterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        bool operator==(const const_iterator& other) const { return m_word == other.m_word && m_bits == other.m_bits; }
+        bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+    private:
+        const Word* m_word;
+        const Word* m_end;
+        // What's left of the current word
+        uint32_t m_bits;
+    };
+
+    SelectionSet() = default;
+
+    bool Contains(int id) const
+    {
+        if (id < 0 || m_words.empty())
+            return false;
+
+        const uint32_t slot = m_table[FindSlot(uint32_t(id) / 32)];
+        return slot != EMPTY && (m_words[slot].bits & Bit(id)) != 0;
+    }
+
+    // Each returns true if the set has changed
+    bool Insert(int id)
+    {
+        if (id < 0)
+            return false;
+
+        const uint32_t index = uint32_t(id) / 32;
+        if (!m_words.empty())
+        {
+            const uint32_t slot = m_table[FindSlot(index)];
+            if (slot != EMPTY)
+            {
+                if ((m_words[slot].bits & Bit(id)) != 0)
+                    return false;
+
+                m_words[slot].bits |= Bit(id);
+                ++m_size;
+                ++m_version;
+                return true;
+            }
+        }
+
+        // A new word. The table is kept at most half full
+        if ((m_words.size() + 1) * 2 > m_table.size())
+            Rehash(m_table.empty() ? 16 : m_table.size() * 2);
+
+        m_table[FindSlot(index)] = uint32_t(m_words.size());
+        m_words.push_back({ index, Bit(id) });
+        ++m_size;
+        ++m_version;
+        return true;
+    }
+
+    bool Erase(int id)
+    {
+        if (!Contains(id))
+            return false;
+
+        const size_t tableSlot = FindSlot(uint32_t(id) / 32);
+        const uint32_t slot = m_table[tableSlot];
+
+        m_words[slot].bits &= ~Bit(id);
+        --m_size;
+        ++m_version;
+
+        if (m_words[slot].bits != 0)
+            return true;
+
+        // The word is empty, so it goes: the last word takes its place
+        RemoveFromTable(tableSlot);
+        if (slot != m_words.size() - 1)
+        {
+            m_words[slot] = m_words.back();
+            m_table[FindSlot(m_words[slot].index)] = slot;
+        }
+        m_words.pop_back();
+
+        return true;
+    }
+
+    void Clear()
+    {
+        if (m_size == 0)
+            return;
+
+        // Only the table slots in use need emptying. They're all found first (the words' bits are going anyway, so they
+        // hold them in the meantime), as emptying some would cut others off from where they're looked for
+        for (Word& word : m_words)
+            word.bits = uint32_t(FindSlot(word.index));
+        for (const Word& word : m_words)
+            m_table[word.bits] = EMPTY;
+
+        m_words.clear();
+        m_size = 0;
+        ++m_version;
+    }
+
+    // Makes this the only selected object
+    void Select(int id)
+    {
+        if (m_size == 1 && Contains(id))
+            return;
+
+        Clear();
+        Insert(id);
+    }
+
+    // Assigning copies the contents and moves the version on (the version is this set's, not the other's)
+    SelectionSet& operator=(const SelectionSet& other)
+    {
+        if (this == &other)
+            return *this;
+
+        m_words = other.m_words;
+        m_table = other.m_table;
+        m_size = other.m_size;
+        ++m_version;
+        return *this;
+    }
+
+    SelectionSet(const SelectionSet& other) : m_words(other.m_words), m_table(other.m_table), m_size(other.m_size) {}
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    // Any one of the IDs (the set mustn't be empty)
+    int front() const { return *begin(); }
+
+    const_iterator begin() const { return const_iterator(m_words.data(), m_words.data() + m_words.size()); }
+    const_iterator end() const { return const_iterator(m_words.data() + m_words.size(), m_words.data() + m_words.size()); }
+
+    uint64_t GetVersion() const { return m_version; }
+
+private:
+    static uint32_t Bit(int id) { return uint32_t(1) << (uint32_t(id) % 32); }
+
+    static size_t Hash(uint32_t index)
+    {
+        // Fibonacci hashing, with the high bits folded down as the table is indexed with the low ones
+        const uint32_t hash = index * 2654435769u;
+        return hash ^ (hash >> 16);
+    }
+
+    // The table slot holding the word, or the empty slot it would go in (the table mustn't be empty)
+    size_t FindSlot(uint32_t index) const
+    {
+        const size_t mask = m_table.size() - 1;
+        size_t slot = Hash(index) & mask;
+        while (m_table[slot] != EMPTY && m_words[m_table[slot]].index != index)
+            slot = (slot + 1) & mask;
+
+        return slot;
+    }
+
+    // Empties a table slot, moving later entries of the same run back so none end up out of reach
+    void RemoveFromTable(size_t slot)
+    {
+        const size_t mask = m_table.size() - 1;
+        for (size_t next = (slot + 1) & mask; m_table[next] != EMPTY; next = (next + 1) & mask)
+        {
+            // The entry can fill the gap if the gap is between where it wants to be and where it is
+            const size_t home = Hash(m_words[m_table[next]].index) & mask;
+            if (((next - home) & mask) >= ((next - slot) & mask))
+            {
+                m_table[slot] = m_table[next];
+                slot = next;
+            }
+        }
+
+        m_table[slot] = EMPTY;
+    }
+
+    void Rehash(size_t tableSize)
+    {
+        m_table.assign(tableSize, uint32_t(EMPTY));
+        for (uint32_t word = 0; word < m_words.size(); ++word)
+            m_table[FindSlot(m_words[word].index)] = word;
+    }
+
+    static uint32_t LowestBit(uint32_t bits)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, bits);
+        return index;
+#else
+        return uint32_t(__builtin_ctz(bits));
+#endif
+    }
+
+    // The words with any bits set, and where each is in there (EMPTY if nowhere) by hash. The table's size is a power
+    // of two
+    std::vector<Word> m_words;
+    std::vector<uint32_t> m_table;
+    size_t m_size = 0;
+    uint64_t m_version = 0;
+};
@@ -0,0 +1,276 @@
+#include "pch.h"
+#include "SplatMap.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+
+namespace
+{
+    // Weights a texel moves towards when a layer is painted onto it
+    const XMVECTORF32 LAYER_TARGETS[SplatMap::NUM_LAYERS] =
+    {
+        { 1.f, 0.f, 0.f, 0.f },
+        { 0.f, 1.f, 0.f, 0.f },
+        { 0.f, 0.f, 1.f, 0.f },
+        { 0.f, 0.f, 0.f, 1.f }
+    };
+
+    // Converts normalised weights to bytes that sum to exactly 255
+    XMUBYTEN4 XM_CALLCONV Quantise(FXMVECTOR weights)
+    {
+        XMFLOAT4 q;
+        XMStoreFloat4(&q, XMVectorRound(XMVectorScale(weights, 255.f)));
+
+        float* channels = &q.x;
+
+        // Rounding can leave us a step or two off--give the difference to the heaviest layer
+        float residual = 255.f - (q.x + q.y + q.z + q.w);
+        *std::max_element(channels, channels + SplatMap::NUM_LAYERS) += residual;
+
+        return XMUBYTEN4(uint8_t(q.x), uint8_t(q.y), uint8_t(q.z), uint8_t(q.w));
+    }
+}
+
+void SplatMap::Initialise(int width, int height)
+{
+    m_width = width;
+    m_height = height;
+    m_tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    m_tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    m_weights.assign(width * height, XMUBYTEN4(uint8_t(255), uint8_t(0), uint8_t(0), uint8_t(0)));
+
+    m_uploadDirty.assign(m_tilesX * m_tilesY, true);
+    m_saveDirty.assign(m_tilesX * m_tilesY, false);
+    m_fileMatches = false;
+}
+
+bool SplatMap::Load(const std::string& path)
+{
+    const int width = m_width, height = m_height;
+    Initialise(width, height);
+
+    FILE *pFile = NULL;
+    errno_t ret = fopen_s(&pFile, path.c_str(), "rb");
+    if (ret != 0 || pFile == NULL)
+        return false;
+
+    size_t read = fread(m_weights.data(), sizeof(XMUBYTEN4), m_weights.size(), pFile);
+    fclose(pFile);
+
+    // Not an alpha map for this terrain--start over rather than using half a file
+    if (read != m_weights.size())
+    {
+        Initialise(width, height);
+        return false;
+    }
+
+    m_fileMatches = true;
+    return true;
+}
+
+bool SplatMap::Save(const std::string& path)
+{
+    // Only the painted tiles need writing if the file on disk is the one that was loaded (or last saved in full)
+    if (m_fileMatches)
+    {
+        FILE *pFile = NULL;
+        errno_t ret = fopen_s(&pFile, path.c_str(), "r+b");
+        if (ret == 0 && pFile != NULL)
+        {
+            for (int tileY = 0; tileY < m_tilesY; ++tileY)
+                for (int tileX = 0; tileX < m_tilesX; ++tileX)
+                    if (m_saveDirty[tileY * m_tilesX + tileX])
+                        WriteTile(pFile, tileX, tileY);
+
+            bool succeeded = (ferror(pFile) == 0);
+            succeeded = (fclose(pFile) == 0) && succeeded;
+
+            if (succeeded)
+                std::fill(m_saveDirty.begin(), m_saveDirty.end(), false);
+
+            return succeeded;
+        }
+    }
+
+    // Otherwise the whole map is written, to a temporary file first (as HeightMapWriter does) so that a failed save
+    // never leaves a half-written map behind
+    const std::string tempPath = path + ".tmp";
+
+    FILE *pFile = NULL;
+    errno_t ret = fopen_s(&pFile, tempPath.c_str(), "wb");
+    if (ret != 0 || pFile == NULL)
+        return false;
+
+    bool succeeded = (fwrite(m_weights.data(), sizeof(XMUBYTEN4), m_weights.size(), pFile) == m_weights.size());
+    succeeded = (fclose(pFile) == 0) && succeeded;
+
+    if (succeeded)
+        succeeded = (MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0);
+
+    if (!succeeded)
+    {
+        remove(tempPath.c_str());
+        return false;
+    }
+
+    std::fill(m_saveDirty.begin(), m_saveDirty.end(), false);
+    m_fileMatches = true;
+    return true;
+}
+
+void SplatMap::Paint(float centerX, float centerY, float radius, int layer, float strength)
+{
+    if (layer < 0 || layer >= NUM_LAYERS || radius <= 0.f)
+        return;
+
+    const int minX = std::max(0, int(std::floor(centerX - radius)));
+    const int minY = std::max(0, int(std::floor(centerY - radius)));
+    const int maxX = std::min(m_width - 1, int(std::ceil(centerX + radius)));
+    const int maxY = std::min(m_height - 1, int(std::ceil(centerY + radius)));
+
+    if (minX > maxX || minY > maxY)
+        return;
+
+    const XMVECTOR target = LAYER_TARGETS[layer];
+
+    for (int y = minY; y <= maxY; ++y)
+    {
+        for (int x = minX; x <= maxX; ++x)
+        {
+            float dx = x - centerX;
+            float dy = y - centerY;
+            float distance = std::sqrt(dx * dx + dy * dy);
+            if (distance >= radius)
+                continue;
+
+            // Same falloff as the sculpting brush
+            float amount = strength * (1.f - (distance / radius));
+
+            XMUBYTEN4& texel = m_weights[y * m_width + x];
+
+            // Blend towards the painted layer, then renormalise so the layers still sum to one
+            XMVECTOR weights = XMVectorLerp(XMLoadUByteN4(&texel), target, std::min(amount, 1.f));
+            weights = XMVectorDivide(weights, XMVector4Dot(weights, g_XMOne));
+
+            texel = Quantise(weights);
+        }
+    }
+
+    MarkDirty(minX, minY, maxX, maxY);
+}
+
+void SplatMap::CopyTile(int tile, std::vector<XMUBYTEN4>& weights) const
+{
+    const D3D11_BOX box = GetTileBox(tile % m_tilesX, tile / m_tilesX);
+
+    weights.clear();
+    weights.reserve((box.right - box.left) * (box.bottom - box.top));
+    for (UINT y = box.top; y < box.bottom; ++y)
+        weights.insert(weights.end(), &m_weights[y * m_width + box.left], &m_weights[y * m_width + box.right - 1] + 1);
+}
+
+void SplatMap::SwapTile(int tile, std::vector<XMUBYTEN4>& weights)
+{
+    const D3D11_BOX box = GetTileBox(tile % m_tilesX, tile / m_tilesX);
+    assert(weights.size() == (box.right - box.left) * (box.bottom - box.top));
+
+    size_t i = 0;
+    for (UINT y = box.top; y < box.bottom; ++y)
+        for (UINT x = box.left; x < box.right; ++x)
+            std::swap(m_weights[y * m_width + x], weights[i++]);
+
+    MarkDirty(box.left, box.top, box.right - 1, box.bottom - 1);
+}
+
+void SplatMap::CreateTexture(ID3D11Device* device)
+{
+    CD3D11_TEXTURE2D_DESC desc(DXGI_FORMAT_R8G8B8A8_UNORM, m_width, m_height, 1, 1, D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_DEFAULT);
+
+    D3D11_SUBRESOURCE_DATA initialData;
+    initialData.pSysMem = m_weights.data();
+    initialData.SysMemPitch = m_width * sizeof(XMUBYTEN4);
+    initialData.SysMemSlicePitch = 0;
+
+    if (FAILED(device->CreateTexture2D(&desc, &initialData, m_texture.ReleaseAndGetAddressOf())))
+        return;
+
+    device->CreateShaderResourceView(m_texture.Get(), nullptr, m_srv.ReleaseAndGetAddressOf());
+
+    // The texture was created from the current weights
+    std::fill(m_uploadDirty.begin(), m_uploadDirty.end(), false);
+}
+
+void SplatMap::UploadDirtyTiles(ID3D11DeviceContext* context)
+{
+    if (!m_texture)
+        return;
+
+    const UINT rowPitch = m_width * sizeof(XMUBYTEN4);
+
+    for (int tileY = 0; tileY < m_tilesY; ++tileY)
+    {
+        for (int tileX = 0; tileX < m_tilesX; ++tileX)
+        {
+            const int tile = tileY * m_tilesX + tileX;
+            if (!m_uploadDirty[tile])
+                continue;
+
+            D3D11_BOX box = GetTileBox(tileX, tileY);
+            context->UpdateSubresource(m_texture.Get(), 0, &box, &m_weights[box.top * m_width + box.left], rowPitch, 0);
+
+            m_uploadDirty[tile] = false;
+        }
+    }
+}
+
+XMVECTOR SplatMap::GetWeights(int x, int y) const
+{
+    x = std::min(std::max(x, 0), m_width - 1);
+    y = std::min(std::max(y, 0), m_height - 1);
+
+    return XMLoadUByteN4(&m_weights[y * m_width + x]);
+}
+
+void SplatMap::MarkDirty(int minX, int minY, int maxX, int maxY)
+{
+    for (int tileY = minY / TILE_SIZE; tileY <= maxY / TILE_SIZE; ++tileY)
+    {
+        for (int tileX = minX / TILE_SIZE; tileX <= maxX / TILE_SIZE; ++tileX)
+        {
+            m_uploadDirty[tileY * m_tilesX + tileX] = true;
+            m_saveDirty[tileY * m_tilesX + tileX] = true;
+        }
+    }
+}
+
+void SplatMap::WriteTile(FILE* file, int tileX, int tileY) const
+{
+    D3D11_BOX box = GetTileBox(tileX, tileY);
+
+    // Tiles aren't contiguous in the file, so write it one row segment at a time
+    for (UINT y = box.top; y < box.bottom; ++y)
+    {
+        const size_t first = y * m_width + box.left;
+
+        fseek(file, long(first * sizeof(XMUBYTEN4)), SEEK_SET);
+        fwrite(&m_weights[first], sizeof(XMUBYTEN4), box.right - box.left, file);
+    }
+}
+
+D3D11_BOX SplatMap::GetTileBox(int tileX, int tileY) const
+{
+    D3D11_BOX box;
+    box.left = tileX * TILE_SIZE;
+    box.top = tileY * TILE_SIZE;
+    box.right = std::min((tileX + 1) * TILE_SIZE, m_width);
+    box.bottom = std::min((tileY + 1) * TILE_SIZE, m_height);
+    box.front = 0;
+    box.back = 1;
+
+    return box;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <d3d11_1.h>
+#include <DirectXMath.h>
+#include <DirectXPackedVector.h>
+#include <wrl/client.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// CPU-side splat weights for the terrain (one RGBA8 texel per weight, one channel per splat layer).
+// Weights are kept normalised (channels always sum to 255), and the map is split into tiles so that
+// only the areas that have been painted need to be uploaded to the GPU or written back to disk.
+class SplatMap
+{
+public:
+    static constexpr int NUM_LAYERS = 4;
+    static constexpr int TILE_SIZE = 16;
+
+    SplatMap() = default;
+
+    // Resets all weights to be fully layer 0
+    void Initialise(int width, int height);
+
+    // Reads an RGBA8 .raw alpha map. Falls back to Initialise() if the file is missing or the wrong size
+    bool Load(const std::string& path);
+    // Writes the tiles that have been painted since the last save. The whole map is written (and swapped in for the
+    // file) unless the map was loaded from that file or saved to it in full, e.g. if it's missing or Load rejected it
+    bool Save(const std::string& path);
+
+    // Paints 'layer' into a circle (in texel coordinates) with a linear falloff towards the edge
+    void Paint(float centerX, float centerY, float radius, int layer, float strength);
+
+    // The weights over a tile (row by row), for undoing painting. Swapping puts the given weights in the map and the
+    // map's in 'weights'
+    void CopyTile(int tile, std::vector<DirectX::PackedVector::XMUBYTEN4>& weights) const;
+    void SwapTile(int tile, std::vector<DirectX::PackedVector::XMUBYTEN4>& weights);
+
+    // GPU copy of the weights
+    void CreateTexture(ID3D11Device* device);
+    void UploadDirtyTiles(ID3D11DeviceContext* context);
+    ID3D11ShaderResourceView* GetShaderResourceView() const { return m_srv.Get(); }
+
+    int GetWidth() const { return m_width; }
+    int GetHeight() const { return m_height; }
+
+    // True if any tiles have been painted since the last successful Save()
+    bool HasUnsavedTiles() const { return std::find(m_saveDirty.begin(), m_saveDirty.end(), true) != m_saveDirty.end(); }
+    // CPU weights plus their GPU copy
+    size_t GetMemoryUsage() const { return m_weights.size() * sizeof(DirectX::PackedVector::XMUBYTEN4) * 2; }
+
+    // Normalised weights of a single texel (x = layer 0, ..., w = layer 3)
+    DirectX::XMVECTOR GetWeights(int x, int y) const;
+
+private:
+    void MarkDirty(int minX, int minY, int maxX, int maxY);
+    void WriteTile(FILE* file, int tileX, int tileY) const;
+    D3D11_BOX GetTileBox(int tileX, int tileY) const;
+
+    int m_width = 0;
+    int m_height = 0;
+    int m_tilesX = 0;
+    int m_tilesY = 0;
+
+    std::vector<DirectX::PackedVector::XMUBYTEN4> m_weights;
+
+    // Tiles that have changed since they were last uploaded/saved
+    std::vector<bool> m_uploadDirty;
+    std::vector<bool> m_saveDirty;
+
+    // Whether the file holds this map as of the last save (everything but the tiles in m_saveDirty), so the painted
+    // tiles can be written into it where they are
+    bool m_fileMatches = false;
+
+    Microsoft::WRL::ComPtr<ID3D11Texture2D>             m_texture;
+    Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>    m_srv;
+};
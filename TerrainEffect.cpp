@@ -0,0 +1,86 @@
+#include "TerrainEffect.h"
+#include <algorithm>
+#include <cfloat>
+
+TerrainEffect::TerrainEffect(ID3D11Device * device)
+    :   CustomEffect(device, L"terrain_vs.cso", L"terrain_ps.cso")
+{
+    // Create constant buffers
+    m_matrixBuffer.Create(device);
+    m_propertiesBuffer.Create(device);
+
+    // No morphing until told otherwise
+    m_terrainProperties.cameraPosition = g_XMZero;
+    for (XMFLOAT4& range : m_terrainProperties.morphRanges)
+        range = XMFLOAT4(FLT_MAX * 0.5f, FLT_MAX, 0.f, 0.f);
+
+    m_terrainProperties.grid = XMFLOAT4(1.f, 1.f, 0.f, 0.f);
+    m_terrainProperties.texCoord = XMFLOAT4(1.f, 1.f, 0.f, 0.f);
+    m_terrainProperties.splatTiling = XMFLOAT4(1.f, 1.f, 1.f, 1.f);
+}
+
+void TerrainEffect::Apply(ID3D11DeviceContext* deviceContext)
+{
+    CustomEffect::Apply(deviceContext);
+
+    // Set constant buffers
+    m_matrixBuffer.SetData(deviceContext, m_matrices);
+    m_propertiesBuffer.SetData(deviceContext, m_terrainProperties);
+
+    ID3D11Buffer* buffers[] = { m_matrixBuffer.GetBuffer(), m_propertiesBuffer.GetBuffer() };
+    deviceContext->VSSetConstantBuffers(0, 2, buffers);
+    // The pixel shader only needs the splat tiling
+    deviceContext->PSSetConstantBuffers(1, 1, &buffers[1]);
+
+    ID3D11ShaderResourceView* textures[] =
+    {
+        m_texture, m_lightmap, m_overlay, m_splatWeights,
+        m_splatTextures[0], m_splatTextures[1], m_splatTextures[2], m_splatTextures[3]
+    };
+    deviceContext->PSSetShaderResources(0, _countof(textures), textures);
+}
+
+void TerrainEffect::SetSplat(ID3D11ShaderResourceView* weights, ID3D11ShaderResourceView* const textures[SplatMap::NUM_LAYERS], const int tiling[SplatMap::NUM_LAYERS])
+{
+    m_splatWeights = weights;
+    std::copy(textures, textures + SplatMap::NUM_LAYERS, m_splatTextures);
+    m_terrainProperties.splatTiling = XMFLOAT4(float(tiling[0]), float(tiling[1]), float(tiling[2]), float(tiling[3]));
+}
+
+void XM_CALLCONV TerrainEffect::SetCameraPosition(FXMVECTOR position)
+{
+    m_terrainProperties.cameraPosition = position;
+}
+
+void TerrainEffect::SetMorphRange(int lod, float start, float end)
+{
+    m_terrainProperties.morphRanges[lod] = XMFLOAT4(start, end, 0.f, 0.f);
+}
+
+void TerrainEffect::SetGrid(int resolution, float spacing, XMFLOAT2 origin, float texCoordStep)
+{
+    m_terrainProperties.grid = XMFLOAT4(float(resolution), spacing, origin.x, origin.y);
+    m_terrainProperties.texCoord = XMFLOAT4(texCoordStep, 1.f / float(resolution - 1), 0.f, 0.f);
+}
+
+void XM_CALLCONV TerrainEffect::SetWorld(FXMMATRIX value)
+{
+    m_matrices.world = value;
+}
+
+void XM_CALLCONV TerrainEffect::SetView(FXMMATRIX value)
+{
+    m_matrices.view = value;
+}
+
+void XM_CALLCONV TerrainEffect::SetProjection(FXMMATRIX value)
+{
+    m_matrices.projection = value;
+}
+
+void XM_CALLCONV TerrainEffect::SetMatrices(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection)
+{
+    m_matrices.world = world;
+    m_matrices.view = view;
+    m_matrices.projection = projection;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "CustomEffect.h"
+#include "SplatMap.h"
+#include "TerrainQuadtree.h"
+
+// Textured, lit terrain that morphs vertices between LOD levels (see TerrainQuadtree)
+class TerrainEffect : public CustomEffect
+{
+public:
+    explicit TerrainEffect(_In_ ID3D11Device* device);
+
+    // IEffect interface
+    virtual void __cdecl Apply(_In_ ID3D11DeviceContext* deviceContext) override;
+
+    // IEffectMatrices interface
+    virtual void XM_CALLCONV SetWorld(FXMMATRIX value) override;
+    virtual void XM_CALLCONV SetView(FXMMATRIX value) override;
+    virtual void XM_CALLCONV SetProjection(FXMMATRIX value) override;
+    virtual void XM_CALLCONV SetMatrices(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection) override;
+
+    // TerrainEffect-specific interface
+    void SetTexture(ID3D11ShaderResourceView* texture) { m_texture = texture; }
+    // Baked ambient occlusion (r) and sun visibility (g) per grid vertex (see TerrainLightmap)
+    void SetLightmap(ID3D11ShaderResourceView* lightmap) { m_lightmap = lightmap; }
+    // RGBA per grid vertex, alpha blended over the lit terrain (see TerrainHydrology::BuildOverlay)
+    void SetOverlay(ID3D11ShaderResourceView* overlay) { m_overlay = overlay; }
+    // Splat textures blended by the weight map (one channel per texture, see SplatMap), each repeated 'tiling' times
+    // across the grid
+    void SetSplat(ID3D11ShaderResourceView* weights, ID3D11ShaderResourceView* const textures[SplatMap::NUM_LAYERS], const int tiling[SplatMap::NUM_LAYERS]);
+    void XM_CALLCONV SetCameraPosition(FXMVECTOR position);
+    void SetMorphRange(int lod, float start, float end);
+    // Vertices only store their heights--x/z and uv are worked out from this and the vertex' index
+    void SetGrid(int resolution, float spacing, XMFLOAT2 origin, float texCoordStep);
+
+private:
+    __declspec(align(16))
+        struct TerrainProperties
+    {
+        XMVECTOR cameraPosition;
+        // (start, end, -, -) distance of each LOD level's morph
+        XMFLOAT4 morphRanges[TerrainQuadtree::MAX_LODS];
+        // (resolution, spacing, origin x, origin z)
+        XMFLOAT4 grid;
+        // (uv step per vertex, uv step per vertex for the splat textures before their tiling, -, -)
+        XMFLOAT4 texCoord;
+        // How many times each splat texture repeats across the grid
+        XMFLOAT4 splatTiling;
+    };
+
+    TerrainProperties m_terrainProperties;
+    ConstantBuffer<TerrainProperties> m_propertiesBuffer;
+
+    // Helper stores matrix parameter values
+    struct EffectMatrices
+    {
+        EffectMatrices()
+        {
+            world = XMMatrixIdentity();
+            view = XMMatrixIdentity();
+            projection = XMMatrixIdentity();
+        }
+
+        XMMATRIX world;
+        XMMATRIX view;
+        XMMATRIX projection;
+    };
+
+    EffectMatrices m_matrices;
+    ConstantBuffer<EffectMatrices> m_matrixBuffer;
+
+    ID3D11ShaderResourceView* m_texture = nullptr;
+    ID3D11ShaderResourceView* m_lightmap = nullptr;
+    ID3D11ShaderResourceView* m_overlay = nullptr;
+    ID3D11ShaderResourceView* m_splatWeights = nullptr;
+    ID3D11ShaderResourceView* m_splatTextures[SplatMap::NUM_LAYERS] = {};
+};
@@ -0,0 +1,314 @@
+#include "TerrainHydrology.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <functional>
+#include <queue>
+
+using namespace DirectX;
+
+namespace
+{
+    // D8 neighbours (x, z offsets), and the distance to each in cells
+    const int OFFSET_X[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+    const int OFFSET_Z[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+    const float DISTANCE[8] = { 1.f, 1.41421356f, 1.f, 1.41421356f, 1.f, 1.41421356f, 1.f, 1.41421356f };
+
+    // Anything shallower than this is just the fill's nudge to make flats drain
+    const float FLOODED_DEPTH = 1e-3f;
+
+    struct OpenCell
+    {
+        float height;
+        uint32_t cell;
+
+        bool operator>(const OpenCell& rhs) const { return height > rhs.height; }
+    };
+
+    uint32_t PackColour(uint32_t r, uint32_t g, uint32_t b, uint32_t a)
+    {
+        return r | (g << 8) | (b << 16) | (a << 24);
+    }
+
+    // Distinct-ish colour per label
+    uint32_t LabelColour(uint32_t label, uint32_t alpha)
+    {
+        uint32_t hash = label * 2654435761u;
+        hash ^= hash >> 15;
+
+        // Keep every channel away from black so basins are visible on dark terrain
+        return PackColour(64 + (hash & 0xbf), 64 + ((hash >> 8) & 0xbf), 64 + ((hash >> 16) & 0xbf), alpha);
+    }
+}
+
+void TerrainHydrology::Analyse(const float* heights, size_t stride, int resolution, float spacing)
+{
+    m_resolution = resolution;
+    m_spacing = spacing;
+
+    if (resolution < 2)
+    {
+        m_filled.clear();
+        return;
+    }
+
+    FillDepressions(heights, stride);
+    CalculateFlowDirections();
+    CalculateAccumulation();
+    LabelWatersheds();
+}
+
+void TerrainHydrology::FillDepressions(const float* heights, size_t stride)
+{
+    const int last = m_resolution - 1;
+    const size_t numCells = size_t(m_resolution) * m_resolution;
+
+    m_filled.resize(numCells);
+    m_depth.resize(numCells);
+
+    std::vector<uint8_t> closed(numCells, 0);
+
+    // Cells at the edge of what's been flooded so far, lowest first. Cells raised to the level of the cell
+    // they were reached from skip the heap (everything in a depression is at that level, so order doesn't matter)
+    std::priority_queue<OpenCell, std::vector<OpenCell>, std::greater<OpenCell>> open;
+    std::queue<uint32_t> pit;
+
+    // Water leaves the grid over its edges
+    for (int z = 0; z <= last; ++z)
+    {
+        for (int x = 0; x <= last; x += ((z == 0 || z == last) ? 1 : last))
+        {
+            const uint32_t cell = z * m_resolution + x;
+            m_filled[cell] = heights[cell * stride];
+            closed[cell] = 1;
+            open.push({ m_filled[cell], cell });
+        }
+    }
+
+    while (!open.empty() || !pit.empty())
+    {
+        uint32_t cell;
+        if (!pit.empty())
+        {
+            cell = pit.front();
+            pit.pop();
+        }
+        else
+        {
+            cell = open.top().cell;
+            open.pop();
+        }
+
+        const int x = cell % m_resolution;
+        const int z = cell / m_resolution;
+
+        // Anything reached from here has to end up (however slightly) higher, so there's always a way down
+        const float raised = std::nextafter(m_filled[cell], FLT_MAX);
+
+        for (int i = 0; i < 8; ++i)
+        {
+            const int nx = x + OFFSET_X[i];
+            const int nz = z + OFFSET_Z[i];
+            if (nx < 0 || nz < 0 || nx > last || nz > last)
+                continue;
+
+            const uint32_t neighbour = nz * m_resolution + nx;
+            if (closed[neighbour])
+                continue;
+
+            closed[neighbour] = 1;
+
+            const float height = heights[neighbour * stride];
+            if (height <= raised)
+            {
+                m_filled[neighbour] = raised;
+                pit.push(neighbour);
+            }
+            else
+            {
+                m_filled[neighbour] = height;
+                open.push({ height, neighbour });
+            }
+        }
+    }
+
+    m_numFlooded = 0;
+    for (size_t cell = 0; cell < numCells; ++cell)
+    {
+        m_depth[cell] = m_filled[cell] - heights[cell * stride];
+        if (m_depth[cell] > FLOODED_DEPTH)
+            ++m_numFlooded;
+    }
+}
+
+void TerrainHydrology::CalculateFlowDirections()
+{
+    const int last = m_resolution - 1;
+    m_flow.assign(m_filled.size(), NO_FLOW);
+
+    for (int z = 1; z < last; ++z)
+    {
+        for (int x = 1; x < last; ++x)
+        {
+            const uint32_t cell = z * m_resolution + x;
+
+            // Steepest descent. The fill guarantees at least one neighbour is lower
+            float steepest = 0.f;
+            for (int i = 0; i < 8; ++i)
+            {
+                const float drop = m_filled[cell] - m_filled[(z + OFFSET_Z[i]) * m_resolution + x + OFFSET_X[i]];
+                const float slope = drop / DISTANCE[i];
+                if (drop > 0.f && slope > steepest)
+                {
+                    steepest = slope;
+                    m_flow[cell] = uint8_t(i);
+                }
+            }
+        }
+    }
+}
+
+void TerrainHydrology::CalculateAccumulation()
+{
+    const size_t numCells = m_filled.size();
+
+    const auto Downstream = [&](uint32_t cell)
+    {
+        return uint32_t(cell + OFFSET_Z[m_flow[cell]] * m_resolution + OFFSET_X[m_flow[cell]]);
+    };
+
+    // Number of cells flowing into each one
+    std::vector<uint8_t> donors(numCells, 0);
+    for (uint32_t cell = 0; cell < numCells; ++cell)
+        if (m_flow[cell] != NO_FLOW)
+            ++donors[Downstream(cell)];
+
+    // Kahn's algorithm: start from the ridges (cells nothing flows into), and pass each cell's total
+    // downstream once everything above it has been counted
+    m_order.clear();
+    m_order.reserve(numCells);
+    for (uint32_t cell = 0; cell < numCells; ++cell)
+        if (donors[cell] == 0)
+            m_order.push_back(cell);
+
+    m_accumulation.assign(numCells, 1);
+    for (size_t i = 0; i < m_order.size(); ++i)
+    {
+        const uint32_t cell = m_order[i];
+        if (m_flow[cell] == NO_FLOW)
+            continue;
+
+        const uint32_t downstream = Downstream(cell);
+        m_accumulation[downstream] += m_accumulation[cell];
+
+        if (--donors[downstream] == 0)
+            m_order.push_back(downstream);
+    }
+}
+
+void TerrainHydrology::LabelWatersheds()
+{
+    m_watershed.resize(m_filled.size());
+    m_numWatersheds = 0;
+
+    // Backwards through the flow order, every cell's downstream neighbour has already been labelled
+    for (auto it = m_order.rbegin(); it != m_order.rend(); ++it)
+    {
+        const uint32_t cell = *it;
+        if (m_flow[cell] == NO_FLOW)
+            m_watershed[cell] = m_numWatersheds++;
+        else
+            m_watershed[cell] = m_watershed[cell + OFFSET_Z[m_flow[cell]] * m_resolution + OFFSET_X[m_flow[cell]]];
+    }
+}
+
+TerrainHydrology::Sample TerrainHydrology::Query(float gridX, float gridZ) const
+{
+    Sample sample = {};
+    if (m_filled.empty())
+        return sample;
+
+    const int last = m_resolution - 1;
+    const int x = std::min(std::max(int(std::lround(gridX)), 0), last);
+    const int z = std::min(std::max(int(std::lround(gridZ)), 0), last);
+    const uint32_t cell = z * m_resolution + x;
+
+    sample.waterDepth = (m_depth[cell] > FLOODED_DEPTH ? m_depth[cell] : 0.f);
+    sample.drainageArea = m_accumulation[cell] * m_spacing * m_spacing;
+    sample.watershed = m_watershed[cell];
+
+    if (m_flow[cell] != NO_FLOW)
+    {
+        const float distance = DISTANCE[m_flow[cell]];
+        sample.flowDirection = XMFLOAT2(OFFSET_X[m_flow[cell]] / distance, OFFSET_Z[m_flow[cell]] / distance);
+    }
+
+    return sample;
+}
+
+void TerrainHydrology::BuildOverlay(Overlay overlay, std::vector<uint32_t>& texels) const
+{
+    const size_t numCells = m_filled.size();
+    texels.assign(numCells, 0);
+
+    switch (overlay)
+    {
+        case OVERLAY_WATER:
+        {
+            // Deeper water is more opaque (fully so from 4m down)
+            for (size_t cell = 0; cell < numCells; ++cell)
+            {
+                if (m_depth[cell] > FLOODED_DEPTH)
+                {
+                    const float opacity = std::min(m_depth[cell] / 4.f, 1.f);
+                    texels[cell] = PackColour(32, 96, 224, 96 + uint32_t(159.f * opacity));
+                }
+            }
+            break;
+        }
+
+        case OVERLAY_FLOW:
+        {
+            // Log scale, since a handful of cells take in most of the grid. Only the upper part of the range shows
+            const float maxLog = std::log(float(std::max<size_t>(numCells, 2)));
+            for (size_t cell = 0; cell < numCells; ++cell)
+            {
+                const float t = std::log(float(m_accumulation[cell])) / maxLog;
+                if (t > 0.35f)
+                {
+                    const float opacity = std::min((t - 0.35f) / 0.35f, 1.f);
+                    texels[cell] = PackColour(0, 200, 255, 64 + uint32_t(191.f * opacity));
+                }
+            }
+            break;
+        }
+
+        case OVERLAY_WATERSHEDS:
+        {
+            // Tinted per basin, with the divides between them drawn more strongly
+            const int last = m_resolution - 1;
+            for (int z = 0; z <= last; ++z)
+            {
+                for (int x = 0; x <= last; ++x)
+                {
+                    const uint32_t cell = z * m_resolution + x;
+                    const bool divide = (x < last && m_watershed[cell + 1] != m_watershed[cell]) ||
+                                        (z < last && m_watershed[cell + m_resolution] != m_watershed[cell]);
+
+                    texels[cell] = LabelColour(m_watershed[cell], divide ? 224 : 112);
+                }
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+size_t TerrainHydrology::GetMemoryUsage() const
+{
+    return m_depth.size() * sizeof(float) + m_filled.size() * sizeof(float) + m_flow.size() * sizeof(uint8_t) +
+           m_accumulation.size() * sizeof(uint32_t) + m_watershed.size() * sizeof(uint32_t) + m_order.size() * sizeof(uint32_t);
+}
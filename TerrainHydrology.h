@@ -0,0 +1,82 @@
+#pragma once
+#include <DirectXMath.h>
+
+#include <cstdint>
+#include <vector>
+
+// Drainage analysis of a square heightmap grid, with the grid's edges as the outlets:
+//  - Depressions are filled with a priority-flood (Barnes et al.), raising every filled cell a hair above the
+//    cell it was reached from, so the filled surface drains everywhere (flats included). O(n log n)
+//  - Each cell flows to its steepest downhill neighbour on the filled surface (D8)
+//  - Flow accumulation (how many cells drain through each one) and watershed labels (which outlet each cell
+//    ends up at) follow the flow graph in topological order. O(n)
+// The filled height minus the terrain's height is where water would pool.
+class TerrainHydrology
+{
+public:
+    // What the overlay shows
+    enum Overlay
+    {
+        OVERLAY_NONE = 0,
+        OVERLAY_WATER,          // Depth of the water that would pool in depressions
+        OVERLAY_FLOW,           // Rivers (cells lots of others drain through)
+        OVERLAY_WATERSHEDS,     // A colour per drainage basin
+        OVERLAY_COUNT
+    };
+
+    // Flow direction of the grid's edge cells (their water leaves the grid)
+    static constexpr uint8_t NO_FLOW = 8;
+
+    struct Sample
+    {
+        // Metres of water that would pool here (0 unless the point is in a depression)
+        float waterDepth;
+        // Square metres of terrain that drain through this point (itself included)
+        float drainageArea;
+        // Index of the watershed (drainage basin) the point is in
+        uint32_t watershed;
+        // (x, z) direction water flows in, unit length (zero at the grid's edges)
+        DirectX::XMFLOAT2 flowDirection;
+    };
+
+    TerrainHydrology() = default;
+
+    // heights: resolution * resolution samples, 'spacing' metres apart (row major, z rows), read every 'stride' floats
+    void Analyse(const float* heights, size_t stride, int resolution, float spacing);
+    bool IsEmpty() const { return m_filled.empty(); }
+
+    // Results at the grid vertex nearest a (fractional) grid position, clamped to the grid
+    Sample Query(float gridX, float gridZ) const;
+
+    int GetResolution() const { return m_resolution; }
+    uint32_t GetWatershedCount() const { return m_numWatersheds; }
+    // Cells in depressions (that the fill raised by more than a rounding error)
+    size_t GetFloodedCellCount() const { return m_numFlooded; }
+
+    // One RGBA8 texel per grid vertex (red in the lowest byte), alpha blended over the terrain
+    void BuildOverlay(Overlay overlay, std::vector<uint32_t>& texels) const;
+
+    size_t GetMemoryUsage() const;
+
+private:
+    void FillDepressions(const float* heights, size_t stride);
+    void CalculateFlowDirections();
+    void CalculateAccumulation();
+    void LabelWatersheds();
+
+    int m_resolution = 0;
+    float m_spacing = 1.f;
+
+    // Per cell (row major, z rows)
+    std::vector<float> m_depth;             // Filled height minus terrain height
+    std::vector<float> m_filled;
+    std::vector<uint8_t> m_flow;            // Index into the neighbour offsets, or NO_FLOW
+    std::vector<uint32_t> m_accumulation;   // Cells draining through this one, itself included
+    std::vector<uint32_t> m_watershed;
+
+    // Cells ordered so that every cell comes before the one it flows into
+    std::vector<uint32_t> m_order;
+
+    uint32_t m_numWatersheds = 0;
+    size_t m_numFlooded = 0;
+};
@@ -0,0 +1,307 @@
+#include "TerrainLayerStack.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+
+void TerrainLayerStack::Initialise(int resolution, const float* heights, size_t stride)
+{
+    m_resolution = resolution;
+    m_tilesPerSide = (resolution + TILE_SIZE - 1) / TILE_SIZE;
+
+    const size_t numTiles = size_t(m_tilesPerSide) * m_tilesPerSide;
+
+    Layer base = { LAYER_BASE, BLEND_REPLACE, true };
+    base.values.resize(numTiles);
+    base.mask.resize(numTiles);
+    base.tileUsed.assign(numTiles, 1);
+
+    // The heights are the composite of the base layer alone
+    m_composite.resize(size_t(resolution) * resolution);
+    for (int tile = 0; tile < int(numTiles); ++tile)
+    {
+        const int firstX = (tile % m_tilesPerSide) * TILE_SIZE;
+        const int firstZ = (tile / m_tilesPerSide) * TILE_SIZE;
+        const int lastX = std::min(firstX + TILE_SIZE, m_resolution) - 1;
+        const int lastZ = std::min(firstZ + TILE_SIZE, m_resolution) - 1;
+
+        base.values[tile].assign(TILE_SIZE * TILE_SIZE, 0.f);
+        for (int z = firstZ; z <= lastZ; ++z)
+        {
+            for (int x = firstX; x <= lastX; ++x)
+            {
+                const size_t index = size_t(z) * m_resolution + x;
+                base.values[tile][GetTileIndex(x, z)] = m_composite[index] = heights[index * stride];
+            }
+        }
+    }
+
+    m_layers.clear();
+    m_layers.push_back(std::move(base));
+
+    m_tileDirty.assign(numTiles, 0);
+    m_numDirtyTiles = 0;
+}
+
+void TerrainLayerStack::InsertLayer(size_t index, Type type, BlendMode blend)
+{
+    Layer layer = { type, blend, true };
+    layer.values.resize(m_tileDirty.size());
+    layer.mask.resize(m_tileDirty.size());
+
+    // Procedural layers can reach anywhere (but they start out without a generator, so there's nothing to redo yet)
+    layer.tileUsed.assign(m_tileDirty.size(), (type == LAYER_PROCEDURAL ? 1 : 0));
+
+    m_layers.insert(m_layers.begin() + std::min(index, m_layers.size()), std::move(layer));
+}
+
+void TerrainLayerStack::SetGenerator(size_t layer, Generator generator)
+{
+    m_layers[layer].generator = std::move(generator);
+    MarkTiles(0, 0, m_resolution - 1, m_resolution - 1);
+}
+
+void TerrainLayerStack::SetVisible(size_t layer, bool visible)
+{
+    Layer& changed = m_layers[layer];
+    if (changed.visible == visible)
+        return;
+
+    changed.visible = visible;
+
+    // Only the tiles the layer has anything in look any different
+    for (int tile = 0; tile < int(m_tileDirty.size()); ++tile)
+    {
+        if (changed.tileUsed[tile])
+            MarkTile(tile);
+    }
+}
+
+void TerrainLayerStack::Invalidate(int minX, int minZ, int maxX, int maxZ)
+{
+    MarkTiles(minX, minZ, maxX, maxZ);
+}
+
+void TerrainLayerStack::Rebase(int x, int z, float height)
+{
+    const size_t index = size_t(z) * m_resolution + x;
+    const int tile = (z / TILE_SIZE) * m_tilesPerSide + x / TILE_SIZE;
+
+    m_layers[0].values[tile][GetTileIndex(x, z)] += height - m_composite[index];
+    m_composite[index] = height;
+}
+
+void TerrainLayerStack::CopyTile(size_t layer, int tile, std::vector<float>& values) const
+{
+    const std::vector<float>& copied = m_layers[layer].values[tile];
+    values.clear();
+    if (copied.empty())
+        return;
+
+    const int firstX = (tile % m_tilesPerSide) * TILE_SIZE;
+    const int firstZ = (tile / m_tilesPerSide) * TILE_SIZE;
+    const int lastX = std::min(firstX + TILE_SIZE, m_resolution) - 1;
+    const int lastZ = std::min(firstZ + TILE_SIZE, m_resolution) - 1;
+
+    values.reserve(size_t(lastX - firstX + 1) * (lastZ - firstZ + 1));
+    for (int z = firstZ; z <= lastZ; ++z)
+        values.insert(values.end(), &copied[GetTileIndex(firstX, z)], &copied[GetTileIndex(lastX, z)] + 1);
+}
+
+void TerrainLayerStack::SwapTile(size_t layer, int tile, std::vector<float>& values)
+{
+    Layer& swapped = m_layers[layer];
+    if (swapped.values[tile].empty() && values.empty())
+        return;
+
+    const int firstX = (tile % m_tilesPerSide) * TILE_SIZE;
+    const int firstZ = (tile / m_tilesPerSide) * TILE_SIZE;
+    const int lastX = std::min(firstX + TILE_SIZE, m_resolution) - 1;
+    const int lastZ = std::min(firstZ + TILE_SIZE, m_resolution) - 1;
+
+    UseTile(swapped, tile, false);
+
+    // Values start at 0
+    if (values.empty())
+        values.assign(size_t(lastX - firstX + 1) * (lastZ - firstZ + 1), 0.f);
+
+    size_t i = 0;
+    for (int z = firstZ; z <= lastZ; ++z)
+        for (int x = firstX; x <= lastX; ++x)
+            std::swap(swapped.values[tile][GetTileIndex(x, z)], values[i++]);
+}
+
+bool TerrainLayerStack::Composite(float* heights, size_t stride, float minHeight, float maxHeight, int& minX, int& minZ, int& maxX, int& maxZ)
+{
+    if (m_numDirtyTiles == 0)
+        return false;
+
+    std::vector<int> tiles;
+    tiles.reserve(m_numDirtyTiles);
+    for (int tile = 0; tile < int(m_tileDirty.size()); ++tile)
+        if (m_tileDirty[tile])
+            tiles.push_back(tile);
+
+    // Tiles only write their own vertices (generators included)
+    std::vector<uint8_t> tileChanged(tiles.size(), 0);
+    ParallelFor(tiles.size(), [&](size_t i)
+    {
+        CompositeTile(tiles[i]);
+
+        const int tileX = tiles[i] % m_tilesPerSide;
+        const int tileZ = tiles[i] / m_tilesPerSide;
+        const int lastX = std::min((tileX + 1) * TILE_SIZE, m_resolution) - 1;
+        const int lastZ = std::min((tileZ + 1) * TILE_SIZE, m_resolution) - 1;
+
+        for (int z = tileZ * TILE_SIZE; z <= lastZ; ++z)
+        {
+            for (int x = tileX * TILE_SIZE; x <= lastX; ++x)
+            {
+                const size_t index = size_t(z) * m_resolution + x;
+                const float height = std::min(std::max(m_composite[index], minHeight), maxHeight);
+
+                if (heights[index * stride] != height)
+                {
+                    heights[index * stride] = height;
+                    tileChanged[i] = 1;
+                }
+            }
+        }
+    });
+
+    std::fill(m_tileDirty.begin(), m_tileDirty.end(), 0);
+    m_numDirtyTiles = 0;
+
+    bool changed = false;
+    for (size_t i = 0; i < tiles.size(); ++i)
+    {
+        if (!tileChanged[i])
+            continue;
+
+        const int tileMinX = (tiles[i] % m_tilesPerSide) * TILE_SIZE;
+        const int tileMinZ = (tiles[i] / m_tilesPerSide) * TILE_SIZE;
+        const int tileMaxX = std::min(tileMinX + TILE_SIZE, m_resolution) - 1;
+        const int tileMaxZ = std::min(tileMinZ + TILE_SIZE, m_resolution) - 1;
+
+        if (!changed)
+        {
+            minX = tileMinX; minZ = tileMinZ; maxX = tileMaxX; maxZ = tileMaxZ;
+            changed = true;
+        }
+        else
+        {
+            minX = std::min(minX, tileMinX); minZ = std::min(minZ, tileMinZ);
+            maxX = std::max(maxX, tileMaxX); maxZ = std::max(maxZ, tileMaxZ);
+        }
+    }
+
+    return changed;
+}
+
+size_t TerrainLayerStack::GetMemoryUsage() const
+{
+    size_t bytes = m_composite.size() * sizeof(float) + m_tileDirty.size();
+    for (const Layer& layer : m_layers)
+    {
+        bytes += (layer.values.size() + layer.mask.size()) * sizeof(std::vector<float>) + layer.tileUsed.size();
+        for (size_t tile = 0; tile < layer.values.size(); ++tile)
+            bytes += (layer.values[tile].capacity() + layer.mask[tile].capacity()) * sizeof(float);
+    }
+
+    return bytes;
+}
+
+void TerrainLayerStack::UseTile(Layer& layer, int tile, bool withMask)
+{
+    if (layer.values[tile].empty())
+        layer.values[tile].assign(TILE_SIZE * TILE_SIZE, 0.f);
+
+    if (withMask)
+    {
+        if (layer.mask[tile].empty())
+            layer.mask[tile].assign(TILE_SIZE * TILE_SIZE, 0.f);
+
+        layer.masked = true;
+    }
+
+    layer.tileUsed[tile] = 1;
+    MarkTile(tile);
+}
+
+void TerrainLayerStack::MarkTiles(int minX, int minZ, int maxX, int maxZ)
+{
+    minX = std::max(minX, 0) / TILE_SIZE;
+    minZ = std::max(minZ, 0) / TILE_SIZE;
+    maxX = std::min(maxX, m_resolution - 1) / TILE_SIZE;
+    maxZ = std::min(maxZ, m_resolution - 1) / TILE_SIZE;
+
+    for (int tileZ = minZ; tileZ <= maxZ; ++tileZ)
+        for (int tileX = minX; tileX <= maxX; ++tileX)
+            MarkTile(tileZ * m_tilesPerSide + tileX);
+}
+
+void TerrainLayerStack::MarkTile(int tile)
+{
+    if (!m_tileDirty[tile])
+    {
+        m_tileDirty[tile] = 1;
+        ++m_numDirtyTiles;
+    }
+}
+
+void TerrainLayerStack::CompositeTile(int tile)
+{
+    const int firstX = (tile % m_tilesPerSide) * TILE_SIZE;
+    const int firstZ = (tile / m_tilesPerSide) * TILE_SIZE;
+    const int lastX = std::min(firstX + TILE_SIZE, m_resolution) - 1;
+    const int lastZ = std::min(firstZ + TILE_SIZE, m_resolution) - 1;
+
+    // Bottom to top, a layer at a time
+    for (const Layer& layer : m_layers)
+    {
+        if (!layer.visible || !layer.tileUsed[tile])
+            continue;
+
+        if (layer.type == LAYER_PROCEDURAL)
+        {
+            if (layer.generator)
+                layer.generator(firstX, firstZ, lastX, lastZ, m_composite.data());
+            continue;
+        }
+
+        const std::vector<float>& values = layer.values[tile];
+        const std::vector<float>& mask = layer.mask[tile];
+        // A masked layer doesn't show where the mask hasn't been painted
+        if (values.empty() || (layer.masked && mask.empty()))
+            continue;
+
+        if (layer.type == LAYER_BASE)
+        {
+            for (int z = firstZ; z <= lastZ; ++z)
+                std::copy_n(&values[GetTileIndex(firstX, z)], lastX - firstX + 1, &m_composite[size_t(z) * m_resolution + firstX]);
+            continue;
+        }
+
+        for (int z = firstZ; z <= lastZ; ++z)
+        {
+            for (int x = firstX; x <= lastX; ++x)
+            {
+                const size_t index = size_t(z) * m_resolution + x;
+                const size_t tileIndex = GetTileIndex(x, z);
+                const float weight = (layer.masked ? mask[tileIndex] : 1.f);
+                const float below = m_composite[index];
+                const float value = values[tileIndex];
+
+                float blended;
+                switch (layer.blend)
+                {
+                    case BLEND_ADD:     blended = below + value;                break;
+                    case BLEND_MAX:     blended = std::max(below, value);       break;
+                    case BLEND_MIN:     blended = std::min(below, value);       break;
+                    default:            blended = value;                        break;
+                }
+
+                m_composite[index] = below + (blended - below) * weight;
+            }
+        }
+    }
+}
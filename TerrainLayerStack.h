@@ -0,0 +1,138 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Non-destructive terrain heights for a square grid: a base heightmap with layers blended on top of it, bottom to top.
+//  - Sculpt layers hold offsets added to what's below (what brushes paint into)
+//  - Stamp layers hold heights blended in under a mask (one per paste)
+//  - Procedural layers work their heights out from what's below (e.g. roads and rivers)
+// Every layer can be hidden, and any layer with a mask only shows where the mask has been painted. Layers are stored,
+// and the composite is cached, in tiles: a layer only has the tiles it's been written to (so a paste costs its
+// footprint), editing a layer only recomposites the tiles the edit touched, and hiding/showing one only those it has
+// anything in. Dirty tiles are recomposited in parallel.
+class TerrainLayerStack
+{
+public:
+    static constexpr int TILE_SIZE = 16;
+
+    enum Type
+    {
+        LAYER_BASE = 0,
+        LAYER_SCULPT,
+        LAYER_STAMP,
+        LAYER_PROCEDURAL
+    };
+
+    enum BlendMode
+    {
+        BLEND_ADD = 0,      // Values are offsets
+        BLEND_REPLACE,
+        BLEND_MAX,          // Only raises what's below
+        BLEND_MIN           // Only lowers what's below
+    };
+
+    // Fills in a procedural layer over an (inclusive, grid coordinate) region. 'heights' is the whole grid (row major,
+    // z rows), holding the composite of the layers below on the way in and the layer's result on the way out.
+    // Called for many tiles at once, so it mustn't write outside its region
+    using Generator = std::function<void(int minX, int minZ, int maxX, int maxZ, float* heights)>;
+
+    TerrainLayerStack() = default;
+
+    // Starts over with only the base layer (heights read every 'stride' floats)
+    void Initialise(int resolution, const float* heights, size_t stride);
+
+    size_t GetLayerCount() const { return m_layers.size(); }
+    Type GetType(size_t layer) const { return m_layers[layer].type; }
+    bool IsVisible(size_t layer) const { return m_layers[layer].visible; }
+
+    // Layers above 'index' move up one. The new layer is empty (and visible)
+    void InsertLayer(size_t index, Type type, BlendMode blend);
+    void SetGenerator(size_t layer, Generator generator);
+    void SetVisible(size_t layer, bool visible);
+
+    // A layer's values (and mask, if 'withMask') for the caller to change over an (inclusive, grid coordinate) region.
+    // edit(minX, minZ, maxX, maxZ, values, mask) is called for each tile the region overlaps, with the part of the
+    // region in it and the tile's values/mask (indexed by GetTileIndex; mask is null if not asked for). Only those
+    // tiles are allocated (values start at 0, and the mask at 0, i.e. hidden). The region is recomposited by the next
+    // Composite
+    template <typename EditTile>
+    void Edit(size_t layer, int minX, int minZ, int maxX, int maxZ, bool withMask, EditTile edit)
+    {
+        minX = std::max(minX, 0);
+        minZ = std::max(minZ, 0);
+        maxX = std::min(maxX, m_resolution - 1);
+        maxZ = std::min(maxZ, m_resolution - 1);
+
+        Layer& edited = m_layers[layer];
+        for (int tileZ = minZ / TILE_SIZE; tileZ <= maxZ / TILE_SIZE; ++tileZ)
+        {
+            for (int tileX = minX / TILE_SIZE; tileX <= maxX / TILE_SIZE; ++tileX)
+            {
+                const int tile = tileZ * m_tilesPerSide + tileX;
+                UseTile(edited, tile, withMask);
+
+                edit(std::max(minX, tileX * TILE_SIZE), std::max(minZ, tileZ * TILE_SIZE),
+                     std::min(maxX, (tileX + 1) * TILE_SIZE - 1), std::min(maxZ, (tileZ + 1) * TILE_SIZE - 1),
+                     edited.values[tile].data(), withMask ? edited.mask[tile].data() : nullptr);
+            }
+        }
+    }
+    // Where a vertex is in its tile's values/mask
+    static size_t GetTileIndex(int x, int z) { return size_t(z % TILE_SIZE) * TILE_SIZE + size_t(x % TILE_SIZE); }
+    // Whatever procedural layers are based on has changed over a region
+    void Invalidate(int minX, int minZ, int maxX, int maxZ);
+    // The height at a vertex has been set from outside: the base layer takes up the difference, so the composite
+    // comes out at that height (exactly so unless a layer above replaces, rather than adds to, what's below it)
+    void Rebase(int x, int z, float height);
+
+    // A layer's values over a tile (row by row), for undoing edits. No values stands for a tile nothing has been
+    // written to yet. Swapping puts the given values in the layer and the layer's in 'values'; the tile is
+    // recomposited by the next Composite
+    void CopyTile(size_t layer, int tile, std::vector<float>& values) const;
+    void SwapTile(size_t layer, int tile, std::vector<float>& values);
+
+    bool IsDirty() const { return m_numDirtyTiles > 0; }
+
+    // Recomposites the dirty tiles into 'heights' (every 'stride' floats), clamped to [minHeight, maxHeight].
+    // Returns false if no heights changed, otherwise the bounds of the tiles where they did
+    bool Composite(float* heights, size_t stride, float minHeight, float maxHeight, int& minX, int& minZ, int& maxX, int& maxZ);
+
+    size_t GetMemoryUsage() const;
+
+private:
+    struct Layer
+    {
+        Type type;
+        BlendMode blend;
+        bool visible;
+        // Per tile, TILE_SIZE x TILE_SIZE (see GetTileIndex). Empty until written to
+        std::vector<std::vector<float>> values;
+        std::vector<std::vector<float>> mask;
+        // Whether the layer has a mask (without one it shows everywhere it has values)
+        bool masked;
+        // Tiles the layer has been written to (all of them for procedural layers)
+        std::vector<uint8_t> tileUsed;
+        Generator generator;
+    };
+
+    // Allocates a layer's tile (and its mask's, if 'withMask') if it hasn't been yet, and marks it used and dirty
+    void UseTile(Layer& layer, int tile, bool withMask);
+    // Marks the tiles overlapping a region dirty
+    void MarkTiles(int minX, int minZ, int maxX, int maxZ);
+    void MarkTile(int tile);
+    void CompositeTile(int tile);
+
+    int m_resolution = 0;
+    int m_tilesPerSide = 0;
+
+    std::vector<Layer> m_layers;
+
+    // The cached composite (before clamping), per vertex
+    std::vector<float> m_composite;
+
+    std::vector<uint8_t> m_tileDirty;
+    size_t m_numDirtyTiles = 0;
+};
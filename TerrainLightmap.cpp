@@ -0,0 +1,324 @@
+#include "pch.h"
+#include "TerrainLightmap.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+using namespace DirectX;
+
+namespace
+{
+    // Just enough of the .dds format for an uncompressed two channel texture
+    // (16 bit luminance + alpha, which loaders read as R8G8_UNORM)
+    struct DDSPixelFormat
+    {
+        uint32_t size;
+        uint32_t flags;
+        uint32_t fourCC;
+        uint32_t rgbBitCount;
+        uint32_t rBitMask;
+        uint32_t gBitMask;
+        uint32_t bBitMask;
+        uint32_t aBitMask;
+    };
+
+    struct DDSHeader
+    {
+        uint32_t size;
+        uint32_t flags;
+        uint32_t height;
+        uint32_t width;
+        uint32_t pitchOrLinearSize;
+        uint32_t depth;
+        uint32_t mipMapCount;
+        uint32_t reserved1[11];
+        DDSPixelFormat pixelFormat;
+        uint32_t caps;
+        uint32_t caps2;
+        uint32_t caps3;
+        uint32_t caps4;
+        uint32_t reserved2;
+    };
+
+    const uint32_t DDS_MAGIC = 0x20534444;  // "DDS "
+    const uint32_t DDSD_CAPS = 0x1, DDSD_HEIGHT = 0x2, DDSD_WIDTH = 0x4, DDSD_PITCH = 0x8, DDSD_PIXELFORMAT = 0x1000;
+    const uint32_t DDPF_ALPHAPIXELS = 0x1, DDPF_LUMINANCE = 0x20000;
+    const uint32_t DDSCAPS_TEXTURE = 0x1000;
+}
+
+void TerrainLightmap::Initialise(int resolution, float spacing, const Settings& settings)
+{
+    m_resolution = resolution;
+    m_spacing = spacing;
+    m_settings = settings;
+    m_tilesPerSide = (resolution + TILE_SIZE - 1) / TILE_SIZE;
+    m_reach = std::min(int(std::ceil(settings.occlusionRadius / spacing)), resolution - 1);
+
+    m_texels.assign(resolution * resolution, Texel{ 255, 255 });
+
+    m_bakeDirty.assign(m_tilesPerSide * m_tilesPerSide, true);
+    m_uploadDirty.assign(m_tilesPerSide * m_tilesPerSide, false);
+    m_numDirtyTiles = m_bakeDirty.size();
+}
+
+void TerrainLightmap::MarkDirty(int minX, int minZ, int maxX, int maxZ)
+{
+    // Anything that can see the changed heights as part of its horizon
+    minX = std::max(minX - m_reach, 0);
+    minZ = std::max(minZ - m_reach, 0);
+    maxX = std::min(maxX + m_reach, m_resolution - 1);
+    maxZ = std::min(maxZ + m_reach, m_resolution - 1);
+    if (minX > maxX || minZ > maxZ)
+        return;
+
+    minX /= TILE_SIZE;
+    minZ /= TILE_SIZE;
+    maxX /= TILE_SIZE;
+    maxZ /= TILE_SIZE;
+
+    for (int tileZ = minZ; tileZ <= maxZ; ++tileZ)
+    {
+        for (int tileX = minX; tileX <= maxX; ++tileX)
+        {
+            const int tile = tileZ * m_tilesPerSide + tileX;
+            if (!m_bakeDirty[tile])
+            {
+                m_bakeDirty[tile] = true;
+                ++m_numDirtyTiles;
+            }
+        }
+    }
+}
+
+size_t TerrainLightmap::Bake(const float* heights, size_t stride, const BVH& bvh, XMFLOAT2 origin, size_t maxTiles,
+                             const Surroundings& surroundings)
+{
+    if (m_numDirtyTiles == 0)
+        return 0;
+
+    std::vector<int> tiles;
+    for (int tile = 0; tile < int(m_bakeDirty.size()) && (maxTiles == 0 || tiles.size() < maxTiles); ++tile)
+        if (m_bakeDirty[tile])
+            tiles.push_back(tile);
+
+    // Nothing can raise the horizon above the highest point of the terrain
+    const float maxHeight = std::max(bvh.GetBounds().Center.y + bvh.GetBounds().Extents.y, surroundings.maxHeight);
+
+    // Tiles only write their own texels
+    ParallelFor(tiles.size(), [&](size_t i)
+    {
+        BakeTile(tiles[i] % m_tilesPerSide, tiles[i] / m_tilesPerSide, heights, stride, bvh, origin, surroundings, maxHeight);
+    });
+
+    for (int tile : tiles)
+    {
+        m_bakeDirty[tile] = false;
+        m_uploadDirty[tile] = true;
+    }
+
+    m_numDirtyTiles -= tiles.size();
+    return m_numDirtyTiles;
+}
+
+bool TerrainLightmap::Save(const std::string& path) const
+{
+    FILE *pFile = NULL;
+    errno_t ret = fopen_s(&pFile, path.c_str(), "wb");
+    if (ret != 0 || pFile == NULL)
+        return false;
+
+    DDSHeader header = {};
+    header.size = sizeof(DDSHeader);
+    header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PITCH | DDSD_PIXELFORMAT;
+    header.height = m_resolution;
+    header.width = m_resolution;
+    header.pitchOrLinearSize = m_resolution * sizeof(Texel);
+    header.pixelFormat.size = sizeof(DDSPixelFormat);
+    header.pixelFormat.flags = DDPF_LUMINANCE | DDPF_ALPHAPIXELS;
+    header.pixelFormat.rgbBitCount = 16;
+    header.pixelFormat.rBitMask = 0x00ff;
+    header.pixelFormat.aBitMask = 0xff00;
+    header.caps = DDSCAPS_TEXTURE;
+
+    fwrite(&DDS_MAGIC, sizeof(DDS_MAGIC), 1, pFile);
+    fwrite(&header, sizeof(header), 1, pFile);
+    fwrite(m_texels.data(), sizeof(Texel), m_texels.size(), pFile);
+
+    bool succeeded = (ferror(pFile) == 0);
+    fclose(pFile);
+
+    return succeeded;
+}
+
+void TerrainLightmap::CreateTexture(ID3D11Device* device)
+{
+    CD3D11_TEXTURE2D_DESC desc(DXGI_FORMAT_R8G8_UNORM, m_resolution, m_resolution, 1, 1, D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_DEFAULT);
+
+    D3D11_SUBRESOURCE_DATA initialData;
+    initialData.pSysMem = m_texels.data();
+    initialData.SysMemPitch = m_resolution * sizeof(Texel);
+    initialData.SysMemSlicePitch = 0;
+
+    if (FAILED(device->CreateTexture2D(&desc, &initialData, m_texture.ReleaseAndGetAddressOf())))
+        return;
+
+    device->CreateShaderResourceView(m_texture.Get(), nullptr, m_srv.ReleaseAndGetAddressOf());
+
+    // The texture was created from the current texels
+    std::fill(m_uploadDirty.begin(), m_uploadDirty.end(), false);
+}
+
+void TerrainLightmap::UploadDirtyTiles(ID3D11DeviceContext* context)
+{
+    if (!m_texture)
+        return;
+
+    const UINT rowPitch = m_resolution * sizeof(Texel);
+
+    for (int tileZ = 0; tileZ < m_tilesPerSide; ++tileZ)
+    {
+        for (int tileX = 0; tileX < m_tilesPerSide; ++tileX)
+        {
+            const int tile = tileZ * m_tilesPerSide + tileX;
+            if (!m_uploadDirty[tile])
+                continue;
+
+            D3D11_BOX box = GetTileBox(tileX, tileZ);
+            context->UpdateSubresource(m_texture.Get(), 0, &box, &m_texels[box.top * m_resolution + box.left], rowPitch, 0);
+
+            m_uploadDirty[tile] = false;
+        }
+    }
+}
+
+void TerrainLightmap::BakeTile(int tileX, int tileZ, const float* heights, size_t stride, const BVH& bvh, XMFLOAT2 origin,
+                               const Surroundings& surroundings, float maxHeight)
+{
+    // Horizon directions, and rays spread over the sun's disc
+    XMFLOAT2 directions[NUM_HORIZON_DIRECTIONS];
+    for (int i = 0; i < NUM_HORIZON_DIRECTIONS; ++i)
+    {
+        const float angle = XM_2PI * (i + 0.5f) / NUM_HORIZON_DIRECTIONS;
+        directions[i] = XMFLOAT2(std::cos(angle), std::sin(angle));
+    }
+
+    const XMVECTOR sun = XMVector3Normalize(XMLoadFloat3(&m_settings.sunDirection));
+    const XMVECTOR tangent = XMVector3Normalize(XMVector3Cross(sun, g_XMIdentityR1));
+    const XMVECTOR bitangent = XMVector3Cross(tangent, sun);
+
+    XMVECTOR sunRays[NUM_SUN_RAYS];
+    for (int i = 0; i < NUM_SUN_RAYS; ++i)
+    {
+        const float angle = XM_2PI * i / NUM_SUN_RAYS;
+        const float offset = std::tan(m_settings.sunRadius * 0.5f);
+        sunRays[i] = XMVector3Normalize(sun + (tangent * std::cos(angle) + bitangent * std::sin(angle)) * offset);
+    }
+
+    // Start sun rays a little above the surface, so they don't hit the triangles they start on
+    const float bias = m_spacing * 0.1f;
+
+    const D3D11_BOX box = GetTileBox(tileX, tileZ);
+    for (int z = int(box.top); z < int(box.bottom); ++z)
+    {
+        for (int x = int(box.left); x < int(box.right); ++x)
+        {
+            const float height = heights[(z * m_resolution + x) * stride];
+
+            // Ambient occlusion: average sine of the horizon angle over every direction
+            float occlusion = 0.f;
+            for (const XMFLOAT2& direction : directions)
+            {
+                float horizon = 0.f;    // Tangent of the horizon angle
+
+                // Steps grow with distance, since far away samples matter less
+                for (float step = 1.f; step <= float(m_reach); step = std::max(step + 1.f, step * 1.25f))
+                {
+                    const float distance = step * m_spacing;
+
+                    // Even the highest point of the terrain couldn't raise the horizon from here on
+                    if ((maxHeight - height) / distance <= horizon)
+                        break;
+
+                    float sampleHeight;
+                    if (!SampleHeight(heights, stride, surroundings, x + direction.x * step, z + direction.y * step, sampleHeight))
+                        break;
+
+                    horizon = std::max(horizon, (sampleHeight - height) / distance);
+                }
+
+                occlusion += horizon / std::sqrt(1.f + horizon * horizon);
+            }
+
+            const float ambient = 1.f - occlusion / NUM_HORIZON_DIRECTIONS;
+
+            // Sun visibility
+            const XMVECTOR position = XMVectorSet(origin.x + x * m_spacing, height + bias, origin.y + z * m_spacing, 0.f);
+
+            int visibleRays = 0;
+            for (const XMVECTOR& ray : sunRays)
+            {
+                XMVECTOR hit;
+                if (surroundings.occluded ? !surroundings.occluded(position, ray) : !bvh.Intersects(position, ray, hit))
+                    ++visibleRays;
+            }
+
+            const float sunVisibility = float(visibleRays) / NUM_SUN_RAYS;
+
+            Texel& texel = m_texels[z * m_resolution + x];
+            texel.ambient = uint8_t(std::lround(ambient * 255.f));
+            texel.sun = uint8_t(std::lround(sunVisibility * 255.f));
+        }
+    }
+}
+
+bool TerrainLightmap::SampleHeight(const float* heights, size_t stride, const Surroundings& surroundings, float x, float z, float& height) const
+{
+    const int last = m_resolution - 1;
+
+    float corners[4];
+    const int x0 = int(std::floor(x));
+    const int z0 = int(std::floor(z));
+
+    for (int corner = 0; corner < 4; ++corner)
+    {
+        int gridX = x0 + (corner & 1);
+        int gridZ = z0 + (corner >> 1);
+
+        // Which grid the sample is in (the surrounding grids share their edge samples with this one)
+        const int dx = (gridX < 0 ? -1 : (gridX > last ? 1 : 0));
+        const int dz = (gridZ < 0 ? -1 : (gridZ > last ? 1 : 0));
+        const float* grid = (dx == 0 && dz == 0 ? heights : surroundings.heights[dz + 1][dx + 1]);
+        if (!grid)
+            return false;
+
+        gridX -= dx * last;
+        gridZ -= dz * last;
+        if (gridX < 0 || gridZ < 0 || gridX > last || gridZ > last)
+            return false;
+
+        corners[corner] = grid[(gridZ * m_resolution + gridX) * stride];
+    }
+
+    const float fx = x - x0;
+    const float fz = z - z0;
+
+    const float bottom = corners[0] + (corners[1] - corners[0]) * fx;
+    const float top = corners[2] + (corners[3] - corners[2]) * fx;
+    height = bottom + (top - bottom) * fz;
+    return true;
+}
+
+D3D11_BOX TerrainLightmap::GetTileBox(int tileX, int tileZ) const
+{
+    D3D11_BOX box;
+    box.left = tileX * TILE_SIZE;
+    box.top = tileZ * TILE_SIZE;
+    box.right = std::min((tileX + 1) * TILE_SIZE, m_resolution);
+    box.bottom = std::min((tileZ + 1) * TILE_SIZE, m_resolution);
+    box.front = 0;
+    box.back = 1;
+
+    return box;
+}
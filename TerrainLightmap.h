@@ -0,0 +1,108 @@
+#pragma once
+#include "BVH.h"
+
+#include <d3d11_1.h>
+#include <DirectXMath.h>
+#include <wrl/client.h>
+
+#include <cfloat>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Baked lighting for a square heightmap grid: per sample, horizon-based ambient occlusion and how much of
+// the sun is visible (one RG8 texel per sample). Baking is done on the CPU, a tile at a time across all
+// hardware threads. Occlusion is found by marching the heightmap towards the horizon in a number of directions
+// (stopping as soon as nothing further out can be tall enough to raise the horizon), and sun visibility by
+// casting a few rays towards the sun through the terrain's BVH. Given the grids around it (see Surroundings),
+// both carry on across its edges, so neighbouring grids light each other without seams.
+// After an edit, only the tiles within reach of the changed heights are rebaked.
+class TerrainLightmap
+{
+public:
+    static constexpr int TILE_SIZE = 16;
+    static constexpr int NUM_HORIZON_DIRECTIONS = 8;
+    static constexpr int NUM_SUN_RAYS = 4;
+
+    struct Settings
+    {
+        // How far (in metres) to look for occluders
+        float occlusionRadius = 64.f;
+        // Towards the sun (the same key light as the terrain shader)
+        DirectX::XMFLOAT3 sunDirection = DirectX::XMFLOAT3(0.5265408f, 0.5735765f, 0.6275069f);
+        // Angular radius (in radians) of the sun, for soft shadow edges
+        float sunRadius = 0.02f;
+    };
+
+    // True if a (world space) ray hits the terrain
+    using RayTest = std::function<bool(const DirectX::XMVECTOR& origin, const DirectX::XMVECTOR& direction)>;
+
+    // What's around the grid. Anything missing is open ground
+    struct Surroundings
+    {
+        // Heights of the grids next to this one by [dz + 1][dx + 1], null where there isn't one (and in the middle).
+        // They're laid out like this grid's heights, and share their edge samples with it
+        const float* heights[3][3] = {};
+        // Highest point of those grids
+        float maxHeight = -FLT_MAX;
+        // Sun rays are cast through this grid's BVH if not set
+        RayTest occluded;
+    };
+
+    TerrainLightmap() = default;
+
+    // Every tile starts out needing a bake (and fully lit until it gets one)
+    void Initialise(int resolution, float spacing, const Settings& settings = Settings());
+
+    // Heights in a (grid coordinate, inclusive) region have changed. Tiles whose lighting they can affect need rebaking.
+    // The region can be outside the grid (heights in a neighbouring grid, in this one's coordinates)
+    void MarkDirty(int minX, int minZ, int maxX, int maxZ);
+    bool IsDirty() const { return m_numDirtyTiles > 0; }
+
+    // Rebakes up to maxTiles dirty tiles (all of them if 0). Heights are read every 'stride' floats, and the
+    // BVH must be over the same heights. Returns the number of tiles still waiting
+    size_t Bake(const float* heights, size_t stride, const BVH& bvh, DirectX::XMFLOAT2 origin, size_t maxTiles = 0,
+                const Surroundings& surroundings = Surroundings());
+
+    // Writes the whole map as an (uncompressed, R = ambient light left after occlusion, G = sun visibility) .dds texture
+    bool Save(const std::string& path) const;
+
+    // GPU copy of the lightmap
+    void CreateTexture(ID3D11Device* device);
+    void UploadDirtyTiles(ID3D11DeviceContext* context);
+    ID3D11ShaderResourceView* GetShaderResourceView() const { return m_srv.Get(); }
+
+    size_t GetMemoryUsage() const { return m_texels.size() * sizeof(Texel) * 2; }
+
+private:
+    struct Texel
+    {
+        uint8_t ambient;  // 1 - occlusion
+        uint8_t sun;
+    };
+
+    void BakeTile(int tileX, int tileZ, const float* heights, size_t stride, const BVH& bvh, DirectX::XMFLOAT2 origin,
+                  const Surroundings& surroundings, float maxHeight);
+    // Bilinearly filtered height at a (fractional) grid position, reaching into the surrounding grids. Returns false
+    // if it's off the edge of them
+    bool SampleHeight(const float* heights, size_t stride, const Surroundings& surroundings, float x, float z, float& height) const;
+    D3D11_BOX GetTileBox(int tileX, int tileZ) const;
+
+    int m_resolution = 0;
+    float m_spacing = 1.f;
+    int m_tilesPerSide = 0;
+    Settings m_settings;
+    // Occlusion radius in grid samples (no further than the surrounding grids go)
+    int m_reach = 0;
+
+    std::vector<Texel> m_texels;
+
+    // Tiles whose heights (or those around them) have changed since they were baked, and baked tiles not yet uploaded
+    std::vector<bool> m_bakeDirty;
+    std::vector<bool> m_uploadDirty;
+    size_t m_numDirtyTiles = 0;
+
+    Microsoft::WRL::ComPtr<ID3D11Texture2D>             m_texture;
+    Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>    m_srv;
+};
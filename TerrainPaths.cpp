@@ -0,0 +1,253 @@
+#include "TerrainPaths.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+
+using namespace DirectX;
+
+const TerrainPaths::Profile TerrainPaths::ROAD = { false, 4.f, 0.f, 0.5f, 24.f };
+const TerrainPaths::Profile TerrainPaths::RIVER = { true, 3.f, 1.5f, 0.35f, 16.f };
+
+namespace
+{
+    // Curve samples are (roughly) this many metres apart
+    const float SAMPLE_SPACING = 2.f;
+    const int MAX_SAMPLES_PER_SPAN = 64;
+
+    bool IsRiver(const std::string& name)
+    {
+        static const char PREFIX[] = "river";
+        if (name.size() < sizeof(PREFIX) - 1)
+            return false;
+
+        for (size_t i = 0; i < sizeof(PREFIX) - 1; ++i)
+            if (std::tolower(static_cast<unsigned char>(name[i])) != PREFIX[i])
+                return false;
+
+        return true;
+    }
+
+    TerrainPaths::Area Expand(TerrainPaths::Area area, float amount)
+    {
+        area.min = XMFLOAT2(area.min.x - amount, area.min.y - amount);
+        area.max = XMFLOAT2(area.max.x + amount, area.max.y + amount);
+        return area;
+    }
+
+    bool Overlaps(const TerrainPaths::Area& a, const TerrainPaths::Area& b)
+    {
+        return a.min.x <= b.max.x && a.max.x >= b.min.x && a.min.y <= b.max.y && a.max.y >= b.min.y;
+    }
+
+    bool operator!=(const XMFLOAT4& a, const XMFLOAT4& b)
+    {
+        return a.x != b.x || a.y != b.y || a.z != b.z || a.w != b.w;
+    }
+}
+
+void TerrainPaths::Update(const std::vector<SceneObject>& nodes, std::vector<Area>& changed)
+{
+    changed.clear();
+
+    std::vector<Path> previous;
+    previous.swap(m_paths);
+
+    BuildPaths(nodes, m_paths);
+    Tessellate();
+
+    const auto AddSpans = [&](const Path& path, int first, int last)
+    {
+        first = std::max(first, 0);
+        last = std::min(last, int(path.spanAreas.size()) - 1);
+        for (int span = first; span <= last; ++span)
+            changed.push_back(path.spanAreas[span]);
+    };
+
+    std::vector<bool> kept(previous.size(), false);
+    for (const Path& path : m_paths)
+    {
+        auto old = std::find_if(previous.begin(), previous.end(), [&](const Path& p) { return p.startID == path.startID; });
+        if (old == previous.end())
+        {
+            AddSpans(path, 0, INT_MAX);
+            continue;
+        }
+
+        if (old->nodes.size() != path.nodes.size() || old->profile != path.profile)
+        {
+            AddSpans(*old, 0, INT_MAX);
+            AddSpans(path, 0, INT_MAX);
+        }
+        else
+        {
+            // A node shapes the curve over the two spans either side of it
+            for (int node = 0; node < int(path.nodes.size()); ++node)
+            {
+                if (path.nodes[node] != old->nodes[node])
+                {
+                    AddSpans(*old, node - 2, node + 1);
+                    AddSpans(path, node - 2, node + 1);
+                }
+            }
+        }
+
+        kept[old - previous.begin()] = true;
+    }
+
+    // Paths that are gone
+    for (size_t path = 0; path < previous.size(); ++path)
+        if (!kept[path])
+            AddSpans(previous[path], 0, INT_MAX);
+}
+
+void TerrainPaths::Clear()
+{
+    m_paths.clear();
+    m_segments.clear();
+}
+
+void TerrainPaths::GetAreas(std::vector<Area>& areas) const
+{
+    areas.clear();
+    for (const Path& path : m_paths)
+        areas.insert(areas.end(), path.spanAreas.begin(), path.spanAreas.end());
+}
+
+void TerrainPaths::FindSegments(const Area& area, std::vector<uint32_t>& segments) const
+{
+    segments.clear();
+    for (uint32_t segment = 0; segment < m_segments.size(); ++segment)
+        if (Overlaps(m_segments[segment].corridor, area))
+            segments.push_back(segment);
+}
+
+float TerrainPaths::Apply(float x, float z, float height, const std::vector<uint32_t>& segments) const
+{
+    // Each path's segments are next to each other, so one path at a time
+    for (size_t i = 0; i < segments.size();)
+    {
+        const uint32_t path = m_segments[segments[i]].path;
+        const Profile& profile = *m_paths[path].profile;
+
+        // Distance past the edge of the path's surface, and the curve's height there, at the nearest segment
+        float edgeDistance = FLT_MAX;
+        float curveHeight = 0.f;
+        for (; i < segments.size() && m_segments[segments[i]].path == path; ++i)
+        {
+            const Segment& segment = m_segments[segments[i]];
+
+            const float abX = segment.b.x - segment.a.x;
+            const float abZ = segment.b.z - segment.a.z;
+            const float lengthSq = abX * abX + abZ * abZ;
+            const float t = (lengthSq > 0.f ? std::min(std::max(((x - segment.a.x) * abX + (z - segment.a.z) * abZ) / lengthSq, 0.f), 1.f) : 0.f);
+
+            const float dx = x - (segment.a.x + abX * t);
+            const float dz = z - (segment.a.z + abZ * t);
+            const float width = profile.halfWidth * (segment.a.w + (segment.b.w - segment.a.w) * t);
+
+            const float distance = std::sqrt(dx * dx + dz * dz) - width;
+            if (distance < edgeDistance)
+            {
+                edgeDistance = distance;
+                curveHeight = segment.a.y + (segment.b.y - segment.a.y) * t;
+            }
+        }
+
+        if (edgeDistance >= profile.bankWidth)
+            continue;
+
+        // Banks rise (or fall) away from the edge at a constant slope. Clamping against them is why applying a profile twice changes nothing
+        const float bank = profile.bankSlope * std::max(edgeDistance, 0.f);
+        if (profile.carve)
+            height = std::min(height, curveHeight - profile.depth + bank);
+        else
+            height = std::min(std::max(height, curveHeight - bank), curveHeight + bank);
+    }
+
+    return height;
+}
+
+void TerrainPaths::BuildPaths(const std::vector<SceneObject>& nodes, std::vector<Path>& paths)
+{
+    std::vector<const SceneObject*> pathNodes;
+    for (const SceneObject& node : nodes)
+        if (node.path_node || node.path_node_start || node.path_node_end)
+            pathNodes.push_back(&node);
+
+    std::sort(pathNodes.begin(), pathNodes.end(), [](const SceneObject* a, const SceneObject* b) { return a->ID < b->ID; });
+
+    bool inPath = false;
+    for (const SceneObject* node : pathNodes)
+    {
+        // A new start cuts off a path that never got an end
+        if (node->path_node_start)
+        {
+            paths.push_back({ node->ID, IsRiver(node->name) ? &RIVER : &ROAD });
+            inPath = true;
+        }
+
+        if (!inPath)
+            continue;
+
+        paths.back().nodes.push_back(XMFLOAT4(node->posX, node->posY, node->posZ, std::max(node->scaX, 0.1f)));
+
+        if (node->path_node_end)
+            inPath = false;
+    }
+
+    paths.erase(std::remove_if(paths.begin(), paths.end(), [](const Path& path) { return path.nodes.size() < 2; }), paths.end());
+}
+
+void TerrainPaths::Tessellate()
+{
+    m_segments.clear();
+
+    for (uint32_t pathIndex = 0; pathIndex < m_paths.size(); ++pathIndex)
+    {
+        Path& path = m_paths[pathIndex];
+        const int numNodes = int(path.nodes.size());
+
+        path.spanAreas.resize(numNodes - 1);
+        for (int span = 0; span < numNodes - 1; ++span)
+        {
+            // The curve is extended past its ends by mirroring the neighbouring node
+            const XMVECTOR p1 = XMLoadFloat4(&path.nodes[span]);
+            const XMVECTOR p2 = XMLoadFloat4(&path.nodes[span + 1]);
+            const XMVECTOR p0 = (span > 0 ? XMLoadFloat4(&path.nodes[span - 1]) : p1 + p1 - p2);
+            const XMVECTOR p3 = (span + 2 < numNodes ? XMLoadFloat4(&path.nodes[span + 2]) : p2 + p2 - p1);
+
+            const float chord = XMVectorGetX(XMVector2Length(XMVectorSwizzle<0, 2, 0, 2>(p2 - p1)));
+            const int numSamples = std::min(std::max(int(std::ceil(chord / SAMPLE_SPACING)), 1), MAX_SAMPLES_PER_SPAN);
+
+            Area& spanArea = path.spanAreas[span];
+            spanArea = { XMFLOAT2(FLT_MAX, FLT_MAX), XMFLOAT2(-FLT_MAX, -FLT_MAX) };
+
+            XMFLOAT4 previous;
+            XMStoreFloat4(&previous, p1);
+
+            for (int sample = 1; sample <= numSamples; ++sample)
+            {
+                XMFLOAT4 current;
+                XMStoreFloat4(&current, XMVectorCatmullRom(p0, p1, p2, p3, float(sample) / numSamples));
+                current.w = std::max(current.w, 0.f);
+
+                Segment segment;
+                segment.a = previous;
+                segment.b = current;
+                segment.path = pathIndex;
+                segment.corridor = Expand({ XMFLOAT2(std::min(previous.x, current.x), std::min(previous.z, current.z)),
+                                            XMFLOAT2(std::max(previous.x, current.x), std::max(previous.z, current.z)) },
+                                          path.profile->halfWidth * std::max(previous.w, current.w) + path.profile->bankWidth);
+
+                spanArea.min = XMFLOAT2(std::min(spanArea.min.x, segment.corridor.min.x), std::min(spanArea.min.y, segment.corridor.min.y));
+                spanArea.max = XMFLOAT2(std::max(spanArea.max.x, segment.corridor.max.x), std::max(spanArea.max.y, segment.corridor.max.y));
+
+                m_segments.push_back(segment);
+                previous = current;
+            }
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "SceneObject.h"
+
+#include <DirectXMath.h>
+
+#include <cstdint>
+#include <vector>
+
+// Roads and riverbeds cut into the terrain along paths of path node objects. Path nodes are taken in
+// order of ID: a path starts at a node flagged path_node_start and runs through the following path nodes
+// up to (and including) one flagged path_node_end. A Catmull-Rom curve through the nodes is tessellated
+// into short segments, and every terrain vertex near a segment is pulled onto the path's profile:
+//  - Roads are flattened to the curve's height, with banks cut/filled at a fixed slope either side
+//  - Rivers (paths whose start node's name begins with "river") are dug below the curve, and only ever lower the terrain
+// Applying a profile to terrain it has already been applied to changes nothing.
+// A node's x scale widens the path around it.
+class TerrainPaths
+{
+public:
+    struct Profile
+    {
+        // Lowers the terrain below the curve (river), rather than flattening it to it (road)
+        bool carve;
+        // Metres either side of the curve that are fully on the profile (scaled by the nodes' x scale)
+        float halfWidth;
+        // How far below the curve a carved bed is
+        float depth;
+        // Rise per metre of the banks, and how far they reach past the edge of the bed/road surface
+        float bankSlope;
+        float bankWidth;
+    };
+
+    static const Profile ROAD;
+    static const Profile RIVER;
+
+    // World space (x, z) rectangle
+    struct Area
+    {
+        DirectX::XMFLOAT2 min, max;
+    };
+
+    TerrainPaths() = default;
+
+    // Rebuilds the paths from the scene's path nodes (other objects are ignored). 'changed' gets the corridors
+    // that now need recarving: around the spans next to a node that has moved, or of paths that have come or gone
+    void Update(const std::vector<SceneObject>& nodes, std::vector<Area>& changed);
+    void Clear();
+    bool IsEmpty() const { return m_segments.empty(); }
+
+    // Corridor of every span of every path
+    void GetAreas(std::vector<Area>& areas) const;
+
+    // Segments whose corridor overlaps an area
+    void FindSegments(const Area& area, std::vector<uint32_t>& segments) const;
+    // Terrain height at (x, z) once every path that 'segments' (from FindSegments, in order) belongs to has been applied
+    float Apply(float x, float z, float height, const std::vector<uint32_t>& segments) const;
+
+private:
+    struct Path
+    {
+        int startID;
+        const Profile* profile;
+        // (x, y, z, width scale) of each node
+        std::vector<DirectX::XMFLOAT4> nodes;
+        // Corridor of each span (between consecutive nodes)
+        std::vector<Area> spanAreas;
+    };
+
+    struct Segment
+    {
+        // Ends of the segment: (x, y, z, width scale)
+        DirectX::XMFLOAT4 a, b;
+        Area corridor;
+        uint32_t path;
+    };
+
+    static void BuildPaths(const std::vector<SceneObject>& nodes, std::vector<Path>& paths);
+    void Tessellate();
+
+    std::vector<Path> m_paths;
+    std::vector<Segment> m_segments;
+};
@@ -0,0 +1,265 @@
+#include "TerrainQuadtree.h"
+
+#include <cassert>
+#include <cfloat>
+
+using namespace DirectX;
+
+void TerrainQuadtree::Initialise(int resolution, float spacing, XMFLOAT2 origin, int leafSize, float firstLodRange)
+{
+    assert(leafSize > 0 && (leafSize & (leafSize - 1)) == 0);
+
+    m_resolution = resolution;
+    m_spacing = spacing;
+    m_origin = origin;
+    m_leafSize = leafSize;
+
+    // Enough levels for a single root node to cover the whole grid
+    m_numLods = 1;
+    while ((leafSize << (m_numLods - 1)) < resolution - 1 && m_numLods < MAX_LODS)
+        ++m_numLods;
+
+    m_leavesPerSide = 1 << (m_numLods - 1);
+
+    m_minMax.resize(m_numLods);
+    for (int lod = 0; lod < m_numLods; ++lod)
+    {
+        const int nodesPerSide = m_leavesPerSide >> lod;
+        m_minMax[lod].assign(nodesPerSide * nodesPerSide, XMFLOAT2(0.f, 0.f));
+    }
+
+    // Each level covers twice the distance of the one below it, and morphs over the last part of its range
+    for (int lod = 0; lod < m_numLods; ++lod)
+    {
+        m_ranges[lod] = firstLodRange * float(1 << lod);
+
+        const float previousRange = (lod > 0 ? m_ranges[lod - 1] : 0.f);
+        m_morphRanges[lod] = XMFLOAT2(previousRange + (m_ranges[lod] - previousRange) * MORPH_START_RATIO, m_ranges[lod]);
+    }
+
+    // There's nothing for the top level to morph into
+    m_morphRanges[m_numLods - 1] = XMFLOAT2(FLT_MAX * 0.5f, FLT_MAX);
+}
+
+void TerrainQuadtree::UpdateHeights(const float* heights, size_t stride, int minX, int minZ, int maxX, int maxZ)
+{
+    const int last = m_resolution - 1;
+
+    // Vertices on a leaf's edge belong to the neighbouring leaf as well
+    const int minLeafX = std::max(0, minX - 1) / m_leafSize;
+    const int minLeafZ = std::max(0, minZ - 1) / m_leafSize;
+    const int maxLeafX = std::min(maxX / m_leafSize, m_leavesPerSide - 1);
+    const int maxLeafZ = std::min(maxZ / m_leafSize, m_leavesPerSide - 1);
+
+    for (int leafZ = minLeafZ; leafZ <= maxLeafZ; ++leafZ)
+    {
+        for (int leafX = minLeafX; leafX <= maxLeafX; ++leafX)
+        {
+            float minHeight = FLT_MAX;
+            float maxHeight = -FLT_MAX;
+
+            const int endX = std::min((leafX + 1) * m_leafSize, last);
+            const int endZ = std::min((leafZ + 1) * m_leafSize, last);
+            for (int z = std::min(leafZ * m_leafSize, last); z <= endZ; ++z)
+            {
+                for (int x = std::min(leafX * m_leafSize, last); x <= endX; ++x)
+                {
+                    const float height = heights[(z * m_resolution + x) * stride];
+                    minHeight = std::min(minHeight, height);
+                    maxHeight = std::max(maxHeight, height);
+                }
+            }
+
+            GetMinMax(0, leafX, leafZ) = XMFLOAT2(minHeight, maxHeight);
+        }
+    }
+
+    // Propagate up
+    for (int lod = 1; lod < m_numLods; ++lod)
+    {
+        for (int nodeZ = minLeafZ >> lod; nodeZ <= maxLeafZ >> lod; ++nodeZ)
+        {
+            for (int nodeX = minLeafX >> lod; nodeX <= maxLeafX >> lod; ++nodeX)
+            {
+                const XMFLOAT2& a = GetMinMax(lod - 1, nodeX * 2, nodeZ * 2);
+                const XMFLOAT2& b = GetMinMax(lod - 1, nodeX * 2 + 1, nodeZ * 2);
+                const XMFLOAT2& c = GetMinMax(lod - 1, nodeX * 2, nodeZ * 2 + 1);
+                const XMFLOAT2& d = GetMinMax(lod - 1, nodeX * 2 + 1, nodeZ * 2 + 1);
+
+                GetMinMax(lod, nodeX, nodeZ) = XMFLOAT2(std::min({ a.x, b.x, c.x, d.x }), std::max({ a.y, b.y, c.y, d.y }));
+            }
+        }
+    }
+}
+
+void XM_CALLCONV TerrainQuadtree::Select(FXMVECTOR cameraPosition, const BoundingFrustum& frustum, std::vector<Patch>& patches) const
+{
+    patches.clear();
+
+    // The root is always in range (the top level has no upper limit), so everything gets handled
+    SelectNode(m_numLods - 1, 0, 0, cameraPosition, frustum, patches);
+}
+
+void XM_CALLCONV TerrainQuadtree::Select(FXMMATRIX view, CXMMATRIX projection, std::vector<Patch>& patches) const
+{
+    const XMMATRIX invView = XMMatrixInverse(nullptr, view);
+
+    BoundingFrustum frustum = GetViewFrustum(projection);
+    frustum.Transform(frustum, invView);
+
+    Select(invView.r[3], frustum, patches);
+}
+
+BoundingFrustum XM_CALLCONV TerrainQuadtree::GetViewFrustum(FXMMATRIX projection)
+{
+    BoundingFrustum frustum(projection);
+    // Right-handed projection: in front of the camera is negative z, so near and far come out swapped
+    if (frustum.Near > frustum.Far)
+        std::swap(frustum.Near, frustum.Far);
+
+    return frustum;
+}
+
+void TerrainQuadtree::BuildPatchIndices(std::vector<uint32_t>& indices)
+{
+    indices.clear();
+    m_patchRanges.assign(m_numLods * 2, std::vector<IndexRange>());
+
+    for (int nodeLevel = 0; nodeLevel < m_numLods; ++nodeLevel)
+    {
+        const int nodeSize = m_leafSize << nodeLevel;
+        const int nodesPerSide = m_leavesPerSide >> nodeLevel;
+
+        for (int lod = nodeLevel; lod < std::min(nodeLevel + 2, m_numLods); ++lod)
+        {
+            std::vector<IndexRange>& ranges = m_patchRanges[nodeLevel * 2 + (lod - nodeLevel)];
+            ranges.resize(nodesPerSide * nodesPerSide);
+
+            for (int nodeZ = 0; nodeZ < nodesPerSide; ++nodeZ)
+            {
+                for (int nodeX = 0; nodeX < nodesPerSide; ++nodeX)
+                {
+                    IndexRange& range = ranges[nodeZ * nodesPerSide + nodeX];
+                    range.first = uint32_t(indices.size());
+
+                    // Nodes in the padding beyond the grid come out empty
+                    AppendIndices(Patch{ nodeX * nodeSize, nodeZ * nodeSize, nodeSize, lod }, indices);
+
+                    range.count = uint32_t(indices.size()) - range.first;
+                }
+            }
+        }
+    }
+}
+
+const TerrainQuadtree::IndexRange& TerrainQuadtree::GetIndexRange(const Patch& patch) const
+{
+    int nodeLevel = 0;
+    while ((m_leafSize << nodeLevel) < patch.size)
+        ++nodeLevel;
+
+    const int nodesPerSide = m_leavesPerSide >> nodeLevel;
+    const int nodeX = patch.x / patch.size;
+    const int nodeZ = patch.z / patch.size;
+
+    assert(patch.lod - nodeLevel >= 0 && patch.lod - nodeLevel < 2);
+    return m_patchRanges[nodeLevel * 2 + (patch.lod - nodeLevel)][nodeZ * nodesPerSide + nodeX];
+}
+
+float TerrainQuadtree::GetMorphTarget(const float* heights, size_t stride, int x, int z, int& morphLevel) const
+{
+    const auto Height = [&](int gx, int gz) { return heights[(gz * m_resolution + gx) * stride]; };
+
+    const int last = m_resolution - 1;
+
+    // A vertex is on the grid of every level up to the number of trailing zeros in its coordinates,
+    // and is only ever 'odd' (i.e. not on the next level's grid) at the last of them.
+    // The last row/column is on every level's grid (cells are squashed onto it)
+    const int bits = (x < last ? x : 0) | (z < last ? z : 0);
+
+    morphLevel = 0;
+    while (morphLevel < m_numLods - 1 && (bits & (1 << morphLevel)) == 0)
+        ++morphLevel;
+
+    if (morphLevel == m_numLods - 1)
+        return Height(x, z);
+
+    const int step = 1 << morphLevel;
+
+    const bool oddX = ((x >> morphLevel) & 1) != 0 && x < last;
+    const bool oddZ = ((z >> morphLevel) & 1) != 0 && z < last;
+
+    // The coarser edge (or cell diagonal, if both are odd) this vertex sits on. The far ends are clamped to the grid
+    const int x0 = oddX ? x - step : x;
+    const int x1 = oddX ? std::min(x + step, last) : x;
+    const int z0 = oddZ ? z - step : z;
+    const int z1 = oddZ ? std::min(z + step, last) : z;
+
+    const float t = oddX ? float(x - x0) / float(x1 - x0) : float(z - z0) / float(z1 - z0);
+
+    const float h0 = Height(x0, z0);
+    return h0 + (Height(x1, z1) - h0) * t;
+}
+
+bool XM_CALLCONV TerrainQuadtree::SelectNode(int lod, int nodeX, int nodeZ, FXMVECTOR cameraPosition, const BoundingFrustum& frustum, std::vector<Patch>& patches) const
+{
+    XMFLOAT3 camera;
+    XMStoreFloat3(&camera, cameraPosition);
+
+    const BoundingBox bounds = GetNodeBounds(lod, nodeX, nodeZ);
+
+    // Out of this level's range--the parent draws this area instead
+    if (lod < m_numLods - 1 && !bounds.Intersects(BoundingSphere(camera, m_ranges[lod])))
+        return false;
+
+    // Not visible, but handled all the same
+    if (!frustum.Intersects(bounds))
+        return true;
+
+    const int nodeSize = m_leafSize << lod;
+
+    // Draw the whole node at this level if none of it is close enough for the next level down
+    if (lod == 0 || !bounds.Intersects(BoundingSphere(camera, m_ranges[lod - 1])))
+    {
+        patches.push_back({ nodeX * nodeSize, nodeZ * nodeSize, nodeSize, lod });
+        return true;
+    }
+
+    const int childSize = nodeSize / 2;
+    for (int childZ = nodeZ * 2; childZ < nodeZ * 2 + 2; ++childZ)
+    {
+        for (int childX = nodeX * 2; childX < nodeX * 2 + 2; ++childX)
+        {
+            // Padding beyond the grid
+            if (childX * childSize >= m_resolution - 1 || childZ * childSize >= m_resolution - 1)
+                continue;
+
+            // Children that are out of range are drawn at this level
+            if (!SelectNode(lod - 1, childX, childZ, cameraPosition, frustum, patches) && frustum.Intersects(GetNodeBounds(lod - 1, childX, childZ)))
+                patches.push_back({ childX * childSize, childZ * childSize, childSize, lod });
+        }
+    }
+
+    return true;
+}
+
+BoundingBox TerrainQuadtree::GetNodeBounds(int lod, int nodeX, int nodeZ) const
+{
+    const int nodeSize = m_leafSize << lod;
+    const int last = m_resolution - 1;
+
+    const int x0 = std::min(nodeX * nodeSize, last);
+    const int z0 = std::min(nodeZ * nodeSize, last);
+    const int x1 = std::min(x0 + nodeSize, last);
+    const int z1 = std::min(z0 + nodeSize, last);
+
+    const XMFLOAT2& minMax = GetMinMax(lod, nodeX, nodeZ);
+
+    const XMVECTOR minCorner = XMVectorSet(m_origin.x + x0 * m_spacing, minMax.x, m_origin.y + z0 * m_spacing, 0.f);
+    const XMVECTOR maxCorner = XMVectorSet(m_origin.x + x1 * m_spacing, minMax.y, m_origin.y + z1 * m_spacing, 0.f);
+
+    BoundingBox bounds;
+    BoundingBox::CreateFromPoints(bounds, minCorner, maxCorner);
+
+    return bounds;
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Continuous distance-dependent LOD (CDLOD) for a square heightmap grid.
+// The grid is covered by a quadtree whose leaves are leafSize quads across. Every frame, nodes are picked
+// by their distance from the camera (each level covering twice the range of the one below it) and culled
+// against the view frustum. A selected patch is drawn with every 2^lod-th vertex of the full grid, and
+// vertices towards the far end of a level's range are morphed into the next level so there's no popping.
+// Nothing in here touches the GPU.
+class TerrainQuadtree
+{
+public:
+    static constexpr int MAX_LODS = 16;
+    // How far through a level's range vertices start morphing into the next level
+    static constexpr float MORPH_START_RATIO = 0.66f;
+
+    struct Patch
+    {
+        // Grid coordinates of the patch's bottom-left vertex, and its width in (full resolution) quads
+        int x, z;
+        int size;
+        int lod;
+    };
+
+    struct IndexRange
+    {
+        uint32_t first;
+        uint32_t count;
+    };
+
+    TerrainQuadtree() = default;
+
+    // spacing: distance between grid vertices, origin: world space (x, z) of vertex (0, 0)
+    // firstLodRange: distance from the camera that LOD 0 is drawn out to
+    void Initialise(int resolution, float spacing, DirectX::XMFLOAT2 origin, int leafSize = 16, float firstLodRange = 128.f);
+
+    // Recalculates node height bounds in a (grid coordinate) region. Heights are read every 'stride' floats
+    void UpdateHeights(const float* heights, size_t stride, int minX, int minZ, int maxX, int maxZ);
+    void UpdateHeights(const float* heights, size_t stride) { UpdateHeights(heights, stride, 0, 0, m_resolution - 1, m_resolution - 1); }
+
+    // Picks the patches to draw this frame (frustum in world space)
+    void XM_CALLCONV Select(DirectX::FXMVECTOR cameraPosition, const DirectX::BoundingFrustum& frustum, std::vector<Patch>& patches) const;
+    // The same, seen through a camera's (right-handed) view and projection
+    void XM_CALLCONV Select(DirectX::FXMMATRIX view, DirectX::CXMMATRIX projection, std::vector<Patch>& patches) const;
+
+    // View space frustum of a right-handed projection
+    static DirectX::BoundingFrustum XM_CALLCONV GetViewFrustum(DirectX::FXMMATRIX projection);
+
+    // Triangle list indices (into the full resolution grid) for a patch
+    template <typename Index>
+    void AppendIndices(const Patch& patch, std::vector<Index>& indices) const
+    {
+        const int step = 1 << patch.lod;
+        const int last = m_resolution - 1;
+
+        // Cells on the grid's far edges are squashed onto the last row/column
+        for (int z = patch.z; z < std::min(patch.z + patch.size, last); z += step)
+        {
+            for (int x = patch.x; x < std::min(patch.x + patch.size, last); x += step)
+            {
+                const int x1 = std::min(x + step, last);
+                const int z1 = std::min(z + step, last);
+
+                const Index bottomL = Index(z * m_resolution + x);
+                const Index bottomR = Index(z * m_resolution + x1);
+                const Index topR = Index(z1 * m_resolution + x1);
+                const Index topL = Index(z1 * m_resolution + x);
+
+                // Same split as the full resolution terrain
+                indices.insert(indices.end(), { bottomL, bottomR, topR, bottomL, topR, topL });
+            }
+        }
+    }
+
+    // Lays out the indices of every patch Select() can return in a single (static) index buffer
+    void BuildPatchIndices(std::vector<uint32_t>& indices);
+    // Where a patch's indices are in the buffer made by BuildPatchIndices()
+    const IndexRange& GetIndexRange(const Patch& patch) const;
+
+    // Height of the next coarser level's surface at a grid vertex, and the level at which the vertex morphs into it
+    float GetMorphTarget(const float* heights, size_t stride, int x, int z, int& morphLevel) const;
+
+    // (start, end) distances of each level's morph
+    const DirectX::XMFLOAT2& GetMorphRange(int lod) const { return m_morphRanges[lod]; }
+
+    int GetLodCount() const { return m_numLods; }
+
+private:
+    bool XM_CALLCONV SelectNode(int lod, int nodeX, int nodeZ, DirectX::FXMVECTOR cameraPosition, const DirectX::BoundingFrustum& frustum, std::vector<Patch>& patches) const;
+
+    DirectX::BoundingBox GetNodeBounds(int lod, int nodeX, int nodeZ) const;
+    DirectX::XMFLOAT2& GetMinMax(int lod, int nodeX, int nodeZ) { return m_minMax[lod][nodeZ * (m_leavesPerSide >> lod) + nodeX]; }
+    const DirectX::XMFLOAT2& GetMinMax(int lod, int nodeX, int nodeZ) const { return m_minMax[lod][nodeZ * (m_leavesPerSide >> lod) + nodeX]; }
+
+    int m_resolution = 0;
+    float m_spacing = 1.f;
+    DirectX::XMFLOAT2 m_origin;
+
+    int m_leafSize = 16;
+    int m_leavesPerSide = 1;
+    int m_numLods = 1;
+
+    // Per level, per node (min, max) heights
+    std::vector<std::vector<DirectX::XMFLOAT2>> m_minMax;
+
+    // A patch is either a whole node drawn at its own level, or a quarter of a node drawn at the parent's level.
+    // Indexed by [node level * 2 + (lod - node level)][node]
+    std::vector<std::vector<IndexRange>> m_patchRanges;
+
+    float m_ranges[MAX_LODS];
+    DirectX::XMFLOAT2 m_morphRanges[MAX_LODS];
+};
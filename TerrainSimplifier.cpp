@@ -0,0 +1,296 @@
+#include "TerrainSimplifier.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <unordered_map>
+
+using namespace DirectX;
+
+TerrainSimplifier::TerrainSimplifier(std::vector<float> heights, int resolution, float spacing, XMFLOAT2 origin, int tileSize)
+    :   m_heights(std::move(heights)),
+        m_resolution(resolution),
+        m_spacing(spacing),
+        m_origin(origin),
+        m_tileSize(tileSize)
+{
+    assert(tileSize > 1 && (tileSize & (tileSize - 1)) == 0);
+    assert(m_heights.size() == size_t(resolution * resolution));
+
+    // The grid is padded out to a whole number of tiles (padding repeats the last row/column)
+    m_tilesPerSide = (resolution - 1 + tileSize - 1) / tileSize;
+
+    // Every tile shares the same triangle hierarchy, so it only needs working out once
+    m_numTriangles = tileSize * tileSize * 2 - 2;
+    m_numParentTriangles = m_numTriangles - tileSize * tileSize;
+
+    m_triangleCoords.resize(m_numTriangles * 4);
+    for (int i = 0; i < m_numTriangles; ++i)
+    {
+        // Triangle ids are implicit binary tree indices (the two roots are 2 and 3)
+        int id = i + 2;
+        int ax = 0, ay = 0, bx = 0, by = 0, cx = 0, cy = 0;
+        if (id & 1)
+            bx = by = cx = tileSize;    // bottom-left root
+        else
+            ax = ay = cy = tileSize;    // top-right root
+
+        while ((id >>= 1) > 1)
+        {
+            const int mx = (ax + bx) >> 1;
+            const int my = (ay + by) >> 1;
+
+            if (id & 1)
+            {
+                // Left child
+                bx = ax; by = ay;
+                ax = cx; ay = cy;
+            }
+            else
+            {
+                // Right child
+                ax = bx; ay = by;
+                bx = cx; by = cy;
+            }
+
+            cx = mx;
+            cy = my;
+        }
+
+        m_triangleCoords[i * 4 + 0] = uint16_t(ax);
+        m_triangleCoords[i * 4 + 1] = uint16_t(ay);
+        m_triangleCoords[i * 4 + 2] = uint16_t(bx);
+        m_triangleCoords[i * 4 + 3] = uint16_t(by);
+    }
+}
+
+std::vector<TerrainSimplifier::Mesh> TerrainSimplifier::Simplify(float maxError) const
+{
+    const size_t numTiles = m_tilesPerSide * m_tilesPerSide;
+    const size_t gridSize = m_tileSize + 1;
+
+    // Per-tile error maps
+    std::vector<ErrorMap> errorMaps(numTiles);
+    ParallelFor(numTiles, [&](size_t tile)
+    {
+        errorMaps[tile].assign(gridSize * gridSize, 0.f);
+        CalculateErrors(tile % m_tilesPerSide, tile / m_tilesPerSide, errorMaps[tile]);
+    });
+
+    // Make shared edges agree, then push any raised errors up the hierarchy again.
+    // Errors only ever grow, so this settles quickly (usually after a single pass)
+    while (ShareEdgeErrors(errorMaps))
+    {
+        ParallelFor(numTiles, [&](size_t tile)
+        {
+            CalculateErrors(tile % m_tilesPerSide, tile / m_tilesPerSide, errorMaps[tile]);
+        });
+    }
+
+    std::vector<Mesh> meshes(numTiles);
+    ParallelFor(numTiles, [&](size_t tile)
+    {
+        meshes[tile] = BuildMesh(tile % m_tilesPerSide, tile / m_tilesPerSide, errorMaps[tile], maxError);
+    });
+
+    return meshes;
+}
+
+bool TerrainSimplifier::WriteOBJ(const std::string& path, const std::vector<Mesh>& meshes)
+{
+    FILE *pFile = NULL;
+    errno_t ret = fopen_s(&pFile, path.c_str(), "w");
+    if (ret != 0 || pFile == NULL)
+        return false;
+
+    // Border vertices appear in several tiles--weld them so the file is one watertight mesh
+    std::unordered_map<uint32_t, uint32_t> objIndices;
+    std::vector<uint32_t> remap;
+
+    for (size_t tile = 0; tile < meshes.size(); ++tile)
+    {
+        const Mesh& mesh = meshes[tile];
+
+        remap.resize(mesh.vertices.size());
+        for (size_t i = 0; i < mesh.vertices.size(); ++i)
+        {
+            auto inserted = objIndices.emplace(mesh.gridIndices[i], uint32_t(objIndices.size() + 1));
+            if (inserted.second)
+                fprintf(pFile, "v %f %f %f\n", mesh.vertices[i].x, mesh.vertices[i].y, mesh.vertices[i].z);
+
+            remap[i] = inserted.first->second;
+        }
+
+        fprintf(pFile, "g tile%zu\n", tile);
+        for (size_t i = 0; i < mesh.indices.size(); i += 3)
+            fprintf(pFile, "f %u %u %u\n", remap[mesh.indices[i]], remap[mesh.indices[i + 1]], remap[mesh.indices[i + 2]]);
+    }
+
+    bool succeeded = (ferror(pFile) == 0);
+    fclose(pFile);
+
+    return succeeded;
+}
+
+float TerrainSimplifier::Sample(int x, int z) const
+{
+    // Padding outside the heightmap repeats the last row/column
+    x = std::min(x, m_resolution - 1);
+    z = std::min(z, m_resolution - 1);
+
+    return m_heights[z * m_resolution + x];
+}
+
+void TerrainSimplifier::CalculateErrors(int tileX, int tileZ, ErrorMap& errors) const
+{
+    const int gridSize = m_tileSize + 1;
+    const int offsetX = tileX * m_tileSize;
+    const int offsetZ = tileZ * m_tileSize;
+
+    // Smallest triangles first, so children are done before their parents
+    for (int i = m_numTriangles - 1; i >= 0; --i)
+    {
+        const int ax = m_triangleCoords[i * 4 + 0];
+        const int ay = m_triangleCoords[i * 4 + 1];
+        const int bx = m_triangleCoords[i * 4 + 2];
+        const int by = m_triangleCoords[i * 4 + 3];
+
+        // Hypotenuse midpoint and the right-angle corner
+        const int mx = (ax + bx) >> 1;
+        const int my = (ay + by) >> 1;
+        const int cx = mx + my - ay;
+        const int cy = my + ax - mx;
+
+        // Error introduced by not splitting the hypotenuse
+        const float interpolatedHeight = (Sample(offsetX + ax, offsetZ + ay) + Sample(offsetX + bx, offsetZ + by)) * 0.5f;
+        const float middleError = std::abs(interpolatedHeight - Sample(offsetX + mx, offsetZ + my));
+
+        float& error = errors[my * gridSize + mx];
+        error = std::max(error, middleError);
+
+        // A parent must split if either of its children does
+        if (i < m_numParentTriangles)
+        {
+            const int leftChildIndex = ((ay + cy) >> 1) * gridSize + ((ax + cx) >> 1);
+            const int rightChildIndex = ((by + cy) >> 1) * gridSize + ((bx + cx) >> 1);
+
+            error = std::max({ error, errors[leftChildIndex], errors[rightChildIndex] });
+        }
+    }
+}
+
+bool TerrainSimplifier::ShareEdgeErrors(std::vector<ErrorMap>& errorMaps) const
+{
+    const int gridSize = m_tileSize + 1;
+
+    bool changed = false;
+    const auto share = [&](float& a, float& b)
+    {
+        if (a != b)
+        {
+            a = b = std::max(a, b);
+            changed = true;
+        }
+    };
+
+    for (int tileZ = 0; tileZ < m_tilesPerSide; ++tileZ)
+    {
+        for (int tileX = 0; tileX < m_tilesPerSide; ++tileX)
+        {
+            ErrorMap& errors = errorMaps[tileZ * m_tilesPerSide + tileX];
+
+            // Right edge is the neighbour's left edge
+            if (tileX + 1 < m_tilesPerSide)
+            {
+                ErrorMap& right = errorMaps[tileZ * m_tilesPerSide + tileX + 1];
+                for (int i = 0; i < gridSize; ++i)
+                    share(errors[i * gridSize + m_tileSize], right[i * gridSize]);
+            }
+
+            // Top edge is the neighbour's bottom edge
+            if (tileZ + 1 < m_tilesPerSide)
+            {
+                ErrorMap& top = errorMaps[(tileZ + 1) * m_tilesPerSide + tileX];
+                for (int i = 0; i < gridSize; ++i)
+                    share(errors[m_tileSize * gridSize + i], top[i]);
+            }
+        }
+    }
+
+    return changed;
+}
+
+TerrainSimplifier::Mesh TerrainSimplifier::BuildMesh(int tileX, int tileZ, const ErrorMap& errors, float maxError) const
+{
+    const int gridSize = m_tileSize + 1;
+    const int offsetX = tileX * m_tileSize;
+    const int offsetZ = tileZ * m_tileSize;
+
+    Mesh mesh;
+
+    // Vertices are keyed on their (clamped) position in the full grid, so padding collapses onto the real edge
+    std::unordered_map<uint32_t, uint32_t> vertexLookup;
+    const auto addVertex = [&](int x, int z, int& gridX, int& gridZ)
+    {
+        gridX = std::min(offsetX + x, m_resolution - 1);
+        gridZ = std::min(offsetZ + z, m_resolution - 1);
+
+        const uint32_t gridIndex = gridZ * m_resolution + gridX;
+        auto inserted = vertexLookup.emplace(gridIndex, uint32_t(mesh.vertices.size()));
+        if (inserted.second)
+        {
+            mesh.vertices.emplace_back(m_origin.x + gridX * m_spacing, Sample(gridX, gridZ), m_origin.y + gridZ * m_spacing);
+            mesh.gridIndices.push_back(gridIndex);
+        }
+
+        return inserted.first->second;
+    };
+
+    const auto addTriangle = [&](int ax, int ay, int bx, int by, int cx, int cy)
+    {
+        int gax, gaz, gbx, gbz, gcx, gcz;
+        uint32_t a = addVertex(ax, ay, gax, gaz);
+        uint32_t b = addVertex(bx, by, gbx, gbz);
+        uint32_t c = addVertex(cx, cy, gcx, gcz);
+
+        // Triangles in the padding collapse to nothing
+        const int cross = (gbx - gax) * (gcz - gaz) - (gbz - gaz) * (gcx - gax);
+        if (cross == 0)
+            return;
+
+        // Same winding as the editor's index buffer
+        if (cross < 0)
+            std::swap(b, c);
+
+        mesh.indices.push_back(a);
+        mesh.indices.push_back(b);
+        mesh.indices.push_back(c);
+    };
+
+    // Walk down the hierarchy, splitting wherever the error is too large
+    struct Triangle { int ax, ay, bx, by, cx, cy; };
+    std::vector<Triangle> stack;
+    stack.push_back({ 0, 0, m_tileSize, m_tileSize, m_tileSize, 0 });
+    stack.push_back({ m_tileSize, m_tileSize, 0, 0, 0, m_tileSize });
+
+    while (!stack.empty())
+    {
+        Triangle t = stack.back();
+        stack.pop_back();
+
+        const int mx = (t.ax + t.bx) >> 1;
+        const int my = (t.ay + t.by) >> 1;
+
+        if (std::abs(t.ax - t.cx) + std::abs(t.ay - t.cy) > 1 && errors[my * gridSize + mx] > maxError)
+        {
+            stack.push_back({ t.cx, t.cy, t.ax, t.ay, mx, my });
+            stack.push_back({ t.bx, t.by, t.cx, t.cy, mx, my });
+        }
+        else
+            addTriangle(t.ax, t.ay, t.bx, t.by, t.cx, t.cy);
+    }
+
+    return mesh;
+}
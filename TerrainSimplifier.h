@@ -0,0 +1,53 @@
+#pragma once
+#include <DirectXMath.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Builds simplified terrain meshes from a heightmap using a right-triangulated irregular network (RTIN).
+// The heightmap is split into square tiles that are simplified in parallel. Errors along shared tile edges
+// are kept equal, so neighbouring tiles split their borders identically and the result is watertight.
+class TerrainSimplifier
+{
+public:
+    struct Mesh
+    {
+        std::vector<DirectX::XMFLOAT3> vertices;
+        // Index of each vertex in the full resolution grid (handy for welding tiles together)
+        std::vector<uint32_t> gridIndices;
+        std::vector<uint32_t> indices;
+    };
+
+    // heights: resolution * resolution samples (row major, z rows)
+    // tileSize: quads per tile edge (must be a power of two)
+    TerrainSimplifier(std::vector<float> heights, int resolution, float spacing, DirectX::XMFLOAT2 origin, int tileSize = 32);
+
+    // One mesh per tile, with no vertex deviating more than maxError vertically from the heightmap
+    std::vector<Mesh> Simplify(float maxError) const;
+
+    // Writes the tiles as a single welded .obj
+    static bool WriteOBJ(const std::string& path, const std::vector<Mesh>& meshes);
+
+private:
+    using ErrorMap = std::vector<float>;
+
+    float Sample(int x, int z) const;
+
+    void CalculateErrors(int tileX, int tileZ, ErrorMap& errors) const;
+    bool ShareEdgeErrors(std::vector<ErrorMap>& errorMaps) const;
+    Mesh BuildMesh(int tileX, int tileZ, const ErrorMap& errors, float maxError) const;
+
+    std::vector<float> m_heights;
+    int m_resolution;
+    float m_spacing;
+    DirectX::XMFLOAT2 m_origin;
+
+    int m_tileSize;
+    int m_tilesPerSide;
+
+    // Triangle corner coordinates (ax, ay, bx, by) of every triangle in a tile's RTIN hierarchy, smallest last
+    std::vector<uint16_t> m_triangleCoords;
+    int m_numTriangles;
+    int m_numParentTriangles;
+};
@@ -0,0 +1,88 @@
+#include "TerrainStamp.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace DirectX;
+
+void TerrainStamp::Set(std::vector<float> heights, int resolution, float spacing)
+{
+    m_heights = std::move(heights);
+    m_resolution = resolution;
+    m_spacing = spacing;
+    m_base = (m_heights.empty() ? 0.f : *std::min_element(m_heights.begin(), m_heights.end()));
+}
+
+void TerrainStamp::GetFootprint(const Placement& placement, XMFLOAT2& min, XMFLOAT2& max) const
+{
+    // Half the width of the rotated square's bounding box
+    const float halfSize = 0.5f * GetSize() * placement.scale;
+    const float extent = halfSize * (std::abs(std::cos(placement.rotation)) + std::abs(std::sin(placement.rotation)));
+
+    min = XMFLOAT2(placement.center.x - extent, placement.center.y - extent);
+    max = XMFLOAT2(placement.center.x + extent, placement.center.y + extent);
+}
+
+XMVECTOR XM_CALLCONV TerrainStamp::Sample(const Placement& placement, FXMVECTOR xs, FXMVECTOR zs, XMVECTOR& weight) const
+{
+    weight = g_XMZero;
+    if (m_resolution < 2)
+        return g_XMZero;
+
+    const float halfGrid = 0.5f * (m_resolution - 1);
+    const XMVECTOR maxCell = XMVectorReplicate(float(m_resolution - 2));
+
+    // Into the stamp's grid: undo the placement's translation, rotation and scale
+    const float toGrid = 1.f / (m_spacing * placement.scale);
+    const XMVECTOR cosine = XMVectorReplicate(std::cos(placement.rotation) * toGrid);
+    const XMVECTOR sine = XMVectorReplicate(std::sin(placement.rotation) * toGrid);
+
+    const XMVECTOR dx = xs - XMVectorReplicate(placement.center.x);
+    const XMVECTOR dz = zs - XMVectorReplicate(placement.center.y);
+
+    // Relative to the stamp's center, in grid units
+    const XMVECTOR u = dx * cosine + dz * sine;
+    const XMVECTOR v = dz * cosine - dx * sine;
+
+    // Fade in from the edges (square falloff, smoothed)
+    const XMVECTOR edgeDistance = XMVectorReplicate(halfGrid) - XMVectorMax(XMVectorAbs(u), XMVectorAbs(v));
+    weight = XMVectorSaturate(edgeDistance / XMVectorReplicate(std::max(placement.feather * halfGrid, 1e-3f)));
+    weight = weight * weight * (XMVectorReplicate(3.f) - weight - weight);
+
+    // Nothing to do if every lane is outside
+    if (XMVector4LessOrEqual(weight, g_XMZero))
+        return g_XMZero;
+
+    const XMVECTOR gridX = XMVectorClamp(u + XMVectorReplicate(halfGrid), g_XMZero, maxCell + g_XMOne);
+    const XMVECTOR gridZ = XMVectorClamp(v + XMVectorReplicate(halfGrid), g_XMZero, maxCell + g_XMOne);
+
+    const XMVECTOR cellX = XMVectorMin(XMVectorFloor(gridX), maxCell);
+    const XMVECTOR cellZ = XMVectorMin(XMVectorFloor(gridZ), maxCell);
+
+    const XMVECTOR fracX = gridX - cellX;
+    const XMVECTOR fracZ = gridZ - cellZ;
+
+    XMFLOAT4A cx, cz;
+    XMStoreFloat4A(&cx, cellX);
+    XMStoreFloat4A(&cz, cellZ);
+
+    // No gather instruction to lean on, so fetch the corner heights one lane at a time
+    XMFLOAT4A bottomL, bottomR, topR, topL;
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        const int x = int((&cx.x)[lane]);
+        const int z = int((&cz.x)[lane]);
+
+        (&bottomL.x)[lane] = GetHeight(x, z);
+        (&bottomR.x)[lane] = GetHeight(x + 1, z);
+        (&topR.x)[lane] = GetHeight(x + 1, z + 1);
+        (&topL.x)[lane] = GetHeight(x, z + 1);
+    }
+
+    // Bilinear (the stamp may be rotated, so there's no triangle split to follow)
+    const XMVECTOR bottom = XMVectorLerpV(XMLoadFloat4A(&bottomL), XMLoadFloat4A(&bottomR), fracX);
+    const XMVECTOR top = XMVectorLerpV(XMLoadFloat4A(&topL), XMLoadFloat4A(&topR), fracX);
+    const XMVECTOR stamp = XMVectorLerpV(bottom, top, fracZ);
+
+    return (placement.blend == BLEND_ADD ? stamp - XMVectorReplicate(m_base) : stamp);
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <DirectXMath.h>
+
+#include <vector>
+
+// A square block of heights copied off the terrain (the terrain clipboard), which can be pasted back
+// anywhere: rotated about y, scaled, blended with what's there, and faded out towards its edges.
+// Pasting resamples the block for four destination vertices at a time (the blending is left to the
+// terrain's stamp layers, see TerrainLayerStack).
+class TerrainStamp
+{
+public:
+    enum BlendMode
+    {
+        BLEND_REPLACE = 0,  // Copied heights as they were
+        BLEND_ADD,          // Copied relief (heights above its lowest point) on top of the destination
+        BLEND_MAX,          // Only raises the destination
+        BLEND_MIN,          // Only lowers the destination
+        BLEND_COUNT
+    };
+
+    struct Placement
+    {
+        // World space (x, z) of the stamp's center
+        DirectX::XMFLOAT2 center = DirectX::XMFLOAT2(0.f, 0.f);
+        // Radians about y
+        float rotation = 0.f;
+        // Horizontal only
+        float scale = 1.f;
+        BlendMode blend = BLEND_REPLACE;
+        // Fraction of the way from the edges to the center over which the stamp fades in
+        float feather = 0.25f;
+    };
+
+    TerrainStamp() = default;
+
+    // heights: resolution * resolution samples, 'spacing' metres apart (row major, z rows)
+    void Set(std::vector<float> heights, int resolution, float spacing);
+    void Clear() { m_heights.clear(); m_resolution = 0; }
+    bool IsEmpty() const { return m_heights.empty(); }
+
+    // Width (in metres) of the copied block, before scaling
+    float GetSize() const { return (m_resolution - 1) * m_spacing; }
+
+    // World space (x, z) bounds of a placed stamp
+    void GetFootprint(const Placement& placement, DirectX::XMFLOAT2& min, DirectX::XMFLOAT2& max) const;
+
+    // The stamp at four world space positions (xs, zs), as the value to blend in with the placement's blend mode
+    // (relief for BLEND_ADD, heights otherwise), and how much of it to blend in (0 outside the stamp)
+    DirectX::XMVECTOR XM_CALLCONV Sample(const Placement& placement, DirectX::FXMVECTOR xs, DirectX::FXMVECTOR zs, DirectX::XMVECTOR& weight) const;
+
+private:
+    float GetHeight(int x, int z) const { return m_heights[z * m_resolution + x]; }
+
+    std::vector<float> m_heights;
+    int m_resolution = 0;
+    float m_spacing = 1.f;
+    // Lowest copied height (BLEND_ADD adds the relief above it)
+    float m_base = 0.f;
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include <d3d11_1.h>
+#include <DirectXMath.h>
+
+#include <cmath>
+#include <cstdint>
+
+// Compact terrain vertex (12 bytes). x/z and uv follow from the vertex' index in the grid, so only the
+// height is stored. On top of that each vertex carries what it needs to morph into the next coarser
+// LOD level (see TerrainQuadtree)
+struct TerrainVertex
+{
+    float height;
+    // Height of the next coarser level's surface at this vertex
+    float morphHeight;
+    // Octahedron encoded normal (see EncodeOctNormal)
+    uint8_t normal[2];
+    // The only LOD level at which this vertex morphs
+    uint8_t morphLevel;
+    uint8_t padding;
+
+    static const int InputElementCount = 4;
+    static const D3D11_INPUT_ELEMENT_DESC InputElements[InputElementCount];
+};
+
+// Octahedral normal encoding, folded around y (so normals of a heightmap never actually get folded)
+inline void XM_CALLCONV EncodeOctNormal(DirectX::FXMVECTOR normal, uint8_t encoded[2])
+{
+    DirectX::XMFLOAT3 n;
+    DirectX::XMStoreFloat3(&n, normal);
+
+    const float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    float u = n.x / l1;
+    float v = n.z / l1;
+
+    if (n.y < 0.f)
+    {
+        const float foldedU = (1.f - std::abs(v)) * (u >= 0.f ? 1.f : -1.f);
+        const float foldedV = (1.f - std::abs(u)) * (v >= 0.f ? 1.f : -1.f);
+        u = foldedU;
+        v = foldedV;
+    }
+
+    // [-1, 1] -> [0, 255]
+    encoded[0] = uint8_t(std::lround((u * 0.5f + 0.5f) * 255.f));
+    encoded[1] = uint8_t(std::lround((v * 0.5f + 0.5f) * 255.f));
+}
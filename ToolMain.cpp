@@ -1,14 +1,20 @@
 #include "ToolMain.h"
 #include "resource.h"
+#include <algorithm>
 #include <vector>
 #include <sstream>
+#include <cmath>
 
 #include <DirectXMath.h>
 
+namespace
+{
+    const char* const DATABASE_PATH = "database/test.db";
+}
+
 //ToolMain Class
 ToolMain::ToolMain()
 {
-    m_currentChunk = 0;		//default value
     m_sceneGraph.clear();	//clear the vector for the scenegraph
     m_databaseConnection = NULL;
 
@@ -23,16 +29,13 @@ ToolMain::~ToolMain()
 }
 
 
-const std::vector<int> ToolMain::getCurrentSelectionIDs() const
+const SelectionSet& ToolMain::getCurrentSelectionIDs() const
 {
     return m_selectedObjects;
 }
 
 void ToolMain::onActionInitialise(HWND handle, int width, int height)
 {
-    //FIX: This is a work-around to stop TransformDialog being left with an invalid pointer
-    m_selectedObjects.reserve(256);
-
     //window size, handle etc for directX
     m_width = width;
     m_height = height;
@@ -51,7 +54,7 @@ void ToolMain::onActionInitialise(HWND handle, int width, int height)
 
     //database connection establish
     int rc;
-    rc = sqlite3_open("database/test.db", &m_databaseConnection);
+    rc = sqlite3_open(DATABASE_PATH, &m_databaseConnection);
 
     if (rc)
     {
@@ -68,183 +71,162 @@ void ToolMain::onActionInitialise(HWND handle, int width, int height)
 
 void ToolMain::onActionLoad()
 {
-    //load current chunk and objects into lists
-    if (!m_sceneGraph.empty())		//is the vector empty
-    {
-        m_sceneGraph.clear();		//if not, empty it
-    }
+    //forget the current world. Objects come in along with their chunk
+    m_sceneGraph.clear();
+    m_selectedObjects.Clear();
+    m_history.Clear();
+    m_loadedChunkIDs.clear();
+    m_parkedObjects.clear();
+    m_d3dRenderer.ClearDisplayList();
 
     //SQL
     int rc;
     char *sqlCommand;
-    char *ErrMSG = 0;
-    sqlite3_stmt *pResults;								//results of the query
     sqlite3_stmt *pResultsChunk;
 
-    //OBJECTS IN THE WORLD
+    //THE WORLD CHUNKS
     //prepare SQL Text
-    sqlCommand = "SELECT * from Objects";				//sql command which will return all records from the objects table.
-    //Send Command and fill result object
-    rc = sqlite3_prepare_v2(m_databaseConnection, sqlCommand, -1, &pResults, 0);
-
-    //loop for each row in results until there are no more rows.  ie for every row in the results. We create and object
-    while (sqlite3_step(pResults) == SQLITE_ROW)
-    {
-        SceneObject newSceneObject;
-        newSceneObject.ID = sqlite3_column_int(pResults, 0);
-        newSceneObject.chunk_ID = sqlite3_column_int(pResults, 1);
-        newSceneObject.model_path = reinterpret_cast<const char*>(sqlite3_column_text(pResults, 2));
-        newSceneObject.tex_diffuse_path = reinterpret_cast<const char*>(sqlite3_column_text(pResults, 3));
-        newSceneObject.posX = static_cast<float>(sqlite3_column_double(pResults, 4));
-        newSceneObject.posY = static_cast<float>(sqlite3_column_double(pResults, 5));
-        newSceneObject.posZ = static_cast<float>(sqlite3_column_double(pResults, 6));
-        newSceneObject.rotX = static_cast<float>(sqlite3_column_double(pResults, 7));
-        newSceneObject.rotY = static_cast<float>(sqlite3_column_double(pResults, 8));
-        newSceneObject.rotZ = static_cast<float>(sqlite3_column_double(pResults, 9));
-        newSceneObject.scaX = static_cast<float>(sqlite3_column_double(pResults, 10));
-        newSceneObject.scaY = static_cast<float>(sqlite3_column_double(pResults, 11));
-        newSceneObject.scaZ = static_cast<float>(sqlite3_column_double(pResults, 12));
-        newSceneObject.render = (sqlite3_column_int(pResults, 13) != 0);
-        newSceneObject.collision = (sqlite3_column_int(pResults, 14) != 0);
-        newSceneObject.collision_mesh = reinterpret_cast<const char*>(sqlite3_column_text(pResults, 15));
-        newSceneObject.collectable = (sqlite3_column_int(pResults, 16) != 0);
-        newSceneObject.destructable = (sqlite3_column_int(pResults, 17) != 0);
-        newSceneObject.health_amount = sqlite3_column_int(pResults, 18);
-        newSceneObject.editor_render = (sqlite3_column_int(pResults, 19) != 0);
-        newSceneObject.editor_texture_vis = (sqlite3_column_int(pResults, 20) != 0);
-        newSceneObject.editor_normals_vis = (sqlite3_column_int(pResults, 21) != 0);
-        newSceneObject.editor_collision_vis = (sqlite3_column_int(pResults, 22) != 0);
-        newSceneObject.editor_pivot_vis = (sqlite3_column_int(pResults, 23) != 0);
-        newSceneObject.pivotX = static_cast<float>(sqlite3_column_double(pResults, 24));
-        newSceneObject.pivotY = static_cast<float>(sqlite3_column_double(pResults, 25));
-        newSceneObject.pivotZ = static_cast<float>(sqlite3_column_double(pResults, 26));
-        newSceneObject.snapToGround = (sqlite3_column_int(pResults, 27) != 0);
-        newSceneObject.AINode = (sqlite3_column_int(pResults, 28) != 0);
-        newSceneObject.audio_path = reinterpret_cast<const char*>(sqlite3_column_text(pResults, 29));
-        newSceneObject.volume = static_cast<float>(sqlite3_column_double(pResults, 30));
-        newSceneObject.pitch = static_cast<float>(sqlite3_column_double(pResults, 31));
-        newSceneObject.pan = static_cast<float>(sqlite3_column_int(pResults, 32));
-        newSceneObject.one_shot = (sqlite3_column_int(pResults, 33) != 0);
-        newSceneObject.play_on_init = (sqlite3_column_int(pResults, 34) != 0);
-        newSceneObject.play_in_editor = (sqlite3_column_int(pResults, 35) != 0);
-        newSceneObject.min_dist = static_cast<int>(sqlite3_column_double(pResults, 36));
-        newSceneObject.max_dist = static_cast<int>(sqlite3_column_double(pResults, 37));
-        newSceneObject.camera = (sqlite3_column_int(pResults, 38) != 0);
-        newSceneObject.path_node = (sqlite3_column_int(pResults, 39) != 0);
-        newSceneObject.path_node_start = (sqlite3_column_int(pResults, 40) != 0);
-        newSceneObject.path_node_end = (sqlite3_column_int(pResults, 41) != 0);
-        newSceneObject.parent_id = sqlite3_column_int(pResults, 42);
-        newSceneObject.editor_wireframe = (sqlite3_column_int(pResults, 43) != 0);
-        newSceneObject.name = reinterpret_cast<const char*>(sqlite3_column_text(pResults, 44));
-
-        //send completed object to scenegraph
-        m_sceneGraph.push_back(newSceneObject);
-    }
-
-    //THE WORLD CHUNK
-    //prepare SQL Text
-    sqlCommand = "SELECT * from Chunks";				//sql command which will return all records from  chunks table. There is only one tho.
+    sqlCommand = "SELECT * from Chunks";				//sql command which will return all records from  chunks table.
                                                         //Send Command and fill result object
     rc = sqlite3_prepare_v2(m_databaseConnection, sqlCommand, -1, &pResultsChunk, 0);
 
+    m_chunks.clear();
+    while (sqlite3_step(pResultsChunk) == SQLITE_ROW)
+    {
+        ChunkObject chunk;
+        chunk.ID = sqlite3_column_int(pResultsChunk, 0);
+        chunk.name = reinterpret_cast<const char*>(sqlite3_column_text(pResultsChunk, 1));
+        chunk.chunk_x_size_metres = sqlite3_column_int(pResultsChunk, 2);
+        chunk.chunk_y_size_metres = sqlite3_column_int(pResultsChunk, 3);
+        chunk.chunk_base_resolution = sqlite3_column_int(pResultsChunk, 4);
+        chunk.heightmap_path = reinterpret_cast<const char*>(sqlite3_column_text(pResultsChunk, 5));
+        chunk.tex_diffuse_path = reinterpret_cast<const char*>(sqlite3_column_text(pResultsChunk, 6));
+        chunk.tex_splat_alpha_path = reinterpret_cast<const char*>(sqlite3_column_text(pResultsChunk, 7));
+        chunk.tex_splat_1_path = reinterpret_cast<const char*>(sqlite3_column_text(pResultsChunk, 8));
+        chunk.tex_splat_2_path = reinterpret_cast<const char*>(sqlite3_column_text(pResultsChunk, 9));
+        chunk.tex_splat_3_path = reinterpret_cast<const char*>(sqlite3_column_text(pResultsChunk, 10));
+        chunk.tex_splat_4_path = reinterpret_cast<const char*>(sqlite3_column_text(pResultsChunk, 11));
+        chunk.render_wireframe = (sqlite3_column_int(pResultsChunk, 12) != 0);
+        chunk.render_normals = (sqlite3_column_int(pResultsChunk, 13) != 0);
+        chunk.tex_diffuse_tiling = sqlite3_column_int(pResultsChunk, 14);
+        chunk.tex_splat_1_tiling = sqlite3_column_int(pResultsChunk, 15);
+        chunk.tex_splat_2_tiling = sqlite3_column_int(pResultsChunk, 16);
+        chunk.tex_splat_3_tiling = sqlite3_column_int(pResultsChunk, 17);
+        chunk.tex_splat_4_tiling = sqlite3_column_int(pResultsChunk, 18);
+
+        //the grid position columns are optional. Without them, chunks are laid out in a row in the order they're stored
+        chunk.grid_x = int(m_chunks.size());
+        chunk.grid_z = 0;
+        for (int column = 19; column < sqlite3_column_count(pResultsChunk); ++column)
+        {
+            const std::string columnName = sqlite3_column_name(pResultsChunk, column);
+            if (columnName == "grid_x")
+                chunk.grid_x = sqlite3_column_int(pResultsChunk, column);
+            else if (columnName == "grid_z")
+                chunk.grid_z = sqlite3_column_int(pResultsChunk, column);
+        }
 
-    sqlite3_step(pResultsChunk);
-    m_chunk.ID = sqlite3_column_int(pResultsChunk, 0);
-    m_chunk.name = reinterpret_cast<const char*>(sqlite3_column_text(pResultsChunk, 1));
-    m_chunk.chunk_x_size_metres = sqlite3_column_int(pResultsChunk, 2);
-    m_chunk.chunk_y_size_metres = sqlite3_column_int(pResultsChunk, 3);
-    m_chunk.chunk_base_resolution = sqlite3_column_int(pResultsChunk, 4);
-    m_chunk.heightmap_path = reinterpret_cast<const char*>(sqlite3_column_text(pResultsChunk, 5));
-    m_chunk.tex_diffuse_path = reinterpret_cast<const char*>(sqlite3_column_text(pResultsChunk, 6));
-    m_chunk.tex_splat_alpha_path = reinterpret_cast<const char*>(sqlite3_column_text(pResultsChunk, 7));
-    m_chunk.tex_splat_1_path = reinterpret_cast<const char*>(sqlite3_column_text(pResultsChunk, 8));
-    m_chunk.tex_splat_2_path = reinterpret_cast<const char*>(sqlite3_column_text(pResultsChunk, 9));
-    m_chunk.tex_splat_3_path = reinterpret_cast<const char*>(sqlite3_column_text(pResultsChunk, 10));
-    m_chunk.tex_splat_4_path = reinterpret_cast<const char*>(sqlite3_column_text(pResultsChunk, 11));
-    m_chunk.render_wireframe = (sqlite3_column_int(pResultsChunk, 12) != 0);
-    m_chunk.render_normals = (sqlite3_column_int(pResultsChunk, 13) != 0);
-    m_chunk.tex_diffuse_tiling = sqlite3_column_int(pResultsChunk, 14);
-    m_chunk.tex_splat_1_tiling = sqlite3_column_int(pResultsChunk, 15);
-    m_chunk.tex_splat_2_tiling = sqlite3_column_int(pResultsChunk, 16);
-    m_chunk.tex_splat_3_tiling = sqlite3_column_int(pResultsChunk, 17);
-    m_chunk.tex_splat_4_tiling = sqlite3_column_int(pResultsChunk, 18);
+        m_chunks.push_back(chunk);
+    }
 
+    sqlite3_finalize(pResultsChunk);
 
-    //Process REsults into renderable
-    m_d3dRenderer.BuildDisplayList(&m_sceneGraph);
-    //build the renderable chunk 
-    m_d3dRenderer.BuildDisplayChunk(&m_chunk);
+    //objects in chunks that haven't been loaded yet still own their IDs, so new IDs start past the highest one stored
+    int maxObjectID = -1;
+    if (sqlite3_prepare_v2(m_databaseConnection, "SELECT MAX(ID) FROM Objects", -1, &pResultsChunk, 0) == SQLITE_OK)
+    {
+        if (sqlite3_step(pResultsChunk) == SQLITE_ROW && sqlite3_column_type(pResultsChunk, 0) != SQLITE_NULL)
+            maxObjectID = sqlite3_column_int(pResultsChunk, 0);
 
+        sqlite3_finalize(pResultsChunk);
+    }
+    m_idAllocator.Reset(maxObjectID);
+
+    //the renderable chunks (and their objects) are built as the camera gets near them
+    m_d3dRenderer.BuildDisplayChunks(m_chunks, DATABASE_PATH);
 }
 
 void ToolMain::onActionSave()
 {
     //SQL
     int rc;
-    char *sqlCommand;
     char *ErrMSG = 0;
     sqlite3_stmt *pResults;								//results of the query
 
 
-    //OBJECTS IN THE WORLD Delete them all
+    //only chunks that have been loaded have objects we know about, the rest are left as they are
+    std::vector<SceneObject> objects(m_sceneGraph.cbegin(), m_sceneGraph.cend());
+    std::set<int> savedChunkIDs = m_loadedChunkIDs;
+    for (const auto& parked : m_parkedObjects)
+    {
+        savedChunkIDs.insert(parked.first);
+        objects.insert(objects.end(), parked.second.cbegin(), parked.second.cend());
+    }
+
+    std::stringstream chunkIDs;
+    for (int chunkID : savedChunkIDs)
+        chunkIDs << (chunkID == *savedChunkIDs.cbegin() ? "" : ",") << chunkID;
+
+    //OBJECTS IN THE WORLD Delete them all (from those chunks)
     //prepare SQL Text
-    sqlCommand = "DELETE FROM Objects";	 //will delete the whole object table.   Slightly risky but hey.
-    rc = sqlite3_prepare_v2(m_databaseConnection, sqlCommand, -1, &pResults, 0);
+    std::string deleteCommand = "DELETE FROM Objects WHERE chunk_ID IN (" + chunkIDs.str() + ")";
+    rc = sqlite3_prepare_v2(m_databaseConnection, deleteCommand.c_str(), -1, &pResults, 0);
     sqlite3_step(pResults);
+    sqlite3_finalize(pResults);
 
     //Populate with our new objects
     std::wstring sqlCommand2;
-    int numObjects = m_sceneGraph.size();	//Loop thru the scengraph.
+    int numObjects = objects.size();	//Loop thru the objects.
 
     for (int i = 0; i < numObjects; i++)
     {
         std::stringstream command;
         command << "INSERT INTO Objects "
-            << "VALUES(" << m_sceneGraph.at(i).ID << ","
-            << m_sceneGraph.at(i).chunk_ID << ","
-            << "'" << m_sceneGraph.at(i).model_path << "'" << ","
-            << "'" << m_sceneGraph.at(i).tex_diffuse_path << "'" << ","
-            << m_sceneGraph.at(i).posX << ","
-            << m_sceneGraph.at(i).posY << ","
-            << m_sceneGraph.at(i).posZ << ","
-            << m_sceneGraph.at(i).rotX << ","
-            << m_sceneGraph.at(i).rotY << ","
-            << m_sceneGraph.at(i).rotZ << ","
-            << m_sceneGraph.at(i).scaX << ","
-            << m_sceneGraph.at(i).scaY << ","
-            << m_sceneGraph.at(i).scaZ << ","
-            << m_sceneGraph.at(i).render << ","
-            << m_sceneGraph.at(i).collision << ","
-            << "'" << m_sceneGraph.at(i).collision_mesh << "'" << ","
-            << m_sceneGraph.at(i).collectable << ","
-            << m_sceneGraph.at(i).destructable << ","
-            << m_sceneGraph.at(i).health_amount << ","
-            << m_sceneGraph.at(i).editor_render << ","
-            << m_sceneGraph.at(i).editor_texture_vis << ","
-            << m_sceneGraph.at(i).editor_normals_vis << ","
-            << m_sceneGraph.at(i).editor_collision_vis << ","
-            << m_sceneGraph.at(i).editor_pivot_vis << ","
-            << m_sceneGraph.at(i).pivotX << ","
-            << m_sceneGraph.at(i).pivotY << ","
-            << m_sceneGraph.at(i).pivotZ << ","
-            << m_sceneGraph.at(i).snapToGround << ","
-            << m_sceneGraph.at(i).AINode << ","
-            << "'" << m_sceneGraph.at(i).audio_path << "'" << ","
-            << m_sceneGraph.at(i).volume << ","
-            << m_sceneGraph.at(i).pitch << ","
-            << m_sceneGraph.at(i).pan << ","
-            << m_sceneGraph.at(i).one_shot << ","
-            << m_sceneGraph.at(i).play_on_init << ","
-            << m_sceneGraph.at(i).play_in_editor << ","
-            << m_sceneGraph.at(i).min_dist << ","
-            << m_sceneGraph.at(i).max_dist << ","
-            << m_sceneGraph.at(i).camera << ","
-            << m_sceneGraph.at(i).path_node << ","
-            << m_sceneGraph.at(i).path_node_start << ","
-            << m_sceneGraph.at(i).path_node_end << ","
-            << m_sceneGraph.at(i).parent_id << ","
-            << m_sceneGraph.at(i).editor_wireframe << ","
-            << "'" << m_sceneGraph.at(i).name << "'"
+            << "VALUES(" << objects.at(i).ID << ","
+            << objects.at(i).chunk_ID << ","
+            << "'" << objects.at(i).model_path << "'" << ","
+            << "'" << objects.at(i).tex_diffuse_path << "'" << ","
+            << objects.at(i).posX << ","
+            << objects.at(i).posY << ","
+            << objects.at(i).posZ << ","
+            << objects.at(i).rotX << ","
+            << objects.at(i).rotY << ","
+            << objects.at(i).rotZ << ","
+            << objects.at(i).scaX << ","
+            << objects.at(i).scaY << ","
+            << objects.at(i).scaZ << ","
+            << objects.at(i).render << ","
+            << objects.at(i).collision << ","
+            << "'" << objects.at(i).collision_mesh << "'" << ","
+            << objects.at(i).collectable << ","
+            << objects.at(i).destructable << ","
+            << objects.at(i).health_amount << ","
+            << objects.at(i).editor_render << ","
+            << objects.at(i).editor_texture_vis << ","
+            << objects.at(i).editor_normals_vis << ","
+            << objects.at(i).editor_collision_vis << ","
+            << objects.at(i).editor_pivot_vis << ","
+            << objects.at(i).pivotX << ","
+            << objects.at(i).pivotY << ","
+            << objects.at(i).pivotZ << ","
+            << objects.at(i).snapToGround << ","
+            << objects.at(i).AINode << ","
+            << "'" << objects.at(i).audio_path << "'" << ","
+            << objects.at(i).volume << ","
+            << objects.at(i).pitch << ","
+            << objects.at(i).pan << ","
+            << objects.at(i).one_shot << ","
+            << objects.at(i).play_on_init << ","
+            << objects.at(i).play_in_editor << ","
+            << objects.at(i).min_dist << ","
+            << objects.at(i).max_dist << ","
+            << objects.at(i).camera << ","
+            << objects.at(i).path_node << ","
+            << objects.at(i).path_node_start << ","
+            << objects.at(i).path_node_end << ","
+            << objects.at(i).parent_id << ","
+            << objects.at(i).editor_wireframe << ","
+            << "'" << objects.at(i).name << "'"
             << ")";
         std::string sqlCommand2 = command.str();
         rc = sqlite3_prepare_v2(m_databaseConnection, sqlCommand2.c_str(), -1, &pResults, 0);
@@ -255,7 +237,45 @@ void ToolMain::onActionSave()
 
 void ToolMain::onActionSaveTerrain()
 {
-    m_d3dRenderer.SaveDisplayChunk(&m_chunk);
+    // NOTE: Does nothing if a save is already in progress (the status bar will say as much)
+    m_d3dRenderer.SaveDisplayChunks();
+}
+
+void ToolMain::onActionExportTerrain(float maxError)
+{
+    // One file per loaded chunk
+    std::string paths;
+    if (m_d3dRenderer.ExportSimplifiedTerrain(maxError, paths))
+        MessageBoxA(m_toolHandle, ("Terrain exported to\n" + paths).c_str(), "Notification", MB_OK);
+    else
+        MessageBoxA(m_toolHandle, ("Could not write (some of)\n" + paths).c_str(), "Error", MB_OK);
+}
+
+std::wstring ToolMain::getTerrainSaveStatus() const
+{
+    float progress = 0.f;
+    switch (m_d3dRenderer.GetTerrainSaveState(progress))
+    {
+        case HeightMapWriter::STATE_WRITING:
+            return L"Saving terrain... " + std::to_wstring(int(progress * 100.f)) + L"%";
+        case HeightMapWriter::STATE_SUCCEEDED:
+            return L"Terrain has been saved successfully";
+        case HeightMapWriter::STATE_FAILED:
+            return L"Terrain could not be saved!";
+        default:
+            return L"";
+    }
+}
+
+std::wstring ToolMain::getTerrainLoadStatus() const
+{
+    std::string lastFailedName;
+    const size_t numFailed = m_d3dRenderer.GetFailedChunkCount(lastFailedName);
+    if (numFailed == 0)
+        return L"";
+
+    return L"Could not load " + std::to_wstring(numFailed) + (numFailed == 1 ? L" chunk" : L" chunks") +
+        L" (last: \"" + std::wstring(lastFailedName.begin(), lastFailedName.end()) + L"\")";
 }
 
 void ToolMain::Tick(MSG *msg)
@@ -290,37 +310,8 @@ void ToolMain::Tick(MSG *msg)
             m_toolInputCommands.mouseDY = mouseDY;
         }
         // if the cursor captured, but not controlling camera, it is moving objects along an axis
-        else if (!m_selectedObjects.empty())
-        {
-            constexpr static float sensitivity = 0.25f;
-
-            if (m_moveAxis != MoveAxis::AXIS_NONE)
-            {
-                // Move each selected object by some amount proportional to the cursor movement
-                for (int id : m_selectedObjects)
-                {
-                    SceneObject* object = GetObjectFromID(id);
-
-                    switch (m_moveAxis)
-                    {
-                        case MoveAxis::AXIS_X:
-                            object->posX += (float) mouseDX * sensitivity;
-                            break;
-                        case MoveAxis::AXIS_Y:
-                            object->posY += (float) mouseDY * sensitivity;
-                            break;
-                        case MoveAxis::AXIS_Z:
-                            object->posZ += (float) mouseDX * sensitivity;
-                            break;
-                    }
-
-                    UpdateDisplayObject(object);
-
-                    // Reveals if an object has been moved this frame--used to notify the transfom dialog so it can update its controls
-                    m_objectHasBeenMoved = true;
-                }
-            }
-        }
+        else if (!m_selectedObjects.empty() && m_moveAxis != MoveAxis::AXIS_NONE && (mouseDX != 0 || mouseDY != 0))
+            TransformSelection(mouseDX, mouseDY);
 
         // Move cursor back to the center of the screen
         POINT clientCenterScreen = m_clientCenter;
@@ -358,25 +349,92 @@ void ToolMain::Tick(MSG *msg)
 
             // Manipulate the terrain under the cursor if either mouse button is currently down
             if (m_leftMouseBtnDown ^ m_rightMouseBtnDown)
-                m_d3dRenderer.ManipulateTerrain(wsCoord, m_leftMouseBtnDown, m_brushSize, m_brushForce);
+            {
+                // The whole stroke is undone in one go
+                OpenHistoryEntry(MERGE_BRUSH_STROKE);
+
+                if (m_brushMode == BRUSH_PAINT)
+                    m_d3dRenderer.PaintTerrain(wsCoord, (m_leftMouseBtnDown ? m_paintLayer : 0), m_brushSize, m_paintStrength);
+                else
+                {
+                    m_d3dRenderer.ManipulateTerrain(wsCoord, m_leftMouseBtnDown, m_brushSize, m_brushForce);
+                    m_snapObjectsThisFrame = true;
+                }
+
+                // Into the history as they go, so a long stroke is kept within its budget too
+                RecordBrushedTiles(false);
+            }
         }
 
         // Hide/show the brush decal depending on whether or not the intersection test passed
         m_d3dRenderer.ShowBrushDecal(intersectsTerrain);
     }
 
+    // Whatever's under the free cursor is picked every frame (the camera and the objects move, not just the cursor)
+    if (!m_cursorCaptured && !m_brushActive && !m_dragging)
+        m_d3dRenderer.UpdateHoveredObject(m_cursorPos, m_dxClientRect);
+    else
+        m_d3dRenderer.ClearHoveredObject();
+
     // If the user is clicking and dragging (creating a selection box)
     if (m_dragging)
     {
         m_toolInputCommands.selectionRectangleBegin = { m_beginDragPos.x, m_beginDragPos.y };
         m_toolInputCommands.selectionRectangleEnd = { m_currentDragPos.x, m_currentDragPos.y };
+
+        // Highlight what the selection would be if the button was let go now
+        RECT selectionRect =
+        {
+            min(m_beginDragPos.x, m_currentDragPos.x),	// left
+            min(m_beginDragPos.y, m_currentDragPos.y),	// top
+            max(m_beginDragPos.x, m_currentDragPos.x),	// right
+            max(m_beginDragPos.y, m_currentDragPos.y)	// bottom
+        };
+
+        Game::PickingMode mode = Game::PICK_NORMAL;
+        if (GetKeyState(VK_CONTROL) < 0)
+            mode = Game::PICK_INVERT;
+        else if (GetKeyState(VK_SHIFT) < 0)
+            mode = Game::PICK_EXCLUSIVE;
+
+        // Only worked out again if the objects in the box, the mode, or the selection it applies to have changed
+        const bool insideChanged = m_d3dRenderer.UpdateSelectionPreview(selectionRect);
+        if (insideChanged || mode != m_previewMode || m_selectedObjects.GetVersion() != m_previewBaseVersion)
+        {
+            if (mode == Game::PICK_NORMAL)
+                m_previewSelection.Clear();
+            else
+                m_previewSelection = m_selectedObjects;
+
+            for (int id : m_d3dRenderer.GetSelectionPreview())
+                Game::ApplyPick(id, m_previewSelection, mode);
+
+            m_previewMode = mode;
+            m_previewBaseVersion = m_selectedObjects.GetVersion();
+        }
     }
     else
     {
         m_toolInputCommands.selectionRectangleBegin = m_toolInputCommands.selectionRectangleEnd = { -1, -1 };
+        m_d3dRenderer.EndSelectionPreview();
     }
 
-    m_d3dRenderer.SetSelectionIDs(m_selectedObjects);
+    ApplyStreamedChunks();
+
+    // Before snapping, so objects land on the carved terrain
+    if (m_updatePathsThisFrame || m_objectHasBeenMoved)
+    {
+        UpdateTerrainPaths();
+        m_updatePathsThisFrame = false;
+    }
+
+    if (m_snapObjectsThisFrame || m_objectHasBeenMoved)
+    {
+        SnapObjectsToGround();
+        m_snapObjectsThisFrame = false;
+    }
+
+    m_d3dRenderer.SetSelection(m_dragging ? m_previewSelection : m_selectedObjects);
 
     //Renderer Update Call
     m_d3dRenderer.Tick(&m_toolInputCommands);
@@ -385,21 +443,120 @@ void ToolMain::Tick(MSG *msg)
     m_toolInputCommands.mouseDX = m_toolInputCommands.mouseDY = 0;
 }
 
-SceneObject * ToolMain::GetObjectFromID(int id)
+void ToolMain::TransformSelection(long mouseDX, long mouseDY)
+{
+    constexpr static float sensitivity = 0.25f;
+    constexpr static float yawSensitivity = 0.5f;
+    constexpr static float scaleSensitivity = 0.005f;
+
+    // The whole drag is undone in one go
+    OpenHistoryEntry(MERGE_MOVE_OBJECTS);
+
+    // Children follow their parent around, so only move the topmost selected objects. The pivot is their centre
+    m_movedObjectIDs.clear();
+    XMVECTOR pivot = XMVectorZero();
+    for (int id : m_selectedObjects)
+    {
+        const SceneObject* object = GetObjectFromID(id);
+        if (!object || HasSelectedAncestor(*object))
+            continue;
+
+        m_history.RecordTransform(id, EditHistory::Transform::Of(*object));
+
+        m_movedObjectIDs.push_back(id);
+        pivot += XMVectorSet(object->posX, object->posY, object->posZ, 0.f);
+    }
+
+    if (m_movedObjectIDs.empty())
+        return;
+
+    pivot /= XMVectorReplicate(float(m_movedObjectIDs.size()));
+
+    // Move by some amount proportional to the cursor movement
+    XMVECTOR translation = XMVectorZero();
+    float yaw = 0.f;
+    float scale = 1.f;
+    switch (m_moveAxis)
+    {
+        case MoveAxis::AXIS_X:
+            translation = XMVectorSet((float) mouseDX * sensitivity, 0.f, 0.f, 0.f);
+            break;
+        case MoveAxis::AXIS_Y:
+            translation = XMVectorSet(0.f, (float) mouseDY * sensitivity, 0.f, 0.f);
+            break;
+        case MoveAxis::AXIS_Z:
+            translation = XMVectorSet(0.f, 0.f, (float) mouseDX * sensitivity, 0.f);
+            break;
+        case MoveAxis::AXIS_YAW:
+            yaw = (float) mouseDX * yawSensitivity;
+            break;
+        case MoveAxis::AXIS_SCALE:
+            // Exponential, so it never gets to zero (or flips over)
+            scale = std::exp((float) mouseDY * scaleSensitivity);
+            break;
+    }
+
+    m_d3dRenderer.TransformDisplayListItems(m_movedObjectIDs, pivot, translation, yaw, scale);
+
+    // Bring the objects up to date with where they've ended up
+    for (int id : m_movedObjectIDs)
+    {
+        SceneObject* object = GetObjectFromID(id);
+
+        EditHistory::Transform transform;
+        if (m_d3dRenderer.GetDisplayListItemTransform(id, transform.position, transform.rotation, transform.scale))
+            transform.ApplyTo(*object);
+
+        if (object->snapToGround)
+            m_snapObjectsThisFrame = true;
+    }
+
+    m_updatePathsThisFrame = true;
+
+    // Reveals if an object has been moved this frame--used to notify the transfom dialog so it can update its controls
+    m_objectHasBeenMoved = true;
+}
+
+bool ToolMain::HasSelectedAncestor(const SceneObject& object) const
 {
-    // FIX: This pointer could be invalidated if the scene graph grows
-    auto object = std::find_if(m_sceneGraph.begin(), m_sceneGraph.end(),
-                               [&](const auto& o) { return o.ID == id; });
+    // Bounded, in case the parents go round in a loop
+    int parentID = object.parent_id;
+    for (size_t depth = 0; parentID != 0 && depth < m_sceneGraph.size(); ++depth)
+    {
+        if (m_selectedObjects.Contains(parentID))
+            return true;
+
+        const SceneObject* parent = m_sceneGraph.Find(parentID);
+        if (!parent)
+            break;
 
-    if (object == m_sceneGraph.cend())
-        return nullptr;
+        parentID = parent->parent_id;
+    }
 
-    return &(*object);
+    return false;
 }
 
 void ToolMain::UpdateDisplayObject(const SceneObject * sceneObject)
+{
+    // The dialog has already changed the object, but the display list still has the transform from before. Edits to
+    // the same object one after another are undone in one go
+    OpenHistoryEntry(MERGE_TRANSFORM_DIALOG + uint32_t(sceneObject->ID));
+
+    EditHistory::Transform before;
+    if (m_d3dRenderer.GetDisplayListItemTransform(sceneObject->ID, before.position, before.rotation, before.scale))
+        m_history.RecordTransform(sceneObject->ID, before);
+
+    SyncDisplayObject(sceneObject);
+}
+
+void ToolMain::SyncDisplayObject(const SceneObject * sceneObject)
 {
     m_d3dRenderer.UpdateDisplayListItem(*sceneObject);
+
+    if (sceneObject->snapToGround)
+        m_snapObjectsThisFrame = true;
+
+    m_updatePathsThisFrame = true;
 }
 
 void ToolMain::ToggleBrush()
@@ -414,7 +571,7 @@ void ToolMain::ToggleBrush()
     m_d3dRenderer.ShowBrushDecal(m_brushActive);
 
     // Clear selections as well
-    m_selectedObjects.clear();
+    m_selectedObjects.Clear();
 }
 
 bool ToolMain::UpdateInput(MSG * msg)
@@ -478,7 +635,11 @@ bool ToolMain::UpdateInput(MSG * msg)
                 bool isShiftDown = (msg->wParam & MK_SHIFT);
 
                 // Determine which axis to move the selected object(s) along according to the modifier keys currently held down
-                if (isCtrlDown)
+                if (isCtrlDown && isShiftDown)
+                    m_moveAxis = MoveAxis::AXIS_YAW;
+                else if (isCtrlDown && isAltDown)
+                    m_moveAxis = MoveAxis::AXIS_SCALE;
+                else if (isCtrlDown)
                     m_moveAxis = MoveAxis::AXIS_X;
                 else if (isAltDown)
                     m_moveAxis = MoveAxis::AXIS_Y;
@@ -500,6 +661,9 @@ bool ToolMain::UpdateInput(MSG * msg)
 
             m_leftMouseBtnDown = false;
 
+            // Ends a brush stroke
+            CloseHistoryEntry();
+
             // Do box selection if the user has performed a drag action
             if (m_dragging)
             {
@@ -539,35 +703,19 @@ bool ToolMain::UpdateInput(MSG * msg)
                 int id = -1;
                 if (m_d3dRenderer.Pick(m_cursorPos, m_dxClientRect, id))
                 {
-                    // Search for the picked object in our selected objects container
-                    auto itID = std::find(m_selectedObjects.cbegin(), m_selectedObjects.cend(), id);
-
-                    // If the object is already selected
-                    if (itID != m_selectedObjects.cend())
+                    // If control is down, unselect the object if it's already selected, and add it otherwise ...
+                    if ((msg->wParam & MK_CONTROL) != 0)
                     {
-                        // If control is down, unselect the object ...
-                        if ((msg->wParam & MK_CONTROL) != 0)
-                            m_selectedObjects.erase(itID);
-                        // ... otherwise, make this the only selection
-                        else
-                        {
-                            m_selectedObjects.clear();
-                            m_selectedObjects.push_back(id);
-                        }
+                        if (!m_selectedObjects.Erase(id))
+                            m_selectedObjects.Insert(id);
                     }
-                    // If the object is not yet selected
+                    // ... otherwise, make this the only selection
                     else
-                    {
-                        // Clear the selected objects if CTRL is not down
-                        if ((msg->wParam & MK_CONTROL) == 0)
-                            m_selectedObjects.clear();
-
-                        m_selectedObjects.push_back(id);
-                    }
+                        m_selectedObjects.Select(id);
                 }
                 // Clear selections if picking failed
                 else
-                	m_selectedObjects.clear();
+                	m_selectedObjects.Clear();
             }
         }
         break;
@@ -585,6 +733,9 @@ bool ToolMain::UpdateInput(MSG * msg)
 
             m_rightMouseBtnDown = false;
 
+            // Ends a brush stroke or a drag
+            CloseHistoryEntry();
+
             // Capture/release the cursor when right mouse button is clicked/released
             if ((!m_cursorControlsCamera && !m_brushActive))
                 m_captureCursorThisFrame = true;
@@ -637,6 +788,93 @@ bool ToolMain::UpdateInput(MSG * msg)
         m_keyArray[' '] = false;
     }
 
+    // Cycle through the drainage analysis overlays (none, pooled water, flow, watersheds)
+    if (m_keyArray['H'])
+    {
+        m_d3dRenderer.SetHydrologyOverlay(TerrainHydrology::Overlay((m_d3dRenderer.GetHydrologyOverlay() + 1) % TerrainHydrology::OVERLAY_COUNT));
+
+        m_keyArray['H'] = false;
+    }
+
+    // Brush mode (sculpt/paint) and splat layer selection
+    if (m_brushActive)
+    {
+        if (m_keyArray['P'])
+        {
+            m_brushMode = (m_brushMode == BRUSH_SCULPT ? BRUSH_PAINT : BRUSH_SCULPT);
+
+            m_keyArray['P'] = false;
+        }
+
+        // Terrain stamp rotation (15 degree steps), blend mode and feather
+        if (m_keyArray['R'])
+        {
+            m_stampRotation = std::fmod(m_stampRotation + XMConvertToRadians(15.f), XM_2PI);
+
+            m_keyArray['R'] = false;
+        }
+
+        if (m_keyArray['B'])
+        {
+            m_stampBlend = TerrainStamp::BlendMode((m_stampBlend + 1) % TerrainStamp::BLEND_COUNT);
+
+            m_keyArray['B'] = false;
+        }
+
+        if (m_keyArray['F'])
+        {
+            m_stampFeather = (m_stampFeather >= 0.5f ? 0.f : m_stampFeather + 0.25f);
+
+            m_keyArray['F'] = false;
+        }
+
+        // Terrain layers: add a sculpt layer (and sculpt it), pick the next layer (the base is left out), show/hide the picked layer
+        if (m_keyArray['N'])
+        {
+            m_d3dRenderer.SelectTerrainLayer(m_d3dRenderer.AddTerrainLayer());
+            m_brushMode = BRUSH_SCULPT;
+
+            m_keyArray['N'] = false;
+        }
+
+        if (m_keyArray['L'])
+        {
+            const size_t numLayers = m_d3dRenderer.GetTerrainLayers().size();
+            if (numLayers > 1)
+                m_d3dRenderer.SelectTerrainLayer(m_d3dRenderer.GetSelectedTerrainLayer() % (numLayers - 1) + 1);
+
+            m_keyArray['L'] = false;
+        }
+
+        if (m_keyArray['O'])
+        {
+            const size_t layer = m_d3dRenderer.GetSelectedTerrainLayer();
+            if (layer < m_d3dRenderer.GetTerrainLayers().size())
+            {
+                const bool visible = m_d3dRenderer.GetTerrainLayers()[layer].visible;
+
+                // Closed after, so the base layer tiles moved along chunk borders go in with it
+                OpenHistoryEntry();
+                m_history.RecordTerrainLayer(layer, visible);
+                m_d3dRenderer.SetTerrainLayerVisible(layer, !visible, true);
+                CloseHistoryEntry();
+
+                m_snapObjectsThisFrame = true;
+            }
+
+            m_keyArray['O'] = false;
+        }
+
+        for (int layer = 0; layer < SplatMap::NUM_LAYERS; ++layer)
+        {
+            if (m_keyArray['1' + layer])
+            {
+                m_paintLayer = layer;
+                m_brushMode = BRUSH_PAINT;
+            }
+        }
+    }
+
     // Delete selected object(s)
     if (m_keyArray[VK_DELETE])
     {
@@ -764,119 +1002,423 @@ POINT ToolMain::CalculateCenter(const RECT & rect) const
 
 bool ToolMain::DeleteSceneObjects(const std::vector<int>& objectIDs)
 {
-    std::vector<SceneObject> deletedObjects;
+    OpenHistoryEntry();
 
     bool deletedAnything = false;
     for (int id : objectIDs)
     {
-        for (auto it = m_sceneGraph.cbegin(); it != m_sceneGraph.cend();)
-        {
-            // Erase this item only if the id matches
-            if (it->ID != id)
-                ++it;
-            else
-            {
-                deletedAnything = true;
+        const SceneObject* object = m_sceneGraph.Find(id);
+        if (!object)
+            continue;
 
-                // Save for posterity
-                deletedObjects.push_back(*it);
+        deletedAnything = true;
 
-                // Remove item
-                m_d3dRenderer.RemoveDisplayListItem(id);
-                it = m_sceneGraph.erase(it);
-            }
-        }
+        // Save for posterity
+        m_history.RecordObject(id, object);
+
+        // Remove item (an undo takes its ID back)
+        m_d3dRenderer.RemoveDisplayListItem(id);
+        m_sceneGraph.Remove(id);
+        m_idAllocator.Release(id);
     }
 
-    m_deleteHistory.push_back(deletedObjects);
+    CloseHistoryEntry();
+
+    if (deletedAnything)
+        m_updatePathsThisFrame = true;
+
     return deletedAnything;
 }
 
-void ToolMain::OnDelete()
+void ToolMain::SnapObjectsToGround()
 {
-    if (!m_selectedObjects.empty())
+    // Gather the positions of the snapped objects so the terrain can be sampled in one batch
+    std::vector<SceneObject*> snappedObjects;
+    std::vector<float> xs, zs;
+    for (SceneObject& object : m_sceneGraph)
+    {
+        // Path nodes decide the height of the terrain under them (see TerrainPaths), not the other way round
+        if (!object.snapToGround || object.path_node || object.path_node_start || object.path_node_end)
+            continue;
+
+        // Children are placed relative to their parent, and follow it around instead
+        if (object.parent_id != 0 && m_sceneGraph.Contains(object.parent_id))
+            continue;
+
+        snappedObjects.push_back(&object);
+        xs.push_back(object.posX);
+        zs.push_back(object.posZ);
+    }
+
+    if (snappedObjects.empty())
+        return;
+
+    std::vector<float> heights(snappedObjects.size());
+    m_d3dRenderer.SampleTerrainHeights(xs.data(), zs.data(), heights.data(), heights.size());
+
+    for (size_t i = 0; i < snappedObjects.size(); ++i)
     {
-        DeleteSceneObjects(m_selectedObjects);
-        m_selectedObjects.clear();
+        SceneObject* object = snappedObjects[i];
+        if (object->posY == heights[i])
+            continue;
 
-        // The user has performed a new action, so let's forget our redo history
-        m_redoHistory.clear();
+        object->posY = heights[i];
+        m_d3dRenderer.UpdateDisplayListItem(*object);
+
+        // Let the transform dialog know the object has moved
+        m_objectHasBeenMoved = true;
     }
 }
 
-void ToolMain::OnCtrlZ()
+void ToolMain::UpdateTerrainPaths()
 {
-    if (!m_deleteHistory.empty())
+    std::vector<SceneObject> nodes;
+    const auto gather = [&](const auto& objects)
     {
-        // Add the previous item(s) back into the scene graph
-        std::vector<SceneObject> objectsToRestore = m_deleteHistory.back();
-        m_deleteHistory.pop_back();
+        for (const SceneObject& object : objects)
+            if (object.path_node || object.path_node_start || object.path_node_end)
+                nodes.push_back(object);
+    };
 
-        std::vector<int> restoredObjectIDs;
-        restoredObjectIDs.reserve(objectsToRestore.size());
-        for (auto object : objectsToRestore)
+    gather(m_sceneGraph);
+    for (const auto& parked : m_parkedObjects)
+        gather(parked.second);
+
+    if (m_d3dRenderer.SetTerrainPaths(nodes))
+        m_snapObjectsThisFrame = true;
+}
+
+void ToolMain::ApplyStreamedChunks()
+{
+    std::vector<ChunkManager::StreamedChunk> loaded;
+    std::vector<int> unloaded;
+    m_d3dRenderer.TakeStreamedChunks(loaded, unloaded);
+
+    for (int chunkID : unloaded)
+    {
+        m_loadedChunkIDs.erase(chunkID);
+        std::vector<SceneObject>& parked = m_parkedObjects[chunkID];
+
+        // Park the chunk's objects, and drop their visual representation
+        m_sceneGraph.RemoveIf([&](const SceneObject& object)
         {
-            m_d3dRenderer.AddDisplayListItem(object);
-            m_sceneGraph.push_back(object);
+            if (object.chunk_ID != chunkID)
+                return false;
+
+            m_selectedObjects.Erase(object.ID);
+            m_d3dRenderer.RemoveDisplayListItem(object.ID);
 
-            restoredObjectIDs.push_back(object.ID);
+            parked.push_back(object);
+            return true;
+        });
+    }
+
+    for (ChunkManager::StreamedChunk& chunk : loaded)
+    {
+        m_loadedChunkIDs.insert(chunk.chunkID);
+
+        // Parked objects are more up to date than what's in the database
+        auto parked = m_parkedObjects.find(chunk.chunkID);
+        if (parked != m_parkedObjects.end())
+        {
+            chunk.objects = std::move(parked->second);
+            m_parkedObjects.erase(parked);
         }
 
-        m_redoHistory.push_back(restoredObjectIDs);
+        for (const SceneObject& object : chunk.objects)
+        {
+            m_idAllocator.Claim(object.ID);
+            m_d3dRenderer.AddDisplayListItem(object);
+            m_sceneGraph.Insert(object);
+        }
+
+        // The terrain under them has only just arrived
+        m_snapObjectsThisFrame = true;
+        m_updatePathsThisFrame = true;
     }
 }
 
+void ToolMain::OnDelete()
+{
+    if (!m_selectedObjects.empty())
+    {
+        DeleteSceneObjects(std::vector<int>(m_selectedObjects.begin(), m_selectedObjects.end()));
+        m_selectedObjects.Clear();
+    }
+}
+
+void ToolMain::OnCtrlZ()
+{
+    // Whatever is still going on is finished first, so it's what gets undone
+    CloseHistoryEntry();
+
+    std::vector<ChunkManager::TerrainTile*> tiles;
+    if (m_history.Undo([&](const EditHistory::Change& change) { return CanSwapHistoryChange(change); },
+                       [&](EditHistory::Change& change) { SwapHistoryChange(change, tiles); }))
+        FinishHistorySwap(tiles);
+}
+
 void ToolMain::OnCtrlY()
 {
-    if (!m_redoHistory.empty())
+    CloseHistoryEntry();
+
+    std::vector<ChunkManager::TerrainTile*> tiles;
+    if (m_history.Redo([&](const EditHistory::Change& change) { return CanSwapHistoryChange(change); },
+                       [&](EditHistory::Change& change) { SwapHistoryChange(change, tiles); }))
+        FinishHistorySwap(tiles);
+}
+
+SceneObject* ToolMain::FindObject(int id)
+{
+    if (SceneObject* object = m_sceneGraph.Find(id))
+        return object;
+
+    for (auto& parked : m_parkedObjects)
+    {
+        for (SceneObject& object : parked.second)
+        {
+            if (object.ID == id)
+                return &object;
+        }
+    }
+
+    return nullptr;
+}
+
+void ToolMain::OpenHistoryEntry(uint64_t mergeKey)
+{
+    if (!m_history.IsOpen(mergeKey))
+        CloseHistoryEntry();
+
+    m_history.Open(mergeKey);
+}
+
+void ToolMain::CloseHistoryEntry()
+{
+    RecordBrushedTiles(true);
+    m_history.Close();
+}
+
+void ToolMain::RecordBrushedTiles(bool strokeEnded)
+{
+    // Brushes keep the tiles they change themselves (only the renderer knows which they are)
+    std::vector<ChunkManager::TerrainTile> tiles;
+    m_d3dRenderer.TakeTerrainUndo(tiles, strokeEnded);
+
+    for (ChunkManager::TerrainTile& tile : tiles)
+        m_history.RecordTerrainTile(std::move(tile));
+}
+
+bool ToolMain::CanSwapHistoryChange(const EditHistory::Change& change) const
+{
+    if (change.type != EditHistory::Change::OBJECT || !change.object)
+        return true;
+
+    // The object has to come back with its own ID, as the rest of the journal knows it by that. Either it's free, or
+    // what has it now is the object as it is on this side of the change (which is taken out first)
+    const int id = change.object->ID;
+    if (m_idAllocator.IsFree(id))
+        return true;
+
+    if (id == change.id)
+    {
+        if (m_sceneGraph.Contains(id))
+            return true;
+
+        for (const auto& parked : m_parkedObjects)
+        {
+            for (const SceneObject& object : parked.second)
+            {
+                if (object.ID == id)
+                    return true;
+            }
+        }
+    }
+
+    TRACE("Can't undo/redo: object ID %d has been taken", id);
+    return false;
+}
+
+void ToolMain::SwapHistoryChange(EditHistory::Change& change, std::vector<ChunkManager::TerrainTile*>& tiles)
+{
+    switch (change.type)
     {
-        std::vector<int> objectsToDelete = m_redoHistory.back();
-        m_redoHistory.pop_back();
+        case EditHistory::Change::OBJECT_TRANSFORM:
+        {
+            // The object's chunk may have been streamed out since, in which case it's parked
+            SceneObject* object = FindObject(change.id);
+            if (!object)
+                break;
+
+            const EditHistory::Transform current = EditHistory::Transform::Of(*object);
+            change.transform.ApplyTo(*object);
+            change.transform = current;
+
+            if (m_sceneGraph.Contains(change.id))
+                SyncDisplayObject(object);
+        }
+            break;
+
+        case EditHistory::Change::OBJECT:
+        {
+            // Take the object out as it is now ...
+            std::unique_ptr<SceneObject> current;
+            if (const SceneObject* object = m_sceneGraph.Find(change.id))
+            {
+                current.reset(new SceneObject(*object));
+
+                m_selectedObjects.Erase(change.id);
+                m_d3dRenderer.RemoveDisplayListItem(change.id);
+                m_sceneGraph.Remove(change.id);
+                m_idAllocator.Release(change.id);
+            }
+            else
+            {
+                for (auto& parked : m_parkedObjects)
+                {
+                    auto object = std::find_if(parked.second.begin(), parked.second.end(), [&](const SceneObject& other) { return other.ID == change.id; });
+                    if (object == parked.second.end())
+                        continue;
+
+                    current.reset(new SceneObject(*object));
+                    parked.second.erase(object);
+                    m_idAllocator.Release(change.id);
+                    break;
+                }
+            }
+
+            // ... and put it back as it was on the other side of the change (CanSwapHistoryChange has made sure its
+            // ID is free by now)
+            if (change.object)
+            {
+                const SceneObject& object = *change.object;
+                m_idAllocator.Claim(object.ID);
+
+                // The object's chunk may have been streamed out since
+                if (m_loadedChunkIDs.count(object.chunk_ID) == 0)
+                    m_parkedObjects[object.chunk_ID].push_back(object);
+                else
+                {
+                    m_d3dRenderer.AddDisplayListItem(object);
+                    m_sceneGraph.Insert(object);
+                }
+            }
+
+            change.object = std::move(current);
+        }
+            break;
 
-        DeleteSceneObjects(objectsToDelete);
+        case EditHistory::Change::TERRAIN_TILE:
+            tiles.push_back(change.tile.get());
+            break;
+
+        case EditHistory::Change::TERRAIN_LAYER:
+        {
+            const size_t layer = size_t(change.id);
+            if (layer >= m_d3dRenderer.GetTerrainLayers().size())
+                break;
+
+            const bool visible = m_d3dRenderer.GetTerrainLayers()[layer].visible;
+            m_d3dRenderer.SetTerrainLayerVisible(layer, change.visible, false);
+            change.visible = visible;
+        }
+            break;
     }
 }
 
+void ToolMain::FinishHistorySwap(const std::vector<ChunkManager::TerrainTile*>& tiles)
+{
+    if (!tiles.empty())
+        m_d3dRenderer.SwapTerrainTiles(tiles);
+
+    m_snapObjectsThisFrame = true;
+    m_updatePathsThisFrame = true;
+
+    // Let the transform dialog know objects may have moved
+    m_objectHasBeenMoved = true;
+}
+
 void ToolMain::OnCtrlC()
 {
+    // With the brush active, copy the terrain under it instead
+    if (m_brushActive)
+    {
+        if (m_cursorIntersectsTerrain)
+        {
+            m_d3dRenderer.CopyTerrain(XMLoadFloat3(&m_terrainManipPosition), m_brushSize, m_terrainClipboard);
+            m_stampRotation = 0.f;
+        }
+
+        return;
+    }
+
     // Store ID of the objects we wish to copy
-    m_clipboard = m_selectedObjects;
+    m_clipboard.assign(m_selectedObjects.begin(), m_selectedObjects.end());
 }
 
 void ToolMain::OnCtrlV()
 {
-    using namespace std::placeholders;
+    if (m_brushActive)
+    {
+        if (m_cursorIntersectsTerrain && !m_terrainClipboard.IsEmpty())
+        {
+            TerrainStamp::Placement placement;
+            placement.center = XMFLOAT2(m_terrainManipPosition.x, m_terrainManipPosition.z);
+            placement.rotation = m_stampRotation;
+            placement.scale = m_brushSize / m_terrainClipboard.GetSize();
+            placement.blend = m_stampBlend;
+            placement.feather = m_stampFeather;
+
+            // Every paste goes into a layer of its own, so it's undone by hiding that (and putting back the base layer
+            // tiles moved along chunk borders, which go into the entry as it's closed)
+            OpenHistoryEntry();
+
+            size_t layer;
+            if (m_d3dRenderer.PasteTerrain(m_terrainClipboard, placement, layer))
+            {
+                m_history.RecordTerrainLayer(layer, false);
+                m_snapObjectsThisFrame = true;
+            }
+
+            CloseHistoryEntry();
+        }
+
+        return;
+    }
 
-    int newID = 0;
-    const auto hasID = [](int id, const SceneObject& object) { return object.ID == id; };
+    OpenHistoryEntry();
 
     // Unselect objects that are to be copied
-    m_selectedObjects.clear();
+    m_selectedObjects.Clear();
     for (int id : m_clipboard)
     {
         // Find the selected object
-        auto originalObject = std::find_if(m_sceneGraph.cbegin(), m_sceneGraph.cend(), std::bind(hasID, id, _1));
+        const SceneObject* originalObject = m_sceneGraph.Find(id);
 
-        if (originalObject == m_sceneGraph.cend())
+        if (!originalObject)
             continue;
 
-        // Find a unique ID
-        while (std::find_if(m_sceneGraph.cbegin(), m_sceneGraph.cend(), std::bind(hasID, newID, _1)) != m_sceneGraph.cend())
-            ++newID;
-
         // Copy selected object
         SceneObject newSceneObject = *originalObject;
 
         // Give it a new ID
+        const int newID = m_idAllocator.Allocate();
         newSceneObject.ID = newID;
 
+        // Undoing removes it
+        m_history.RecordObject(newID, nullptr);
+
         // Add copy to scene graph
-        m_sceneGraph.push_back(newSceneObject);
+        m_sceneGraph.Insert(newSceneObject);
 
         // Create visual representation
         m_d3dRenderer.AddDisplayListItem(newSceneObject);
 
         // Select the newly created copy
-        m_selectedObjects.push_back(newID);
+        m_selectedObjects.Insert(newID);
     }
+
+    CloseHistoryEntry();
+
+    m_updatePathsThisFrame = true;
 }
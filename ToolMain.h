@@ -5,7 +5,12 @@
 #include "Game.h"
 #include "sqlite3.h"
 #include "SceneObject.h"
+#include "IDAllocator.h"
+#include "SelectionSet.h"
+#include "EditHistory.h"
 #include "InputCommands.h"
+#include <map>
+#include <set>
 #include <vector>
 
 class ToolMain
@@ -26,12 +31,15 @@ public:
 
     // functions
 	//onAction - These are the interface to MFC
-	const std::vector<int> ToolMain::getCurrentSelectionIDs() const;		//returns the selection number of currently selected object so that It can be displayed.
+	const SelectionSet& getCurrentSelectionIDs() const;		//returns the selection number of currently selected object so that It can be displayed.
 	void	onActionInitialise(HWND handle, int width, int height);			//Passes through handle and hieght and width and initialises DirectX renderer and SQL LITE
 	void	onActionFocusCamera();
-	void	onActionLoad();													//load the current chunk
-	afx_msg	void	onActionSave();											//save the current chunk
-	afx_msg void	onActionSaveTerrain();									//save chunk geometry
+	void	onActionLoad();													//load the world's chunk list (chunks stream in around the camera)
+	afx_msg	void	onActionSave();											//save the objects of every chunk that has been loaded
+	afx_msg void	onActionSaveTerrain();									//save geometry of the loaded chunks (in the background)
+	std::wstring	getTerrainSaveStatus() const;							//progress/result of the last terrain save, for the status bar
+	std::wstring	getTerrainLoadStatus() const;							//chunks that couldn't be loaded (empty if none), for the status bar
+	void	onActionExportTerrain(float maxError);							//write a simplified copy of the terrain mesh (.obj)
 
 	void	Tick(MSG *msg);
 	bool	UpdateInput(MSG *msg);
@@ -41,8 +49,13 @@ public:
 
     void    OnResizeOrPositionChanged();
 
-    SceneObject* GetObjectFromID(int id);
+    // Null if there's no such object. The pointer is only good until objects are next added or removed (see SceneStore)
+    SceneObject* GetObjectFromID(int id) { return m_sceneGraph.Find(id); }
+    // Handles stay good for as long as the object is in the scene graph
+    SceneGraph::Handle GetObjectHandle(int id) const { return m_sceneGraph.GetHandle(id); }
+    SceneObject* GetObjectFromHandle(SceneGraph::Handle handle) { return m_sceneGraph.Get(handle); }
 
+    // After the object has been edited in place (by the transform dialog)
     void    UpdateDisplayObject(const SceneObject* sceneObject);
 
     void    ToggleBrush();
@@ -50,13 +63,11 @@ public:
     bool    ObjectMovedThisFrame() const { return m_objectHasBeenMoved; }
 
     //variables
-	std::vector<SceneObject>    m_sceneGraph;	//our scenegraph storing all the objects in the current chunk
+	SceneGraph                  m_sceneGraph;	//our scenegraph storing all the objects in the loaded chunks
 
-    std::vector<std::vector<SceneObject>>    m_deleteHistory;
-    std::vector<std::vector<int>>            m_redoHistory;
-
-	ChunkObject					m_chunk;		//our landscape chunk
-	std::vector<int> m_selectedObjects;						//ID of current Selection
+	std::vector<ChunkObject>	m_chunks;		//every chunk in the world
+	SelectionSet m_selectedObjects;							//ID of current Selection
+	SelectionSet m_previewSelection;						//What the selection would be if the selection box was let go now
 
 private:
     // functions
@@ -69,6 +80,37 @@ private:
 
     bool    DeleteSceneObjects(const std::vector<int>& objectIDs);
 
+    // Moves/turns/scales the selection in one batch, according to m_moveAxis and how far the cursor has moved
+    void    TransformSelection(long mouseDX, long mouseDY);
+    // True if the object's parent, or any of its parent's parents, is selected
+    bool    HasSelectedAncestor(const SceneObject& object) const;
+
+    // Brings the object's visual representation (and whatever follows it) up to date
+    void    SyncDisplayObject(const SceneObject* sceneObject);
+
+    // Null if there's no such object, loaded or parked
+    SceneObject* FindObject(int id);
+
+    // Undo/redo (see EditHistory). Closing the entry is also when the terrain tiles brushed since go into it
+    void    OpenHistoryEntry(uint64_t mergeKey = 0);
+    void    CloseHistoryEntry();
+    // Moves the tiles brushes have kept into the open entry
+    void    RecordBrushedTiles(bool strokeEnded);
+    // Whether a change can be undone/redone as it stands (an object can't come back if its ID has been taken)
+    bool    CanSwapHistoryChange(const EditHistory::Change& change) const;
+    // Swaps one change of an entry being undone/redone. Terrain tiles are only gathered, to be swapped all at once
+    void    SwapHistoryChange(EditHistory::Change& change, std::vector<ChunkManager::TerrainTile*>& tiles);
+    void    FinishHistorySwap(const std::vector<ChunkManager::TerrainTile*>& tiles);
+
+    // Places every object flagged with snapToGround on the terrain surface
+    void    SnapObjectsToGround();
+
+    // Recarves the roads/rivers along the path nodes (parked ones included) wherever they've changed
+    void    UpdateTerrainPaths();
+
+    // Adds/removes the objects of chunks that have been streamed in/out
+    void    ApplyStreamedChunks();
+
     void    OnDelete();
     void    OnCtrlZ();
     void    OnCtrlY();
@@ -84,7 +126,14 @@ private:
 
 	int m_width;		//dimensions passed to directX
 	int m_height;
-	int m_currentChunk;			//the current chunk of thedatabase that we are operating on.  Dictates loading and saving. 
+
+	// Chunks whose objects are in the scene graph. Objects of chunks that have been streamed out are
+	// parked here (edits and all) until the chunk comes back in, and are saved along with the rest
+	std::set<int> m_loadedChunkIDs;
+	std::map<int, std::vector<SceneObject>> m_parkedObjects;
+
+	// Object IDs, across every chunk (loaded or not)
+	IDAllocator m_idAllocator;
 	
 	POINT m_clientCenter{ 0, 0 };
 	POINT m_lastCursorPos{ 0, 0 }, m_cursorPos{ 0, 0 };
@@ -98,28 +147,73 @@ private:
     bool m_leftMouseBtnDown = false;
     bool m_rightMouseBtnDown = false;
 
+    // How dragging with the right mouse button transforms the selection (picked with the modifier keys). It's turned
+    // and scaled around its centre
     enum MoveAxis
     {
         AXIS_NONE = 0,
         AXIS_X,
         AXIS_Y,
-        AXIS_Z
+        AXIS_Z,
+        AXIS_YAW,
+        AXIS_SCALE
     } m_moveAxis;
 
+    // Scratch space for the selected objects being moved (those without a selected ancestor, as the rest follow it)
+    std::vector<int> m_movedObjectIDs;
+
     bool m_objectHasBeenMoved = false;
 
+    // Set whenever objects or the terrain move, so snapped objects follow the ground
+    bool m_snapObjectsThisFrame = false;
+
+    // Set whenever objects come, go or change, so paths follow their nodes
+    bool m_updatePathsThisFrame = false;
+
 	// rectangle selection (rts style)
 	bool m_dragging = false;
 	POINT m_beginDragPos;
 	POINT m_currentDragPos;
+	// What m_previewSelection was last worked out with
+	Game::PickingMode m_previewMode = Game::PICK_NORMAL;
+	uint64_t m_previewBaseVersion = 0;
 
     bool m_brushActive = false;
     float m_brushSize = 32.f;
     float m_brushForce = 1.25f;
 
+    // What the brush does to the terrain (toggled with P while the brush is active)
+    enum BrushMode
+    {
+        BRUSH_SCULPT = 0,
+        BRUSH_PAINT
+    } m_brushMode = BRUSH_SCULPT;
+
+    // Splat layer painted with the left mouse button (selected with 1-4); right mouse button paints layer 0
+    int m_paintLayer = 1;
+    float m_paintStrength = 0.1f;
+
     DirectX::XMFLOAT3 m_terrainManipPosition;
 	bool m_cursorIntersectsTerrain = false;
     bool m_updateTerrainManipPosition = false;
 
     std::vector<int> m_clipboard;
+
+    EditHistory m_history;
+
+    // Merge keys of the edits that carry on over several frames
+    enum HistoryMergeKey : uint64_t
+    {
+        MERGE_MOVE_OBJECTS = 1,
+        MERGE_BRUSH_STROKE,
+        // Plus the ID of the object in the dialog
+        MERGE_TRANSFORM_DIALOG = uint64_t(1) << 32
+    };
+
+    // Terrain clipboard (Ctrl+C/Ctrl+V while the brush is active). Pastes are scaled to the brush size,
+    // rotated with R, blended as picked with B, and faded in over the feather (cycled with F)
+    TerrainStamp m_terrainClipboard;
+    float m_stampRotation = 0.f;
+    TerrainStamp::BlendMode m_stampBlend = TerrainStamp::BLEND_REPLACE;
+    float m_stampFeather = 0.25f;
 };
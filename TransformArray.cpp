@@ -0,0 +1,385 @@
+#include "TransformArray.h"
+
+#include <algorithm>
+
+using namespace DirectX;
+
+constexpr uint32_t TransformArray::NO_PARENT;
+
+uint32_t TransformArray::Add(const XMFLOAT3& position, const XMFLOAT3& rotation, const XMFLOAT3& scale, const BoundingBox& localBounds)
+{
+    uint32_t index;
+    if (!m_freeIndices.empty())
+    {
+        index = m_freeIndices.back();
+        m_freeIndices.pop_back();
+    }
+    else
+    {
+        index = uint32_t(m_posX.size());
+
+        for (auto array : { &m_posX, &m_posY, &m_posZ, &m_rotX, &m_rotY, &m_rotZ, &m_scaX, &m_scaY, &m_scaZ,
+                            &m_centerX, &m_centerY, &m_centerZ, &m_extentX, &m_extentY, &m_extentZ })
+            array->push_back(0.f);
+
+        m_parent.push_back(NO_PARENT);
+        m_inUse.push_back(0);
+        m_local.emplace_back();
+        m_world.emplace_back();
+        m_worldBounds.emplace_back();
+        m_proxy.push_back(ObjectBVH::INVALID);
+        m_dirty.push_back(0);
+        m_orderPos.push_back(0);
+    }
+
+    m_inUse[index] = 1;
+    m_parent[index] = NO_PARENT;
+
+    // A new transform has no parent, so it simply goes on the end of the hierarchy
+    if (!m_hierarchyChanged)
+    {
+        m_orderPos[index] = uint32_t(m_order.size());
+        m_order.push_back(index);
+        m_subtreeSize.push_back(1);
+    }
+
+    m_centerX[index] = localBounds.Center.x;
+    m_centerY[index] = localBounds.Center.y;
+    m_centerZ[index] = localBounds.Center.z;
+    m_extentX[index] = localBounds.Extents.x;
+    m_extentY[index] = localBounds.Extents.y;
+    m_extentZ[index] = localBounds.Extents.z;
+
+    m_posX[index] = position.x; m_posY[index] = position.y; m_posZ[index] = position.z;
+    m_rotX[index] = rotation.x; m_rotY[index] = rotation.y; m_rotZ[index] = rotation.z;
+    m_scaX[index] = scale.x;    m_scaY[index] = scale.y;    m_scaZ[index] = scale.z;
+
+    MarkDirty(index);
+    return index;
+}
+
+void TransformArray::Remove(uint32_t index)
+{
+    m_inUse[index] = 0;
+    m_parent[index] = NO_PARENT;
+
+    if (m_proxy[index] != ObjectBVH::INVALID)
+    {
+        m_tree.Remove(m_proxy[index]);
+        m_proxy[index] = ObjectBVH::INVALID;
+    }
+
+    // Its place in the hierarchy is left empty until it's next sorted (and it's skipped over if it's in the dirty list)
+    if (!m_hierarchyChanged)
+    {
+        m_order[m_orderPos[index]] = NO_PARENT;
+        ++m_numRemovedPositions;
+    }
+
+    m_freeIndices.push_back(index);
+}
+
+void TransformArray::Clear()
+{
+    for (auto array : { &m_posX, &m_posY, &m_posZ, &m_rotX, &m_rotY, &m_rotZ, &m_scaX, &m_scaY, &m_scaZ,
+                        &m_centerX, &m_centerY, &m_centerZ, &m_extentX, &m_extentY, &m_extentZ })
+        array->clear();
+
+    m_parent.clear();
+    m_inUse.clear();
+    m_local.clear();
+    m_world.clear();
+    m_worldBounds.clear();
+    m_tree.Clear();
+    m_proxy.clear();
+    m_dirty.clear();
+    m_dirtyList.clear();
+    m_freeIndices.clear();
+
+    m_order.clear();
+    m_subtreeSize.clear();
+    m_orderPos.clear();
+    m_numRemovedPositions = 0;
+    m_hierarchyChanged = false;
+}
+
+void TransformArray::Set(uint32_t index, const XMFLOAT3& position, const XMFLOAT3& rotation, const XMFLOAT3& scale)
+{
+    if (m_posX[index] == position.x && m_posY[index] == position.y && m_posZ[index] == position.z &&
+        m_rotX[index] == rotation.x && m_rotY[index] == rotation.y && m_rotZ[index] == rotation.z &&
+        m_scaX[index] == scale.x && m_scaY[index] == scale.y && m_scaZ[index] == scale.z)
+        return;
+
+    m_posX[index] = position.x; m_posY[index] = position.y; m_posZ[index] = position.z;
+    m_rotX[index] = rotation.x; m_rotY[index] = rotation.y; m_rotZ[index] = rotation.z;
+    m_scaX[index] = scale.x;    m_scaY[index] = scale.y;    m_scaZ[index] = scale.z;
+
+    MarkDirty(index);
+}
+
+void XM_CALLCONV TransformArray::TransformGroup(const uint32_t* indices, size_t count, FXMVECTOR pivot, FXMVECTOR translation, float yaw, float scale)
+{
+    float sinYaw, cosYaw;
+    XMScalarSinCos(&sinYaw, &cosYaw, XMConvertToRadians(yaw));
+
+    const XMVECTOR pivotX = XMVectorSplatX(pivot), pivotY = XMVectorSplatY(pivot), pivotZ = XMVectorSplatZ(pivot);
+    const XMVECTOR moveX = XMVectorSplatX(translation), moveY = XMVectorSplatY(translation), moveZ = XMVectorSplatZ(translation);
+    const XMVECTOR sine = XMVectorReplicate(sinYaw), cosine = XMVectorReplicate(cosYaw);
+    const XMVECTOR turn = XMVectorReplicate(yaw), factor = XMVectorReplicate(scale);
+
+    for (size_t i = 0; i < count; i += 4)
+    {
+        // The last group is padded out with its last transform (every lane is read before any is written back, so it
+        // simply gets the same result more than once)
+        uint32_t lanes[4];
+        for (size_t lane = 0; lane < 4; ++lane)
+            lanes[lane] = indices[std::min(i + lane, count - 1)];
+
+        const auto gather = [&lanes](const std::vector<float>& array)
+        {
+            return XMVectorSet(array[lanes[0]], array[lanes[1]], array[lanes[2]], array[lanes[3]]);
+        };
+
+        // Offset from the pivot, scaled, then turned as XMMatrixRotationY would
+        const XMVECTOR offsetX = (gather(m_posX) - pivotX) * factor;
+        const XMVECTOR offsetY = (gather(m_posY) - pivotY) * factor;
+        const XMVECTOR offsetZ = (gather(m_posZ) - pivotZ) * factor;
+
+        const XMVECTOR results[7] =
+        {
+            pivotX + offsetX * cosine + offsetZ * sine + moveX,
+            pivotY + offsetY + moveY,
+            pivotZ + offsetZ * cosine - offsetX * sine + moveZ,
+            // Yaw is applied last (see UpdateLocalMatrices), so turning about the vertical axis only adds to it
+            gather(m_rotY) + turn,
+            gather(m_scaX) * factor,
+            gather(m_scaY) * factor,
+            gather(m_scaZ) * factor
+        };
+
+        std::vector<float>* const arrays[7] = { &m_posX, &m_posY, &m_posZ, &m_rotY, &m_scaX, &m_scaY, &m_scaZ };
+        for (int array = 0; array < 7; ++array)
+        {
+            XMFLOAT4A values;
+            XMStoreFloat4A(&values, results[array]);
+
+            for (int lane = 0; lane < 4; ++lane)
+                (*arrays[array])[lanes[lane]] = (&values.x)[lane];
+        }
+
+        for (uint32_t lane : lanes)
+            MarkDirty(lane);
+    }
+}
+
+bool TransformArray::SetParent(uint32_t index, uint32_t parent)
+{
+    // Make sure the transform isn't somewhere above its new parent
+    bool valid = true;
+    for (uint32_t ancestor = parent; ancestor != NO_PARENT; ancestor = m_parent[ancestor])
+    {
+        if (ancestor == index)
+        {
+            parent = NO_PARENT;
+            valid = false;
+            break;
+        }
+    }
+
+    if (m_parent[index] != parent)
+    {
+        m_parent[index] = parent;
+        m_hierarchyChanged = true;
+        MarkDirty(index);
+    }
+
+    return valid;
+}
+
+void TransformArray::UpdateDirty()
+{
+    if (m_dirtyList.empty())
+        return;
+
+    // Sort the hierarchy out if it's changed (or has gathered too many gaps)
+    if (m_hierarchyChanged || m_numRemovedPositions > m_order.size() / 2)
+        SortHierarchy();
+
+    UpdateLocalMatrices();
+
+    for (uint32_t index : m_dirtyList)
+        m_dirty[index] = 0;
+
+    // Removed transforms need nothing more, and the rest are taken in hierarchy order
+    m_dirtyList.erase(std::remove_if(m_dirtyList.begin(), m_dirtyList.end(), [this](uint32_t index) { return !m_inUse[index]; }), m_dirtyList.end());
+    std::sort(m_dirtyList.begin(), m_dirtyList.end(), [this](uint32_t a, uint32_t b) { return m_orderPos[a] < m_orderPos[b]; });
+
+    // Every dirty transform's subtree, once each (subtrees of dirty transforms within them are already covered)
+    uint32_t updatedUpTo = 0;
+    for (uint32_t index : m_dirtyList)
+    {
+        const uint32_t first = m_orderPos[index];
+        const uint32_t last = first + m_subtreeSize[first];
+
+        for (uint32_t pos = std::max(first, updatedUpTo); pos < last; ++pos)
+        {
+            if (m_order[pos] != NO_PARENT)
+                UpdateWorldMatrix(m_order[pos]);
+        }
+
+        updatedUpTo = std::max(updatedUpTo, last);
+    }
+
+    m_dirtyList.clear();
+}
+
+void TransformArray::UpdateLocalMatrices()
+{
+    const size_t count = m_dirtyList.size();
+
+    // Degrees to radians, halved for the quaternion
+    const XMVECTOR toHalfRadians = XMVectorReplicate(XM_PI / 360.f);
+    const XMVECTOR two = XMVectorReplicate(2.f);
+
+    for (size_t i = 0; i < count; i += 4)
+    {
+        // The last group is padded out with its last transform (which is simply worked out more than once)
+        uint32_t lanes[4];
+        for (size_t lane = 0; lane < 4; ++lane)
+            lanes[lane] = m_dirtyList[std::min(i + lane, count - 1)];
+
+        const auto gather = [&lanes](const std::vector<float>& array)
+        {
+            return XMVectorSet(array[lanes[0]], array[lanes[1]], array[lanes[2]], array[lanes[3]]);
+        };
+
+        // Quaternion from pitch (x), yaw (y) and roll (z), as XMQuaternionRotationRollPitchYaw would have it
+        XMVECTOR sp, cp, sy, cy, sr, cr;
+        XMVectorSinCos(&sp, &cp, gather(m_rotX) * toHalfRadians);
+        XMVectorSinCos(&sy, &cy, gather(m_rotY) * toHalfRadians);
+        XMVectorSinCos(&sr, &cr, gather(m_rotZ) * toHalfRadians);
+
+        const XMVECTOR qx = cr * sp * cy + sr * cp * sy;
+        const XMVECTOR qy = cr * cp * sy - sr * sp * cy;
+        const XMVECTOR qz = sr * cp * cy - cr * sp * sy;
+        const XMVECTOR qw = cr * cp * cy + sr * sp * sy;
+
+        const XMVECTOR xx = qx * qx, yy = qy * qy, zz = qz * qz;
+        const XMVECTOR xy = qx * qy, xz = qx * qz, yz = qy * qz;
+        const XMVECTOR xw = qx * qw, yw = qy * qw, zw = qz * qw;
+
+        // Rows of scale * rotation (m[row][column]), then the translation
+        const XMVECTOR scaleX = gather(m_scaX), scaleY = gather(m_scaY), scaleZ = gather(m_scaZ);
+        const XMVECTOR m[4][3] =
+        {
+            { scaleX * (g_XMOne - two * (yy + zz)),  scaleX * two * (xy + zw),               scaleX * two * (xz - yw) },
+            { scaleY * two * (xy - zw),              scaleY * (g_XMOne - two * (xx + zz)),   scaleY * two * (yz + xw) },
+            { scaleZ * two * (xz + yw),              scaleZ * two * (yz - xw),               scaleZ * (g_XMOne - two * (xx + yy)) },
+            { gather(m_posX),                        gather(m_posY),                         gather(m_posZ) }
+        };
+
+        XMFLOAT4A rows[4][3];
+        for (int row = 0; row < 4; ++row)
+            for (int column = 0; column < 3; ++column)
+                XMStoreFloat4A(&rows[row][column], m[row][column]);
+
+        // Back out to each transform
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            XMFLOAT4X4& local = m_local[lanes[lane]];
+            for (int row = 0; row < 4; ++row)
+            {
+                for (int column = 0; column < 3; ++column)
+                    local.m[row][column] = (&rows[row][column].x)[lane];
+
+                local.m[row][3] = (row == 3 ? 1.f : 0.f);
+            }
+        }
+    }
+}
+
+void TransformArray::UpdateWorldMatrix(uint32_t index)
+{
+    // Parents are always done first
+    XMMATRIX world = XMLoadFloat4x4(&m_local[index]);
+    if (m_parent[index] != NO_PARENT)
+        world = XMMatrixMultiply(world, XMLoadFloat4x4(&m_world[m_parent[index]]));
+
+    XMStoreFloat4x4(&m_world[index], world);
+
+    // World bounds: the centre goes through the whole transform, the extents through the absolute rotation/scale
+    const XMVECTOR center = XMVector3Transform(XMVectorSet(m_centerX[index], m_centerY[index], m_centerZ[index], 0.f), world);
+    const XMVECTOR extents = XMVectorAbs(world.r[0]) * m_extentX[index] + XMVectorAbs(world.r[1]) * m_extentY[index] + XMVectorAbs(world.r[2]) * m_extentZ[index];
+
+    XMStoreFloat3(&m_worldBounds[index].Center, center);
+    XMStoreFloat3(&m_worldBounds[index].Extents, extents);
+
+    // Only touches the tree if the bounds have left their fattened ones there
+    if (m_proxy[index] == ObjectBVH::INVALID)
+        m_proxy[index] = m_tree.Insert(index, m_worldBounds[index]);
+    else
+        m_tree.Move(m_proxy[index], m_worldBounds[index]);
+}
+
+void TransformArray::SortHierarchy()
+{
+    const uint32_t count = uint32_t(size());
+
+    // Bucket the children by parent
+    m_childStart.assign(count + 1, 0);
+    for (uint32_t index = 0; index < count; ++index)
+        if (m_inUse[index] && m_parent[index] != NO_PARENT)
+            ++m_childStart[m_parent[index] + 1];
+
+    for (uint32_t index = 0; index < count; ++index)
+        m_childStart[index + 1] += m_childStart[index];
+
+    m_children.resize(m_childStart[count]);
+    m_stack.assign(m_childStart.begin(), m_childStart.end() - 1);
+    for (uint32_t index = 0; index < count; ++index)
+        if (m_inUse[index] && m_parent[index] != NO_PARENT)
+            m_children[m_stack[m_parent[index]]++] = index;
+
+    // Depth first from every root, so each subtree comes out in one run
+    m_order.clear();
+    m_stack.clear();
+    for (uint32_t root = 0; root < count; ++root)
+    {
+        if (!m_inUse[root] || m_parent[root] != NO_PARENT)
+            continue;
+
+        m_stack.push_back(root);
+        while (!m_stack.empty())
+        {
+            const uint32_t index = m_stack.back();
+            m_stack.pop_back();
+
+            m_orderPos[index] = uint32_t(m_order.size());
+            m_order.push_back(index);
+
+            for (uint32_t child = m_childStart[index]; child < m_childStart[index + 1]; ++child)
+                m_stack.push_back(m_children[child]);
+        }
+    }
+
+    // Children come after their parents, so backwards every subtree is complete by the time its root is reached
+    m_subtreeSize.assign(m_order.size(), 1);
+    for (size_t pos = m_order.size(); pos-- > 0;)
+    {
+        const uint32_t parent = m_parent[m_order[pos]];
+        if (parent != NO_PARENT)
+            m_subtreeSize[m_orderPos[parent]] += m_subtreeSize[pos];
+    }
+
+    m_numRemovedPositions = 0;
+    m_hierarchyChanged = false;
+}
+
+void TransformArray::MarkDirty(uint32_t index)
+{
+    if (m_dirty[index])
+        return;
+
+    m_dirty[index] = 1;
+    m_dirtyList.push_back(index);
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+#include "ObjectBVH.h"
+
+// Object transforms (position, rotation in degrees, scale) kept as a structure of arrays, along with the world matrix
+// and world-space bounding box worked out from each. Transforms can have a parent, in which case they're relative to it.
+// Only what has changed since is worked out again whenever UpdateDirty is called: the local matrices of the transforms
+// that were set (four at a time, one per SIMD lane), then the world matrices of those and everything below them.
+// The hierarchy is kept flattened depth first, so every subtree is one contiguous run of it, parents ahead of their
+// children; bringing a moved parent and all its children up to date is a single walk along that run.
+// The world bounds are also kept in a dynamic BVH (the items being transform indices), for picking.
+// Indices stay the same for as long as the transform is around; removed ones are reused by later adds.
+class TransformArray
+{
+public:
+    static constexpr uint32_t NO_PARENT = UINT32_MAX;
+
+    TransformArray() = default;
+
+    // localBounds is the model-space bounding box of whatever the transform is for
+    uint32_t Add(const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& rotation, const DirectX::XMFLOAT3& scale, const DirectX::BoundingBox& localBounds);
+    // Any children have to be given another parent (or none) first
+    void Remove(uint32_t index);
+    void Clear();
+
+    // Only marks the transform dirty if anything has actually changed
+    void Set(uint32_t index, const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& rotation, const DirectX::XMFLOAT3& scale);
+
+    // Moves a group of transforms together: each is scaled (uniformly) and turned about the vertical axis (in degrees)
+    // around the pivot, then translated. Done four transforms at a time, straight on the source arrays. No index should
+    // be in there twice
+    void XM_CALLCONV TransformGroup(const uint32_t* indices, size_t count, DirectX::FXMVECTOR pivot, DirectX::FXMVECTOR translation, float yaw, float scale);
+
+    void Get(uint32_t index, DirectX::XMFLOAT3& position, DirectX::XMFLOAT3& rotation, DirectX::XMFLOAT3& scale) const
+    {
+        position = DirectX::XMFLOAT3(m_posX[index], m_posY[index], m_posZ[index]);
+        rotation = DirectX::XMFLOAT3(m_rotX[index], m_rotY[index], m_rotZ[index]);
+        scale = DirectX::XMFLOAT3(m_scaX[index], m_scaY[index], m_scaZ[index]);
+    }
+
+    // Returns false (and leaves the transform without a parent) if the parent is the transform itself or one of its children
+    bool SetParent(uint32_t index, uint32_t parent);
+    uint32_t GetParent(uint32_t index) const { return m_parent[index]; }
+
+    void UpdateDirty();
+    bool IsDirty() const { return !m_dirtyList.empty(); }
+
+    // Up to date as of the last UpdateDirty
+    DirectX::XMMATRIX XM_CALLCONV GetWorld(uint32_t index) const { return DirectX::XMLoadFloat4x4(&m_world[index]); }
+    const DirectX::BoundingBox& GetBounds(uint32_t index) const { return m_worldBounds[index]; }
+    const ObjectBVH& GetTree() const { return m_tree; }
+
+    size_t size() const { return m_posX.size(); }
+
+private:
+    void MarkDirty(uint32_t index);
+
+    void UpdateLocalMatrices();
+    void UpdateWorldMatrix(uint32_t index);
+
+    // Lays the hierarchy out again (after parents have changed)
+    void SortHierarchy();
+
+    // Source transforms
+    std::vector<float> m_posX, m_posY, m_posZ;
+    std::vector<float> m_rotX, m_rotY, m_rotZ;
+    std::vector<float> m_scaX, m_scaY, m_scaZ;
+
+    // Model-space bounds
+    std::vector<float> m_centerX, m_centerY, m_centerZ;
+    std::vector<float> m_extentX, m_extentY, m_extentZ;
+
+    std::vector<uint32_t> m_parent;
+    std::vector<uint8_t> m_inUse;
+
+    // Cached results
+    std::vector<DirectX::XMFLOAT4X4> m_local;
+    std::vector<DirectX::XMFLOAT4X4> m_world;
+    std::vector<DirectX::BoundingBox> m_worldBounds;
+
+    // Where each transform's world bounds are in the tree (INVALID until they've first been worked out)
+    ObjectBVH m_tree;
+    std::vector<uint32_t> m_proxy;
+
+    std::vector<uint8_t> m_dirty;
+    std::vector<uint32_t> m_dirtyList;
+    std::vector<uint32_t> m_freeIndices;
+
+    // The hierarchy, depth first: the transform at each position (NO_PARENT where one has been removed since), and how
+    // many positions its subtree takes up (itself included). m_orderPos is the other way round
+    std::vector<uint32_t> m_order;
+    std::vector<uint32_t> m_subtreeSize;
+    std::vector<uint32_t> m_orderPos;
+    size_t m_numRemovedPositions = 0;
+    bool m_hierarchyChanged = false;
+
+    // Scratch space for sorting the hierarchy
+    std::vector<uint32_t> m_childStart, m_children, m_stack;
+};
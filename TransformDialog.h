@@ -21,6 +21,8 @@ public:
 #endif
 
     void SetSceneObject(SceneObject* object);
+    // Points the dialog at the same object's new address (or null, if it's gone) without touching the controls
+    void RebindSceneObject(SceneObject* object) { m_object = object; }
 
     void NotifyDisplayObjectUpdated() { m_controlsChanged = false; }
     bool ControlsChanged() const { return m_controlsChanged; }
@@ -35,7 +37,7 @@ private:
     afx_msg void OnControlChanged();
     afx_msg void End();
 
-    SceneObject* m_object;
+    SceneObject* m_object = nullptr;
     bool m_controlsChanged = false;
 
     DECLARE_MESSAGE_MAP()
@@ -0,0 +1,57 @@
+// The chunk's diffuse texture isn't sampled itself--it's bound in place of any splat texture the chunk doesn't have
+Texture2D diffuseTexture : register(t0);
+// (ambient occlusion, sun visibility), one texel per grid vertex
+Texture2D lightmap : register(t1);
+// Analysis results drawn over the terrain (transparent where there's nothing to show)
+Texture2D overlay : register(t2);
+// Weight of each splat texture (r = 1, ..., a = 4), one texel per grid vertex like the lightmap
+Texture2D splatWeights : register(t3);
+Texture2D splat1 : register(t4);
+Texture2D splat2 : register(t5);
+Texture2D splat3 : register(t6);
+Texture2D splat4 : register(t7);
+
+SamplerState texSampler : register(s0);
+
+cbuffer TerrainProperties : register(b1)
+{
+    // See terrain_vs.hlsl (only the tiling is needed here)
+    float4 cameraPosition;
+    float4 morphRanges[16];
+    float4 grid;
+    float4 texCoord;
+    float4 splatTiling;
+};
+
+struct VSOutput
+{
+    float4 position : SV_POSITION;
+    float3 normal : NORMAL;
+    float2 texCoord : TEXCOORD0;
+    float2 lightmapCoord : TEXCOORD1;
+    float2 splatCoord : TEXCOORD2;
+};
+
+float4 main(VSOutput input) : SV_Target
+{
+    // Same key light and ambient as BasicEffect's default lighting
+    static const float3 LIGHT_DIRECTION = float3(-0.5265408f, -0.5735765f, -0.6275069f);
+    static const float3 LIGHT_COLOUR = float3(1.f, 0.9607844f, 0.8078432f);
+    static const float3 AMBIENT_COLOUR = float3(0.05333332f, 0.09882354f, 0.1819608f);
+
+    float2 baked = lightmap.Sample(texSampler, input.lightmapCoord).rg;
+
+    float3 normal = normalize(input.normal);
+    float3 lighting = AMBIENT_COLOUR * baked.r + LIGHT_COLOUR * saturate(dot(normal, -LIGHT_DIRECTION)) * baked.g;
+
+    // The weights always add up to one
+    float4 weights = splatWeights.Sample(texSampler, input.lightmapCoord);
+    float4 diffuse = splat1.Sample(texSampler, input.splatCoord * splatTiling.x) * weights.r +
+                     splat2.Sample(texSampler, input.splatCoord * splatTiling.y) * weights.g +
+                     splat3.Sample(texSampler, input.splatCoord * splatTiling.z) * weights.b +
+                     splat4.Sample(texSampler, input.splatCoord * splatTiling.w) * weights.a;
+
+    float4 overlayColour = overlay.Sample(texSampler, input.lightmapCoord);
+
+    return float4(lerp(diffuse.rgb * lighting, overlayColour.rgb, overlayColour.a), diffuse.a);
+}
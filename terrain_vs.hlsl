@@ -0,0 +1,81 @@
+#define MAX_LODS 16
+
+cbuffer Matrices : register(b0)
+{
+    row_major matrix world;
+    row_major matrix view;
+    row_major matrix projection;
+};
+
+cbuffer TerrainProperties : register(b1)
+{
+    float4 cameraPosition;
+    // (start, end, -, -)
+    float4 morphRanges[MAX_LODS];
+    // (resolution, spacing, origin x, origin z)
+    float4 grid;
+    // (uv step per vertex, uv step per vertex for the splat textures before their tiling, -, -)
+    float4 texCoord;
+    // How many times each splat texture repeats across the grid
+    float4 splatTiling;
+};
+
+struct VSInput
+{
+    float height : HEIGHT;
+    // Height of the next LOD level's surface
+    float morphHeight : MORPHHEIGHT;
+    // Octahedron encoded
+    float2 normal : NORMAL;
+    // The LOD level this vertex morphs at
+    uint morphLevel : MORPHLEVEL;
+    // Index into the terrain grid
+    uint vertexID : SV_VertexID;
+};
+
+struct VSOutput
+{
+    float4 position : SV_POSITION;
+    float3 normal : NORMAL;
+    float2 texCoord : TEXCOORD0;
+    float2 lightmapCoord : TEXCOORD1;
+    // Across the grid, [0, 1]
+    float2 splatCoord : TEXCOORD2;
+};
+
+float3 DecodeOctNormal(float2 encoded)
+{
+    // Folded around y (see EncodeOctNormal)
+    float2 e = encoded * 2.f - 1.f;
+    float3 n = float3(e.x, 1.f - abs(e.x) - abs(e.y), e.y);
+
+    if (n.y < 0.f)
+        n.xz = (1.f - abs(e.yx)) * (e >= 0.f ? 1.f : -1.f);
+
+    return normalize(n);
+}
+
+VSOutput main(VSInput input)
+{
+    uint resolution = (uint) grid.x;
+    float2 gridPosition = float2(input.vertexID % resolution, input.vertexID / resolution);
+
+    float2 xz = grid.zw + gridPosition * grid.y;
+    float4 worldPosition = mul(float4(xz.x, input.height, xz.y, 1.f), world);
+
+    // Vertices are shared by every patch that uses them, so the morph only depends on the vertex itself.
+    // Vertices only ever show up at their morph level near the end of its range, so this is a no-op closer in
+    float2 range = morphRanges[input.morphLevel].xy;
+    float morph = saturate((distance(worldPosition.xyz, cameraPosition.xyz) - range.x) / (range.y - range.x));
+    worldPosition.y = lerp(worldPosition.y, input.morphHeight, morph);
+
+    VSOutput output;
+    output.position = mul(mul(worldPosition, view), projection);
+    output.normal = mul(DecodeOctNormal(input.normal), (float3x3) world);
+    output.texCoord = gridPosition * texCoord.x;
+    // Lightmap texels are centered on the vertices
+    output.lightmapCoord = (gridPosition + 0.5f) / grid.x;
+    output.splatCoord = gridPosition * texCoord.y;
+
+    return output;
+}